@@ -32,6 +32,10 @@
 # include <sys/types.h>
 # include <sys/socket.h>
 # include <sys/un.h>
+# include <sys/ioctl.h>
+# ifdef HAVE_SYS_EPOLL_H
+#  include <sys/epoll.h>
+# endif
 #else	/* WIN32 */
 # include <strings.h>
 # include "wincompat.h"
@@ -45,6 +49,18 @@
 #include "nut_stdint.h"
 #include "nut_float.h"
 
+/* Deletions which a DUMPSINCE resync must replay, as the protocol lines
+ * that were broadcast (DELINFO, DELENUM, DELRANGE, DELCMD) */
+typedef struct dstate_dellog_s {
+	uint64_t	gen;
+	char	*line;
+	struct dstate_dellog_s	*next;
+} dstate_dellog_t;
+
+/* How many deletions to remember for DUMPSINCE; older resync points
+ * get a complete re-dump */
+#define DSTATE_DELLOG_MAX	256
+
 	static TYPE_FD	sockfd = ERROR_FD;
 #ifndef WIN32
 	static char	*sockfn = NULL;
@@ -60,6 +76,29 @@
 	static st_tree_t	*dtree_root = NULL;
 	static cmdlist_t	*cmdhead = NULL;
 
+	/* Change tracking for incremental resync (DUMPSINCE), see
+	 * docs/sock-protocol.txt: gen_id identifies the life time of
+	 * this tree, gen is bumped by each change of it (and stamped
+	 * into changed nodes), cmds_gen is that of the latest ADDCMD.
+	 * Deletions older than dellog_floor were forgotten. */
+	static char	gen_id[SMALLBUF];
+	static uint64_t	gen = 0, cmds_gen = 0, dellog_floor = 0;
+	static dstate_dellog_t	*dellog_head = NULL, *dellog_tail = NULL;
+	static size_t	dellog_count = 0;
+
+	/* Warm-start snapshot (see dstate_snapshot_*()): data loaded from
+	 * the file, and the names of variables merged from it into the live
+	 * tree at snapshot_cutoff, pending validation by fresh data */
+	static st_tree_t	*snapshot_root = NULL;
+	static char	**snapshot_merged = NULL;
+	static size_t	snapshot_merged_count = 0;
+	static st_tree_timespec_t	snapshot_cutoff;
+
+	/* Driver hints (see dstate_snapshot_sethint()): those loaded from
+	 * the snapshot, and those to save into the next one */
+	static st_tree_t	*snapshot_hints = NULL;
+	static st_tree_t	*hints_root = NULL;
+
 	struct ups_handler	upsh;
 
 	/* Globally track if we are charging or losing power, and how fast */
@@ -318,6 +357,250 @@ static void sock_disconnect(conn_t *conn)
 	free(conn);
 }
 
+/** Bump the generation of the state tree, and stamp it into the
+ *  named state tree node (if any) to track it as changed for DUMPSINCE.
+ */
+static void dstate_gen_touch(const char *var)
+{
+	st_tree_t	*node;
+
+	gen++;
+
+	if (var && (node = state_tree_find(dtree_root, var)))
+		node->gen = gen;
+}
+
+/** Remember a deletion broadcast (the protocol line as sent) so it can be
+ *  replayed to a DUMPSINCE client; forget the oldest beyond DSTATE_DELLOG_MAX.
+ */
+static void dstate_dellog_add(const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 1, 2)));
+
+static void dstate_dellog_add(const char *fmt, ...)
+{
+	va_list	ap;
+	char	buf[ST_SOCK_BUF_LEN];
+	dstate_dellog_t	*entry;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	gen++;
+
+	entry = (dstate_dellog_t *)xcalloc(1, sizeof(*entry));
+	entry->gen = gen;
+	entry->line = xstrdup(buf);
+
+	if (dellog_tail) {
+		dellog_tail->next = entry;
+	} else {
+		dellog_head = entry;
+	}
+	dellog_tail = entry;
+	dellog_count++;
+
+	while (dellog_count > DSTATE_DELLOG_MAX) {
+		entry = dellog_head;
+		dellog_head = entry->next;
+		dellog_floor = entry->gen;
+		dellog_count--;
+		free(entry->line);
+		free(entry);
+	}
+}
+
+static void dstate_dellog_free(void)
+{
+	dstate_dellog_t	*entry, *enext;
+
+	for (entry = dellog_head; entry; entry = enext) {
+		enext = entry->next;
+		free(entry->line);
+		free(entry);
+	}
+
+	dellog_head = NULL;
+	dellog_tail = NULL;
+	dellog_count = 0;
+	dellog_floor = gen;
+}
+
+/** Identify the life time of the state tree for DUMPSINCE
+ *  clients, so they can not mistake a restarted driver's generation
+ *  numbers for those of the tree they have cached.
+ */
+static const char *dstate_gen_id(void)
+{
+	if (!*gen_id) {
+		struct timeval	now;
+
+		gettimeofday(&now, NULL);
+		snprintf(gen_id, sizeof(gen_id),
+			"%" PRIiMAX ".%" PRIiMAX ".%06" PRIiMAX,
+			(intmax_t)getpid(), (intmax_t)now.tv_sec, (intmax_t)now.tv_usec);
+	}
+
+	return gen_id;
+}
+
+/* Driver performance self-instrumentation: named counters with a
+ * histogram of power-of-two buckets, reported by the STATS command
+ * (see docs/sock-protocol.txt) and optionally as driver.perf.* data.
+ */
+
+#define DSTATE_PERF_BUCKETS	26	/* up to 2^25 us (~33s) and beyond */
+#define DSTATE_PERF_MAX	128	/* names tracked, to not grow unbounded */
+#define DSTATE_PERF_INDEX	256	/* hash buckets, a power of two */
+
+typedef struct dstate_perf_s {
+	char	*name;
+	const char	*unit;
+	uint64_t	count;
+	double	sum, min, max, last;
+	uint64_t	buckets[DSTATE_PERF_BUCKETS];
+	struct dstate_perf_s	*next;		/* in creation order */
+	struct dstate_perf_s	*hnext;		/* in the same hash bucket */
+} dstate_perf_t;
+
+static dstate_perf_t	*perf_head = NULL, *perf_tail = NULL;
+static dstate_perf_t	*perf_index[DSTATE_PERF_INDEX];
+static size_t	perf_count = 0;
+
+static size_t dstate_perf_hash(const char *name)
+{
+	size_t	hash = 5381;
+
+	while (*name)
+		hash = ((hash << 5) + hash) + (unsigned char)*name++;
+
+	return hash & (DSTATE_PERF_INDEX - 1);
+}
+
+void dstate_perf_record(const char *name, const char *unit, double value)
+{
+	dstate_perf_t	*perf;
+	size_t	bucket, slot;
+	double	limit;
+
+	if (!name)
+		return;
+
+	slot = dstate_perf_hash(name);
+	for (perf = perf_index[slot]; perf; perf = perf->hnext) {
+		if (!strcmp(perf->name, name))
+			break;
+	}
+
+	if (!perf) {
+		if (perf_count >= DSTATE_PERF_MAX) {
+			upsdebugx(6, "%s: too many counters, not tracking %s", __func__, name);
+			return;
+		}
+
+		perf = (dstate_perf_t *)xcalloc(1, sizeof(*perf));
+		perf->name = xstrdup(name);
+		perf->unit = unit ? unit : "";
+		perf->min = value;
+
+		if (perf_tail) {
+			perf_tail->next = perf;
+		} else {
+			perf_head = perf;
+		}
+		perf_tail = perf;
+		perf->hnext = perf_index[slot];
+		perf_index[slot] = perf;
+		perf_count++;
+	}
+
+	if (value < 0)
+		value = 0;
+
+	perf->count++;
+	perf->sum += value;
+	perf->last = value;
+	if (value < perf->min)
+		perf->min = value;
+	if (value > perf->max)
+		perf->max = value;
+
+	/* bucket N counts values below 2^N, the last one all the rest */
+	for (bucket = 0, limit = 1; bucket < DSTATE_PERF_BUCKETS - 1 && value >= limit; bucket++)
+		limit *= 2;
+	perf->buckets[bucket]++;
+}
+
+void dstate_perf_start(st_tree_timespec_t *start)
+{
+	state_get_timestamp(start);
+}
+
+double dstate_perf_elapsed(const st_tree_timespec_t *start)
+{
+	st_tree_timespec_t	now;
+
+	state_get_timestamp(&now);
+	return difftime_st_tree_timespec(now, *start) * 1000000.0;
+}
+
+void dstate_perf_since(const char *name, const st_tree_timespec_t *start)
+{
+	dstate_perf_record(name, "us", dstate_perf_elapsed(start));
+}
+
+void dstate_perf_publish(void)
+{
+	dstate_perf_t	*perf;
+	char	var[ST_MAX_VALUE_LEN];
+
+	for (perf = perf_head; perf; perf = perf->next) {
+		snprintf(var, sizeof(var), "driver.perf.%s.count", perf->name);
+		dstate_setinfo(var, "%" PRIu64, perf->count);
+		snprintf(var, sizeof(var), "driver.perf.%s.avg", perf->name);
+		dstate_setinfo(var, "%.0f", perf->sum / (double)perf->count);
+		snprintf(var, sizeof(var), "driver.perf.%s.max", perf->name);
+		dstate_setinfo(var, "%.0f", perf->max);
+	}
+}
+
+/* Counter name for an instant command or a variable set by a client:
+ * only those the driver registered get one of their own, the others
+ * (names coming from clients) share "<kind>.unknown" rather than fill
+ * up the table */
+static const char *dstate_perf_name(const char *kind, const char *name)
+{
+	static char	perfname[SMALLBUF];
+	const cmdlist_t	*cmd;
+	int	known = 0;
+
+	if (!strcmp(kind, "instcmd")) {
+		for (cmd = cmdhead; cmd && !known; cmd = cmd->next)
+			known = !strcasecmp(cmd->name, name);
+	} else {
+		known = (state_tree_find(dtree_root, name) != NULL);
+	}
+
+	snprintf(perfname, sizeof(perfname), "%s.%s", kind, known ? name : "unknown");
+	return perfname;
+}
+
+static void dstate_perf_free(void)
+{
+	dstate_perf_t	*perf, *pnext;
+
+	for (perf = perf_head; perf; perf = pnext) {
+		pnext = perf->next;
+		free(perf->name);
+		free(perf);
+	}
+
+	perf_head = NULL;
+	perf_tail = NULL;
+	memset(perf_index, 0, sizeof(perf_index));
+	perf_count = 0;
+}
+
 /** Iterate all connections to post a formatted string on them.
  *  Clean up any connections found to be aborted during this cycle.
  *  No return code.
@@ -450,6 +733,7 @@ static int send_to_one(conn_t *conn, const char *fmt, ...)
 	va_list	ap;
 	char	buf[ST_SOCK_BUF_LEN];
 	size_t	buflen;
+	st_tree_timespec_t	start;
 #ifdef WIN32
 	DWORD bytesWritten = 0;
 	BOOL  result = FALSE;
@@ -505,6 +789,8 @@ static int send_to_one(conn_t *conn, const char *fmt, ...)
 	upsdebug_ascii_compact(0, "send_to_one buffer: content: ", buf, buflen);
 */
 
+	dstate_perf_start(&start);
+
 #ifndef WIN32
 	ret = write(conn->fd, buf, buflen);
 #else	/* WIN32 */
@@ -580,6 +866,16 @@ static int send_to_one(conn_t *conn, const char *fmt, ...)
 		errno = ENOTCONN;
 		return -2;	/* failed and freed */
 	} else {
+		dstate_perf_since("socket.write", &start);
+#if !(defined WIN32) && (defined TIOCOUTQ)
+		{
+			/* how much the reader (upsd) did not consume yet */
+			int	outq = 0;
+
+			if (ioctl(conn->fd, TIOCOUTQ, &outq) == 0)
+				dstate_perf_record("socket.outq", "bytes", (double)outq);
+		}
+#endif	/* !WIN32 && TIOCOUTQ */
 #ifndef WIN32
 		upsdebugx(6, "%s: write %" PRIuSIZE " bytes to socket %d succeeded "
 			"(ret=%" PRIiSIZE "):",
@@ -872,6 +1168,74 @@ static int st_tree_dump_conn(st_tree_t *node, conn_t *conn)
 	return 1;	/* no right node; everything's OK here ... */
 }
 
+/**
+ * Like st_tree_dump_conn(), but only send nodes changed after generation
+ * <since> (and always the ups.status, which upsd may have overwritten
+ * locally while waiting for the dump).
+ */
+static int st_tree_dump_conn_since(st_tree_t *node, conn_t *conn, uint64_t since)
+{
+	int	send_ret;
+
+	if (!conn || conn->closing) {
+		upsdebugx(3, "%s: WARNING: called after connection was closed?", __func__);
+		errno = ENOTCONN;
+		return -2;
+	}
+
+	if (!node) {
+		return 1;	/* not an error */
+	}
+
+	if (node->left) {
+		send_ret = st_tree_dump_conn_since(node->left, conn, since);
+		if (errno == ENOTCONN)
+			return -2;
+		if (!send_ret) {
+			return 0;	/* write failed in the child */
+		}
+	}
+
+	if (node->gen > since || !strcasecmp(node->var, "ups.status")) {
+		send_ret = st_tree_dump_conn_one_node(node, conn);
+		if (errno == ENOTCONN)
+			return -2;
+		if (!send_ret)
+			return 0;	/* one of writes failed, bail out */
+	}
+
+	if (node->right) {
+		send_ret = st_tree_dump_conn_since(node->right, conn, since);
+		if (errno == ENOTCONN)
+			return -2;
+		return send_ret;
+	}
+
+	return 1;
+}
+
+/**
+ * Replay deletions logged after generation <since> into the connection.
+ */
+static int dellog_dump_conn(conn_t *conn, uint64_t since)
+{
+	dstate_dellog_t	*entry;
+	int	send_ret;
+
+	for (entry = dellog_head; entry; entry = entry->next) {
+		if (entry->gen <= since)
+			continue;
+
+		send_ret = send_to_one(conn, "%s", entry->line);
+		if (errno == ENOTCONN)
+			return -2;
+		if (!send_ret)
+			return 0;
+	}
+
+	return 1;
+}
+
 /**
  * Report all known commands for this driver into the given connection.
  *
@@ -947,7 +1311,7 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 	}
 
 	upsdebugx(6, "%s: Driver on %s is now handling %s with %" PRIuSIZE " args",
-		__func__, sockfn, numarg ? arg[0] : "<skipped: no command>", numarg);
+		__func__, NUT_STRARG(sockfn), numarg ? arg[0] : "<skipped: no command>", numarg);
 
 	if (numarg < 1) {
 		return 0;
@@ -981,6 +1345,49 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 		return 2;	/* Special code for LOGOUT to be known by caller */
 	}
 
+	/* STATS: performance counters, see dstate_perf_record() */
+	if (!strcasecmp(arg[0], "STATS")) {
+		dstate_perf_t	*perf;
+
+		for (perf = perf_head; perf; perf = perf->next) {
+			char	hist[LARGEBUF];
+			size_t	i;
+			double	limit;
+
+			hist[0] = '\0';
+			for (i = 0, limit = 1; i < DSTATE_PERF_BUCKETS; i++, limit *= 2) {
+				if (!perf->buckets[i])
+					continue;
+				if (i < DSTATE_PERF_BUCKETS - 1) {
+					snprintfcat(hist, sizeof(hist), "%s%.0f:%" PRIu64,
+						*hist ? " " : "", limit, perf->buckets[i]);
+				} else {
+					snprintfcat(hist, sizeof(hist), "%sinf:%" PRIu64,
+						*hist ? " " : "", perf->buckets[i]);
+				}
+			}
+
+			send_ret = send_to_one(conn, "STAT %s %s %" PRIu64 " %.0f %.0f %.0f %.0f \"%s\"\n",
+				perf->name, perf->unit, perf->count, perf->min,
+				perf->sum / (double)perf->count, perf->max, perf->last, hist);
+			send_errno = errno;
+			if (send_errno == ENOTCONN)
+				return -2;
+			if (!send_ret)
+				return -3;	/* failed */
+		}
+
+		send_ret = send_to_one(conn, "STATSDONE\n");
+		send_errno = errno;
+		upsdebugx(6, "%s: %s: send_to_one(STATSDONE) returned %d",
+			__func__, arg[0], send_ret);
+		if (send_errno == ENOTCONN)
+			return -2;
+		if (!send_ret)
+			return -3;	/* failed */
+		return send_ret;
+	}
+
 	if (!strcasecmp(arg[0], "GETPID")) {
 		send_ret = send_to_one(conn, "PID %" PRIiMAX "\n", (intmax_t)getpid());
 		send_errno = errno;
@@ -993,7 +1400,109 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 		return send_ret;
 	}
 
-	if (!strcasecmp(arg[0], "DUMPALL") || !strcasecmp(arg[0], "DUMPSTATUS") || (!strcasecmp(arg[0], "DUMPVALUE") && numarg > 1)) {
+	/* DUMPSINCE <gen_id> <gen>: resume from a previously reported GENERATION */
+	if (!strcasecmp(arg[0], "DUMPSINCE") && numarg > 2) {
+		uint64_t	since = 0;
+		char	*endptr = NULL;
+		int	resumable = 0;
+
+		errno = 0;
+		if (*arg[2] >= '0' && *arg[2] <= '9')
+			since = (uint64_t)strtoull(arg[2], &endptr, 10);
+
+		if (!strcmp(arg[1], dstate_gen_id())
+		&&  endptr && *endptr == '\0' && errno == 0
+		&&  since <= gen
+		&&  since >= dellog_floor
+		) {
+			resumable = 1;
+		}
+
+		upsdebugx(2, "%s: %s %s %s: %s (current generation %s %" PRIu64
+			", deletions remembered since %" PRIu64 ")",
+			__func__, arg[0], arg[1], arg[2],
+			resumable ? "resuming" : "sending a complete dump",
+			gen_id, gen, dellog_floor);
+
+		if (resumable) {
+			if (stale == 1) {
+				send_ret = send_to_one(conn, "DATASTALE\n");
+				send_errno = errno;
+				if (send_errno == ENOTCONN)
+					return -2;
+				if (!send_ret)
+					return -3;	/* failed */
+			}
+
+			send_ret = dellog_dump_conn(conn, since);
+			send_errno = errno;
+			upsdebugx(6, "%s: %s: dellog_dump_conn() returned %d",
+				__func__, arg[0], send_ret);
+			if (send_errno == ENOTCONN)
+				return -2;
+			if (!send_ret)
+				return -3;	/* failed */
+
+			send_ret = st_tree_dump_conn_since(dtree_root, conn, since);
+			send_errno = errno;
+			upsdebugx(6, "%s: %s: st_tree_dump_conn_since() returned %d",
+				__func__, arg[0], send_ret);
+			if (send_errno == ENOTCONN)
+				return -2;
+			if (!send_ret)
+				return -3;	/* failed */
+
+			if (cmds_gen > since) {
+				send_ret = cmd_dump_conn(conn);
+				send_errno = errno;
+				upsdebugx(6, "%s: %s: cmd_dump_conn() returned %d",
+					__func__, arg[0], send_ret);
+				if (send_errno == ENOTCONN)
+					return -2;
+				if (!send_ret)
+					return -3;	/* failed */
+			}
+
+			if (stale == 0) {
+				send_ret = send_to_one(conn, "DATAOK\n");
+				send_errno = errno;
+				if (send_errno == ENOTCONN)
+					return -2;
+				if (!send_ret)
+					return -3;	/* failed */
+			}
+
+			send_ret = send_to_one(conn, "GENERATION %s %" PRIu64 "\n",
+				dstate_gen_id(), gen);
+			send_errno = errno;
+			if (send_errno == ENOTCONN)
+				return -2;
+			if (!send_ret)
+				return -3;	/* failed */
+
+			send_ret = send_to_one(conn, "DUMPDONE\n");
+			send_errno = errno;
+			upsdebugx(6, "%s: %s: send_to_one(DUMPDONE) returned %d",
+				__func__, arg[0], send_ret);
+			if (send_errno == ENOTCONN)
+				return -2;
+			if (!send_ret)
+				return -3;	/* failed */
+			return send_ret;
+		}
+
+		/* Tell the client to forget its copy, and fall through to DUMPALL */
+		send_ret = send_to_one(conn, "DUMPRESET\n");
+		send_errno = errno;
+		if (send_errno == ENOTCONN)
+			return -2;
+		if (!send_ret)
+			return -3;	/* failed */
+	}
+
+	if (!strcasecmp(arg[0], "DUMPALL") || !strcasecmp(arg[0], "DUMPSINCE")
+	 || !strcasecmp(arg[0], "DUMPSTATUS") || (!strcasecmp(arg[0], "DUMPVALUE") && numarg > 1)
+	) {
 		/* first thing: the staleness flag (see also below) */
 		if (stale == 1) {
 			send_ret = send_to_one(conn, "DATASTALE\n");
@@ -1006,7 +1515,7 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 				return -3;	/* failed */
 		}
 
-		if (!strcasecmp(arg[0], "DUMPALL")) {
+		if (!strcasecmp(arg[0], "DUMPALL") || !strcasecmp(arg[0], "DUMPSINCE")) {
 			send_ret = st_tree_dump_conn(dtree_root, conn);
 			send_errno = errno;
 			upsdebugx(6, "%s: %s: st_tree_dump_conn() returned %d",
@@ -1055,6 +1564,17 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 				return -3;	/* failed */
 		}
 
+		if (!strcasecmp(arg[0], "DUMPALL") || !strcasecmp(arg[0], "DUMPSINCE")) {
+			/* resync point for a later DUMPSINCE */
+			send_ret = send_to_one(conn, "GENERATION %s %" PRIu64 "\n",
+				dstate_gen_id(), gen);
+			send_errno = errno;
+			if (send_errno == ENOTCONN)
+				return -2;
+			if (!send_ret)
+				return -3;	/* failed */
+		}
+
 		send_ret = send_to_one(conn, "DUMPDONE\n");
 		send_errno = errno;
 		upsdebugx(6, "%s: %s: send_to_one(DUMPDONE) returned %d",
@@ -1168,7 +1688,11 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 
 		/* try the driver-provided handler if present */
 		if (upsh.instcmd) {
+			st_tree_timespec_t	start;
+
+			dstate_perf_start(&start);
 			ret = upsh.instcmd(cmdname, cmdparam);
+			dstate_perf_since(dstate_perf_name("instcmd", cmdname), &start);
 
 			/* send back execution result if requested */
 			send_ret = 1;
@@ -1269,7 +1793,11 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 
 		/* try the driver-provided handler if present */
 		if (upsh.setvar) {
+			st_tree_timespec_t	start;
+
+			dstate_perf_start(&start);
 			ret = upsh.setvar(arg[1], arg[2]);
+			dstate_perf_since(dstate_perf_name("setvar", arg[1]), &start);
 
 			/* send back execution result if requested */
 			send_ret = 1;
@@ -1538,24 +2066,455 @@ char * dstate_init(const char *prog, const char *devname)
 	return xstrdup(sockname);
 }
 
-/* returns 1 if timeout expired or data is available on UPS fd, 0 otherwise */
-int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
+/* Event sources registered by the driver with dstate_fd_add() and
+ * dstate_timer_add(), served by dstate_poll_fds() along with the driver
+ * socket and its connections.
+ * Where epoll is available, the descriptors are kept in an epoll set that
+ * is itself waited for along with the sockets, so that many of them do not
+ * have to be re-added to the select() set on every call.  Sources deleted
+ * by a handler while dispatching are only freed after the dispatch loop.
+ */
+typedef struct dstate_fdsrc_s {
+	TYPE_FD	fd;
+	int	events;	/* DSTATE_FD_READ and/or DSTATE_FD_WRITE */
+	dstate_fd_handler_t	handler;
+	void	*arg;
+	int	removed;
+	struct dstate_fdsrc_s	*next;
+} dstate_fdsrc_t;
+
+typedef struct dstate_timer_s {
+	long	id;
+	long	msec;	/* interval of a repeating timer, or 0 */
+	double	due;	/* seconds since events_epoch */
+	dstate_timer_handler_t	handler;
+	void	*arg;
+	int	removed;
+	struct dstate_timer_s	*next;
+} dstate_timer_t;
+
+static dstate_fdsrc_t	*fdsrc_head = NULL;
+static dstate_timer_t	*timer_head = NULL;	/* sorted by due time */
+static dstate_timer_t	*timer_due = NULL;	/* being dispatched */
+static long	timer_lastid = 0;
+static int	events_dispatching = 0;
+static int	events_have_epoch = 0;
+static st_tree_timespec_t	events_epoch;
+#ifdef HAVE_SYS_EPOLL_H
+static int	events_epfd = -1;
+#endif	/* HAVE_SYS_EPOLL_H */
+
+/* monotonic seconds since the first timer was added */
+static double dstate_events_now(void)
 {
-	int	maxfd = 0; /* Unidiomatic use vs. "sockfd" below, which is "int" on non-WIN32 */
-	int	overrun = 0;
-	conn_t	*conn, *cnext;
-	struct timeval	now;
+	st_tree_timespec_t	now;
 
-#ifndef WIN32
-	int	ret;
-	fd_set	rfds;
+	state_get_timestamp(&now);
+	if (!events_have_epoch) {
+		events_epoch = now;
+		events_have_epoch = 1;
+	}
 
-	FD_ZERO(&rfds);
-	FD_SET(sockfd, &rfds);
+	return difftime_st_tree_timespec(now, events_epoch);
+}
 
-	maxfd = sockfd;
+#ifdef HAVE_SYS_EPOLL_H
+static uint32_t dstate_fd_epoll_events(int events)
+{
+	return ((events & DSTATE_FD_READ) ? (uint32_t)EPOLLIN : 0)
+		| ((events & DSTATE_FD_WRITE) ? (uint32_t)EPOLLOUT : 0);
+}
+#endif	/* HAVE_SYS_EPOLL_H */
 
-	if (VALID_FD(arg_extrafd)) {
+int dstate_fd_add(TYPE_FD fd, dstate_fd_handler_t handler, void *arg)
+{
+	return dstate_fd_add_events(fd, DSTATE_FD_READ, handler, arg);
+}
+
+int dstate_fd_add_events(TYPE_FD fd, int events, dstate_fd_handler_t handler, void *arg)
+{
+#ifndef WIN32
+	dstate_fdsrc_t	*src;
+
+	if (INVALID_FD(fd) || !handler
+	 || !(events & (DSTATE_FD_READ | DSTATE_FD_WRITE))
+	) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (src = fdsrc_head; src; src = src->next) {
+		if (src->fd == fd && !src->removed) {
+			/* just update the handler (and maybe the events) */
+# ifdef HAVE_SYS_EPOLL_H
+			if (src->events != events) {
+				struct epoll_event	ev;
+
+				memset(&ev, 0, sizeof(ev));
+				ev.events = dstate_fd_epoll_events(events);
+				ev.data.ptr = src;
+				if (epoll_ctl(events_epfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+					upslog_with_errno(LOG_ERR, "%s: epoll_ctl(MOD, %d) failed", __func__, fd);
+					return -1;
+				}
+			}
+# endif	/* HAVE_SYS_EPOLL_H */
+			src->events = events;
+			src->handler = handler;
+			src->arg = arg;
+			return 0;
+		}
+	}
+
+# ifdef HAVE_SYS_EPOLL_H
+	if (events_epfd < 0) {
+		events_epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (events_epfd < 0) {
+			upslog_with_errno(LOG_ERR, "%s: epoll_create1 failed", __func__);
+			return -1;
+		}
+	}
+# endif	/* HAVE_SYS_EPOLL_H */
+
+	src = (dstate_fdsrc_t *)xcalloc(1, sizeof(*src));
+	src->fd = fd;
+	src->events = events;
+	src->handler = handler;
+	src->arg = arg;
+
+# ifdef HAVE_SYS_EPOLL_H
+	{
+		struct epoll_event	ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = dstate_fd_epoll_events(events);
+		ev.data.ptr = src;
+		if (epoll_ctl(events_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			upslog_with_errno(LOG_ERR, "%s: epoll_ctl(ADD, %d) failed", __func__, fd);
+			free(src);
+			return -1;
+		}
+	}
+# endif	/* HAVE_SYS_EPOLL_H */
+
+	src->next = fdsrc_head;
+	fdsrc_head = src;
+
+	upsdebugx(3, "%s: watching fd %d", __func__, fd);
+	return 0;
+#else	/* WIN32 */
+	/* NUT_WIN32_INCOMPLETE: drivers wait on their handles themselves */
+	NUT_UNUSED_VARIABLE(fd);
+	NUT_UNUSED_VARIABLE(events);
+	NUT_UNUSED_VARIABLE(handler);
+	NUT_UNUSED_VARIABLE(arg);
+	errno = ENOSYS;
+	return -1;
+#endif	/* WIN32 */
+}
+
+static void dstate_fd_gc(void)
+{
+	dstate_fdsrc_t	*src, **srcp;
+
+	for (srcp = &fdsrc_head; (src = *srcp) != NULL; ) {
+		if (src->removed) {
+			*srcp = src->next;
+			free(src);
+		} else {
+			srcp = &src->next;
+		}
+	}
+}
+
+int dstate_fd_del(TYPE_FD fd)
+{
+	dstate_fdsrc_t	*src;
+
+	for (src = fdsrc_head; src; src = src->next) {
+		if (src->fd == fd && !src->removed)
+			break;
+	}
+
+	if (!src) {
+		errno = ENOENT;
+		return -1;
+	}
+
+#ifdef HAVE_SYS_EPOLL_H
+	/* the caller may have closed it already, which dropped it from the set */
+	if (epoll_ctl(events_epfd, EPOLL_CTL_DEL, fd, NULL) < 0 && errno != EBADF && errno != ENOENT) {
+		upslog_with_errno(LOG_WARNING, "%s: epoll_ctl(DEL, %d) failed", __func__, fd);
+	}
+#endif	/* HAVE_SYS_EPOLL_H */
+
+	src->removed = 1;
+	if (!events_dispatching)
+		dstate_fd_gc();
+
+	upsdebugx(3, "%s: no longer watching fd %d", __func__, fd);
+	return 0;
+}
+
+static void dstate_timer_insert(dstate_timer_t *timer)
+{
+	dstate_timer_t	**tp;
+
+	for (tp = &timer_head; *tp && (*tp)->due <= timer->due; tp = &(*tp)->next)
+		;
+
+	timer->next = *tp;
+	*tp = timer;
+}
+
+long dstate_timer_add(long msec, int repeat, dstate_timer_handler_t handler, void *arg)
+{
+	dstate_timer_t	*timer;
+
+	if (msec < 0 || !handler || (repeat && msec == 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	timer = (dstate_timer_t *)xcalloc(1, sizeof(*timer));
+	timer->id = ++timer_lastid;
+	timer->msec = repeat ? msec : 0;
+	timer->due = dstate_events_now() + (double)msec / 1000.0;
+	timer->handler = handler;
+	timer->arg = arg;
+	dstate_timer_insert(timer);
+
+	upsdebugx(3, "%s: timer %ld due in %ld msec%s", __func__,
+		timer->id, msec, repeat ? " (repeating)" : "");
+	return timer->id;
+}
+
+static void dstate_timer_gc(void)
+{
+	dstate_timer_t	*timer, **tp;
+
+	for (tp = &timer_head; (timer = *tp) != NULL; ) {
+		if (timer->removed) {
+			*tp = timer->next;
+			free(timer);
+		} else {
+			tp = &timer->next;
+		}
+	}
+}
+
+int dstate_timer_del(long id)
+{
+	dstate_timer_t	*timer;
+
+	for (timer = timer_head; timer; timer = timer->next) {
+		if (timer->id == id && !timer->removed)
+			break;
+	}
+
+	if (!timer) {
+		for (timer = timer_due; timer; timer = timer->next) {
+			if (timer->id == id && !timer->removed)
+				break;
+		}
+	}
+
+	if (!timer) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	timer->removed = 1;
+	if (!events_dispatching)
+		dstate_timer_gc();
+
+	return 0;
+}
+
+/* seconds until the next timer is due (0 if overdue), or -1 if none */
+static double dstate_timer_wait(void)
+{
+	dstate_timer_t	*timer;
+	double	wait;
+
+	for (timer = timer_head; timer && timer->removed; timer = timer->next)
+		;
+
+	if (!timer)
+		return -1;
+
+	wait = timer->due - dstate_events_now();
+	return (wait < 0) ? 0 : wait;
+}
+
+/* run the handlers of due timers, re-arming the repeating ones;
+ * returns 1 if any of them asked to end the wait */
+static int dstate_timer_dispatch(void)
+{
+	dstate_timer_t	*timer, **duetail = &timer_due;
+	double	now;
+	int	wake = 0;
+
+	if (!timer_head || timer_due)
+		return 0;
+
+	/* detach the due timers first, so re-armed or newly added
+	 * ones are not run again in this same pass */
+	now = dstate_events_now();
+	while (timer_head && timer_head->due <= now) {
+		timer = timer_head;
+		timer_head = timer->next;
+		timer->next = NULL;
+		*duetail = timer;
+		duetail = &timer->next;
+	}
+
+	events_dispatching++;
+	for (timer = timer_due; timer; timer = timer->next) {
+		if (!timer->removed && timer->handler(timer->arg))
+			wake = 1;
+	}
+	events_dispatching--;
+
+	while ((timer = timer_due) != NULL) {
+		timer_due = timer->next;
+
+		if (timer->removed || !timer->msec) {
+			free(timer);
+			continue;
+		}
+
+		/* keep the cadence, but do not try to catch up on missed runs */
+		timer->due += (double)timer->msec / 1000.0;
+		if (timer->due < now)
+			timer->due = now + (double)timer->msec / 1000.0;
+		dstate_timer_insert(timer);
+	}
+
+	if (!events_dispatching)
+		dstate_timer_gc();
+
+	return wake;
+}
+
+#ifndef WIN32
+/* add the registered descriptors (or their epoll set) to <rfds>/<wfds> */
+static void dstate_fd_prepare(fd_set *rfds, fd_set *wfds, int *maxfd)
+{
+# ifdef HAVE_SYS_EPOLL_H
+	/* the epoll set is readable when any of its members is ready */
+	NUT_UNUSED_VARIABLE(wfds);
+	if (events_epfd >= 0 && fdsrc_head) {
+		FD_SET(events_epfd, rfds);
+		if (events_epfd > *maxfd)
+			*maxfd = events_epfd;
+	}
+# else	/* !HAVE_SYS_EPOLL_H */
+	dstate_fdsrc_t	*src;
+
+	for (src = fdsrc_head; src; src = src->next) {
+		if (src->events & DSTATE_FD_READ)
+			FD_SET(src->fd, rfds);
+		if (src->events & DSTATE_FD_WRITE)
+			FD_SET(src->fd, wfds);
+		if (src->fd > *maxfd)
+			*maxfd = src->fd;
+	}
+# endif	/* !HAVE_SYS_EPOLL_H */
+}
+
+/* run the handlers of the ready descriptors;
+ * returns 1 if any of them asked to end the wait */
+static int dstate_fd_dispatch(fd_set *rfds, fd_set *wfds)
+{
+	int	wake = 0;
+# ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event	evs[32];
+	int	i, n;
+
+	NUT_UNUSED_VARIABLE(wfds);
+	if (events_epfd < 0 || !FD_ISSET(events_epfd, rfds))
+		return 0;
+
+	n = epoll_wait(events_epfd, evs, (int)SIZEOF_ARRAY(evs), 0);
+	if (n < 0) {
+		if (errno != EINTR)
+			upslog_with_errno(LOG_ERR, "%s: epoll_wait failed", __func__);
+		return 0;
+	}
+
+	events_dispatching++;
+	for (i = 0; i < n; i++) {
+		dstate_fdsrc_t	*src = (dstate_fdsrc_t *)evs[i].data.ptr;
+
+		/* may have been deleted by a previous handler in this batch */
+		if (!src->removed && src->handler(src->fd, src->arg))
+			wake = 1;
+	}
+	events_dispatching--;
+# else	/* !HAVE_SYS_EPOLL_H */
+	dstate_fdsrc_t	*src;
+
+	events_dispatching++;
+	for (src = fdsrc_head; src; src = src->next) {
+		if (!src->removed
+		 && (((src->events & DSTATE_FD_READ) && FD_ISSET(src->fd, rfds))
+		  || ((src->events & DSTATE_FD_WRITE) && FD_ISSET(src->fd, wfds)))
+		 && src->handler(src->fd, src->arg))
+			wake = 1;
+	}
+	events_dispatching--;
+# endif	/* !HAVE_SYS_EPOLL_H */
+
+	if (!events_dispatching)
+		dstate_fd_gc();
+
+	return wake;
+}
+#endif	/* !WIN32 */
+
+static void dstate_events_free(void)
+{
+	dstate_fdsrc_t	*src, *snext;
+	dstate_timer_t	*timer, *tnext;
+
+	for (src = fdsrc_head; src; src = snext) {
+		snext = src->next;
+		free(src);
+	}
+	fdsrc_head = NULL;
+
+	for (timer = timer_head; timer; timer = tnext) {
+		tnext = timer->next;
+		free(timer);
+	}
+	timer_head = NULL;
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (events_epfd >= 0) {
+		close(events_epfd);
+		events_epfd = -1;
+	}
+#endif	/* HAVE_SYS_EPOLL_H */
+}
+
+/* returns 1 if timeout expired or data is available on UPS fd, 0 otherwise */
+int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
+{
+	int	maxfd = 0; /* Unidiomatic use vs. "sockfd" below, which is "int" on non-WIN32 */
+	int	overrun = 0;
+	conn_t	*conn, *cnext;
+	struct timeval	now;
+
+#ifndef WIN32
+	int	ret, wake, timer_cut = 0;
+	double	wait;
+	fd_set	rfds, wfds;
+
+	FD_ZERO(&rfds);
+	FD_ZERO(&wfds);
+
+	if (VALID_FD(arg_extrafd)) {
 		FD_SET(arg_extrafd, &rfds);
 
 		if (arg_extrafd > maxfd) {
@@ -1563,6 +2522,14 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 		}
 	}
 
+	if (VALID_FD(sockfd)) {
+		FD_SET(sockfd, &rfds);
+
+		if (sockfd > maxfd) {
+			maxfd = sockfd;
+		}
+	}
+
 	for (conn = connhead; conn; conn = conn->next) {
 		FD_SET(conn->fd, &rfds);
 
@@ -1571,6 +2538,8 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 		}
 	}
 
+	dstate_fd_prepare(&rfds, &wfds, &maxfd);
+
 	gettimeofday(&now, NULL);
 
 	/* number of microseconds should always be positive */
@@ -1588,10 +2557,22 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 		timeout.tv_usec -= now.tv_usec;
 	}
 
-	ret = select(maxfd + 1, &rfds, NULL, NULL, &timeout);
+	/* wake up earlier if a driver timer is due before that */
+	wait = dstate_timer_wait();
+	if (wait >= 0 && wait < (double)timeout.tv_sec + (double)timeout.tv_usec / 1000000.0) {
+		timeout.tv_sec = (time_t)wait;
+		timeout.tv_usec = (suseconds_t)((wait - (double)timeout.tv_sec) * 1000000.0);
+		timer_cut = 1;
+	}
+
+	ret = select(maxfd + 1, &rfds, &wfds, NULL, &timeout);
 
 	if (ret == 0) {
-		return 1;	/* timer expired */
+		wake = dstate_timer_dispatch();
+		if (!timer_cut) {
+			return 1;	/* timer expired */
+		}
+		return wake;
 	}
 
 	if (ret < 0) {
@@ -1609,7 +2590,7 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 		return overrun;
 	}
 
-	if (FD_ISSET(sockfd, &rfds)) {
+	if (VALID_FD(sockfd) && FD_ISSET(sockfd, &rfds)) {
 		sock_connect(sockfd);
 	}
 
@@ -1630,6 +2611,12 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 		}
 	}
 
+	/* driver-registered descriptors and timers may also end the wait */
+	wake = dstate_fd_dispatch(&rfds, &wfds);
+	if (dstate_timer_dispatch() || wake) {
+		return 1;
+	}
+
 	/* tell the caller if that fd woke up */
 	if (VALID_FD(arg_extrafd) && (FD_ISSET(arg_extrafd, &rfds))) {
 		return 1;
@@ -1640,6 +2627,8 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 	DWORD	ret;
 	HANDLE	rfds[32];
 	DWORD	timeout_ms;
+	double	wait;
+	int	timer_cut = 0, wake;
 
 	/* FIXME: Should such table (and limit) be used in reality? */
 	NUT_UNUSED_VARIABLE(arg_extrafd);
@@ -1669,6 +2658,13 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 
 	timeout_ms = (timeout.tv_sec * 1000) + (timeout.tv_usec / 1000);
 
+	/* wake up earlier if a driver timer is due before that */
+	wait = dstate_timer_wait();
+	if (wait >= 0 && wait * 1000.0 < (double)timeout_ms) {
+		timeout_ms = (DWORD)(wait * 1000.0);
+		timer_cut = 1;
+	}
+
 	/* Wait on the read IO of each connections */
 	for (conn = connhead; conn; conn = conn->next) {
 		rfds[maxfd] = conn->read_overlapped.hEvent;
@@ -1685,7 +2681,11 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 				timeout_ms); /* timeout in millisecond */
 
 	if (ret == WAIT_TIMEOUT) {
-		return 1;	/* timer expired */
+		wake = dstate_timer_dispatch();
+		if (!timer_cut) {
+			return 1;	/* timer expired */
+		}
+		return wake;
 	}
 
 	if (ret == WAIT_FAILED) {
@@ -1720,6 +2720,10 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 		}
 	}
 
+	if (dstate_timer_dispatch()) {
+		return 1;
+	}
+
 	/* tell the caller if that fd woke up */
 /*
 	if (VALID_FD(arg_extrafd) && (ret == arg_extrafd)) {
@@ -1762,6 +2766,7 @@ int vdstate_setinfo(const char *var, const char *fmt, va_list ap)
 	ret = state_setinfo(&dtree_root, var, value);
 
 	if (ret == 1) {
+		dstate_gen_touch(var);
 		send_to_all("SETINFO %s \"%s\"\n", var, value);
 	}
 
@@ -1853,6 +2858,7 @@ int vdstate_addenum(const char *var, const char *fmt, va_list ap)
 	ret = state_addenum(dtree_root, var, value);
 
 	if (ret == 1) {
+		dstate_gen_touch(var);
 		send_to_all("ADDENUM %s \"%s\"\n", var, value);
 	}
 
@@ -1924,6 +2930,7 @@ int dstate_addrange(const char *var, const int min, const int max)
 	ret = state_addrange(dtree_root, var, min, max);
 
 	if (ret == 1) {
+		dstate_gen_touch(var);
 		send_to_all("ADDRANGE %s %i %i\n", var, min, max);
 		/* Also add the "NUMBER" flag for ranges */
 		dstate_addflags(var, ST_FLAG_NUMBER);
@@ -1955,6 +2962,7 @@ void dstate_setflags(const char *var, int flags)
 	}
 
 	sttmp->flags = flags;
+	dstate_gen_touch(var);
 
 	/* build the list */
 	snprintf(flist, sizeof(flist), "%s", var);
@@ -2028,6 +3036,7 @@ void dstate_setaux(const char *var, long aux)
 	}
 
 	sttmp->aux = aux;
+	dstate_gen_touch(var);
 
 	/* update listeners */
 	send_to_all("SETAUX %s %ld\n", var, aux);
@@ -2054,6 +3063,8 @@ void dstate_addcmd(const char *cmdname)
 
 	/* update listeners */
 	if (ret == 1) {
+		dstate_gen_touch(NULL);
+		cmds_gen = gen;
 		send_to_all("ADDCMD %s\n", cmdname);
 	}
 }
@@ -2066,6 +3077,7 @@ int dstate_delinfo(const char *var)
 
 	/* update listeners */
 	if (ret == 1) {
+		dstate_dellog_add("DELINFO %s\n", var);
 		send_to_all("DELINFO %s\n", var);
 	}
 
@@ -2080,6 +3092,7 @@ int dstate_delinfo_olderthan(const char *var, const st_tree_timespec_t *cutoff)
 
 	/* update listeners */
 	if (ret == 1) {
+		dstate_dellog_add("DELINFO %s\n", var);
 		send_to_all("DELINFO %s\n", var);
 	}
 
@@ -2094,6 +3107,7 @@ int dstate_delenum(const char *var, const char *val)
 
 	/* update listeners */
 	if (ret == 1) {
+		dstate_dellog_add("DELENUM %s \"%s\"\n", var, val);
 		send_to_all("DELENUM %s \"%s\"\n", var, val);
 	}
 
@@ -2108,6 +3122,7 @@ int dstate_delrange(const char *var, const int min, const int max)
 
 	/* update listeners */
 	if (ret == 1) {
+		dstate_dellog_add("DELRANGE %s %i %i\n", var, min, max);
 		send_to_all("DELRANGE %s %i %i\n", var, min, max);
 	}
 
@@ -2122,6 +3137,7 @@ int dstate_delcmd(const char *cmd)
 
 	/* update listeners */
 	if (ret == 1) {
+		dstate_dellog_add("DELCMD %s\n", cmd);
 		send_to_all("DELCMD %s\n", cmd);
 	}
 
@@ -2136,6 +3152,17 @@ void dstate_free(void)
 	state_cmdfree(cmdhead);
 	cmdhead = NULL;
 
+	dstate_snapshot_free();
+	state_infofree(hints_root);
+	hints_root = NULL;
+
+	/* Whatever comes next is a new tree, not resumable by DUMPSINCE */
+	dstate_dellog_free();
+	gen_id[0] = '\0';
+
+	dstate_perf_free();
+	dstate_events_free();
+
 	sock_close();
 }
 
@@ -2759,3 +3786,320 @@ void dstate_dump(void)
 	fflush(stdout);
 	fflush(stderr);
 }
+
+/* Warm-start snapshots: a copy of the data tree saved as socket protocol
+ * lines (same as DUMPALL would send), so the next start of the driver
+ * can begin with what was discovered before.
+ */
+
+#define DSTATE_SNAPSHOT_VERSION	"1"
+
+/* Dynamic or configuration-derived data which the driver core sets anew
+ * (or which would be wrong to restore even as stale data) */
+static int dstate_snapshot_skip(const char *var)
+{
+	if (!strncasecmp(var, "driver.", 7)
+	 || !strcasecmp(var, "ups.status")
+	 || !strcasecmp(var, "ups.alarm")
+	) {
+		return 1;
+	}
+
+	return 0;
+}
+
+static void dstate_snapshot_save_node(FILE *f, const st_tree_t *node)
+{
+	enum_t	*etmp;
+	range_t	*rtmp;
+
+	if (!node)
+		return;
+
+	dstate_snapshot_save_node(f, node->left);
+
+	if (!dstate_snapshot_skip(node->var)) {
+		fprintf(f, "SETINFO %s \"%s\"\n", node->var, node->val);
+
+		for (etmp = node->enum_list; etmp; etmp = etmp->next)
+			fprintf(f, "ADDENUM %s \"%s\"\n", node->var, etmp->val);
+
+		for (rtmp = node->range_list; rtmp; rtmp = rtmp->next)
+			fprintf(f, "ADDRANGE %s %i %i\n", node->var, rtmp->min, rtmp->max);
+
+		if (node->aux)
+			fprintf(f, "SETAUX %s %ld\n", node->var, node->aux);
+
+		if (node->flags & (ST_FLAG_RW | ST_FLAG_STRING | ST_FLAG_NUMBER)) {
+			fprintf(f, "SETFLAGS %s%s%s%s\n", node->var,
+				(node->flags & ST_FLAG_RW) ? " RW" : "",
+				(node->flags & ST_FLAG_STRING) ? " STRING" : "",
+				(node->flags & ST_FLAG_NUMBER) ? " NUMBER" : "");
+		}
+	}
+
+	dstate_snapshot_save_node(f, node->right);
+}
+
+static void dstate_snapshot_save_hints(FILE *f, const st_tree_t *node)
+{
+	if (!node)
+		return;
+
+	dstate_snapshot_save_hints(f, node->left);
+	fprintf(f, "HINT %s \"%s\"\n", node->var, node->val);
+	dstate_snapshot_save_hints(f, node->right);
+}
+
+int dstate_snapshot_save(const char *fn, const char *ident)
+{
+	char	tmpfn[NUT_PATH_MAX + 1], identbuf[LARGEBUF];
+	FILE	*f;
+	int	ret;
+
+	if (!fn || !ident || !dtree_root)
+		return 0;
+
+	/* write aside and rename, so a crash does not leave half a file */
+	snprintf(tmpfn, sizeof(tmpfn), "%s.tmp", fn);
+
+	f = fopen(tmpfn, "w");
+	if (!f) {
+		upslog_with_errno(LOG_WARNING, "Can't write state snapshot %s", tmpfn);
+		return 0;
+	}
+
+	fprintf(f, "# NUT driver state snapshot, re-created by the driver; do not edit\n");
+	fprintf(f, "SNAPSHOT %s \"%s\"\n", DSTATE_SNAPSHOT_VERSION,
+		pconf_encode(ident, identbuf, sizeof(identbuf)));
+	dstate_snapshot_save_node(f, dtree_root);
+	dstate_snapshot_save_hints(f, hints_root);
+
+	ret = ferror(f);
+	if (fclose(f) != 0 || ret) {
+		upslog_with_errno(LOG_WARNING, "Can't write state snapshot %s", tmpfn);
+		unlink(tmpfn);
+		return 0;
+	}
+
+	if (rename(tmpfn, fn) != 0) {
+		upslog_with_errno(LOG_WARNING, "Can't rename state snapshot %s to %s", tmpfn, fn);
+		unlink(tmpfn);
+		return 0;
+	}
+
+	upsdebugx(2, "%s: saved state snapshot %s", __func__, fn);
+	return 1;
+}
+
+int dstate_snapshot_load(const char *fn, const char *ident)
+{
+	PCONF_CTX_t	ctx;
+	int	restored = 0, header_ok = 0;
+
+	if (!fn || !ident)
+		return -1;
+
+	dstate_snapshot_free();
+
+	pconf_init(&ctx, NULL);
+
+	if (!pconf_file_begin(&ctx, fn)) {
+		upsdebugx(2, "%s: no usable state snapshot: %s", __func__, ctx.errmsg);
+		pconf_finish(&ctx);
+		return -1;
+	}
+
+	while (pconf_file_next(&ctx)) {
+		char	**arg = ctx.arglist;
+		size_t	numargs = ctx.numargs;
+
+		if (pconf_parse_error(&ctx)) {
+			upsdebugx(2, "%s: parse error: %s:%d: %s",
+				__func__, fn, ctx.linenum, ctx.errmsg);
+			continue;
+		}
+
+		if (numargs < 1)
+			continue;
+
+		if (!header_ok) {
+			/* keyed by the device identity; anything else is not ours */
+			if (numargs < 3 || strcasecmp(arg[0], "SNAPSHOT")
+			 || strcmp(arg[1], DSTATE_SNAPSHOT_VERSION) || strcmp(arg[2], ident)
+			) {
+				upslogx(LOG_INFO, "State snapshot %s is not for this device or driver version, ignored", fn);
+				break;
+			}
+			header_ok = 1;
+			continue;
+		}
+
+		if (numargs < 3)
+			continue;
+
+		/* hints are the driver's business, whatever their names */
+		if (!strcasecmp(arg[0], "HINT")) {
+			state_setinfo(&snapshot_hints, arg[1], arg[2]);
+			continue;
+		}
+
+		if (dstate_snapshot_skip(arg[1]))
+			continue;
+
+		if (!strcasecmp(arg[0], "SETINFO")) {
+			if (state_setinfo(&snapshot_root, arg[1], arg[2]) > 0)
+				restored++;
+			continue;
+		}
+
+		if (!strcasecmp(arg[0], "ADDENUM")) {
+			state_addenum(snapshot_root, arg[1], arg[2]);
+			continue;
+		}
+
+		if (!strcasecmp(arg[0], "ADDRANGE") && numargs > 3) {
+			state_addrange(snapshot_root, arg[1], atoi(arg[2]), atoi(arg[3]));
+			continue;
+		}
+
+		if (!strcasecmp(arg[0], "SETAUX")) {
+			state_setaux(snapshot_root, arg[1], arg[2]);
+			continue;
+		}
+
+		if (!strcasecmp(arg[0], "SETFLAGS")) {
+			state_setflags(snapshot_root, arg[1], numargs - 2, &arg[2]);
+			continue;
+		}
+
+		upsdebugx(2, "%s: %s:%d: unexpected '%s' line, ignored",
+			__func__, fn, ctx.linenum, arg[0]);
+	}
+
+	pconf_finish(&ctx);
+
+	if (!header_ok)
+		return -1;
+
+	upsdebugx(1, "%s: loaded %d variables from state snapshot %s",
+		__func__, restored, fn);
+
+	return restored;
+}
+
+const char *dstate_snapshot_getinfo(const char *var)
+{
+	return state_getinfo(snapshot_root, var);
+}
+
+void dstate_snapshot_sethint(const char *name, const char *value)
+{
+	state_setinfo(&hints_root, name, value);
+}
+
+const char *dstate_snapshot_gethint(const char *name)
+{
+	return state_getinfo(snapshot_hints, name);
+}
+
+/* Enum values are kept pconf_encode()d in the tree; undo that to add
+ * them to another tree (which would encode them again) */
+static const char *dstate_snapshot_decode(const char *src, char *dest, size_t destsize)
+{
+	size_t	i = 0;
+
+	for (; *src && i + 1 < destsize; src++) {
+		if (*src == '\\' && src[1])
+			src++;
+		dest[i++] = *src;
+	}
+	dest[i] = '\0';
+
+	return dest;
+}
+
+static void dstate_snapshot_merge_node(const st_tree_t *node)
+{
+	enum_t	*etmp;
+	range_t	*rtmp;
+	char	buf[ST_MAX_VALUE_LEN];
+
+	if (!node)
+		return;
+
+	dstate_snapshot_merge_node(node->left);
+
+	/* live data (whatever the driver set already) always wins */
+	if (!state_tree_find(dtree_root, node->var)
+	 && dstate_setinfo(node->var, "%s", node->raw) > 0
+	) {
+		for (etmp = node->enum_list; etmp; etmp = etmp->next)
+			dstate_addenum(node->var, "%s",
+				dstate_snapshot_decode(etmp->val, buf, sizeof(buf)));
+
+		for (rtmp = node->range_list; rtmp; rtmp = rtmp->next)
+			dstate_addrange(node->var, rtmp->min, rtmp->max);
+
+		if (node->aux)
+			dstate_setaux(node->var, node->aux);
+
+		if (node->flags)
+			dstate_setflags(node->var, dstate_tree_find(node->var)->flags | node->flags);
+
+		snapshot_merged = (char **)xrealloc(snapshot_merged,
+			(snapshot_merged_count + 1) * sizeof(char *));
+		snapshot_merged[snapshot_merged_count++] = xstrdup(node->var);
+	}
+
+	dstate_snapshot_merge_node(node->right);
+}
+
+int dstate_snapshot_merge(void)
+{
+	if (!snapshot_root)
+		return 0;
+
+	dstate_snapshot_merge_node(snapshot_root);
+	state_get_timestamp(&snapshot_cutoff);
+
+	upsdebugx(1, "%s: merged %" PRIuSIZE " variables from state snapshot",
+		__func__, snapshot_merged_count);
+
+	return (int)snapshot_merged_count;
+}
+
+int dstate_snapshot_validate(void)
+{
+	size_t	i;
+	int	deleted = 0;
+
+	for (i = 0; i < snapshot_merged_count; i++) {
+		if (dstate_delinfo_olderthan(snapshot_merged[i], &snapshot_cutoff) > 0) {
+			upsdebugx(2, "%s: %s was restored from state snapshot but not "
+				"confirmed by the device, removed",
+				__func__, snapshot_merged[i]);
+			deleted++;
+		}
+	}
+
+	dstate_snapshot_free();
+
+	return deleted;
+}
+
+void dstate_snapshot_free(void)
+{
+	size_t	i;
+
+	state_infofree(snapshot_root);
+	snapshot_root = NULL;
+	state_infofree(snapshot_hints);
+	snapshot_hints = NULL;
+
+	for (i = 0; i < snapshot_merged_count; i++)
+		free(snapshot_merged[i]);
+	free(snapshot_merged);
+	snapshot_merged = NULL;
+	snapshot_merged_count = 0;
+}
@@ -77,6 +77,29 @@ typedef struct conn_s {
 
 char * dstate_init(const char *prog, const char *devname);
 int dstate_poll_fds(struct timeval timeout, TYPE_FD extrafd);
+
+/* Additional event sources served by dstate_poll_fds(), for drivers which
+ * wait on several descriptors or have periodic work between the updates.
+ * A handler returning non-zero ends the current wait like the "extrafd"
+ * does, so that upsdrv_updateinfo() is called right away.  Handlers may
+ * add or delete sources, including their own.  Descriptors are not yet
+ * supported on WIN32 (dstate_fd_add() returns -1 with ENOSYS there). */
+typedef int (*dstate_fd_handler_t)(TYPE_FD fd, void *arg);
+typedef int (*dstate_timer_handler_t)(void *arg);
+
+/* Watch <fd> for reading; returns 0 on success, -1 and errno on error */
+int dstate_fd_add(TYPE_FD fd, dstate_fd_handler_t handler, void *arg);
+/* Same, for any of DSTATE_FD_READ and DSTATE_FD_WRITE readiness; adding
+ * a watched <fd> again replaces its events and handler */
+#define DSTATE_FD_READ	0x01
+#define DSTATE_FD_WRITE	0x02
+int dstate_fd_add_events(TYPE_FD fd, int events, dstate_fd_handler_t handler, void *arg);
+/* Stop watching <fd> (call this before closing it) */
+int dstate_fd_del(TYPE_FD fd);
+/* Call <handler> in <msec> milliseconds, and then every <msec> if <repeat>;
+ * returns the timer id for dstate_timer_del(), or -1 and errno on error */
+long dstate_timer_add(long msec, int repeat, dstate_timer_handler_t handler, void *arg);
+int dstate_timer_del(long id);
 int vdstate_setinfo(const char *var, const char *fmt, va_list ap);
 int dstate_setinfo(const char *var, const char *fmt, ...)
 	__attribute__ ((__format__ (__printf__, 2, 3)));
@@ -145,4 +168,37 @@ int dstate_detect_phasecount(
 
 void dstate_dump(void);
 
+/* Performance self-instrumentation: record a value (or the time elapsed
+ * since a dstate_perf_start() stamp, in microseconds) into the named
+ * counter; the counters are reported by the STATS socket command, and
+ * by dstate_perf_publish() as driver.perf.<name>.{count,avg,max} data */
+void dstate_perf_record(const char *name, const char *unit, double value);
+void dstate_perf_start(st_tree_timespec_t *start);
+void dstate_perf_since(const char *name, const st_tree_timespec_t *start);
+double dstate_perf_elapsed(const st_tree_timespec_t *start);	/* usec */
+void dstate_perf_publish(void);
+
+/* Warm-start snapshot of the data tree (except dynamic driver.* and
+ * status data) saved to a file, for the next start of the driver:
+ * - dstate_snapshot_load() reads it aside (only if the ident string, the
+ *   device identity, matches) and returns the number of variables, or -1;
+ *   drivers can consult it with dstate_snapshot_getinfo() to skip costly
+ *   discovery;
+ * - dstate_snapshot_merge() adds what the live tree lacks, to be served
+ *   (typically as stale data) until the device answers;
+ * - dstate_snapshot_validate() then removes the merged variables which
+ *   were not set again since, and forgets the snapshot.
+ * Drivers can also keep hints for their next start in the snapshot (e.g.
+ * the protocol a device was found to speak), which are not served as data:
+ * dstate_snapshot_sethint() sets one to be saved, dstate_snapshot_gethint()
+ * returns one loaded from the snapshot (until it is forgotten). */
+int dstate_snapshot_save(const char *fn, const char *ident);
+int dstate_snapshot_load(const char *fn, const char *ident);
+const char *dstate_snapshot_getinfo(const char *var);
+int dstate_snapshot_merge(void);
+int dstate_snapshot_validate(void);
+void dstate_snapshot_free(void);
+void dstate_snapshot_sethint(const char *name, const char *value);
+const char *dstate_snapshot_gethint(const char *name);
+
 #endif	/* DSTATE_H_SEEN */
@@ -77,6 +77,55 @@ static inline unsigned int hibit(unsigned long x)
 	return res;
 }
 
+/* Units and exponents table (HID PDC, 3.2.3) */
+#define NB_HID_UNITS 10
+static struct {
+	const long	Type;
+	const int8_t	Expo;
+} HIDUnits[NB_HID_UNITS] = {
+	{ 0x00000000, 0 },	/* None */
+	{ 0x00F0D121, 7 },	/* Voltage */
+	{ 0x00100001, 0 },	/* Ampere */
+	{ 0x0000D121, 7 },	/* VA */
+	{ 0x0000D121, 7 },	/* Watts */
+	{ 0x00001001, 0 },	/* second */
+	{ 0x00010001, 0 },	/* K */
+	{ 0x00000000, 0 },	/* percent */
+	{ 0x0000F001, 0 },	/* Hertz */
+	{ 0x00101001, 0 },	/* As */
+};
+
+static int8_t get_unit_expo(const HIDData_t *hiddata)
+{
+	int	i;
+	int8_t	unit_expo = hiddata->UnitExp;
+
+	upsdebugx(5, "Unit = %08x, UnitExp = %d", (uint32_t)(hiddata->Unit), hiddata->UnitExp);
+
+	for (i = 0; i < NB_HID_UNITS; i++) {
+
+		if (HIDUnits[i].Type == hiddata->Unit) {
+			unit_expo -= HIDUnits[i].Expo;
+			break;
+		}
+	}
+
+	upsdebugx(5, "Exponent = %d", unit_expo);
+	return unit_expo;
+}
+
+/* exponent function: return a^b */
+static double exponent(double a, int8_t b)
+{
+	if (b>0)
+		return (a * exponent(a, --b));		/* a * a ... */
+
+	if (b<0)
+		return ((1/a) * exponent(a, ++b));	/* (1/a) * (1/a) ... */
+
+	return 1;
+}
+
 /* Note: The USB HID specification states that Local items do not
    carry over to the next Main item (version 1.11, section
    6.2.2.8). Therefore the local state must be reset after each main
@@ -461,6 +510,162 @@ static int HIDParse(HIDParser_t *pParser, HIDData_t *pData)
 	return Found;
 }
 
+/*
+ * Lookup indexes of a parsed descriptor, so that the FindObject_with_*()
+ * calls need not scan all items. Adding keeps the first item found for a
+ * key, so lookups return the same item as a scan of the list would. As
+ * paths are matched on the length of the requested one, the path index
+ * holds every prefix of each item path.
+ * -------------------------------------------------------------------------- */
+typedef struct {
+	const HIDNode_t	*Node;
+	uint8_t	depth;
+	uint8_t	Type;
+	uint8_t	ReportID;
+	uint8_t	Offset;
+} HIDIndexKey_t;
+
+typedef int (*hid_index_match_t)(const HIDData_t *pData, const HIDIndexKey_t *key);
+
+static size_t hid_hash(size_t hash, const void *data, size_t len)
+{
+	const unsigned char	*p = (const unsigned char *)data;
+
+	while (len-- > 0)
+		hash = hash * 33 + *p++;
+
+	return hash;
+}
+
+static size_t hid_path_hash(const HIDIndexKey_t *key)
+{
+	size_t	hash = hid_hash(5381, &key->Type, 1);
+
+	hash = hid_hash(hash, &key->depth, 1);
+	return hid_hash(hash, key->Node, key->depth * sizeof(HIDNode_t));
+}
+
+static int hid_path_match(const HIDData_t *pData, const HIDIndexKey_t *key)
+{
+	return (pData->Type == key->Type && pData->Path.Size >= key->depth
+		&& !memcmp(pData->Path.Node, key->Node, key->depth * sizeof(HIDNode_t)));
+}
+
+static size_t hid_id_hash(const HIDIndexKey_t *key)
+{
+	size_t	hash = hid_hash(5381, &key->ReportID, 1);
+
+	hash = hid_hash(hash, &key->Offset, 1);
+	return hid_hash(hash, &key->Type, 1);
+}
+
+static int hid_id_match(const HIDData_t *pData, const HIDIndexKey_t *key)
+{
+	return (pData->ReportID == key->ReportID && pData->Offset == key->Offset
+		&& pData->Type == key->Type);
+}
+
+static size_t hid_node_hash(const HIDIndexKey_t *key)
+{
+	size_t	hash = hid_hash(5381, &key->ReportID, 1);
+
+	return hid_hash(hash, key->Node, sizeof(HIDNode_t));
+}
+
+static int hid_node_match(const HIDData_t *pData, const HIDIndexKey_t *key)
+{
+	return (pData->ReportID == key->ReportID && pData->Path.Size > 0
+		&& pData->Path.Node[pData->Path.Size - 1] == *key->Node);
+}
+
+/* Return the indexed item matching key, or NULL and the free slot
+ * where it would go in *freeslot (if not NULL) */
+static HIDData_t *hid_index_find(HIDDesc_t *pDesc_arg, const HIDIndex_t *idx,
+	size_t hash, hid_index_match_t match, const HIDIndexKey_t *key, size_t **freeslot)
+{
+	size_t	i, mask = idx->size - 1;
+
+	for (i = hash & mask; idx->slot[i] != 0; i = (i + 1) & mask) {
+		HIDData_t	*pData = &pDesc_arg->item[idx->slot[i] - 1];
+
+		if (match(pData, key))
+			return pData;
+	}
+
+	if (freeslot)
+		*freeslot = &idx->slot[i];
+
+	return NULL;
+}
+
+static void hid_index_add(HIDDesc_t *pDesc_arg, HIDIndex_t *idx,
+	size_t hash, hid_index_match_t match, const HIDIndexKey_t *key, size_t itemno)
+{
+	size_t	*freeslot = NULL;
+
+	if (!idx->size)
+		return;
+
+	if (!hid_index_find(pDesc_arg, idx, hash, match, key, &freeslot))
+		*freeslot = itemno + 1;
+}
+
+/* allocate at least twice as many slots as entries (a power of two) */
+static void hid_index_alloc(HIDIndex_t *idx, size_t entries)
+{
+	size_t	size = 16;
+
+	while (size < 2 * entries)
+		size <<= 1;
+
+	idx->slot = (size_t *)calloc(size, sizeof(*idx->slot));
+	idx->size = (idx->slot ? size : 0);
+}
+
+/*
+ * Index_ReportDesc
+ * (Re)build the lookup indexes, e.g. after items were changed or added
+ * -------------------------------------------------------------------------- */
+void Index_ReportDesc(HIDDesc_t *pDesc_arg)
+{
+	size_t	i, paths = 0;
+	HIDIndexKey_t	key;
+
+	free(pDesc_arg->path_index.slot);
+	free(pDesc_arg->id_index.slot);
+	free(pDesc_arg->node_index.slot);
+
+	for (i = 0; i < pDesc_arg->nitems; i++)
+		paths += pDesc_arg->item[i].Path.Size;
+
+	hid_index_alloc(&pDesc_arg->path_index, paths);
+	hid_index_alloc(&pDesc_arg->id_index, pDesc_arg->nitems);
+	hid_index_alloc(&pDesc_arg->node_index, pDesc_arg->nitems);
+
+	for (i = 0; i < pDesc_arg->nitems; i++) {
+		HIDData_t	*pData = &pDesc_arg->item[i];
+
+		memset(&key, 0, sizeof(key));
+		key.Node = pData->Path.Node;
+		key.Type = pData->Type;
+		key.ReportID = pData->ReportID;
+		key.Offset = pData->Offset;
+
+		for (key.depth = 1; key.depth <= pData->Path.Size && key.depth <= PATH_SIZE; key.depth++)
+			hid_index_add(pDesc_arg, &pDesc_arg->path_index,
+				hid_path_hash(&key), hid_path_match, &key, i);
+
+		hid_index_add(pDesc_arg, &pDesc_arg->id_index,
+			hid_id_hash(&key), hid_id_match, &key, i);
+
+		if (pData->Path.Size > 0) {
+			key.Node = &pData->Path.Node[pData->Path.Size - 1];
+			hid_index_add(pDesc_arg, &pDesc_arg->node_index,
+				hid_node_hash(&key), hid_node_match, &key, i);
+		}
+	}
+}
+
 /*
  * FindObject
  * Get pData characteristics from pData->Path
@@ -486,6 +691,17 @@ HIDData_t *FindObject_with_Path(HIDDesc_t *pDesc_arg, HIDPath_t *Path, uint8_t T
 {
 	size_t	i;
 
+	if (pDesc_arg->path_index.size && Path->Size > 0 && Path->Size <= PATH_SIZE) {
+		HIDIndexKey_t	key;
+
+		memset(&key, 0, sizeof(key));
+		key.Node = Path->Node;
+		key.depth = Path->Size;
+		key.Type = Type;
+		return hid_index_find(pDesc_arg, &pDesc_arg->path_index,
+			hid_path_hash(&key), hid_path_match, &key, NULL);
+	}
+
 	for (i = 0; i < pDesc_arg->nitems; i++) {
 		HIDData_t *pData = &pDesc_arg->item[i];
 
@@ -512,6 +728,17 @@ HIDData_t *FindObject_with_ID(HIDDesc_t *pDesc_arg, uint8_t ReportID, uint8_t Of
 {
 	size_t	i;
 
+	if (pDesc_arg->id_index.size) {
+		HIDIndexKey_t	key;
+
+		memset(&key, 0, sizeof(key));
+		key.ReportID = ReportID;
+		key.Offset = Offset;
+		key.Type = Type;
+		return hid_index_find(pDesc_arg, &pDesc_arg->id_index,
+			hid_id_hash(&key), hid_id_match, &key, NULL);
+	}
+
 	for (i = 0; i < pDesc_arg->nitems; i++) {
 		HIDData_t *pData = &pDesc_arg->item[i];
 
@@ -541,6 +768,16 @@ HIDData_t *FindObject_with_ID_Node(HIDDesc_t *pDesc_arg, uint8_t ReportID, HIDNo
 {
 	size_t	i;
 
+	if (pDesc_arg->node_index.size) {
+		HIDIndexKey_t	key;
+
+		memset(&key, 0, sizeof(key));
+		key.Node = &Node;
+		key.ReportID = ReportID;
+		return hid_index_find(pDesc_arg, &pDesc_arg->node_index,
+			hid_node_hash(&key), hid_node_match, &key, NULL);
+	}
+
 	for (i = 0; i < pDesc_arg->nitems; i++) {
 		HIDData_t	*pData = &pDesc_arg->item[i];
 		HIDPath_t	*pPath;
@@ -568,6 +805,64 @@ HIDData_t *FindObject_with_ID_Node(HIDDesc_t *pDesc_arg, uint8_t ReportID, HIDNo
  * Use Offset, Size, LogMin, and LogMax of pData.
  * Return response in *pValue.
  * -------------------------------------------------------------------------- */
+/*
+ * PrepareValue
+ * Set the value conversion plan of pData from its logical and physical
+ * extents and unit: the mask and sign bit which GetValue() applies, the
+ * factors between logical and physical values, and the unit scale.
+ * Must be called again if any of those fields is changed afterwards.
+ * -------------------------------------------------------------------------- */
+void PrepareValue(HIDData_t *pData)
+{
+	unsigned long	signbit, magMax, magMin;
+
+	/* determine representation without sign bit */
+	magMax = pData->LogMax >= 0 ? (unsigned long)(pData->LogMax) : (unsigned long)(-(pData->LogMax + 1));
+	magMin = pData->LogMin >= 0 ? (unsigned long)(pData->LogMin) : (unsigned long)(-(pData->LogMin + 1));
+
+	/* calculate where the sign bit will be if needed */
+	signbit = 1L << hibit(magMax > magMin ? magMax : magMin);
+
+	/* but only include sign bit in mask if negative numbers are involved */
+	pData->ValueMask = (signbit - 1) | ((pData->LogMin < 0) ? signbit : 0);
+	pData->SignBit = (pData->LogMin < 0) ? signbit : 0;
+
+	pData->PhyFactor = 0;
+	pData->LogFactor = 0;
+
+	/* HID spec says that if one or both are undefined, or if they are
+	 * both 0, then PhyMin = LogMin, PhyMax = LogMax. */
+	if (!pData->have_PhyMax || !pData->have_PhyMin ||
+		(pData->PhyMax == 0 && pData->PhyMin == 0))
+	{
+		/* values are converted as is */
+	} else if ((pData->PhyMax <= pData->PhyMin) || (pData->LogMax <= pData->LogMin)) {
+		/* Paranoia: this should not really happen */
+		upsdebugx(5, "Max was not greater than Min, values will be converted as is");
+	} else {
+		pData->PhyFactor = (double)(pData->PhyMax - pData->PhyMin) / (pData->LogMax - pData->LogMin);
+		pData->LogFactor = (double)(pData->LogMax - pData->LogMin) / (pData->PhyMax - pData->PhyMin);
+	}
+
+	pData->UnitScale = exponent(10, get_unit_expo(pData));
+	pData->prepared = true;
+
+	upsdebugx(5, "PhyMax = %ld, PhyMin = %ld, LogMax = %ld, LogMin = %ld, UnitScale = %g",
+		pData->PhyMax, pData->PhyMin, pData->LogMax, pData->LogMin, pData->UnitScale);
+}
+
+/*
+ * Prepare_ReportDesc
+ * Set the value conversion plans of all items, see PrepareValue()
+ * -------------------------------------------------------------------------- */
+void Prepare_ReportDesc(HIDDesc_t *pDesc_arg)
+{
+	size_t	i;
+
+	for (i = 0; i < pDesc_arg->nitems; i++)
+		PrepareValue(&pDesc_arg->item[i]);
+}
+
 void GetValue(const unsigned char *Buf, HIDData_t *pData, long *pValue)
 {
 	/* Note:  https://github.com/networkupstools/nut/issues/1023
@@ -579,12 +874,27 @@ void GetValue(const unsigned char *Buf, HIDData_t *pData, long *pValue)
 	 */
 
 	int	Weight, Bit;
-	unsigned long mask, signbit, magMax, magMin;
 	long	value = 0;
 
+	if (!pData->prepared)
+		PrepareValue(pData);
+
 	Bit = pData->Offset + 8;	/* First byte of report is report ID */
 
-	for (Weight = 0; Weight < pData->Size; Weight++, Bit++) {
+	if ((Bit & 7) + pData->Size <= 64) {
+		/* collect the whole bytes holding the item, then shift */
+		const unsigned char	*p = &Buf[Bit >> 3];
+		uint64_t	raw = 0;
+
+		for (Weight = 0; Weight < (Bit & 7) + pData->Size; Weight += 8)
+			raw |= (uint64_t)(*p++) << Weight;
+
+		raw >>= (Bit & 7);
+		if (pData->Size < 64)
+			raw &= ((uint64_t)1 << pData->Size) - 1;
+
+		value = (long)(unsigned long)raw;
+	} else for (Weight = 0; Weight < pData->Size; Weight++, Bit++) {
 		int	State = Buf[Bit >> 3] & (1 << (Bit & 7));
 
 		if(State) {
@@ -614,22 +924,14 @@ void GetValue(const unsigned char *Buf, HIDData_t *pData, long *pValue)
 	"throwing away higher-order bits" exacly means, so we try to do
 	something sensible. -PS */
 
-	/* determine representation without sign bit */
-	magMax = pData->LogMax >= 0 ? (unsigned long)(pData->LogMax) : (unsigned long)(-(pData->LogMax + 1));
-	magMin = pData->LogMin >= 0 ? (unsigned long)(pData->LogMin) : (unsigned long)(-(pData->LogMin + 1));
-
-	/* calculate where the sign bit will be if needed */
-	signbit = 1L << hibit(magMax > magMin ? magMax : magMin);
-
-	/* but only include sign bit in mask if negative numbers are involved */
-	mask = (signbit - 1) | ((pData->LogMin < 0) ? signbit : 0);
+	/* (PrepareValue() figured out the mask and sign bit) */
 
 	/* throw away excess high order bits (which may contain garbage) */
-	value = (long)((unsigned long)(value) & mask);
+	value = (long)((unsigned long)(value) & pData->ValueMask);
 
 	/* sign-extend it, if appropriate */
-	if (pData->LogMin < 0 && ((unsigned long)(value) & signbit) != 0) {
-		value |= ~mask;
+	if (((unsigned long)(value) & pData->SignBit) != 0) {
+		value |= ~pData->ValueMask;
 	}
 
 	/* clamp returned value to range [LogMin..LogMax] */
@@ -764,6 +1066,11 @@ HIDDesc_t *Parse_ReportDesc(const usb_ctrl_charbuf ReportDesc, const usb_ctrl_ch
 
 	pDesc_var->item = (HIDData_t *)realloc(pDesc_var->item, pDesc_var->nitems * sizeof(*pDesc_var->item));
 
+	/* without memory for them, lookups just scan the items */
+	Index_ReportDesc(pDesc_var);
+
+	Prepare_ReportDesc(pDesc_var);
+
 	return pDesc_var;
 }
 
@@ -774,6 +1081,9 @@ void Free_ReportDesc(HIDDesc_t *pDesc_arg)
 		return;
 	}
 
+	free(pDesc_arg->path_index.slot);
+	free(pDesc_arg->id_index.slot);
+	free(pDesc_arg->node_index.slot);
 	free(pDesc_arg->item);
 	free(pDesc_arg);
 }
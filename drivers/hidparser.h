@@ -61,6 +61,12 @@ HIDDesc_t *Parse_ReportDesc(const usb_ctrl_charbuf ReportDesc, const usb_ctrl_ch
  * -------------------------------------------------------------------------- */
 void Free_ReportDesc(HIDDesc_t *pDesc_arg);
 
+/*
+ * Index_ReportDesc
+ * (again after changing paths or adding items of a parsed descriptor)
+ * -------------------------------------------------------------------------- */
+void Index_ReportDesc(HIDDesc_t *pDesc_arg);
+
 /*
  * FindObject
  * -------------------------------------------------------------------------- */
@@ -71,6 +77,14 @@ HIDData_t *FindObject_with_Path(HIDDesc_t *pDesc_arg, HIDPath_t *Path, uint8_t T
 HIDData_t *FindObject_with_ID(HIDDesc_t *pDesc_arg, uint8_t ReportID, uint8_t Offset, uint8_t Type);
 
 HIDData_t *FindObject_with_ID_Node(HIDDesc_t *pDesc_arg, uint8_t ReportID, HIDNode_t Node);
+/*
+ * PrepareValue, Prepare_ReportDesc
+ * (again after changing limits or units of items, e.g. to fix them up)
+ * -------------------------------------------------------------------------- */
+void PrepareValue(HIDData_t *pData);
+
+void Prepare_ReportDesc(HIDDesc_t *pDesc_arg);
+
 /*
  * GetValue
  * -------------------------------------------------------------------------- */
@@ -318,8 +318,26 @@ typedef struct {
 	int8_t		have_PhyMax;			/* Physical Max defined?		*/
 
 	bool		mapping_handled;		/* Did any (sub)driver handling loop care about this report? If not, may be a point for improvement... */
+
+	/* Value conversion plan, derived from the above by PrepareValue() */
+	bool		prepared;			/* Plan is set (and limits not changed since)?	*/
+	unsigned long	ValueMask;			/* Raw value bits to keep, incl. sign bit	*/
+	unsigned long	SignBit;			/* Sign bit to extend, 0 if unsigned		*/
+	double		PhyFactor;			/* Physical units per logical one, 0 if same	*/
+	double		LogFactor;			/* Logical units per physical one, 0 if same	*/
+	double		UnitScale;			/* 10 ^ unit exponent				*/
 } HIDData_t;
 
+/*
+ * HIDIndex struct
+ *
+ * Hash table (open addressing) of items of a parsed report descriptor
+ * -------------------------------------------------------------------------- */
+typedef struct {
+	size_t		*slot;				/* item number + 1, or 0 if free	*/
+	size_t		size;				/* number of slots, 0 if not built	*/
+} HIDIndex_t;
+
 /*
  * HIDDesc struct
  *
@@ -329,6 +347,10 @@ typedef struct {
 	size_t		nitems;				/* number of items in descriptor */
 	HIDData_t	*item;				/* list of items			*/
 	size_t		replen[256];		/* list of report lengths, in byte */
+
+	HIDIndex_t	path_index;			/* items by Type and Path (prefix)	*/
+	HIDIndex_t	id_index;			/* items by ReportID, Offset, Type	*/
+	HIDIndex_t	node_index;			/* items by ReportID and last Node	*/
 } HIDDesc_t;
 
 #ifdef __cplusplus
@@ -33,6 +33,7 @@
 #include "config.h" /* must be the first header */
 
 #include <stdio.h>
+#include <ctype.h>
 #ifdef HAVE_STRING_H
 # include <string.h>
 #endif
@@ -61,8 +62,6 @@ static const char *hid_lookup_path(const HIDNode_t usage, usage_tables_t *utab);
 static long hid_lookup_usage(const char *name, usage_tables_t *utab);
 static int string_to_path(const char *string, HIDPath_t *path, usage_tables_t *utab);
 static int path_to_string(char *string, size_t size, const HIDPath_t *path, usage_tables_t *utab);
-static int8_t get_unit_expo(const HIDData_t *hiddata);
-static double exponent(double a, int8_t b);
 
 /* Tweak flag for APC Back-UPS */
 size_t max_report_size = 0;
@@ -381,26 +380,6 @@ static int file_report_buffer(reportbuf_t *rbuf, unsigned char *buf, size_t bufl
 
 /* ---------------------------------------------------------------------- */
 
-/* Units and exponents table (HID PDC, 3.2.3) */
-#define NB_HID_UNITS 10
-static struct {
-	const long	Type;
-	const int8_t	Expo;
-} HIDUnits[NB_HID_UNITS] = {
-	{ 0x00000000, 0 },	/* None */
-	{ 0x00F0D121, 7 },	/* Voltage */
-	{ 0x00100001, 0 },	/* Ampere */
-	{ 0x0000D121, 7 },	/* VA */
-	{ 0x0000D121, 7 },	/* Watts */
-	{ 0x00001001, 0 },	/* second */
-	{ 0x00010001, 0 },	/* K */
-	{ 0x00000000, 0 },	/* percent */
-	{ 0x0000F001, 0 },	/* Hertz */
-	{ 0x00101001, 0 },	/* As */
-};
-
-/* ---------------------------------------------------------------------- */
-
 /* CAUTION: be careful when modifying the output format of this function,
  * since it's used to produce sub-drivers "stub" using
  * scripts/subdriver/gen-usbhid-subdriver.sh
@@ -517,6 +496,24 @@ char *HIDGetDataItem(const HIDData_t *hiddata, usage_tables_t *utab)
 	return itemPath;
 }
 
+/* Convert a logical value of the given item into physical units */
+static double logical_to_scaled(HIDData_t *hiddata, long hValue)
+{
+	double	Value;
+
+	/* Conversion factors and exponents are figured out once per item */
+	if (!hiddata->prepared)
+		PrepareValue(hiddata);
+
+	/* Convert Logical Min, Max and Value into Physical */
+	Value = logical_to_physical(hiddata, hValue);
+
+	/* Process exponents and units */
+	Value *= hiddata->UnitScale;
+
+	return Value;
+}
+
 /* Return the physical value associated with the given HIDData path.
  * return 1 if OK, 0 on fail, -errno otherwise (ie disconnect).
  */
@@ -535,17 +532,62 @@ int HIDGetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double *Value, ti
 		return -errno;
 	}
 
-	*Value = hValue;
+	*Value = logical_to_scaled(hiddata, hValue);
 
-	/* Convert Logical Min, Max and Value into Physical */
-	*Value = logical_to_physical(hiddata, hValue);
+	return 1;
+}
 
-	/* Process exponents and units */
-	*Value *= exponent(10, get_unit_expo(hiddata));
+/* Return the physical value of the given item, as found in the report
+ * buffer (e.g. after HIDRefreshReports()), without any device I/O.
+ * return 1 if OK, 0 on fail.
+ */
+int HIDGetBufferedDataValue(HIDData_t *hiddata, double *Value)
+{
+	long	hValue;
+
+	if (hiddata == NULL || reportbuf == NULL
+	 || reportbuf->data[hiddata->ReportID] == NULL
+	) {
+		return 0;
+	}
+
+	GetValue(reportbuf->data[hiddata->ReportID], hiddata, &hValue);
+
+	*Value = logical_to_scaled(hiddata, hValue);
 
 	return 1;
 }
 
+/* Bring each report with a non-NULL "wanted[ReportID]" item into the
+ * report buffer, reading it from the device at most once (and only if
+ * the buffered copy is older than "age" seconds). The outcome for each
+ * report is stored into "status[ReportID]" like HIDGetDataValue() does
+ * for single items: 1 if OK, -errno otherwise, and 0 if not wanted.
+ * Returns the number of reports now available in the buffer.
+ */
+int HIDRefreshReports(hid_dev_handle_t udev, HIDData_t **wanted, time_t age, int *status)
+{
+	int	id, count = 0;
+
+	for (id = 0; id < 256; id++) {
+		if (wanted[id] == NULL) {
+			status[id] = 0;
+			continue;
+		}
+
+		if (refresh_report_buffer(reportbuf, udev, wanted[id], age) < 0) {
+			upsdebug_with_errno(1, "Can't retrieve Report %02x", (unsigned int)id);
+			status[id] = -errno;
+			continue;
+		}
+
+		status[id] = 1;
+		count++;
+	}
+
+	return count;
+}
+
 /* Return the physical value associated with the given path.
  * return 1 if OK, 0 on fail, -errno otherwise (ie disconnect).
  */
@@ -673,8 +715,11 @@ int HIDSetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double Value)
 		return 0;
 	}
 
+	if (!hiddata->prepared)
+		PrepareValue(hiddata);
+
 	/* Process exponents and units */
-	Value /= exponent(10, get_unit_expo(hiddata));
+	Value /= hiddata->UnitScale;
 
 	/* Convert Physical Min, Max and Value into Logical */
 	hValue = physical_to_logical(hiddata, Value);
@@ -819,33 +864,19 @@ int HIDGetEvents(hid_dev_handle_t udev, HIDData_t **event, int eventsize)
  * Support functions
  *******************************************************/
 
+/* Both conversions below use the factors set by PrepareValue(): if the
+ * physical extents were undefined (or unusable), values are taken as is.
+ * Keep the order of operations, so results do not depend on whether the
+ * factors were computed beforehand or not. */
 static double logical_to_physical(HIDData_t *Data, long logical)
 {
 	double physical;
-	double Factor;
-
-	upsdebugx(5, "PhyMax = %ld, PhyMin = %ld, LogMax = %ld, LogMin = %ld",
-		Data->PhyMax, Data->PhyMin, Data->LogMax, Data->LogMin);
 
-	/* HID spec says that if one or both are undefined, or if they are
-	 * both 0, then PhyMin = LogMin, PhyMax = LogMax. */
-	if (!Data->have_PhyMax || !Data->have_PhyMin ||
-		(Data->PhyMax == 0 && Data->PhyMin == 0))
-	{
+	if (Data->PhyFactor == 0)
 		return (double)logical;
-	}
 
-	/* Paranoia */
-	if ((Data->PhyMax <= Data->PhyMin) || (Data->LogMax <= Data->LogMin))
-	{
-		/* this should not really happen */
-		upsdebugx(5, "Max was not greater than Min, returning logical value as is");
-		return (double)logical;
-	}
-
-	Factor = (double)(Data->PhyMax - Data->PhyMin) / (Data->LogMax - Data->LogMin);
 	/* Convert Value */
-	physical = (double)((logical - Data->LogMin) * Factor) + Data->PhyMin;
+	physical = (double)((logical - Data->LogMin) * Data->PhyFactor) + Data->PhyMin;
 
 	if (physical > Data->PhyMax) {
 		return Data->PhyMax;
@@ -861,30 +892,12 @@ static double logical_to_physical(HIDData_t *Data, long logical)
 static long physical_to_logical(HIDData_t *Data, double physical)
 {
 	long logical;
-	double Factor;
-
-	upsdebugx(5, "PhyMax = %ld, PhyMin = %ld, LogMax = %ld, LogMin = %ld",
-		Data->PhyMax, Data->PhyMin, Data->LogMax, Data->LogMin);
-
-	/* HID spec says that if one or both are undefined, or if they are
-	 * both 0, then PhyMin = LogMin, PhyMax = LogMax. */
-	if (!Data->have_PhyMax || !Data->have_PhyMin ||
-		(Data->PhyMax == 0 && Data->PhyMin == 0))
-	{
-		return (long)physical;
-	}
 
-	/* Paranoia */
-	if ((Data->PhyMax <= Data->PhyMin) || (Data->LogMax <= Data->LogMin))
-	{
-		/* this should not really happen */
-		upsdebugx(5, "Max was not greater than Min, returning physical value as is");
+	if (Data->LogFactor == 0)
 		return (long)physical;
-	}
 
-	Factor = (double)(Data->LogMax - Data->LogMin) / (Data->PhyMax - Data->PhyMin);
 	/* Convert Value */
-	logical = (long)((physical - Data->PhyMin) * Factor) + Data->LogMin;
+	logical = (long)((physical - Data->PhyMin) * Data->LogFactor) + Data->LogMin;
 
 	if (logical > Data->LogMax)
 		return Data->LogMax;
@@ -895,38 +908,6 @@ static long physical_to_logical(HIDData_t *Data, double physical)
 	return logical;
 }
 
-static int8_t get_unit_expo(const HIDData_t *hiddata)
-{
-	int	i;
-	int8_t	unit_expo = hiddata->UnitExp;
-
-	upsdebugx(5, "Unit = %08x, UnitExp = %d", (uint32_t)(hiddata->Unit), hiddata->UnitExp);
-
-	for (i = 0; i < NB_HID_UNITS; i++) {
-
-		if (HIDUnits[i].Type == hiddata->Unit) {
-			unit_expo -= HIDUnits[i].Expo;
-			break;
-		}
-	}
-
-	upsdebugx(5, "Exponent = %d", unit_expo);
-	return unit_expo;
-}
-
-/* exponent function: return a^b */
-static double exponent(double a, int8_t b)
-{
-	if (b>0)
-		return (a * exponent(a, --b));		/* a * a ... */
-
-	if (b<0)
-		return ((1/a) * exponent(a, ++b));	/* (1/a) * (1/a) ... */
-
-	return 1;
-}
-
-/* translate HID string path to numeric path and return path depth */
 static int string_to_path(const char *string, HIDPath_t *path, usage_tables_t *utab)
 {
 	int	i = 0;
@@ -1033,24 +1014,154 @@ static int path_to_string(char *string, size_t size, const HIDPath_t *path, usag
 	return i;
 }
 
-/* usage conversion string -> numeric
- * Returns -1 for error, or a (HIDNode_t) ranged code value
+/* Hash indexes over the entries of the usage tables, by name (case
+ * insensitive) and by code, so that converting paths does not scan all
+ * tables for each node. They are built for the last utab looked up in,
+ * and keep the first entry found for a key, as a scan of the tables would.
  */
-static long hid_lookup_usage(const char *name, usage_tables_t *utab)
+static usage_tables_t	*usage_index_utab = NULL;
+static const usage_lkp_t	**usage_name_index = NULL;
+static const usage_lkp_t	**usage_code_index = NULL;
+static size_t	usage_index_size = 0;	/* power of two, 0 if not built */
+
+static size_t usage_name_hash(const char *name)
 {
-	int i, j;
+	size_t	hash = 5381;
+
+	for (; *name; name++)
+		hash = hash * 33 + (size_t)tolower((unsigned char)*name);
+
+	return hash;
+}
+
+static size_t usage_code_hash(const HIDNode_t code)
+{
+	/* spread the usage page (high word) and index (low word) */
+	return (size_t)code * 2654435761U;
+}
+
+static void usage_index_build(usage_tables_t *utab)
+{
+	size_t	count = 0, size = 64, mask, k;
+	int	i, j;
+
+	free(usage_name_index);
+	free(usage_code_index);
+	usage_name_index = NULL;
+	usage_code_index = NULL;
+	usage_index_size = 0;
+	usage_index_utab = utab;
+
+	for (i = 0; utab[i] != NULL; i++)
+		for (j = 0; utab[i][j].usage_name != NULL; j++)
+			count++;
+
+	while (size < 2 * count)
+		size <<= 1;
+
+	usage_name_index = (const usage_lkp_t **)calloc(size, sizeof(*usage_name_index));
+	usage_code_index = (const usage_lkp_t **)calloc(size, sizeof(*usage_code_index));
+	if (!usage_name_index || !usage_code_index) {
+		/* lookups will just scan the tables */
+		free(usage_name_index);
+		free(usage_code_index);
+		usage_name_index = NULL;
+		usage_code_index = NULL;
+		return;
+	}
+
+	usage_index_size = size;
+	mask = size - 1;
 
 	for (i = 0; utab[i] != NULL; i++)
 	{
 		for (j = 0; utab[i][j].usage_name != NULL; j++)
 		{
-			if (strcasecmp(utab[i][j].usage_name, name))
-				continue;
+			const usage_lkp_t	*entry = &utab[i][j];
 
-			/* Note: currently per hidtypes.h, HIDNode_t == uint32_t */
-			upsdebugx(5, "hid_lookup_usage: %s -> %08x", name, (uint32_t)utab[i][j].usage_code);
-			return (long)(utab[i][j].usage_code);
+			for (k = usage_name_hash(entry->usage_name) & mask;
+				usage_name_index[k] != NULL; k = (k + 1) & mask)
+			{
+				if (!strcasecmp(usage_name_index[k]->usage_name, entry->usage_name))
+					break;
+			}
+			if (usage_name_index[k] == NULL)
+				usage_name_index[k] = entry;
+
+			for (k = usage_code_hash(entry->usage_code) & mask;
+				usage_code_index[k] != NULL; k = (k + 1) & mask)
+			{
+				if (usage_code_index[k]->usage_code == entry->usage_code)
+					break;
+			}
+			if (usage_code_index[k] == NULL)
+				usage_code_index[k] = entry;
+		}
+	}
+
+	upsdebugx(5, "%s: indexed %" PRIuSIZE " usages in %" PRIuSIZE " slots",
+		__func__, count, size);
+}
+
+/* Returns the entry of utab for this name or code (by name if not NULL),
+ * or NULL if not found */
+static const usage_lkp_t *usage_index_find(const char *name, const HIDNode_t code, usage_tables_t *utab)
+{
+	size_t	k, mask;
+	int	i, j;
+
+	if (utab != usage_index_utab)
+		usage_index_build(utab);
+
+	if (!usage_index_size)
+	{
+		for (i = 0; utab[i] != NULL; i++)
+		{
+			for (j = 0; utab[i][j].usage_name != NULL; j++)
+			{
+				if (name ? !strcasecmp(utab[i][j].usage_name, name)
+				         : utab[i][j].usage_code == code)
+					return &utab[i][j];
+			}
 		}
+
+		return NULL;
+	}
+
+	mask = usage_index_size - 1;
+
+	if (name)
+	{
+		for (k = usage_name_hash(name) & mask; usage_name_index[k] != NULL; k = (k + 1) & mask)
+		{
+			if (!strcasecmp(usage_name_index[k]->usage_name, name))
+				return usage_name_index[k];
+		}
+
+		return NULL;
+	}
+
+	for (k = usage_code_hash(code) & mask; usage_code_index[k] != NULL; k = (k + 1) & mask)
+	{
+		if (usage_code_index[k]->usage_code == code)
+			return usage_code_index[k];
+	}
+
+	return NULL;
+}
+
+/* usage conversion string -> numeric
+ * Returns -1 for error, or a (HIDNode_t) ranged code value
+ */
+static long hid_lookup_usage(const char *name, usage_tables_t *utab)
+{
+	const usage_lkp_t	*entry = usage_index_find(name, 0, utab);
+
+	if (entry)
+	{
+		/* Note: currently per hidtypes.h, HIDNode_t == uint32_t */
+		upsdebugx(5, "hid_lookup_usage: %s -> %08x", name, (uint32_t)entry->usage_code);
+		return (long)(entry->usage_code);
 	}
 
 	upsdebugx(5, "hid_lookup_usage: %s -> not found in lookup table", name);
@@ -1060,18 +1171,12 @@ static long hid_lookup_usage(const char *name, usage_tables_t *utab)
 /* usage conversion numeric -> string */
 static const char *hid_lookup_path(const HIDNode_t usage, usage_tables_t *utab)
 {
-	int i, j;
+	const usage_lkp_t	*entry = usage_index_find(NULL, usage, utab);
 
-	for (i = 0; utab[i] != NULL; i++)
+	if (entry)
 	{
-		for (j = 0; utab[i][j].usage_name != NULL; j++)
-		{
-			if (utab[i][j].usage_code != usage)
-				continue;
-
-			upsdebugx(5, "hid_lookup_path: %08x -> %s", (unsigned int)usage, utab[i][j].usage_name);
-			return utab[i][j].usage_name;
-		}
+		upsdebugx(5, "hid_lookup_path: %08x -> %s", (unsigned int)usage, entry->usage_name);
+		return entry->usage_name;
 	}
 
 	upsdebugx(5, "hid_lookup_path: %08x -> not found in lookup table", (unsigned int)usage);
@@ -135,6 +135,16 @@ char *HIDGetDataItem(const HIDData_t *hiddata, usage_tables_t *utab);
  * -------------------------------------------------------------------------- */
 int HIDGetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double *Value, time_t age);
 
+/*
+ * HIDGetBufferedDataValue
+ * -------------------------------------------------------------------------- */
+int HIDGetBufferedDataValue(HIDData_t *hiddata, double *Value);
+
+/*
+ * HIDRefreshReports
+ * -------------------------------------------------------------------------- */
+int HIDRefreshReports(hid_dev_handle_t udev, HIDData_t **wanted, time_t age, int *status);
+
 /*
  * HIDSetDataValue
  * -------------------------------------------------------------------------- */
@@ -859,6 +859,7 @@ static int nut_libusb_get_report(
 	usb_ctrl_charbufsize ReportSize)
 {
 	int	ret;
+	st_tree_timespec_t	start;
 
 	upsdebugx(4, "Entering nut_libusb_get_report");
 
@@ -866,12 +867,16 @@ static int nut_libusb_get_report(
 		return 0;
 	}
 
+	dstate_perf_start(&start);
 	ret = usb_control_msg(udev,
 		USB_ENDPOINT_IN + USB_TYPE_CLASS + USB_RECIP_INTERFACE,
 		0x01, /* HID_REPORT_GET */
 		ReportId+(0x03<<8), /* HID_REPORT_TYPE_FEATURE */
 		usb_subdriver.hid_rep_index,
 		raw_buf, ReportSize, USB_TIMEOUT);
+	dstate_perf_since(ret >= 0 ? "usb.get_report" :
+		(ret == -ETIMEDOUT ? "usb.get_report.timeout" : "usb.get_report.error"),
+		&start);
 
 #ifdef WIN32
 	errno = -ret;
@@ -896,17 +901,20 @@ static int nut_libusb_set_report(
 	usb_ctrl_charbufsize ReportSize)
 {
 	int	ret;
+	st_tree_timespec_t	start;
 
 	if (!udev) {
 		return 0;
 	}
 
+	dstate_perf_start(&start);
 	ret = usb_control_msg(udev,
 		USB_ENDPOINT_OUT + USB_TYPE_CLASS + USB_RECIP_INTERFACE,
 		0x09, /* HID_REPORT_SET = 0x09*/
 		ReportId+(0x03<<8), /* HID_REPORT_TYPE_FEATURE */
 		usb_subdriver.hid_rep_index,
 		raw_buf, ReportSize, USB_TIMEOUT);
+	dstate_perf_since(ret >= 0 ? "usb.set_report" : "usb.set_report.error", &start);
 
 #ifdef WIN32
 	errno = -ret;
@@ -975,13 +983,19 @@ static int nut_libusb_get_interrupt(
 	usb_ctrl_timeout_msec timeout)
 {
 	int ret;
+	st_tree_timespec_t	start;
 
 	if (!udev) {
 		return -1;
 	}
 
 	/* Interrupt EP is USB_ENDPOINT_IN with offset defined in hid_ep_in, which is 0 by default, unless overridden in subdriver. */
+	dstate_perf_start(&start);
 	ret = usb_interrupt_read(udev, USB_ENDPOINT_IN + usb_subdriver.hid_ep_in, (char *)buf, bufsize, timeout);
+	/* the timeout is the normal "nothing happened" outcome here */
+	dstate_perf_since(ret >= 0 ? "usb.interrupt" :
+		(ret == -ETIMEDOUT ? "usb.interrupt.timeout" : "usb.interrupt.error"),
+		&start);
 
 #ifdef WIN32
 	errno = -ret;
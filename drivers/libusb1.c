@@ -42,12 +42,15 @@
 #include "nut_stdint.h"
 #include "nut_bool.h"
 
+#include <ctype.h>
+
 #ifndef WIN32
 # include <signal.h>	/* sigaction(), SIGALRM for the atexit watchdog */
+# include <poll.h>	/* POLLIN, POLLOUT of the libusb pollfds */
 #endif
 
 #define USB_DRIVER_NAME		"USB communication driver (libusb 1.0)"
-#define USB_DRIVER_VERSION	"0.54"
+#define USB_DRIVER_VERSION	"0.57"
 
 /* driver description structure */
 upsdrv_info_t comm_upsdrv_info = {
@@ -131,7 +134,424 @@ static void nut_libusb_cleanup_atexit(void)
 	nut_usb_ctx_initialized = false;
 }
 
+/* Device arrivals: once a device was opened, libusb hotplug callbacks (or
+ * without those, kernel uevents read by usb-common.c) report USB devices
+ * which appear later.  While the driver is disconnected, reopening then
+ * only scans the bus within NUT_LIBUSB_HOTPLUG_SETTLE seconds after an
+ * arrival (so udev can finish setting up the device node), and the
+ * arrival ends the main loop wait so the driver can reconnect at once.
+ * The device may also still be on the bus after a failed reopen (busy
+ * interface, permissions not applied yet, a missed event...), so the
+ * bus is scanned anyway every NUT_LIBUSB_HOTPLUG_RESCAN seconds.
+ * Without such events, or with the "usb_nohotplug" flag, each attempt
+ * to reopen the device scans the bus as before.
+ */
+#define NUT_LIBUSB_HOTPLUG_SETTLE	10
+#define NUT_LIBUSB_HOTPLUG_RESCAN	300
+
+static nut_bool_t	nut_usb_hotplug_armed = false;
+static nut_bool_t	nut_usb_hotplug_waiting = false;	/* last reopen found nothing */
+static nut_bool_t	nut_usb_hotplug_wake = false;
+static time_t	nut_usb_hotplug_until = 0;	/* bus scans allowed until then */
+static time_t	nut_usb_hotplug_scanned = 0;	/* last bus scan which found nothing */
+
 static void nut_libusb_close(libusb_device_handle *udev);
+static void nut_libusb_hotplug_arm(void);
+static int nut_libusb_hotplug_skip_scan(void);
+
+/* invoke matcher against device */
+static inline int matches(USBDeviceMatcher_t *matcher, USBDevice_t *device) {
+	if (!matcher) {
+		return 1;
+	}
+	return matcher->match_function(device, matcher->privdata);
+}
+
+/* Capture and replay of USB transactions ("usb_record" and "usb_replay"
+ * driver options, for drivers which only talk to the device through the
+ * usb_subdriver methods).  A capture is a text file with the identity of
+ * the device and its report descriptor, then one line per transaction:
+ *	device <VendorID> <ProductID> <bcdDevice>	(hex)
+ *	vendor|product|serial|rdesc <data>
+ *	<msec> get_report|set_report|get_string|interrupt <index> <result> <data>
+ * where <result> is the libusb return code (or length, for the control
+ * transfers), <index> is the report ID or string index (0 for interrupt),
+ * and <data> the bytes transferred, in hex ("-" if none).  The timestamps
+ * count from the start of the recording.  A replay serves the recorded
+ * answers to the driver without any device: each report ID and string
+ * index, and the interrupt pipe, go through their recorded transactions
+ * in order, and start over from the first when they run out.
+ */
+#define NUT_LIBUSB_CAPTURE_HEADER	"# NUT USB capture, format 1"
+#define NUT_LIBUSB_CAPTURE_LINE		(2 * MAX_REPORT_SIZE + 64)
+
+typedef enum {
+	NUT_USB_XFER_GET_REPORT = 0,
+	NUT_USB_XFER_SET_REPORT,
+	NUT_USB_XFER_GET_STRING,
+	NUT_USB_XFER_INTERRUPT,
+	NUT_USB_XFER_KINDS
+} nut_libusb_xfer_t;
+
+static const char	*nut_libusb_xfer_name[NUT_USB_XFER_KINDS] = {
+	"get_report", "set_report", "get_string", "interrupt"
+};
+
+typedef struct {
+	int	result;
+	int	len;
+	unsigned char	*data;
+	long	next;	/* next transaction of same kind and index, or -1 */
+} nut_libusb_replay_xfer_t;
+
+static FILE	*nut_usb_record_file = NULL;
+static st_tree_timespec_t	nut_usb_record_start;
+
+static nut_bool_t	nut_usb_replaying = false;
+static int	nut_usb_replay_handle;	/* its address serves as the device handle */
+static USBDevice_t	nut_usb_replay_device;
+static unsigned char	*nut_usb_replay_rdesc = NULL;
+static int	nut_usb_replay_rdlen = -1;
+static nut_libusb_replay_xfer_t	*nut_usb_replay_xfers = NULL;
+static long	nut_usb_replay_count = 0;
+/* first and next-to-serve transaction, per kind and (8-bit) index */
+static long	nut_usb_replay_first[NUT_USB_XFER_KINDS][256];
+static long	nut_usb_replay_cursor[NUT_USB_XFER_KINDS][256];
+
+#define NUT_LIBUSB_REPLAY_HANDLE	((libusb_device_handle *)(void *)&nut_usb_replay_handle)
+
+static void nut_libusb_record_hex(const unsigned char *data, int len)
+{
+	int	i;
+
+	if (len <= 0) {
+		fputs(" -", nut_usb_record_file);
+		return;
+	}
+
+	fputc(' ', nut_usb_record_file);
+	for (i = 0; i < len; i++)
+		fprintf(nut_usb_record_file, "%02x", data[i]);
+}
+
+/* Append a transaction to the capture, if recording */
+static void nut_libusb_record(nut_libusb_xfer_t kind, int index, int result,
+	const void *data, int len)
+{
+	st_tree_timespec_t	now;
+
+	if (!nut_usb_record_file)
+		return;
+
+	state_get_timestamp(&now);
+	fprintf(nut_usb_record_file, "%.0f %s %d %d",
+		difftime_st_tree_timespec(now, nut_usb_record_start) * 1000.0,
+		nut_libusb_xfer_name[kind], index, result);
+	nut_libusb_record_hex((const unsigned char *)data, len);
+	fputc('\n', nut_usb_record_file);
+}
+
+/* Write the identity of the device just opened to the capture */
+static void nut_libusb_record_device(const USBDevice_t *curDevice,
+	const unsigned char *rdbuf, int rdlen)
+{
+	if (!nut_usb_record_file)
+		return;
+
+	fprintf(nut_usb_record_file, "device %04x %04x %04x\n",
+		curDevice->VendorID, curDevice->ProductID, curDevice->bcdDevice);
+	if (curDevice->Vendor) {
+		fputs("vendor", nut_usb_record_file);
+		nut_libusb_record_hex((const unsigned char *)curDevice->Vendor, (int)strlen(curDevice->Vendor));
+		fputc('\n', nut_usb_record_file);
+	}
+	if (curDevice->Product) {
+		fputs("product", nut_usb_record_file);
+		nut_libusb_record_hex((const unsigned char *)curDevice->Product, (int)strlen(curDevice->Product));
+		fputc('\n', nut_usb_record_file);
+	}
+	if (curDevice->Serial) {
+		fputs("serial", nut_usb_record_file);
+		nut_libusb_record_hex((const unsigned char *)curDevice->Serial, (int)strlen(curDevice->Serial));
+		fputc('\n', nut_usb_record_file);
+	}
+	if (rdbuf && rdlen >= 0) {
+		fputs("rdesc", nut_usb_record_file);
+		nut_libusb_record_hex(rdbuf, rdlen);
+		fputc('\n', nut_usb_record_file);
+	}
+}
+
+/* Decode a hex (or "-") data field into a new buffer; returns its length,
+ * or -1 if it is not valid */
+static int nut_libusb_replay_hex(const char *hex, unsigned char **data)
+{
+	size_t	i, len = strlen(hex);
+	unsigned int	byte;
+
+	*data = NULL;
+	if (!strcmp(hex, "-"))
+		return 0;
+
+	if (len % 2 || len / 2 > MAX_REPORT_SIZE)
+		return -1;
+
+	*data = (unsigned char *)xmalloc(len / 2 + 1);
+	for (i = 0; i < len / 2; i++) {
+		if (sscanf(hex + 2 * i, "%2x", &byte) != 1) {
+			free(*data);
+			*data = NULL;
+			return -1;
+		}
+		(*data)[i] = (unsigned char)byte;
+	}
+	(*data)[len / 2] = '\0';
+
+	return (int)(len / 2);
+}
+
+static char *nut_libusb_replay_string(const char *hex)
+{
+	unsigned char	*data;
+
+	if (nut_libusb_replay_hex(hex, &data) < 0)
+		return NULL;
+
+	return data ? (char *)data : xstrdup("");
+}
+
+/* Load the capture to replay; fatal if it can not be used */
+static void nut_libusb_replay_load(const char *filename)
+{
+	FILE	*f;
+	char	*line, word[16], hex[NUT_LIBUSB_CAPTURE_LINE];
+	long	last[NUT_USB_XFER_KINDS][256];
+	size_t	kind, i, alloc = 0;
+	unsigned int	lineno = 0, vid, pid, bcd;
+	int	index, result, len;
+	double	msec;
+
+	f = fopen(filename, "r");
+	if (!f)
+		fatal_with_errno(EXIT_FAILURE, "Can't open USB capture %s", filename);
+
+	line = (char *)xmalloc(NUT_LIBUSB_CAPTURE_LINE);
+	memset(&nut_usb_replay_device, 0, sizeof(nut_usb_replay_device));
+	for (kind = 0; kind < NUT_USB_XFER_KINDS; kind++) {
+		for (i = 0; i < 256; i++) {
+			nut_usb_replay_first[kind][i] = -1;
+			nut_usb_replay_cursor[kind][i] = -1;
+			last[kind][i] = -1;
+		}
+	}
+
+	while (fgets(line, NUT_LIBUSB_CAPTURE_LINE, f)) {
+		lineno++;
+
+		if (!strchr(line, '\n') && !feof(f))
+			fatalx(EXIT_FAILURE, "USB capture %s: line %u is too long", filename, lineno);
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if (sscanf(line, "device %x %x %x", &vid, &pid, &bcd) == 3) {
+			/* only the first device opened is replayed */
+			if (nut_usb_replay_device.VendorID || nut_usb_replay_device.ProductID)
+				break;
+			nut_usb_replay_device.VendorID = (uint16_t)vid;
+			nut_usb_replay_device.ProductID = (uint16_t)pid;
+			nut_usb_replay_device.bcdDevice = (uint16_t)bcd;
+			continue;
+		}
+
+		if (sscanf(line, "%15s %s", word, hex) == 2 && !isdigit((unsigned char)word[0])) {
+			if (!strcmp(word, "vendor")) {
+				nut_usb_replay_device.Vendor = nut_libusb_replay_string(hex);
+			} else if (!strcmp(word, "product")) {
+				nut_usb_replay_device.Product = nut_libusb_replay_string(hex);
+			} else if (!strcmp(word, "serial")) {
+				nut_usb_replay_device.Serial = nut_libusb_replay_string(hex);
+			} else if (!strcmp(word, "rdesc")) {
+				nut_usb_replay_rdlen = nut_libusb_replay_hex(hex, &nut_usb_replay_rdesc);
+			} else {
+				fatalx(EXIT_FAILURE, "USB capture %s: unknown line %u", filename, lineno);
+			}
+			continue;
+		}
+
+		if (sscanf(line, "%lf %15s %d %d %s", &msec, word, &index, &result, hex) != 5
+		||  index < 0 || index > 255
+		) {
+			fatalx(EXIT_FAILURE, "USB capture %s: bad line %u", filename, lineno);
+		}
+
+		for (kind = 0; kind < NUT_USB_XFER_KINDS; kind++) {
+			if (!strcmp(word, nut_libusb_xfer_name[kind]))
+				break;
+		}
+		if (kind == NUT_USB_XFER_KINDS)
+			fatalx(EXIT_FAILURE, "USB capture %s: unknown transaction on line %u", filename, lineno);
+
+		if ((size_t)nut_usb_replay_count >= alloc) {
+			alloc = alloc ? 2 * alloc : 256;
+			nut_usb_replay_xfers = (nut_libusb_replay_xfer_t *)xrealloc(
+				nut_usb_replay_xfers, alloc * sizeof(*nut_usb_replay_xfers));
+		}
+
+		len = nut_libusb_replay_hex(hex, &nut_usb_replay_xfers[nut_usb_replay_count].data);
+		if (len < 0)
+			fatalx(EXIT_FAILURE, "USB capture %s: bad data on line %u", filename, lineno);
+
+		nut_usb_replay_xfers[nut_usb_replay_count].result = result;
+		nut_usb_replay_xfers[nut_usb_replay_count].len = len;
+		nut_usb_replay_xfers[nut_usb_replay_count].next = -1;
+
+		/* chain it after the previous one of same kind and index */
+		if (last[kind][index] < 0)
+			nut_usb_replay_first[kind][index] = nut_usb_replay_count;
+		else
+			nut_usb_replay_xfers[last[kind][index]].next = nut_usb_replay_count;
+		last[kind][index] = nut_usb_replay_count;
+
+		nut_usb_replay_count++;
+	}
+
+	free(line);
+	fclose(f);
+
+	if (!nut_usb_replay_device.VendorID && !nut_usb_replay_device.ProductID)
+		fatalx(EXIT_FAILURE, "USB capture %s: no device found", filename);
+
+	upslogx(LOG_INFO, "Replaying %ld USB transactions of device %04x:%04x from %s",
+		nut_usb_replay_count, nut_usb_replay_device.VendorID,
+		nut_usb_replay_device.ProductID, filename);
+}
+
+/* Serve the next recorded transaction of this kind and index: copies
+ * its data (up to len bytes) and returns its result, or "fallback" if
+ * none was recorded.  *xferlen (if not NULL) gets the copied length. */
+static int nut_libusb_replay(nut_libusb_xfer_t kind, int index,
+	void *data, int len, int *xferlen, int fallback)
+{
+	nut_libusb_replay_xfer_t	*xfer;
+	long	cur;
+
+	if (xferlen)
+		*xferlen = 0;
+
+	if (index < 0 || index > 255 || nut_usb_replay_first[kind][index] < 0)
+		return fallback;
+
+	cur = nut_usb_replay_cursor[kind][index];
+	cur = (cur < 0 || nut_usb_replay_xfers[cur].next < 0)
+		? nut_usb_replay_first[kind][index] : nut_usb_replay_xfers[cur].next;
+	nut_usb_replay_cursor[kind][index] = cur;
+
+	xfer = &nut_usb_replay_xfers[cur];
+	if (data && len > 0 && kind != NUT_USB_XFER_SET_REPORT) {
+		if (len > xfer->len)
+			len = xfer->len;
+		if (len > 0)
+			memcpy(data, xfer->data, (size_t)len);
+		if (xferlen)
+			*xferlen = len;
+	}
+
+	return xfer->result;
+}
+
+/* Replay of nut_libusb_open(): "opens" the recorded device if it passes
+ * the matchers and callback, like a real one would */
+static int nut_libusb_replay_open(libusb_device_handle **udevp,
+	USBDevice_t *curDevice, USBDeviceMatcher_t *matcher,
+	int (*callback)(libusb_device_handle *udev,
+		USBDevice_t *hd, usb_ctrl_charbuf rdbuf, usb_ctrl_charbufsize rdlen)
+	)
+{
+	USBDeviceMatcher_t	*m;
+
+	*udevp = NULL;
+
+	free(curDevice->Vendor);
+	free(curDevice->Product);
+	free(curDevice->Serial);
+	free(curDevice->Bus);
+	free(curDevice->Device);
+#if (defined WITH_USB_BUSPORT) && (WITH_USB_BUSPORT)
+	free(curDevice->BusPort);
+#endif
+	memset(curDevice, '\0', sizeof(*curDevice));
+
+	curDevice->VendorID = nut_usb_replay_device.VendorID;
+	curDevice->ProductID = nut_usb_replay_device.ProductID;
+	curDevice->bcdDevice = nut_usb_replay_device.bcdDevice;
+	if (nut_usb_replay_device.Vendor)
+		curDevice->Vendor = xstrdup(nut_usb_replay_device.Vendor);
+	if (nut_usb_replay_device.Product)
+		curDevice->Product = xstrdup(nut_usb_replay_device.Product);
+	if (nut_usb_replay_device.Serial)
+		curDevice->Serial = xstrdup(nut_usb_replay_device.Serial);
+	curDevice->Bus = xstrdup("000");
+	curDevice->Device = xstrdup("000");
+
+	for (m = matcher; m; m = m->next) {
+		if (matches(m, curDevice) != 1) {
+			upsdebugx(2, "libusb1: replayed device does not match");
+			return -1;
+		}
+	}
+
+	*udevp = NUT_LIBUSB_REPLAY_HANDLE;
+
+	if (!callback)
+		return 1;
+
+	if (nut_usb_replay_rdlen < USB_CTRL_CHARBUFSIZE_MIN
+	||  (uintmax_t)nut_usb_replay_rdlen > (uintmax_t)USB_CTRL_CHARBUFSIZE_MAX
+	||  callback(*udevp, curDevice, nut_usb_replay_rdesc, (usb_ctrl_charbufsize)nut_usb_replay_rdlen) < 1
+	) {
+		upsdebugx(2, "libusb1: replayed device was not accepted");
+		*udevp = NULL;
+		return -1;
+	}
+
+	return nut_usb_replay_rdlen;
+}
+
+void nut_libusb_capture_addvars(void)
+{
+	addvar(VAR_VALUE, "usb_record", "Record all USB transactions with the device to this file");
+	addvar(VAR_VALUE, "usb_replay", "Replay USB transactions recorded in this file, instead of using a device");
+}
+
+/* Set up recording or replay on first open, as asked by driver options */
+static void nut_libusb_capture_init(void)
+{
+	static nut_bool_t	done = false;
+	const char	*filename;
+
+	if (done)
+		return;
+	done = true;
+
+	if ((filename = getval("usb_replay")) != NULL) {
+		nut_libusb_replay_load(filename);
+		nut_usb_replaying = true;
+		return;
+	}
+
+	if ((filename = getval("usb_record")) != NULL) {
+		nut_usb_record_file = fopen(filename, "w");
+		if (!nut_usb_record_file)
+			fatal_with_errno(EXIT_FAILURE, "Can't create USB capture %s", filename);
+
+		/* keep complete lines on disk, in case the driver dies */
+		setvbuf(nut_usb_record_file, NULL, _IOLBF, 0);
+		fprintf(nut_usb_record_file, "%s\n", NUT_LIBUSB_CAPTURE_HEADER);
+		state_get_timestamp(&nut_usb_record_start);
+		upslogx(LOG_INFO, "Recording USB transactions to %s", filename);
+	}
+}
 
 /*! Add USB-related driver variables with addvar() and dstate_setinfo().
  * This removes some code duplication across the USB drivers.
@@ -170,6 +590,8 @@ void nut_usb_addvars(void)
 		"option to take the first match if available, or try another "
 		"(association of driver to device may vary between runs)");
 
+	addvar(VAR_FLAG, "usb_nohotplug", "Scan the bus on each attempt to reconnect, rather than wait for USB device arrival events");
+
 	addvar(VAR_VALUE, "usb_set_altinterface", "Force redundant call to usb_set_altinterface() (value=bAlternateSetting; default=0)");
 
 	addvar(VAR_VALUE, "usb_config_index",	"Deeper tuning of USB communications for complex devices");
@@ -187,14 +609,6 @@ void nut_usb_addvars(void)
 	upsdebugx(1, "Using USB implementation: %s", dstate_getinfo("driver.version.usb"));
 }
 
-/* invoke matcher against device */
-static inline int matches(USBDeviceMatcher_t *matcher, USBDevice_t *device) {
-	if (!matcher) {
-		return 1;
-	}
-	return matcher->match_function(device, matcher->privdata);
-}
-
 /*! If needed, set the USB alternate interface.
  *
  * In NUT 2.7.2 and earlier, the following call was made unconditionally:
@@ -367,6 +781,11 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 		usb_hid_number_opts_parsed = 1;
 	}
 
+	nut_libusb_capture_init();
+	if (nut_usb_replaying) {
+		return nut_libusb_replay_open(udevp, curDevice, matcher, callback);
+	}
+
 	/* libusb base init: initialize our explicit context on the first call
 	 * here, and register the matching one-shot teardown via atexit. See the
 	 * comment near the file-scope declaration of nut_usb_ctx for the design
@@ -396,6 +815,12 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 		libusb_close(*udevp);
 #endif
 
+	if (nut_libusb_hotplug_skip_scan()) {
+		upsdebugx(2, "libusb1: no USB device arrived since the last attempt, not scanning the bus");
+		*udevp = NULL;
+		return -1;
+	}
+
 	devcount = libusb_get_device_list(nut_usb_ctx, &devlist);
 
 	/* devcount may be < 0, loop will get skipped;
@@ -707,6 +1132,7 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 		if (!callback) {
 			libusb_free_config_descriptor(conf_desc);
 			libusb_free_device_list(devlist, 1);
+			nut_libusb_record_device(curDevice, NULL, -1);
 			return 1;
 		}
 
@@ -920,6 +1346,8 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 		fflush(stdout);
 		libusb_free_device_list(devlist, 1);
 
+		nut_libusb_record_device(curDevice, rdbuf, rdlen);
+		nut_libusb_hotplug_arm();
 		return rdlen;
 
 		next_device:
@@ -935,6 +1363,8 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 	/* If we got here, we did not return a successfully chosen device above */
 	*udevp = NULL;
 	libusb_free_device_list(devlist, 1);
+	nut_usb_hotplug_waiting = nut_usb_hotplug_armed;
+	nut_usb_hotplug_scanned = time(NULL);
 	upsdebugx(2, "libusb1: No appropriate HID device found");
 	fflush(stdout);
 
@@ -1047,6 +1477,7 @@ static int nut_libusb_get_report(
 	usb_ctrl_charbufsize ReportSize)
 {
 	int	ret;
+	st_tree_timespec_t	start;
 
 	upsdebugx(4, "Entering libusb_get_report");
 
@@ -1073,12 +1504,22 @@ static int nut_libusb_get_report(
 	}
 
 	/* libusb0: USB_ENDPOINT_IN + USB_TYPE_CLASS + USB_RECIP_INTERFACE */
-	ret = libusb_control_transfer(udev,
-		LIBUSB_ENDPOINT_IN|LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE,
-		0x01, /* HID_REPORT_GET */
-		(uint16_t)ReportId + (0x03<<8), /* HID_REPORT_TYPE_FEATURE */
-		usb_subdriver.hid_rep_index,
-		raw_buf, (uint16_t)ReportSize, USB_TIMEOUT);
+	dstate_perf_start(&start);
+	if (udev == NUT_LIBUSB_REPLAY_HANDLE) {
+		ret = nut_libusb_replay(NUT_USB_XFER_GET_REPORT, (int)ReportId,
+			raw_buf, (int)ReportSize, NULL, LIBUSB_ERROR_PIPE);
+	} else {
+		ret = libusb_control_transfer(udev,
+			LIBUSB_ENDPOINT_IN|LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE,
+			0x01, /* HID_REPORT_GET */
+			(uint16_t)ReportId + (0x03<<8), /* HID_REPORT_TYPE_FEATURE */
+			usb_subdriver.hid_rep_index,
+			raw_buf, (uint16_t)ReportSize, USB_TIMEOUT);
+	}
+	dstate_perf_since(ret >= 0 ? "usb.get_report" :
+		(ret == LIBUSB_ERROR_TIMEOUT ? "usb.get_report.timeout" : "usb.get_report.error"),
+		&start);
+	nut_libusb_record(NUT_USB_XFER_GET_REPORT, (int)ReportId, ret, raw_buf, ret);
 
 	/* Ignore "protocol stall" (for unsupported request) on control endpoint */
 	if (ret == LIBUSB_ERROR_PIPE) {
@@ -1099,6 +1540,7 @@ static int nut_libusb_set_report(
 	usb_ctrl_charbufsize ReportSize)
 {
 	int	ret;
+	st_tree_timespec_t	start;
 
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_UNSIGNED_ZERO_COMPARE) )
 # pragma GCC diagnostic push
@@ -1123,12 +1565,20 @@ static int nut_libusb_set_report(
 	}
 
 	/* libusb0: USB_ENDPOINT_OUT + USB_TYPE_CLASS + USB_RECIP_INTERFACE */
-	ret = libusb_control_transfer(udev,
-		LIBUSB_ENDPOINT_OUT|LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE,
-		0x09, /* HID_REPORT_SET = 0x09*/
-		(uint16_t)ReportId + (0x03<<8), /* HID_REPORT_TYPE_FEATURE */
-		usb_subdriver.hid_rep_index,
-		raw_buf, (uint16_t)ReportSize, USB_TIMEOUT);
+	dstate_perf_start(&start);
+	if (udev == NUT_LIBUSB_REPLAY_HANDLE) {
+		ret = nut_libusb_replay(NUT_USB_XFER_SET_REPORT, (int)ReportId,
+			NULL, 0, NULL, (int)ReportSize);
+	} else {
+		ret = libusb_control_transfer(udev,
+			LIBUSB_ENDPOINT_OUT|LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE,
+			0x09, /* HID_REPORT_SET = 0x09*/
+			(uint16_t)ReportId + (0x03<<8), /* HID_REPORT_TYPE_FEATURE */
+			usb_subdriver.hid_rep_index,
+			raw_buf, (uint16_t)ReportSize, USB_TIMEOUT);
+	}
+	dstate_perf_since(ret >= 0 ? "usb.set_report" : "usb.set_report.error", &start);
+	nut_libusb_record(NUT_USB_XFER_SET_REPORT, (int)ReportId, ret, raw_buf, (int)ReportSize);
 
 	/* Ignore "protocol stall" (for unsupported request) on control endpoint */
 	if (ret == LIBUSB_ERROR_PIPE) {
@@ -1154,8 +1604,18 @@ static int nut_libusb_get_string(
 		return -1;
 	}
 
-	ret = nut_usb_get_string(udev, (uint8_t)StringIdx,
-		buf, (int)buflen);
+	if (udev == NUT_LIBUSB_REPLAY_HANDLE) {
+		int	len;
+
+		ret = nut_libusb_replay(NUT_USB_XFER_GET_STRING, (int)StringIdx,
+			buf, (int)buflen - 1, &len, LIBUSB_ERROR_PIPE);
+		buf[len] = '\0';
+	} else {
+		ret = nut_usb_get_string(udev, (uint8_t)StringIdx,
+			buf, (int)buflen);
+	}
+	nut_libusb_record(NUT_USB_XFER_GET_STRING, (int)StringIdx, ret,
+		buf, ret < 0 ? -1 : (int)strlen(buf));
 
 	/** 0 can be seen as an empty string, or as LIBUSB_SUCCESS for
 	 * logging below - also tends to happen */
@@ -1172,6 +1632,489 @@ static int nut_libusb_get_string(
 	return nut_libusb_strerror(ret, __func__);
 }
 
+/* Asynchronous interrupt pipe reads, if the driver asked for them with
+ * nut_libusb_set_async_interrupt(): one transfer is kept submitted on the
+ * interrupt IN endpoint all the time (re-submitted from its completion
+ * callback), and the descriptors of the libusb context are watched by
+ * the driver main loop via dstate_fd_add_events().  A completed report
+ * thus ends the wait for the next update right away, and
+ * nut_libusb_get_interrupt() only picks up the queued reports without
+ * ever waiting inside libusb.  Where libusb does not expose its pollfds
+ * (e.g. on WIN32) the synchronous reads with a timeout are used.
+ */
+#define NUT_LIBUSB_ASYNC_QUEUE		8
+#define NUT_LIBUSB_ASYNC_BUFSIZE	0x200
+#define NUT_LIBUSB_ASYNC_STOP_WAIT	50	/* times 100 msec */
+
+typedef struct {
+	int	len;
+	unsigned char	data[NUT_LIBUSB_ASYNC_BUFSIZE];
+} nut_libusb_async_report_t;
+
+static nut_bool_t	nut_usb_async_wanted = false;
+static nut_bool_t	nut_usb_ctx_watched = false;	/* pollfds are in the main loop */
+static libusb_device_handle	*nut_usb_async_udev = NULL;
+static struct libusb_transfer	*nut_usb_async_xfer = NULL;
+static nut_bool_t	nut_usb_async_inflight = false;
+static nut_bool_t	nut_usb_async_stopping = false;	/* do not resubmit */
+static int	nut_usb_async_error = LIBUSB_SUCCESS;	/* for the next get_interrupt */
+static unsigned char	nut_usb_async_buf[NUT_LIBUSB_ASYNC_BUFSIZE];
+static nut_libusb_async_report_t	nut_usb_async_queue[NUT_LIBUSB_ASYNC_QUEUE];
+static size_t	nut_usb_async_head = 0, nut_usb_async_count = 0;
+static long	nut_usb_async_wake_timer = -1;	/* more reports are queued */
+
+void nut_libusb_set_async_interrupt(int enable)
+{
+	nut_usb_async_wanted = (enable ? true : false);
+}
+
+#ifndef WIN32
+/* returns TRUE-ish once after a device arrived while disconnected */
+static int nut_libusb_hotplug_woken(void)
+{
+	if (!nut_usb_hotplug_wake) {
+		return 0;
+	}
+
+	nut_usb_hotplug_wake = false;
+	return 1;
+}
+
+/* main loop handler for the libusb descriptors: run the completion and
+ * hotplug callbacks without waiting, and wake the driver if a report
+ * came in or the device may be back */
+static int nut_libusb_fd_ready(TYPE_FD fd, void *arg)
+{
+	struct timeval	tv = { 0, 0 };
+	int	wake;
+
+	NUT_UNUSED_VARIABLE(fd);
+	NUT_UNUSED_VARIABLE(arg);
+
+	libusb_handle_events_timeout(nut_usb_ctx, &tv);
+
+	wake = nut_libusb_hotplug_woken();
+	return (wake || nut_usb_async_count > 0 || nut_usb_async_error != LIBUSB_SUCCESS);
+}
+
+/* one-shot timer ending the current wait for the next update,
+ * so that reports which queued up are not delayed until then */
+static int nut_libusb_async_wake(void *arg)
+{
+	NUT_UNUSED_VARIABLE(arg);
+
+	nut_usb_async_wake_timer = -1;
+	return 1;
+}
+
+static int nut_libusb_watch_fd(int fd, short events)
+{
+	return dstate_fd_add_events(fd,
+		((events & POLLIN) ? DSTATE_FD_READ : 0)
+		| ((events & POLLOUT) ? DSTATE_FD_WRITE : 0),
+		nut_libusb_fd_ready, NULL);
+}
+
+static void LIBUSB_CALL nut_libusb_pollfd_added(int fd, short events, void *user_data)
+{
+	NUT_UNUSED_VARIABLE(user_data);
+
+	if (nut_libusb_watch_fd(fd, events) < 0) {
+		upslog_with_errno(LOG_WARNING, "%s: can not watch libusb fd %d", __func__, fd);
+	}
+}
+
+static void LIBUSB_CALL nut_libusb_pollfd_removed(int fd, void *user_data)
+{
+	NUT_UNUSED_VARIABLE(user_data);
+
+	dstate_fd_del(fd);
+}
+#endif	/* !WIN32 */
+
+/* Hand the libusb context descriptors over to the driver main loop,
+ * once per process (the context lives as long); returns 0 on success */
+static int nut_libusb_watch_ctx(void)
+{
+#ifndef WIN32
+	const struct libusb_pollfd	**pollfds;
+	size_t	i;
+	int	ret = 0;
+
+	if (nut_usb_ctx_watched) {
+		return 0;
+	}
+
+	pollfds = libusb_get_pollfds(nut_usb_ctx);
+	if (!pollfds) {
+		upsdebugx(1, "%s: libusb can not expose its file descriptors here", __func__);
+		return -1;
+	}
+
+	for (i = 0; pollfds[i]; i++) {
+		if (nut_libusb_watch_fd(pollfds[i]->fd, pollfds[i]->events) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+
+	if (ret < 0) {
+		upsdebug_with_errno(1, "%s: can not watch libusb file descriptors", __func__);
+		for (i = 0; pollfds[i]; i++) {
+			dstate_fd_del(pollfds[i]->fd);
+		}
+	} else {
+		libusb_set_pollfd_notifiers(nut_usb_ctx,
+			nut_libusb_pollfd_added,
+			nut_libusb_pollfd_removed, NULL);
+		nut_usb_ctx_watched = true;
+		upsdebugx(2, "%s: watching %" PRIuSIZE " libusb file descriptor(s)%s",
+			__func__, i,
+			libusb_pollfds_handle_timeouts(nut_usb_ctx) ? "" : " (and timeouts at each update)");
+	}
+
+# if (defined LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000104)
+	libusb_free_pollfds(pollfds);
+# else
+	free(pollfds);
+# endif
+
+	return ret;
+#else	/* WIN32 */
+	/* NUT_WIN32_INCOMPLETE: libusb does not expose pollfds here */
+	return -1;
+#endif	/* WIN32 */
+}
+
+static void nut_libusb_hotplug_arrival(const char *source)
+{
+	upsdebugx(2, "%s: a USB device arrived (%s)%s", __func__, source,
+		nut_usb_hotplug_waiting ? ", will try to reconnect" : "");
+
+	nut_usb_hotplug_until = time(NULL) + NUT_LIBUSB_HOTPLUG_SETTLE;
+	if (nut_usb_hotplug_waiting) {
+		nut_usb_hotplug_wake = true;
+	}
+}
+
+#if (defined LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000102)
+static int LIBUSB_CALL nut_libusb_hotplug_cb(libusb_context *ctx,
+	libusb_device *device, libusb_hotplug_event event, void *user_data)
+{
+	NUT_UNUSED_VARIABLE(ctx);
+	NUT_UNUSED_VARIABLE(device);
+	NUT_UNUSED_VARIABLE(event);
+	NUT_UNUSED_VARIABLE(user_data);
+
+	/* NOTE: libusb forbids opening the device from here */
+	nut_libusb_hotplug_arrival("libusb hotplug");
+	return 0;	/* stay registered */
+}
+#endif	/* LIBUSB_API_VERSION >= 0x01000102 */
+
+#ifndef WIN32
+static int nut_libusb_uevent_ready(TYPE_FD fd, void *arg)
+{
+	int	ret;
+
+	NUT_UNUSED_VARIABLE(arg);
+
+	ret = nut_usb_uevent_read(fd);
+	if (ret > 0) {
+		nut_libusb_hotplug_arrival("kernel uevent");
+	} else if (ret < 0) {
+		upsdebug_with_errno(1, "%s: reading kernel uevents failed", __func__);
+	}
+
+	return nut_libusb_hotplug_woken();
+}
+#endif	/* !WIN32 */
+
+/* Start watching for device arrivals, after a device was opened */
+static void nut_libusb_hotplug_arm(void)
+{
+#ifndef WIN32
+	int	fd;
+#endif
+
+	nut_usb_hotplug_waiting = false;
+
+	if (nut_usb_hotplug_armed || testvar("usb_nohotplug")) {
+		return;
+	}
+
+#if (defined LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000102)
+	/* the callbacks only run when the main loop handles libusb events */
+	if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)
+	 && nut_libusb_watch_ctx() == 0
+	) {
+		int	ret = libusb_hotplug_register_callback(nut_usb_ctx,
+			LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, LIBUSB_HOTPLUG_NO_FLAGS,
+			LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+			LIBUSB_HOTPLUG_MATCH_ANY,
+			nut_libusb_hotplug_cb, NULL, NULL);
+
+		if (ret == LIBUSB_SUCCESS) {
+			upsdebugx(2, "%s: using libusb hotplug events to reconnect", __func__);
+			nut_usb_hotplug_armed = true;
+			return;
+		}
+		upsdebugx(1, "%s: libusb_hotplug_register_callback: %s",
+			__func__, libusb_strerror((enum libusb_error)ret));
+	}
+#endif	/* LIBUSB_API_VERSION >= 0x01000102 */
+
+#ifndef WIN32
+	fd = nut_usb_uevent_open();
+	if (fd >= 0) {
+		if (dstate_fd_add(fd, nut_libusb_uevent_ready, NULL) == 0) {
+			upsdebugx(2, "%s: using kernel uevents to reconnect", __func__);
+			nut_usb_hotplug_armed = true;
+			return;
+		}
+		close(fd);
+	}
+#endif	/* !WIN32 */
+
+	upsdebugx(1, "%s: device arrivals are not reported here, "
+		"reconnection attempts will scan the bus", __func__);
+}
+
+/* Returns TRUE-ish if this attempt to reopen the device can skip
+ * the bus scan, because no device arrived since the last one failed
+ * (and that one was not too long ago) */
+static int nut_libusb_hotplug_skip_scan(void)
+{
+	time_t	now = time(NULL);
+
+	return (nut_usb_hotplug_armed && nut_usb_hotplug_waiting
+		&& now > nut_usb_hotplug_until
+		&& now < nut_usb_hotplug_scanned + NUT_LIBUSB_HOTPLUG_RESCAN);
+}
+
+int nut_libusb_device_arrived(void)
+{
+	return (nut_usb_hotplug_armed && nut_usb_hotplug_waiting
+		&& time(NULL) <= nut_usb_hotplug_until);
+}
+
+static void LIBUSB_CALL nut_libusb_async_complete(struct libusb_transfer *transfer)
+{
+	int	ret;
+	nut_libusb_async_report_t	*report;
+
+	if (transfer != nut_usb_async_xfer) {
+		/* abandoned by nut_libusb_async_stop(), which left its
+		 * device handle open for it: only the transfer is ours */
+		upsdebugx(1, "%s: abandoned interrupt transfer is over, releasing it", __func__);
+		libusb_free_transfer(transfer);
+		return;
+	}
+
+	nut_usb_async_inflight = false;
+	if (nut_usb_async_stopping) {
+		return;
+	}
+
+	switch (transfer->status)
+	{
+	case LIBUSB_TRANSFER_COMPLETED:
+		if (nut_usb_async_count == NUT_LIBUSB_ASYNC_QUEUE) {
+			upsdebugx(1, "%s: report queue full, dropping the oldest one", __func__);
+			nut_usb_async_head = (nut_usb_async_head + 1) % NUT_LIBUSB_ASYNC_QUEUE;
+			nut_usb_async_count--;
+		}
+		report = &nut_usb_async_queue[(nut_usb_async_head + nut_usb_async_count) % NUT_LIBUSB_ASYNC_QUEUE];
+		report->len = transfer->actual_length;
+		memcpy(report->data, transfer->buffer, (size_t)transfer->actual_length);
+		nut_usb_async_count++;
+		break;
+
+	case LIBUSB_TRANSFER_TIMED_OUT:	/* not expected, no timeout is set */
+	case LIBUSB_TRANSFER_OVERFLOW:	/* ignored, like for synchronous reads */
+		upsdebugx(2, "%s: transfer status %d (ignored)", __func__, transfer->status);
+		break;
+
+	case LIBUSB_TRANSFER_CANCELLED:	/* closing */
+		return;
+
+	case LIBUSB_TRANSFER_STALL:
+		nut_usb_async_error = LIBUSB_ERROR_PIPE;
+		return;
+
+	case LIBUSB_TRANSFER_NO_DEVICE:
+		nut_usb_async_error = LIBUSB_ERROR_NO_DEVICE;
+		return;
+
+	case LIBUSB_TRANSFER_ERROR:
+	default:
+		nut_usb_async_error = LIBUSB_ERROR_IO;
+		return;
+	}
+
+	ret = libusb_submit_transfer(transfer);
+	if (ret != LIBUSB_SUCCESS) {
+		nut_usb_async_error = ret;
+		return;
+	}
+	nut_usb_async_inflight = true;
+}
+
+/* Submit the interrupt transfer for "udev", allocating it if needed;
+ * returns a LIBUSB_ERROR_* code */
+static int nut_libusb_async_submit(libusb_device_handle *udev, int length)
+{
+	int	ret;
+
+	if (!nut_usb_async_xfer) {
+		if (nut_libusb_watch_ctx() < 0) {
+			return LIBUSB_ERROR_NOT_SUPPORTED;
+		}
+
+		nut_usb_async_xfer = libusb_alloc_transfer(0);
+		if (!nut_usb_async_xfer) {
+			return LIBUSB_ERROR_NO_MEM;
+		}
+
+		if (length > NUT_LIBUSB_ASYNC_BUFSIZE) {
+			length = NUT_LIBUSB_ASYNC_BUFSIZE;
+		}
+
+		/* no timeout: the transfer just waits for the next report */
+		libusb_fill_interrupt_transfer(nut_usb_async_xfer, udev,
+			LIBUSB_ENDPOINT_IN + usb_subdriver.hid_ep_in,
+			nut_usb_async_buf, length,
+			nut_libusb_async_complete, NULL, 0);
+		nut_usb_async_udev = udev;
+	}
+
+	ret = libusb_submit_transfer(nut_usb_async_xfer);
+	if (ret == LIBUSB_SUCCESS) {
+		nut_usb_async_inflight = true;
+	}
+
+	return ret;
+}
+
+/* Cancel the interrupt transfer of "udev" before it is closed; returns
+ * 0 if done, or -1 if the transfer is still in flight (then the handle
+ * must be left open, see nut_libusb_async_complete()) */
+static int nut_libusb_async_stop(libusb_device_handle *udev)
+{
+	struct timeval	tv = { 0, 100000 };
+	int	i, ret = 0;
+
+	if (!nut_usb_async_xfer || udev != nut_usb_async_udev) {
+		return 0;
+	}
+
+	if (nut_usb_async_inflight) {
+		/* the callback reports the end of the transfer (usually the
+		 * cancellation, at once), and until then libusb may still
+		 * write into it; even if cancelling fails, the transfer may
+		 * be just over, with its callback due */
+		nut_usb_async_stopping = true;
+		i = libusb_cancel_transfer(nut_usb_async_xfer);
+		if (i != LIBUSB_SUCCESS) {
+			upsdebugx(1, "%s: cancelling the interrupt transfer: %s",
+				__func__, libusb_strerror((enum libusb_error)i));
+		}
+
+		for (i = 0; i < NUT_LIBUSB_ASYNC_STOP_WAIT && nut_usb_async_inflight; i++) {
+			libusb_handle_events_timeout(nut_usb_ctx, &tv);
+		}
+		nut_usb_async_stopping = false;
+	}
+
+	if (nut_usb_async_inflight) {
+		/* freeing it, or closing its device, now would let libusb
+		 * use freed memory when the transfer ends after all */
+		upslogx(LOG_WARNING, "%s: interrupt transfer was not cancelled, "
+			"leaving it and its device handle behind", __func__);
+		ret = -1;
+	} else {
+		libusb_free_transfer(nut_usb_async_xfer);
+	}
+
+#ifndef WIN32
+	if (nut_usb_async_wake_timer >= 0) {
+		dstate_timer_del(nut_usb_async_wake_timer);
+		nut_usb_async_wake_timer = -1;
+	}
+#endif	/* !WIN32 */
+
+	nut_usb_async_xfer = NULL;
+	nut_usb_async_udev = NULL;
+	nut_usb_async_inflight = false;
+	nut_usb_async_error = LIBUSB_SUCCESS;
+	nut_usb_async_head = nut_usb_async_count = 0;
+
+	return ret;
+}
+
+/* Asynchronous counterpart of the libusb_interrupt_transfer() call in
+ * nut_libusb_get_interrupt(), with the same return conventions; returns
+ * LIBUSB_ERROR_NOT_SUPPORTED if the caller should read synchronously */
+static int nut_libusb_async_get_interrupt(libusb_device_handle *udev,
+	unsigned char *buf, int *bufsize)
+{
+	struct timeval	tv = { 0, 0 };
+	nut_libusb_async_report_t	*report;
+	int	ret;
+
+	if (nut_usb_async_xfer && udev != nut_usb_async_udev) {
+		/* some other handle, not expected: keep it simple */
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	}
+
+	if (!nut_usb_async_inflight && nut_usb_async_error == LIBUSB_SUCCESS) {
+		ret = nut_libusb_async_submit(udev, *bufsize);
+		if (ret == LIBUSB_ERROR_NOT_SUPPORTED || !nut_usb_async_xfer) {
+			upsdebugx(1, "%s: falling back to synchronous interrupt reads", __func__);
+			nut_usb_async_wanted = false;
+			return LIBUSB_ERROR_NOT_SUPPORTED;
+		}
+		if (ret != LIBUSB_SUCCESS) {
+			return ret;
+		}
+	}
+
+	if (!nut_usb_async_count) {
+		/* collect whatever completed since the main loop looked */
+		libusb_handle_events_timeout(nut_usb_ctx, &tv);
+	}
+
+	if (nut_usb_async_count) {
+		report = &nut_usb_async_queue[nut_usb_async_head];
+		nut_usb_async_head = (nut_usb_async_head + 1) % NUT_LIBUSB_ASYNC_QUEUE;
+		nut_usb_async_count--;
+
+		if (report->len > *bufsize) {
+			upsdebugx(2, "%s: report of %d bytes truncated to %d",
+				__func__, report->len, *bufsize);
+		} else {
+			*bufsize = report->len;
+		}
+		memcpy(buf, report->data, (size_t)*bufsize);
+
+#ifndef WIN32
+		if (nut_usb_async_count && nut_usb_async_wake_timer < 0) {
+			nut_usb_async_wake_timer = dstate_timer_add(0, 0, nut_libusb_async_wake, NULL);
+		}
+#endif	/* !WIN32 */
+		return LIBUSB_SUCCESS;
+	}
+
+	if (nut_usb_async_error != LIBUSB_SUCCESS) {
+		/* report it once; the transfer is submitted again next time */
+		ret = nut_usb_async_error;
+		nut_usb_async_error = LIBUSB_SUCCESS;
+		return ret;
+	}
+
+	return LIBUSB_ERROR_TIMEOUT;	/* nothing happened */
+}
+
 /* Expected evaluated types for the API:
  * static int nut_libusb_get_interrupt(libusb_device_handle *udev,
  *	unsigned char *buf, int bufsize, int timeout)
@@ -1183,6 +2126,7 @@ static int nut_libusb_get_interrupt(
 	usb_ctrl_timeout_msec timeout)
 {
 	int ret, tmpbufsize;
+	st_tree_timespec_t	start;
 
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_UNSIGNED_ZERO_COMPARE) )
 # pragma GCC diagnostic push
@@ -1217,12 +2161,28 @@ static int nut_libusb_get_interrupt(
 	/* ret = libusb_interrupt_transfer(udev, 0x81, buf, bufsize, &bufsize, timeout); */
 	/* libusb0: ret = usb_interrupt_read(udev, USB_ENDPOINT_IN + usb_subdriver.hid_ep_in, (char *)buf, bufsize, timeout); */
 	/* Interrupt EP is LIBUSB_ENDPOINT_IN with offset defined in hid_ep_in, which is 0 by default, unless overridden in subdriver. */
-	ret = libusb_interrupt_transfer(udev,
-		LIBUSB_ENDPOINT_IN + usb_subdriver.hid_ep_in,
-		(unsigned char *)buf, tmpbufsize, &tmpbufsize, timeout);
+	dstate_perf_start(&start);
+	ret = LIBUSB_ERROR_NOT_SUPPORTED;
+	if (udev == NUT_LIBUSB_REPLAY_HANDLE) {
+		ret = nut_libusb_replay(NUT_USB_XFER_INTERRUPT, 0,
+			buf, tmpbufsize, &tmpbufsize, LIBUSB_ERROR_TIMEOUT);
+	} else if (nut_usb_async_wanted) {
+		ret = nut_libusb_async_get_interrupt(udev, (unsigned char *)buf, &tmpbufsize);
+	}
+	if (ret == LIBUSB_ERROR_NOT_SUPPORTED) {
+		ret = libusb_interrupt_transfer(udev,
+			LIBUSB_ENDPOINT_IN + usb_subdriver.hid_ep_in,
+			(unsigned char *)buf, tmpbufsize, &tmpbufsize, timeout);
+	}
+	/* the timeout is the normal "nothing happened" outcome here */
+	dstate_perf_since(ret == LIBUSB_SUCCESS ? "usb.interrupt" :
+		(ret == LIBUSB_ERROR_TIMEOUT ? "usb.interrupt.timeout" : "usb.interrupt.error"),
+		&start);
+	nut_libusb_record(NUT_USB_XFER_INTERRUPT, 0, ret,
+		buf, ret == LIBUSB_SUCCESS ? tmpbufsize : -1);
 
 	/* Clear stall condition */
-	if (ret == LIBUSB_ERROR_PIPE) {
+	if (ret == LIBUSB_ERROR_PIPE && udev != NUT_LIBUSB_REPLAY_HANDLE) {
 		ret = libusb_clear_halt(udev, 0x81);
 	}
 
@@ -1241,7 +2201,7 @@ static int nut_libusb_get_interrupt(
 
 static void nut_libusb_close(libusb_device_handle *udev)
 {
-	if (!udev) {
+	if (!udev || udev == NUT_LIBUSB_REPLAY_HANDLE) {
 		return;
 	}
 
@@ -1249,6 +2209,9 @@ static void nut_libusb_close(libusb_device_handle *udev)
 	 * into uninterruptible sleep.  So don't do it.
 	 */
 	/* libusb_release_interface(udev, usb_subdriver.hid_rep_index); */
+	if (nut_libusb_async_stop(udev) < 0) {
+		return;
+	}
 	libusb_close(udev);
 	/* libusb_exit() is no longer called here. The libusb context is owned
 	 * by nut_libusb_open() and released exactly once at process shutdown
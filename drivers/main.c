@@ -84,6 +84,16 @@ int	handling_upsdrv_shutdown = 0;
 /* for ser_open */
 int	do_lock_port = 1;
 
+/* for ser_get_*(): floor (msec) of the read timeouts adapted to the
+ * measured device latency, or 0 to wait as long as the driver asks */
+int	serial_adaptive_timeout = 0;
+
+/* start with the data tree saved by a previous run (see warmstart_*()) */
+static int	do_warmstart = 0;
+
+/* publish performance counters as driver.perf.* data (see dstate_perf_*()) */
+static int	do_perfvars = 0;
+
 /* for dstate->sock_connect, default to effectively
  * asynchronous (0) with fallback to synchronous (1) */
 int	do_synchronous = -1;
@@ -1219,6 +1229,27 @@ int main_setvar(const char *varname, const char *val, conn_t *conn) {
 		return STAT_SET_HANDLED;
 	}
 
+	if (!strcmp(varname, "driver.flag.perfvars")) {
+		int num = 0;
+		if (str_to_int(val, &num, 10)) {
+			if (num <= 0) {
+				num = 0;
+			} else	num = 1;
+		} else {
+			/* support certain strings */
+			if (!strncmp(val, "enable", 6)	/* "enabled" matches too */
+			 || !strcmp(val, "true")
+			 || !strcmp(val, "yes")
+			 || !strcmp(val, "on")
+			) num = 1;
+		}
+
+		upsdebugx(1, "%s: Setting %s=%d", __func__, varname, num);
+		do_perfvars = num;
+		dstate_setinfo("driver.flag.perfvars", "%d", num);
+		return STAT_SET_HANDLED;
+	}
+
 	/* By default, the driver-specific values are
 	 * unknown to shared standard handler */
 	upsdebugx(2, "shared %s() does not handle variable %s, "
@@ -1270,6 +1301,34 @@ static int main_arg(char *var, char *val)
 		return 1;	/* handled */
 	}
 
+	if (!strcmp(var, "perfvars")) {
+		if (reload_flag) {
+			upsdebugx(6, "%s: SKIP: flag var='%s' currently can not be reloaded "
+				"(but may be changed by protocol SETVAR)", __func__, var);
+		} else {
+			do_perfvars = 1;
+			dstate_setinfo("driver.flag.perfvars", "1");
+		}
+		return 1;	/* handled */
+	}
+
+	/* as a flag, with the default floor; see the valued form below */
+	if (!strcmp(var, "adaptive_timeout") && !val) {
+		serial_adaptive_timeout = 100;
+		dstate_setinfo("driver.flag.adaptive_timeout", "enabled");
+		return 1;	/* handled */
+	}
+
+	if (!strcmp(var, "warmstart")) {
+		if (reload_flag) {
+			upsdebugx(6, "%s: SKIP: flag var='%s' can not be reloaded", __func__, var);
+		} else {
+			do_warmstart = 1;
+			dstate_setinfo("driver.flag.warmstart", "enabled");
+		}
+		return 1;	/* handled */
+	}
+
 	if (!strcmp(var, "allow_killpower")) {
 		if (reload_flag) {
 			upsdebugx(6, "%s: SKIP: flag var='%s' currently can not be reloaded "
@@ -1337,6 +1396,18 @@ static int main_arg(char *var, char *val)
 		return 1;	/* handled */
 	}
 
+	if (!strcmp(var, "adaptive_timeout")) {
+		int	intval = -1;
+		if (str_to_int(val, &intval, 10) && intval >= 0) {
+			serial_adaptive_timeout = intval;
+			dstate_setinfo("driver.parameter.adaptive_timeout", "%d", intval);
+		} else {
+			upslogx(LOG_WARNING, "WARNING: UPS [%s]: invalid adaptive_timeout value: %s",
+				NUT_STRARG(upsname), val);
+		}
+		return 1;	/* handled */
+	}
+
 	if (!strcmp(var, "sddelay")) {
 		upslogx(LOG_INFO, "Obsolete value sddelay found in ups.conf");
 		return 1;	/* handled */
@@ -2010,6 +2081,69 @@ void vartab_free(void)
 }
 
 #ifndef DRIVERS_MAIN_WITHOUT_MAIN
+/* Warm-start snapshot handling: data saved by a previous run is loaded
+ * before the device is initialized (drivers may consult it to skip some
+ * discovery), and what the driver did not find out by the time the socket
+ * opens is served from it (as stale data) until the device talks to us;
+ * then whatever it did not confirm is dropped, and the snapshot is
+ * refreshed for the next start (and again upon exit). */
+static char	*warmstart_fn = NULL;
+static char	warmstart_ident[LARGEBUF];
+static int	warmstart_pending = 0, warmstart_saved = 0;
+
+static void warmstart_load(void)
+{
+	char	fnbuf[NUT_PATH_MAX + 1];
+
+	if (!do_warmstart || dump_data)
+		return;
+
+	snprintf(fnbuf, sizeof(fnbuf), "%s/%s-%s.snapshot",
+		dflt_statepath(), progname, upsname);
+	warmstart_fn = xstrdup(fnbuf);
+
+	/* device identity: a different driver version or device port
+	 * may well mean different data */
+	snprintf(warmstart_ident, sizeof(warmstart_ident), "%s %s %s %s",
+		progname, upsdrv_callbacks.upsdrv_info->version,
+		upsname, NUT_STRARG(device_path));
+
+	if (dstate_snapshot_load(warmstart_fn, warmstart_ident) >= 0)
+		warmstart_pending = 1;
+}
+
+static void warmstart_merge(void)
+{
+	if (!warmstart_pending)
+		return;
+
+	/* if the device already answered, we know better than the snapshot */
+	if (!dstate_is_stale()) {
+		dstate_snapshot_free();
+		warmstart_pending = 0;
+		return;
+	}
+
+	if (dstate_snapshot_merge() > 0)
+		upslogx(LOG_INFO, "Serving data from a state snapshot until the device responds");
+}
+
+static void warmstart_update(void)
+{
+	if (!warmstart_fn || dstate_is_stale())
+		return;
+
+	if (warmstart_pending) {
+		int	ret = dstate_snapshot_validate();
+
+		upsdebugx(1, "Data restored from state snapshot was validated by the device (%d obsolete variables removed)", ret);
+		warmstart_pending = 0;
+	}
+
+	if (dstate_snapshot_save(warmstart_fn, warmstart_ident))
+		warmstart_saved = 1;
+}
+
 static void upsdrv_setproctag(const char *tag)
 {
 	setproctag(tag);
@@ -2043,6 +2177,11 @@ static void exit_cleanup(void)
 		upsnotify(NOTIFY_STATE_STOPPING, "exit_cleanup()");
 	}
 
+	/* save what we know now (if anything worthwhile) for the next start */
+	warmstart_update();
+	free(warmstart_fn);
+	warmstart_fn = NULL;
+
 	free(chroot_path);
 	free(device_path);
 	free(user);
@@ -2381,6 +2520,8 @@ int main(int argc, char **argv)
 	struct	passwd	*new_uid = NULL;
 	int	opt_ret = 0, do_forceshutdown = 0, i;
 	int	update_count = 0;
+	st_tree_timespec_t	perf_start;
+	clock_t	perf_cpu;
 
 # ifndef WIN32
 	int	cmd = 0;
@@ -3221,8 +3362,13 @@ int main(int argc, char **argv)
 	}
 #endif
 
+	/* restore data discovered by a previous run, if asked to */
+	warmstart_load();
+
 	dstate_setinfo("driver.state", "init.device");
+	dstate_perf_start(&perf_start);
 	upsdrv_callbacks.upsdrv_initups();
+	dstate_perf_since("initups", &perf_start);
 	dstate_setinfo("driver.state", "init.quiet");
 
 	/* UPS is detected now, cleanup upon exit */
@@ -3248,7 +3394,9 @@ int main(int argc, char **argv)
 
 	/* get the base data established before allowing connections */
 	dstate_setinfo("driver.state", "init.info");
+	dstate_perf_start(&perf_start);
 	upsdrv_callbacks.upsdrv_initinfo();
+	dstate_perf_since("initinfo", &perf_start);
 
 	/* Register a way to call upsdrv_shutdown() among `sdcommands` */
 	dstate_addcmd("shutdown.default");
@@ -3261,7 +3409,9 @@ int main(int argc, char **argv)
 	/* Note: a few drivers also call their upsdrv_updateinfo() during
 	 * their upsdrv_initinfo(), possibly to impact the initialization */
 	dstate_setinfo("driver.state", "init.updateinfo");
+	dstate_perf_start(&perf_start);
 	upsdrv_callbacks.upsdrv_updateinfo();
+	dstate_perf_since("updateinfo", &perf_start);
 	dstate_setinfo("driver.state", "init.quiet");
 
 	if (dstate_getinfo("driver.flag.ignorelb")) {
@@ -3286,6 +3436,9 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* fill the gaps from a warm-start snapshot, if the device is slow */
+	warmstart_merge();
+
 	/* now we can start servicing requests */
 	/* Only write pid if we're not just dumping data, for discovery */
 	if (!dump_data) {
@@ -3463,6 +3616,11 @@ sockname_ownership_finished:
 	dstate_setflags("driver.flag.allow_killpower", ST_FLAG_RW | ST_FLAG_NUMBER);
 	dstate_addcmd("driver.killpower");
 
+	if (dstate_getinfo("driver.flag.perfvars") == NULL)
+		dstate_setinfo("driver.flag.perfvars", "0");
+
+	dstate_setflags("driver.flag.perfvars", ST_FLAG_RW | ST_FLAG_NUMBER);
+
 # ifndef WIN32
 /* TODO: Equivalent for WIN32 - see SIGCMD_RELOAD in upsd and upsmon */
 	dstate_addcmd("driver.reload");
@@ -3519,9 +3677,23 @@ sockname_ownership_finished:
 		}
 
 		dstate_setinfo("driver.state", "updateinfo");
+		dstate_perf_start(&perf_start);
+		perf_cpu = clock();
 		upsdrv_callbacks.upsdrv_updateinfo();
+		dstate_perf_since("updateinfo", &perf_start);
+		/* processor time too, which does not count waits for the device */
+		if (perf_cpu != (clock_t)-1)
+			dstate_perf_record("updateinfo.cpu", "us",
+				(double)(clock() - perf_cpu) * 1000000.0 / CLOCKS_PER_SEC);
 		dstate_setinfo("driver.state", "quiet");
 
+		if (do_perfvars)
+			dstate_perf_publish();
+
+		/* Validate and refresh the snapshot once the device responded */
+		if (warmstart_fn && !warmstart_saved)
+			warmstart_update();
+
 		/* Dump the data tree (in upsc-like format) to stdout and exit */
 		if (dump_data) {
 			/* Wait for 'dump_data' update loops to ensure data completion */
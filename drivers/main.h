@@ -17,6 +17,7 @@ extern int		broken_driver, experimental_driver,
 			do_lock_port, exit_flag, handling_upsdrv_shutdown;
 extern TYPE_FD		upsfd, extrafd;
 extern time_t		poll_interval;
+extern int		serial_adaptive_timeout;
 
 /* We allow for aliases to certain program names (e.g. when renaming a driver
  * between "old" and "new" and default implementations, it should accept both
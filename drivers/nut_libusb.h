@@ -118,4 +118,23 @@ typedef struct usb_communication_subdriver_s {
 
 extern usb_communication_subdriver_t	usb_subdriver;
 
+#if WITH_LIBUSB_1_0
+/* Keep an asynchronous transfer submitted on the interrupt pipe, so that
+ * get_interrupt() returns the reports collected meanwhile (or none) at
+ * once instead of waiting for its timeout; falls back to synchronous
+ * reads where libusb file descriptors can not be watched by main loop */
+void nut_libusb_set_async_interrupt(int enable);
+
+/* Returns TRUE-ish if a USB device arrived recently while the driver was
+ * disconnected, so that it may try to reconnect right away instead of
+ * after its usual delay (see "usb_nohotplug" driver flag) */
+int nut_libusb_device_arrived(void);
+
+/* Add the "usb_record" and "usb_replay" driver options, to capture the
+ * USB transactions with the device in a file, or to serve them back from
+ * such a file without the device (for drivers only talking to it through
+ * usb_subdriver methods) */
+void nut_libusb_capture_addvars(void);
+#endif	/* WITH_LIBUSB_1_0 */
+
 #endif /* NUT_LIBUSB_H_SEEN */
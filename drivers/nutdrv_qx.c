@@ -165,9 +165,30 @@ static int	is_usb = 0;	/* Whether the device is connected through USB (1) or ser
 #endif	/* QX_USB && QX_SERIAL */
 
 static struct {
-	char	command[SMALLBUF];	/* Command sent to the UPS to get answer/to execute an instant command */
+	size_t	command_id;	/* Command sent to the UPS to get answer (see qx_item_plan_t), 0 if none */
 	char	answer[SMALLBUF];	/* Answer from the UPS, filled at runtime */
-} previous_item = { "", "" };	/* Hold the values of the item processed just before the actual one */
+} previous_item = { 0, "" };	/* Hold the values of the item processed just before the actual one */
+
+/* Compiled form of the qx2nut table of the subdriver, built on its first
+ * use (see qx_plan_build()), with what the walk and lookups would else
+ * work out again from the strings of each item on every poll */
+#define QX_PLAN_STATUS	1	/* ups.status item */
+#define QX_PLAN_ALARM	2	/* ups.alarm item */
+#define QX_PLAN_CHARGE	4	/* battery.charge item */
+#define QX_PLAN_RUNTIME	8	/* battery.runtime item */
+#define QX_PLAN_NUMERIC	16	/* value is formatted as a number (dfl is not "%s") */
+
+typedef struct {
+	size_t	command_id;	/* Same for items with the same command (case-insensitive), 0 if none */
+	long	next_same_type;	/* Next item with the same info_type, or -1 */
+	unsigned int	kind;	/* QX_PLAN_* flags */
+} qx_item_plan_t;
+
+static item_t	*qx_plan_table = NULL;	/* the qx2nut this plan is for */
+static qx_item_plan_t	*qx_plan = NULL;	/* same positions as in qx2nut */
+static size_t	qx_plan_count = 0;
+static long	*qx_plan_index = NULL;	/* hash index of first item by info_type */
+static size_t	qx_plan_index_size = 0;	/* a power of 2 */
 
 
 /* == Support functions == */
@@ -178,6 +199,8 @@ static bool_t	qx_ups_walk(walkmode_t mode);
 static void	ups_status_set(void);
 static void	ups_alarm_set(void);
 static void	qx_set_var(item_t *item);
+static qx_item_plan_t	*qx_item_plan(const item_t *item);
+static void	qx_plan_free(void);
 
 
 /* == Struct & data for status processing == */
@@ -4023,6 +4046,8 @@ void	upsdrv_cleanup(void)
 
 #endif	/* TESTING */
 
+	qx_plan_free();
+
 	upsdebugx(1, "%s finished", __func__);
 }
 
@@ -4317,19 +4342,146 @@ void	update_status(const char *value)
 		__func__, value);
 }
 
+/* Kind of device (and, for USB, its VID:PID) for the protocol hint in
+ * the warm-start snapshot (whose file is already specific to the driver
+ * and port): a cheap check before anything is sent to the device */
+static const char	*subdriver_hint_ident(void)
+{
+#if defined(QX_USB) && !defined(TESTING)
+	static char	ident[SMALLBUF];
+
+# ifdef QX_SERIAL
+	if (is_usb)
+# endif	/* QX_SERIAL */
+	{
+		snprintf(ident, sizeof(ident), "usb %04x:%04x",
+			usbdevice.VendorID, usbdevice.ProductID);
+		return ident;
+	}
+#endif	/* QX_USB && !TESTING */
+
+	return "serial";
+}
+
+/* Once the protocol found last time claimed the device, read the
+ * identity of the device (device.mfr, device.model) with it and compare
+ * it with the one saved in the warm-start snapshot.
+ * Return 1 if at least one of them could be read and all those read
+ * match, 0 otherwise (and then forget what was read) */
+static int	subdriver_hint_check(void)
+{
+	static const char	*ident_vars[] = { "device.mfr", "device.model", NULL };
+	const unsigned long	noflag = QX_FLAG_SKIP | QX_FLAG_ABSENT | QX_FLAG_CMD | QX_FLAG_SETVAR | QX_FLAG_NONUT;
+	int	i, matched = 0;
+
+	for (i = 0; ident_vars[i] != NULL; i++) {
+
+		item_t		*item = find_nut_info(ident_vars[i], 0, noflag);
+		const char	*was = dstate_snapshot_getinfo(ident_vars[i]), *now;
+		int		ret;
+
+		if (!item)
+			continue;
+
+		ret = qx_process(item, NULL);
+		if (!ret)
+			ret = (ups_infoval_set(item) == 1) ? 0 : -1;
+
+		/* Clear data from the item */
+		memset(item->answer, 0, sizeof(item->answer));
+		memset(item->value, 0, sizeof(item->value));
+
+		if (ret)
+			continue;
+
+		now = dstate_getinfo(ident_vars[i]);
+		upsdebugx(2, "%s: %s is '%s', was '%s'", __func__,
+			ident_vars[i], NUT_STRARG(now), NUT_STRARG(was));
+
+		if (!now || !was || strcmp(now, was)) {
+			matched = 0;
+			break;
+		}
+
+		matched++;
+	}
+
+	if (matched)
+		return 1;
+
+	for (i = 0; ident_vars[i] != NULL; i++)
+		dstate_delinfo(ident_vars[i]);
+
+	return 0;
+}
+
+/* Try first the protocol which the device spoke last time, if known
+ * from the warm-start snapshot: one claim() of it instead of probing
+ * for every protocol in turn (with their timeouts).
+ * If it was tried in vain, "tried" points to it afterwards */
+static int	subdriver_matcher_hint(subdriver_t **tried)
+{
+	const char	*hint = dstate_snapshot_gethint("nutdrv_qx.protocol");
+	const char	*hint_ident = dstate_snapshot_gethint("nutdrv_qx.device");
+	int		i;
+
+	if (!hint || !hint_ident || strcmp(hint_ident, subdriver_hint_ident()))
+		return 0;
+
+	for (i = 0; subdriver_list[i] != NULL; i++) {
+
+		if (strcmp(subdriver_list[i]->name, hint))
+			continue;
+
+		subdriver = subdriver_list[i];
+		*tried = subdriver;
+
+		upsdebugx(2, "%s: Trying protocol %s, as found last time...", __func__, subdriver->name);
+		if (!subdriver->claim()) {
+			upsdebugx(1, "%s: Protocol %s found last time did not claim the device, probing all of them",
+				__func__, subdriver->name);
+		} else if (!subdriver_hint_check()) {
+			upsdebugx(1, "%s: Protocol %s claimed a device other than the one found last time, probing all of them",
+				__func__, subdriver->name);
+		} else {
+			upsdebugx(1, "%s: Trying protocol %s: claim succeeded", __func__, subdriver->name);
+			return 1;
+		}
+
+		subdriver = NULL;
+		break;
+	}
+
+	return 0;
+}
+
 /* Choose subdriver */
 static int	subdriver_matcher(void)
 {
 	const char	*protocol = getval("protocol");
+	subdriver_t	*hint_tried = NULL;
 	int		i;
 
 	upsdebugx(2, "%s...", __func__);
 
+	subdriver = NULL;
+
+	/* Unless told which protocol to use, first try the one used last time */
+	if (!protocol)
+		subdriver_matcher_hint(&hint_tried);
+
 	/* Select the subdriver for this device */
-	for (i = 0; subdriver_list[i] != NULL; i++) {
+	for (i = 0; subdriver == NULL && subdriver_list[i] != NULL; i++) {
 
 		int	j;
 
+		/* Already tried (and refused) above */
+		if (subdriver_list[i] == hint_tried) {
+			upsdebugx(2, "Skipping protocol %s, already tried",
+				subdriver_list[i]->name);
+			continue;
+		}
+
 		/* If protocol is set in ups.conf, use it */
 		if (protocol) {
 
@@ -4377,6 +4529,13 @@ static int	subdriver_matcher(void)
 
 	upslogx(LOG_INFO, "Using protocol: %s", subdriver->name);
 
+	/* Remember it for the next start (if warm-start snapshots are used) */
+	dstate_snapshot_sethint("nutdrv_qx.protocol", subdriver->name);
+	dstate_snapshot_sethint("nutdrv_qx.device", subdriver_hint_ident());
+
+	/* Compile its mapping table now (if the claim did not already) */
+	qx_item_plan(subdriver->qx2nut);
+
 	upsdebugx(2, "%s finished", __func__);
 
 	return 1;
@@ -4499,7 +4658,7 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 	}
 
 	/* Clear data from previous_item */
-	memset(previous_item.command, 0, sizeof(previous_item.command));
+	previous_item.command_id = 0;
 	memset(previous_item.answer, 0, sizeof(previous_item.answer));
 
 	/* 3 modes: QX_WALKMODE_INIT, QX_WALKMODE_QUICK_UPDATE
@@ -4508,10 +4667,14 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 	/* Device data walk */
 	for (item = subdriver->qx2nut; item->info_type != NULL; item++) {
 
+		qx_item_plan_t	*plan;
+
 		/* Skip this item */
 		if (item->qxflags & QX_FLAG_SKIP)
 			continue;
 
+		plan = qx_item_plan(item);
+
 		upsdebugx(10, "%s: processing: %s", __func__, item->info_type);
 
 		/* Filter data according to mode */
@@ -4536,9 +4699,7 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 			}
 
 			/* Allow duplicates for these NUT variables */
-			if (!strncmp(item->info_type, "ups.alarm", 9)
-			||  !strncmp(item->info_type, "ups.status", 10)
-			) {
+			if (plan->kind & (QX_PLAN_ALARM | QX_PLAN_STATUS)) {
 				break;
 			}
 
@@ -4621,9 +4782,9 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 
 		/* Check whether the previous item uses the same command
 		 * and then use its answer, if available.. */
-		if (strlen(previous_item.command) > 0
-		&&  strlen(previous_item.answer) > 0
-		&&  !strcasecmp(previous_item.command, item->command)
+		if (previous_item.command_id != 0
+		&&  previous_item.answer[0] != '\0'
+		&&  previous_item.command_id == plan->command_id
 		) {
 
 			snprintf(item->answer, sizeof(item->answer), "%s",
@@ -4641,8 +4802,7 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 		}
 
 		/* Record item as previous_item */
-		snprintf(previous_item.command, sizeof(previous_item.command), "%s",
-			item->command);
+		previous_item.command_id = plan->command_id;
 		snprintf(previous_item.answer, sizeof(previous_item.answer), "%s",
 			item->answer);
 
@@ -4836,15 +4996,154 @@ static void	ups_status_set(void)
 	}
 }
 
+static size_t	qx_plan_hash(const char *type)
+{
+	size_t	hash = 5381;
+
+	for (; *type != '\0'; type++)
+		hash = hash * 33 + (size_t)tolower((unsigned char)*type);
+
+	return hash;
+}
+
+static void	qx_plan_free(void)
+{
+	free(qx_plan);
+	free(qx_plan_index);
+	qx_plan = NULL;
+	qx_plan_index = NULL;
+	qx_plan_index_size = 0;
+	qx_plan_count = 0;
+	qx_plan_table = NULL;
+}
+
+/* QX_PLAN_* flags of an item */
+static unsigned int	qx_plan_kind(const item_t *item)
+{
+	unsigned int	kind = 0;
+
+	if (!strncmp(item->info_type, "ups.status", 10))
+		kind |= QX_PLAN_STATUS;
+	else if (!strncmp(item->info_type, "ups.alarm", 9))
+		kind |= QX_PLAN_ALARM;
+	else if (!strcasecmp(item->info_type, "battery.charge"))
+		kind |= QX_PLAN_CHARGE;
+	else if (!strcasecmp(item->info_type, "battery.runtime"))
+		kind |= QX_PLAN_RUNTIME;
+
+	if (item->dfl != NULL && strcasecmp(item->dfl, "%s"))
+		kind |= QX_PLAN_NUMERIC;
+
+	return kind;
+}
+
+/* Compile the qx2nut table of the current subdriver (see qx_item_plan_t) */
+static void	qx_plan_build(void)
+{
+	item_t	*table = subdriver->qx2nut;
+	size_t	count = 0, commands = 0, i, j, k, mask;
+	long	*last;
+
+	qx_plan_free();
+
+	for (i = 0; table[i].info_type != NULL; i++)
+		count++;
+
+	for (qx_plan_index_size = 16; qx_plan_index_size < count * 2; qx_plan_index_size *= 2)
+		;
+	mask = qx_plan_index_size - 1;
+
+	qx_plan = (qx_item_plan_t *)xcalloc(count + 1, sizeof(*qx_plan));
+	qx_plan_index = (long *)xcalloc(qx_plan_index_size, sizeof(*qx_plan_index));
+	/* last item seen with the info_type of each index slot */
+	last = (long *)xcalloc(qx_plan_index_size, sizeof(*last));
+	for (k = 0; k < qx_plan_index_size; k++)
+		qx_plan_index[k] = -1;
+
+	for (i = 0; i < count; i++) {
+		item_t	*item = &table[i];
+		qx_item_plan_t	*plan = &qx_plan[i];
+
+		/* Number the distinct commands */
+		if (item->command != NULL) {
+			for (j = 0; j < i; j++) {
+				if (table[j].command != NULL
+				&&  !strcasecmp(table[j].command, item->command)
+				) {
+					break;
+				}
+			}
+			plan->command_id = (j < i) ? qx_plan[j].command_id : ++commands;
+		}
+
+		plan->kind = qx_plan_kind(item);
+
+		/* Chain the items of same info_type, in table order */
+		plan->next_same_type = -1;
+		for (k = qx_plan_hash(item->info_type) & mask;
+			qx_plan_index[k] != -1;
+			k = (k + 1) & mask
+		) {
+			if (!strcasecmp(table[qx_plan_index[k]].info_type, item->info_type))
+				break;
+		}
+
+		if (qx_plan_index[k] == -1)
+			qx_plan_index[k] = (long)i;
+		else
+			qx_plan[last[k]].next_same_type = (long)i;
+		last[k] = (long)i;
+	}
+
+	free(last);
+	qx_plan_count = count;
+	qx_plan_table = table;
+
+	upsdebugx(3, "%s: %s: %" PRIuSIZE " items, %" PRIuSIZE " distinct commands",
+		__func__, subdriver->name, count, commands);
+}
+
+/* Plan of this item of the current subdriver's qx2nut (compiling it if
+ * needed); an item out of the table gets a plan of its own, valid until
+ * the next call, which shares no command with other items */
+static qx_item_plan_t	*qx_item_plan(const item_t *item)
+{
+	static qx_item_plan_t	other;
+
+	if (qx_plan_table != subdriver->qx2nut)
+		qx_plan_build();
+
+	if (item < qx_plan_table || (size_t)(item - qx_plan_table) >= qx_plan_count) {
+		other.command_id = 0;
+		other.next_same_type = -1;
+		other.kind = item->info_type ? qx_plan_kind(item) : 0;
+		return &other;
+	}
+
+	return &qx_plan[item - qx_plan_table];
+}
+
 /* See header file for details. */
 item_t	*find_nut_info(const char *varname, const unsigned long flag, const unsigned long noflag)
 {
 	item_t	*item;
+	long	i = -1;
+	size_t	k, mask;
 
-	for (item = subdriver->qx2nut; item->info_type != NULL; item++) {
+	qx_item_plan(subdriver->qx2nut);
+	mask = qx_plan_index_size - 1;
 
-		if (strcasecmp(item->info_type, varname))
-			continue;
+	for (k = qx_plan_hash(varname) & mask; qx_plan_index[k] != -1; k = (k + 1) & mask) {
+		if (!strcasecmp(qx_plan_table[qx_plan_index[k]].info_type, varname)) {
+			i = qx_plan_index[k];
+			break;
+		}
+	}
+
+	/* Go through the items of that info_type, in table order */
+	for (; i != -1; i = qx_plan[i].next_same_type) {
+
+		item = &qx_plan_table[i];
 
 		if (flag && ((item->qxflags & flag) != flag))
 			continue;
@@ -4929,7 +5228,7 @@ static int	qx_process_answer(item_t *item, const size_t len)
 /* See header file for details. */
 int	qx_process(item_t *item, const char *command)
 {
-	char	buf[sizeof(item->answer) - 1] = "", *cmd;
+	char	buf[sizeof(item->answer) - 1] = "", cmdbuf[SMALLBUF], *cmd = cmdbuf;
 	ssize_t	len;
 	size_t	cmdlen = command ?
 		(strlen(command) >= SMALLBUF ? strlen(command) + 1 : SMALLBUF) :
@@ -4937,7 +5236,8 @@ int	qx_process(item_t *item, const char *command)
 	size_t	cmdsz = (sizeof(char) * cmdlen); /* in bytes, to be pedantic */
 	int	cmd_len;
 
-	if ( !(cmd = (char *)xmalloc(cmdsz)) ) {
+	/* Only unusually long commands need a buffer of their own */
+	if (cmdsz > sizeof(cmdbuf) && !(cmd = (char *)xmalloc(cmdsz)) ) {
 		upslogx(LOG_ERR, "qx_process() failed to allocate buffer");
 		return -1;
 	}
@@ -4957,7 +5257,8 @@ int	qx_process(item_t *item, const char *command)
 	) {
 		upsdebugx(4, "%s: failed to preprocess command [%s]",
 			__func__, item->info_type);
-		free (cmd);
+		if (cmd != cmdbuf)
+			free(cmd);
 		return -1;
 	}
 
@@ -4969,7 +5270,8 @@ int	qx_process(item_t *item, const char *command)
 	if (len < 0 || len > INT_MAX) {
 		upsdebugx(4, "%s: failed to preprocess answer [%s]",
 			__func__, item->info_type);
-		free (cmd);
+		if (cmd != cmdbuf)
+			free(cmd);
 		return -1;
 	}
 
@@ -4984,12 +5286,14 @@ int	qx_process(item_t *item, const char *command)
 			/* Clear the failed answer, preventing it from
 			 * being reused by next items with same command */
 			memset(item->answer, 0, sizeof(item->answer));
-			free (cmd);
+			if (cmd != cmdbuf)
+				free(cmd);
 			return -1;
 		}
 	}
 
-	free (cmd);
+	if (cmd != cmdbuf)
+		free(cmd);
 
 	/* Process the answer to get the value */
 	return qx_process_answer(item, (size_t)len);
@@ -4999,6 +5303,7 @@ int	qx_process(item_t *item, const char *command)
 int	ups_infoval_set(item_t *item)
 {
 	char	value[SMALLBUF] = "";
+	const qx_item_plan_t	*plan = qx_item_plan(item);
 
 	/* Item need to be preprocessed? */
 	if (item->preprocess != NULL){
@@ -5011,14 +5316,14 @@ int	ups_infoval_set(item_t *item)
 		}
 
 		/* Deal with status items */
-		if (!strncmp(item->info_type, "ups.status", 10)) {
+		if (plan->kind & QX_PLAN_STATUS) {
 			if (strlen(value) > 0)
 				update_status(value);
 			return 0;
 		}
 
 		/* Deal with alarm items */
-		if (!strncmp(item->info_type, "ups.alarm", 9)) {
+		if (plan->kind & QX_PLAN_ALARM) {
 			if (strlen(value) > 0)
 				alarm_set(value);
 			return 0;
@@ -5033,7 +5338,7 @@ int	ups_infoval_set(item_t *item)
 		if (item->qxflags & QX_FLAG_TRIM)
 			str_trim_m(value, "# ");
 
-		if (strcasecmp(item->dfl, "%s")) {
+		if (plan->kind & QX_PLAN_NUMERIC) {
 
 			if (strspn(value, "0123456789 .") != strlen(value)) {
 				upsdebugx(2, "%s: non numerical value [%s: %s]",
@@ -5062,9 +5367,9 @@ int	ups_infoval_set(item_t *item)
 	dstate_setinfo(item->info_type, "%s", value);
 
 	/* Fill batt.{chrg,runt}.act for guesstimation */
-	if (!strcasecmp(item->info_type, "battery.charge"))
+	if (plan->kind & QX_PLAN_CHARGE)
 		batt.chrg.act = strtol(value, NULL, 10);
-	else if (!strcasecmp(item->info_type, "battery.runtime"))
+	else if (plan->kind & QX_PLAN_RUNTIME)
 		batt.runt.act = strtol(value, NULL, 10);
 
 	return 1;
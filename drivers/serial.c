@@ -44,6 +44,8 @@
 static void ser_open_error(const char *port)
 	__attribute__((noreturn));
 
+static void ser_latency_free(void);
+
 static void ser_open_error(const char *port)
 {
 	struct	stat	fs;
@@ -325,6 +327,8 @@ int ser_close(TYPE_FD_SER fd, const char *port)
 #endif	/* WIN32 */
 	}
 
+	ser_latency_free();
+
 	if (close(fd) != 0)
 		return -1;
 
@@ -336,6 +340,203 @@ int ser_close(TYPE_FD_SER fd, const char *port)
 	return 0;
 }
 
+/* account the time spent on a read (separately for timeouts and errors,
+ * to tell a slow device from a silent one) */
+static ssize_t ser_perf_read(ssize_t ret, const st_tree_timespec_t *start)
+{
+	dstate_perf_since(ret > 0 ? "serial.read" :
+		(ret == 0 ? "serial.read.timeout" : "serial.read.error"), start);
+
+	return ret;
+}
+
+/* Adaptive read timeouts (see the "adaptive_timeout" driver option):
+ * the time from sending a command to the first byte of its reply is
+ * tracked per command, as a smoothed average and mean deviation (like
+ * TCP does for its retransmission timer), and the wait for the reply is
+ * cut from the caller's timeout down to the average plus four deviations,
+ * but not below the configured floor.  A wait cut short is not repeated
+ * for that command until its reply comes in again, so a device which got
+ * slower gets the full timeout and its new latency is learned.
+ */
+#define SER_LATENCY_SLOTS	32	/* commands tracked, a power of two */
+#define SER_LATENCY_SAMPLES	4	/* replies to see before adapting */
+
+typedef struct {
+	unsigned long	hash;
+	size_t	cmdlen;			/* 0 for an unused slot */
+	unsigned char	*cmd;		/* the bytes sent, compared on lookup */
+	char	*name;			/* printable, for the debug log */
+	double	srtt, rttvar;		/* usec */
+	unsigned long	samples;
+	int	backoff;
+} ser_latency_t;
+
+static ser_latency_t	ser_latency[SER_LATENCY_SLOTS];
+static size_t	ser_latency_count = 0;
+
+/* the command last sent, and when, until the first byte of its reply */
+static ser_latency_t	*ser_pending = NULL;
+static st_tree_timespec_t	ser_pending_sent;
+
+/* find (or add) the statistics slot for a command just sent */
+static ser_latency_t *ser_latency_find(const unsigned char *cmd, size_t cmdlen)
+{
+	unsigned long	hash = 5381;
+	size_t	i, slot;
+
+	for (i = 0; i < cmdlen; i++)
+		hash = ((hash << 5) + hash) + cmd[i];
+
+	for (i = 0, slot = hash & (SER_LATENCY_SLOTS - 1); i < SER_LATENCY_SLOTS;
+		i++, slot = (slot + 1) & (SER_LATENCY_SLOTS - 1)
+	) {
+		ser_latency_t	*lat = &ser_latency[slot];
+		char	name[SMALLBUF];
+		size_t	len, namelen;
+
+		if (lat->cmdlen) {
+			if (lat->hash == hash && lat->cmdlen == cmdlen
+			 && !memcmp(lat->cmd, cmd, cmdlen))
+				return lat;
+			continue;
+		}
+
+		/* keep one slot free, so that lookups of new commands end */
+		if (ser_latency_count >= SER_LATENCY_SLOTS - 1)
+			return NULL;
+
+		lat->hash = hash;
+		lat->cmdlen = cmdlen;
+		lat->cmd = (unsigned char *)xcalloc(1, cmdlen);
+		memcpy(lat->cmd, cmd, cmdlen);
+
+		/* name it for the log: printable characters as is, others
+		 * in hex, dropping the usual line terminators */
+		len = cmdlen;
+		while (len > 1 && (cmd[len - 1] == '\r' || cmd[len - 1] == '\n'))
+			len--;
+		for (i = 0, namelen = 0; i < len && namelen < sizeof(name) - 4; i++) {
+			if (isgraph(cmd[i]) && cmd[i] != '\\')
+				name[namelen++] = (char)cmd[i];
+			else
+				namelen += (size_t)snprintf(name + namelen, 5, "\\x%02x", cmd[i]);
+		}
+		name[namelen] = '\0';
+		lat->name = xstrdup(name);
+
+		ser_latency_count++;
+		return lat;
+	}
+
+	return NULL;
+}
+
+/* a command was sent, its reply is expected */
+static void ser_latency_sent(const void *cmd, size_t cmdlen)
+{
+	if (serial_adaptive_timeout <= 0 || cmdlen == 0) {
+		ser_pending = NULL;
+		return;
+	}
+
+	ser_pending = ser_latency_find((const unsigned char *)cmd, cmdlen);
+	dstate_perf_start(&ser_pending_sent);
+}
+
+/* adapt the wait for the first chunk of a reply; returns 1 if the wait
+ * was cut from what the caller asked, 0 if it stays as is */
+static int ser_latency_deadline(time_t *d_sec, useconds_t *d_usec)
+{
+	ser_latency_t	*lat = ser_pending;
+	double	ceiling, floor_usec, deadline;
+
+	if (!lat || lat->samples < SER_LATENCY_SAMPLES || lat->backoff)
+		return 0;
+
+	ceiling = (double)*d_sec * 1000000.0 + (double)*d_usec;
+	floor_usec = (double)serial_adaptive_timeout * 1000.0;
+	if (ceiling <= floor_usec)
+		return 0;
+
+	/* the latency counts from the send, so deduct the time since */
+	deadline = lat->srtt + 4 * lat->rttvar - dstate_perf_elapsed(&ser_pending_sent);
+	if (deadline < floor_usec)
+		deadline = floor_usec;
+	if (deadline >= ceiling)
+		return 0;
+
+	upsdebugx(5, "%s: %s: waiting %.0f instead of %.0f usec (average %.0f, deviation %.0f)",
+		__func__, lat->name, deadline, ceiling, lat->srtt, lat->rttvar);
+	dstate_perf_record("serial.deadline", "us", deadline);
+
+	*d_sec = (time_t)(deadline / 1000000.0);
+	*d_usec = (useconds_t)(deadline - (double)*d_sec * 1000000.0);
+	return 1;
+}
+
+/* account the outcome of the first read for a reply */
+static void ser_latency_read(ssize_t ret, int cut)
+{
+	ser_latency_t	*lat = ser_pending;
+	double	sample;
+
+	if (!lat)
+		return;
+
+	if (ret == 0) {
+		/* no reply (yet): wait in full if the caller tries again,
+		 * and until the reply to this command is seen */
+		if (cut) {
+			upsdebugx(4, "%s: %s: no reply within the adapted timeout",
+				__func__, lat->name);
+			dstate_perf_record("serial.read.timeout.early", "", 1);
+			lat->backoff = 1;
+		}
+		return;
+	}
+
+	ser_pending = NULL;
+	if (ret < 0)
+		return;
+
+	sample = dstate_perf_elapsed(&ser_pending_sent);
+	dstate_perf_record("serial.latency", "us", sample);
+
+	if (lat->samples++ == 0) {
+		lat->srtt = sample;
+		lat->rttvar = sample / 2;
+	} else {
+		double	err = sample - lat->srtt;
+
+		lat->srtt += err / 8;
+		lat->rttvar += ((err < 0 ? -err : err) - lat->rttvar) / 4;
+	}
+	lat->backoff = 0;
+}
+
+/* report (at debug level 2) what was learned, and forget it */
+static void ser_latency_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < SER_LATENCY_SLOTS; i++) {
+		ser_latency_t	*lat = &ser_latency[i];
+
+		if (!lat->cmdlen)
+			continue;
+
+		upsdebugx(2, "%s: %s: %lu replies, average %.0f usec, deviation %.0f usec",
+			__func__, lat->name, lat->samples, lat->srtt, lat->rttvar);
+		free(lat->cmd);
+		free(lat->name);
+	}
+
+	memset(ser_latency, 0, sizeof(ser_latency));
+	ser_latency_count = 0;
+	ser_pending = NULL;
+}
+
 ssize_t ser_send_char(TYPE_FD_SER fd, unsigned char ch)
 {
 	return ser_send_buf_pace(fd, 0, &ch, 1);
@@ -449,36 +650,60 @@ ssize_t ser_send_buf_pace(TYPE_FD_SER fd, useconds_t d_usec, const void *buf,
 	ssize_t	ret = 0;
 	ssize_t	sent;
 	const char	*data = (const char *)buf;
+	st_tree_timespec_t	start;
 
 	assert(buflen < SSIZE_MAX);
+	dstate_perf_start(&start);
 	for (sent = 0; sent < (ssize_t)buflen; sent += ret) {
 		/* Conditions above ensure that (buflen - sent) > 0 below */
 		ret = write(fd, &data[sent], (d_usec == 0) ? (size_t)((ssize_t)buflen - sent) : 1);
 
 		if (ret < 1) {
+			dstate_perf_since("serial.write.error", &start);
 			return ret;
 		}
 
 		usleep(d_usec);
 	}
 
+	dstate_perf_since("serial.write", &start);
+	ser_latency_sent(buf, buflen);
 	return sent;
 }
 
 ssize_t ser_get_char(TYPE_FD_SER fd, void *ch, time_t d_sec, useconds_t d_usec)
 {
+	ssize_t	ret;
+	int	cut;
+	st_tree_timespec_t	start;
+
+	dstate_perf_start(&start);
+	cut = ser_latency_deadline(&d_sec, &d_usec);
+
 	/* Per standard below, we can cast here, because required ranges are
 	 * effectively the same (and signed -1 for suseconds_t), and at most long:
 	 * https://pubs.opengroup.org/onlinepubs/009604599/basedefs/sys/types.h.html
 	 */
-	return select_read(fd, ch, 1, d_sec, (suseconds_t)d_usec);
+	ret = select_read(fd, ch, 1, d_sec, (suseconds_t)d_usec);
+	ser_latency_read(ret, cut);
+
+	return ser_perf_read(ret, &start);
 }
 
 ssize_t ser_get_buf(TYPE_FD_SER fd, void *buf, size_t buflen, time_t d_sec, useconds_t d_usec)
 {
+	ssize_t	ret;
+	int	cut;
+	st_tree_timespec_t	start;
+
 	memset(buf, '\0', buflen);
+	dstate_perf_start(&start);
+	cut = ser_latency_deadline(&d_sec, &d_usec);
 
-	return select_read(fd, buf, buflen, d_sec, (suseconds_t)d_usec);
+	ret = select_read(fd, buf, buflen, d_sec, (suseconds_t)d_usec);
+	ser_latency_read(ret, cut);
+
+	return ser_perf_read(ret, &start);
 }
 
 /* keep reading until buflen bytes are received or a timeout occurs */
@@ -487,22 +712,29 @@ ssize_t ser_get_buf_len(TYPE_FD_SER fd, void *buf, size_t buflen, time_t d_sec,
 	ssize_t	ret;
 	ssize_t	recv;
 	char	*data = (char *)buf;
+	st_tree_timespec_t	start;
 
 	assert(buflen < SSIZE_MAX);
 	memset(buf, '\0', buflen);
+	dstate_perf_start(&start);
 
 	for (recv = 0; recv < (ssize_t)buflen; recv += ret) {
+		/* only the wait for the reply to start is adapted */
+		time_t	wait_sec = d_sec;
+		useconds_t	wait_usec = d_usec;
+		int	cut = ser_latency_deadline(&wait_sec, &wait_usec);
 
 		ret = select_read(fd, &data[recv],
 			(size_t)((ssize_t)buflen - recv),
-			d_sec, (suseconds_t)d_usec);
+			wait_sec, (suseconds_t)wait_usec);
+		ser_latency_read(ret, cut);
 
 		if (ret < 1) {
-			return ret;
+			return ser_perf_read(ret, &start);
 		}
 	}
 
-	return recv;
+	return ser_perf_read(recv, &start);
 }
 
 /* reads a line up to <endchar>, discarding anything else that may follow,
@@ -515,22 +747,31 @@ ssize_t ser_get_line_alert(TYPE_FD_SER fd, void *buf, size_t buflen, char endcha
 	char	tmp[64];
 	char	*data = (char *)buf;
 	ssize_t	count = 0, maxcount;
+	st_tree_timespec_t	start;
 
 	assert(buflen < SSIZE_MAX && buflen > 0);
 	memset(buf, '\0', buflen);
+	dstate_perf_start(&start);
 
 	maxcount = (ssize_t)buflen - 1;		/* for trailing \0 */
 
 	while (count < maxcount) {
-		ret = select_read(fd, tmp, sizeof(tmp), d_sec, (suseconds_t)d_usec);
+		/* only the wait for the reply to start is adapted */
+		time_t	wait_sec = d_sec;
+		useconds_t	wait_usec = d_usec;
+		int	cut = ser_latency_deadline(&wait_sec, &wait_usec);
+
+		ret = select_read(fd, tmp, sizeof(tmp), wait_sec, (suseconds_t)wait_usec);
+		ser_latency_read(ret, cut);
 
 		if (ret < 1) {
-			return ret;
+			return ser_perf_read(ret, &start);
 		}
 
 		for (i = 0; i < ret; i++) {
 
 			if ((count == maxcount) || (tmp[i] == endchar)) {
+				dstate_perf_since("serial.read", &start);
 				return count;
 			}
 
@@ -548,6 +789,7 @@ ssize_t ser_get_line_alert(TYPE_FD_SER fd, void *buf, size_t buflen, char endcha
 		}
 	}
 
+	dstate_perf_since("serial.read", &start);
 	return count;
 }
 
@@ -148,6 +148,32 @@ int g_pwr_battery;
 int pollfreq; /* polling frequency */
 int semistaticfreq; /* semistatic entry update frequency */
 static int semistatic_countdown = 0;
+/* maximum varbinds per GET request; lowered if the agent says tooBig */
+static int max_varbinds = DEFAULT_MAXVARBINDS;
+/* maximum GET requests in flight at once */
+static int max_requests = DEFAULT_MAXREQUESTS;
+
+/* SNMP trap/inform listener (trap_listen), and what the traps received
+ * since the last update pointed at */
+static struct snmp_session	*trap_sess_p = NULL;
+static int	trap_sock = -1;
+static const char	*trap_community = NULL;
+static bool_t	trap_pending = FALSE;
+static bool_t	trap_all = FALSE;	/* too many OIDs: do a full update */
+static char	*trap_OIDs[SU_TRAP_MAXOIDS];
+static size_t	trap_OIDs_count = 0;
+static time_t	trap_lastupdate = 0;	/* traps coming sooner are coalesced */
+#ifndef WIN32
+static long	trap_timer = -1;
+#endif
+/* set while snmp_ups_walk() only re-reads what the traps pointed at */
+static bool_t	walk_targeted = FALSE;
+
+/* SNMPv3 key cache (snmp_keycache) */
+static bool_t	v3cache_enabled = FALSE;
+static bool_t	v3cache_loaded = FALSE;
+static char	v3cache_fn[NUT_PATH_MAX + 1];
+static char	v3cache_ident[LARGEBUF];
 
 static int quirk_symmetra_threephase = 0;
 
@@ -179,7 +205,7 @@ static const char *mibname;
 static const char *mibvers;
 
 #define DRIVER_NAME	"Generic SNMP UPS driver"
-#define DRIVER_VERSION	"1.40"
+#define DRIVER_VERSION	"1.47"
 
 /* driver description structure */
 upsdrv_info_t	upsdrv_info = {
@@ -220,6 +246,12 @@ static int device_template_offset = -1;
 
 /* Forward functions declarations */
 static void disable_transfer_oids(void);
+static void su_prefetch_free(void);
+static void su_lookup_free(void);
+static void su_trap_init(void);
+static void su_trap_free(void);
+static bool_t su_trap_target(const snmp_info_t *su_info_p);
+static bool_t su_trap_due(void);
 bool_t get_and_process_data(int mode, snmp_info_t *su_info_p);
 int extract_template_number(snmp_info_flags_t template_type, const char* varname);
 snmp_info_flags_t get_template_type(const char* varname);
@@ -448,9 +480,20 @@ void upsdrv_updateinfo(void)
 {
 	upsdebugx(1,"SNMP UPS driver: entering %s()", __func__);
 
-	/* only update every pollfreq */
+	/* only update every pollfreq, or re-read what traps told about */
 	/* FIXME: only update status (SU_STATUS_*), à la usbhid-ups, in between */
-	if (time(NULL) > (lastpoll + pollfreq)) {
+	if (time(NULL) > (lastpoll + pollfreq) || su_trap_due() == TRUE) {
+		bool_t	full_update = (time(NULL) > (lastpoll + pollfreq) || trap_all == TRUE);
+		/* traps coming during the walk are for the next update */
+		size_t	traps_handled = trap_OIDs_count, i;
+
+		trap_pending = FALSE;
+		trap_all = FALSE;
+		if (full_update == FALSE) {
+			upsdebugx(1, "%s: trap received, refreshing the related data", __func__);
+			walk_targeted = TRUE;
+			trap_lastupdate = time(NULL);
+		}
 
 		alarm_init();
 		status_init();
@@ -486,8 +529,17 @@ void upsdrv_updateinfo(void)
 		if (daisychain_enabled == TRUE)
 			alarm_commit();
 
+		/* forget about the traps handled */
+		walk_targeted = FALSE;
+		for (i = 0; i < traps_handled; i++)
+			free(trap_OIDs[i]);
+		for (i = traps_handled; i < trap_OIDs_count; i++)
+			trap_OIDs[i - traps_handled] = trap_OIDs[i];
+		trap_OIDs_count -= traps_handled;
+
 		/* store timestamp */
-		lastpoll = time(NULL);
+		if (full_update == TRUE)
+			lastpoll = time(NULL);
 	}
 	else {
 		/* Just tell the same status to upsd */
@@ -597,6 +649,16 @@ void upsdrv_makevartable(void)
 		"Specifies the number of Net-SNMP retries to be used in the requests (default=5)");
 	addvar(VAR_VALUE, SU_VAR_TIMEOUT,
 		"Specifies the Net-SNMP timeout in seconds between retries (default=1)");
+	addvar(VAR_VALUE, SU_VAR_MAXVARBINDS,
+		"Set the maximum number of OIDs requested at once (default=16, 1 to disable)");
+	addvar(VAR_VALUE, SU_VAR_MAXREQUESTS,
+		"Set the maximum number of SNMP requests in flight at once (default=4)");
+	addvar(VAR_FLAG, SU_VAR_KEYCACHE,
+		"Keep the localized SNMPv3 keys in the state path for quicker restarts");
+	addvar(VAR_VALUE, SU_VAR_TRAPLISTEN,
+		"Listen for SNMP traps and informs on this address (e.g. udp:1162) (default: disabled)");
+	addvar(VAR_VALUE | VAR_SENSITIVE, SU_VAR_TRAPCOMMUNITY,
+		"Set the community of the accepted traps (default: same as community, required with SNMPv3)");
 	addvar(VAR_FLAG, "notransferoids",
 		"Disable transfer OIDs (use on APCC Symmetras)");
 	addvar(VAR_FLAG, "symmetrathreephase",
@@ -811,6 +873,10 @@ void upsdrv_initups(void)
 		/* fatalx(EXIT_FAILURE, "Marking the exit code as failure since the driver is not started now"); */
 	}
 
+	/* keep the SNMPv3 keys and engine data for the next start */
+	if (testvar(SU_VAR_KEYCACHE))
+		v3cache_enabled = TRUE;
+
 	/* init SNMP library, etc... */
 	nut_snmp_init(progname, device_path);
 
@@ -843,6 +909,22 @@ void upsdrv_initups(void)
 	}
 	semistatic_countdown = semistaticfreq;
 
+	/* init the number of OIDs requested at once */
+	if (getval(SU_VAR_MAXVARBINDS))
+		max_varbinds = atoi(getval(SU_VAR_MAXVARBINDS));
+	if (max_varbinds < 1) {
+		upsdebugx(1, "Bad %s value provided, setting to default", SU_VAR_MAXVARBINDS);
+		max_varbinds = DEFAULT_MAXVARBINDS;
+	}
+
+	/* init the number of requests in flight at once */
+	if (getval(SU_VAR_MAXREQUESTS))
+		max_requests = atoi(getval(SU_VAR_MAXREQUESTS));
+	if (max_requests < 1) {
+		upsdebugx(1, "Bad %s value provided, setting to default", SU_VAR_MAXREQUESTS);
+		max_requests = DEFAULT_MAXREQUESTS;
+	}
+
 	/* Get UPS Model node to see if there's a MIB */
 /* FIXME: extend and use match_model_OID(char *model) */
 	su_info_p = su_find_info("ups.model");
@@ -967,6 +1049,9 @@ void upsdrv_initups(void)
 
 	/* set shutdown and autostart delay */
 	set_delays();
+
+	/* start listening for traps, if asked to */
+	su_trap_init();
 }
 
 void upsdrv_cleanup(void)
@@ -983,6 +1068,262 @@ void upsdrv_cleanup(void)
  * SNMP functions.
  * ----------------------------------------------------------- */
 
+/* SNMPv3 key cache (snmp_keycache): the localized keys, engine ID and
+ * engine boots/time learnt by a previous run are kept in the state path,
+ * readable by the driver user only, so that a restart neither hashes the
+ * pass phrases (generate_Ku() digests a megabyte of data per key) nor
+ * probes the engine ID again.  The file is only used for the same agent,
+ * user, protocols and pass phrases (as a cheap digest of them); if the
+ * agent rejects the cached keys anyway (e.g. after a pass phrase change
+ * on its side), the file is dropped and the keys made anew. */
+
+/* Digest of the pass phrases, for the cache ident: not a secure hash, it
+ * only tells whether they changed (the cached keys tell more anyway) */
+static uint64_t su_v3cache_digest(const char *authpass, const char *privpass)
+{
+	uint64_t	hash = 5381;
+	const char	*s;
+
+	for (s = authpass ? authpass : ""; *s != '\0'; s++)
+		hash = hash * 33 + (unsigned char)*s;
+	hash = hash * 33;	/* separator, so "ab" "c" differs from "a" "bc" */
+	for (s = privpass ? privpass : ""; *s != '\0'; s++)
+		hash = hash * 33 + (unsigned char)*s;
+
+	return hash;
+}
+
+static void su_hex_encode(char *buf, size_t buflen, const u_char *data, size_t len)
+{
+	size_t	i;
+
+	buf[0] = '\0';
+	for (i = 0; i < len && (i + 1) * 2 < buflen; i++)
+		snprintf(buf + i * 2, 3, "%02x", data[i]);
+}
+
+/* Return the decoded length, or 0 on error */
+static size_t su_hex_decode(const char *hex, u_char *data, size_t maxlen)
+{
+	size_t	len = 0;
+	unsigned int	byte;
+
+	while (hex[0] != '\0' && hex[0] != '\n') {
+		if (len >= maxlen || sscanf(hex, "%2x", &byte) != 1 || hex[1] == '\0')
+			return 0;
+		data[len++] = (u_char)byte;
+		hex += 2;
+	}
+
+	return len;
+}
+
+static bool_t su_v3cache_load(void)
+{
+	FILE	*f;
+	char	line[LARGEBUF], *val;
+	u_char	engineID[SNMP_MAXBUF_SMALL], authKey[SNMP_MAXBUF_SMALL], privKey[SNMP_MAXBUF_SMALL];
+	size_t	engineIDLen = 0, authKeyLen = 0, privKeyLen = 0;
+	unsigned long	boots = 0, etime = 0;
+	long long	saved = 0;
+	bool_t	ident_ok = FALSE;
+#ifndef WIN32
+	struct stat	st;
+#endif
+
+	f = fopen(v3cache_fn, "r");
+	if (f == NULL) {
+		upsdebug_with_errno(2, "%s: no SNMPv3 key cache %s", __func__, v3cache_fn);
+		return FALSE;
+	}
+
+#ifndef WIN32
+	if (fstat(fileno(f), &st) != 0 || (st.st_mode & (S_IRWXG | S_IRWXO))) {
+		upslogx(LOG_WARNING, "Ignoring SNMPv3 key cache %s: "
+			"it must not be accessible to others", v3cache_fn);
+		fclose(f);
+		return FALSE;
+	}
+#endif
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		line[strcspn(line, "\n")] = '\0';
+		if ((val = strchr(line, ' ')) == NULL)
+			continue;
+		*val++ = '\0';
+
+		if (!strcmp(line, "ident"))
+			ident_ok = (strcmp(val, v3cache_ident) == 0);
+		else if (!strcmp(line, "engineid"))
+			engineIDLen = su_hex_decode(val, engineID, sizeof(engineID));
+		else if (!strcmp(line, "authkey"))
+			authKeyLen = su_hex_decode(val, authKey, sizeof(authKey));
+		else if (!strcmp(line, "privkey"))
+			privKeyLen = su_hex_decode(val, privKey, sizeof(privKey));
+		else if (!strcmp(line, "enginetime"))
+			sscanf(val, "%lu %lu %lld", &boots, &etime, &saved);
+	}
+	fclose(f);
+
+	if (ident_ok == FALSE || engineIDLen == 0
+	 || (g_snmp_sess.securityLevel != SNMP_SEC_LEVEL_NOAUTH && authKeyLen == 0)
+	 || (g_snmp_sess.securityLevel == SNMP_SEC_LEVEL_AUTHPRIV && privKeyLen == 0)
+	) {
+		upsdebugx(1, "%s: SNMPv3 key cache %s does not match the configuration",
+			__func__, v3cache_fn);
+		return FALSE;
+	}
+
+	g_snmp_sess.securityEngineID = (u_char *)xcalloc(engineIDLen, 1);
+	memcpy(g_snmp_sess.securityEngineID, engineID, engineIDLen);
+	g_snmp_sess.securityEngineIDLen = engineIDLen;
+
+	if (authKeyLen > 0) {
+		g_snmp_sess.securityAuthLocalKey = (u_char *)xcalloc(authKeyLen, 1);
+		memcpy(g_snmp_sess.securityAuthLocalKey, authKey, authKeyLen);
+		g_snmp_sess.securityAuthLocalKeyLen = authKeyLen;
+	}
+
+	if (privKeyLen > 0) {
+		g_snmp_sess.securityPrivLocalKey = (u_char *)xcalloc(privKeyLen, 1);
+		memcpy(g_snmp_sess.securityPrivLocalKey, privKey, privKeyLen);
+		g_snmp_sess.securityPrivLocalKeyLen = privKeyLen;
+	}
+
+	/* The agent corrects (with a report) a wrong guess of its clock */
+	if (boots > 0 || etime > 0) {
+		long long	elapsed = (long long)time(NULL) - saved;
+
+		g_snmp_sess.engineBoots = (u_int)boots;
+		g_snmp_sess.engineTime = (u_int)(etime + (elapsed > 0 ? (unsigned long)elapsed : 0));
+	}
+
+	upsdebugx(1, "%s: using the SNMPv3 key cache %s", __func__, v3cache_fn);
+	memset(authKey, 0, sizeof(authKey));
+	memset(privKey, 0, sizeof(privKey));
+	return TRUE;
+}
+
+/* Free what su_v3cache_load() put into the session template */
+static void su_v3cache_unload(void)
+{
+	if (g_snmp_sess.securityAuthLocalKey != NULL) {
+		memset(g_snmp_sess.securityAuthLocalKey, 0, g_snmp_sess.securityAuthLocalKeyLen);
+		free(g_snmp_sess.securityAuthLocalKey);
+		g_snmp_sess.securityAuthLocalKey = NULL;
+		g_snmp_sess.securityAuthLocalKeyLen = 0;
+	}
+
+	if (g_snmp_sess.securityPrivLocalKey != NULL) {
+		memset(g_snmp_sess.securityPrivLocalKey, 0, g_snmp_sess.securityPrivLocalKeyLen);
+		free(g_snmp_sess.securityPrivLocalKey);
+		g_snmp_sess.securityPrivLocalKey = NULL;
+		g_snmp_sess.securityPrivLocalKeyLen = 0;
+	}
+
+	free(g_snmp_sess.securityEngineID);
+	g_snmp_sess.securityEngineID = NULL;
+	g_snmp_sess.securityEngineIDLen = 0;
+}
+
+static void su_v3cache_save(void)
+{
+	struct usmUser	*user;
+	u_int	boots = 0, etime = 0;
+	char	tmpfn[NUT_PATH_MAX + 8];
+	char	hex[SNMP_MAXBUF_SMALL * 2 + 1];
+	FILE	*f;
+	int	fd;
+
+	if (g_snmp_sess_p->securityEngineIDLen == 0)
+		return;
+
+	user = usm_get_user(g_snmp_sess_p->securityEngineID,
+		g_snmp_sess_p->securityEngineIDLen, g_snmp_sess_p->securityName);
+	if (user == NULL) {
+		upsdebugx(2, "%s: no USM user to cache the keys of", __func__);
+		return;
+	}
+
+	get_enginetime(g_snmp_sess_p->securityEngineID,
+		(u_int)g_snmp_sess_p->securityEngineIDLen, &boots, &etime, FALSE);
+
+	/* write aside and rename, so a crash does not leave half a file */
+	snprintf(tmpfn, sizeof(tmpfn), "%s.new", v3cache_fn);
+	fd = open(tmpfn, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0 || (f = fdopen(fd, "w")) == NULL) {
+		upslog_with_errno(LOG_WARNING, "Can't write SNMPv3 key cache %s", tmpfn);
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+
+	fprintf(f, "ident %s\n", v3cache_ident);
+	su_hex_encode(hex, sizeof(hex), g_snmp_sess_p->securityEngineID,
+		g_snmp_sess_p->securityEngineIDLen);
+	fprintf(f, "engineid %s\n", hex);
+	fprintf(f, "enginetime %u %u %lld\n", boots, etime, (long long)time(NULL));
+	if (user->authKeyLen > 0) {
+		su_hex_encode(hex, sizeof(hex), user->authKey, user->authKeyLen);
+		fprintf(f, "authkey %s\n", hex);
+	}
+	if (user->privKeyLen > 0) {
+		su_hex_encode(hex, sizeof(hex), user->privKey, user->privKeyLen);
+		fprintf(f, "privkey %s\n", hex);
+	}
+	memset(hex, 0, sizeof(hex));
+
+	if (fclose(f) != 0 || rename(tmpfn, v3cache_fn) != 0) {
+		upslog_with_errno(LOG_WARNING, "Can't write SNMPv3 key cache %s", v3cache_fn);
+		unlink(tmpfn);
+		return;
+	}
+
+	upsdebugx(1, "%s: saved SNMPv3 key cache %s", __func__, v3cache_fn);
+}
+
+/* Check that the agent accepts the cached keys with a GET of sysUpTime.
+ * Return FALSE only if the agent reported an authentication, decryption
+ * or engine ID error: a request which timed out or failed otherwise says
+ * nothing about the keys, and making them anew would not help it. */
+static bool_t su_v3cache_verify(void)
+{
+	oid	name[MAX_OID_LEN];
+	size_t	name_len = MAX_OID_LEN;
+	struct snmp_pdu	*pdu, *response = NULL;
+	int	status;
+
+	if (!read_objid(".1.3.6.1.2.1.1.3.0", name, &name_len))
+		return TRUE;
+
+	pdu = snmp_pdu_create(SNMP_MSG_GET);
+	if (pdu == NULL) {
+		fatalx(EXIT_FAILURE, "Not enough memory");
+	}
+	snmp_add_null_var(pdu, name, name_len);
+
+	status = snmp_synch_response(g_snmp_sess_p, pdu, &response);
+	if (response)
+		snmp_free_pdu(response);
+
+	if (status != STAT_ERROR)
+		return TRUE;
+
+	switch (g_snmp_sess_p->s_snmp_errno) {
+		case SNMPERR_UNKNOWN_ENG_ID:
+		case SNMPERR_USM_UNKNOWNENGINEID:
+		case SNMPERR_AUTHENTICATION_FAILURE:
+		case SNMPERR_USM_AUTHENTICATIONFAILURE:
+		case SNMPERR_DECRYPTION_ERR:
+		case SNMPERR_USM_DECRYPTIONERROR:
+			return FALSE;
+		default:
+			upsdebugx(1, "%s: could not check the cached keys: %s",
+				__func__, snmp_api_errstring(g_snmp_sess_p->s_snmp_errno));
+			return TRUE;
+	}
+}
+
 void nut_snmp_init(const char *type, const char *hostname)
 {
 	char *ns_options = NULL;
@@ -1138,9 +1479,21 @@ void nut_snmp_init(const char *type, const char *hostname)
 #endif
 			fatalx(EXIT_FAILURE, "Bad SNMPv3 authProtocol: %s", authProtocol);
 
+		privProtocol = testvar(SU_VAR_PRIVPROT) ? getval(SU_VAR_PRIVPROT) : "DES";
+
+		if (v3cache_enabled == TRUE) {
+			snprintf(v3cache_fn, sizeof(v3cache_fn), "%s/%s-%s.snmpv3",
+				dflt_statepath(), progname, upsname ? upsname : device_name);
+			snprintf(v3cache_ident, sizeof(v3cache_ident), "%s %s %d %s %s %016" PRIx64,
+				hostname, g_snmp_sess.securityName, g_snmp_sess.securityLevel,
+				authProtocol, privProtocol,
+				su_v3cache_digest(authPassword, privPassword));
+			v3cache_loaded = su_v3cache_load();
+		}
+
 		/* set the authentication key to a MD5/SHA1 hashed version of our
 		 * passphrase (must be at least 8 characters long) */
-		if (g_snmp_sess.securityLevel != SNMP_SEC_LEVEL_NOAUTH) {
+		if (g_snmp_sess.securityLevel != SNMP_SEC_LEVEL_NOAUTH && v3cache_loaded == FALSE) {
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE) )
 # pragma GCC diagnostic push
 #endif
@@ -1176,8 +1529,6 @@ net-snmp/library/keytools.h:   int    generate_Ku(const oid * hashtype, u_int ha
 			}
 		}
 
-		privProtocol = testvar(SU_VAR_PRIVPROT) ? getval(SU_VAR_PRIVPROT) : "DES";
-
 #if NUT_HAVE_LIBNETSNMP_usmDESPrivProtocol
 		if (strcmp(privProtocol, "DES") == 0) {
 			g_snmp_sess.securityPrivProto = usmDESPrivProtocol;
@@ -1212,7 +1563,7 @@ net-snmp/library/keytools.h:   int    generate_Ku(const oid * hashtype, u_int ha
 
 		/* set the privacy key to a MD5/SHA1 hashed version of our
 		 * passphrase (must be at least 8 characters long) */
-		if (g_snmp_sess.securityLevel == SNMP_SEC_LEVEL_AUTHPRIV) {
+		if (g_snmp_sess.securityLevel == SNMP_SEC_LEVEL_AUTHPRIV && v3cache_loaded == FALSE) {
 			g_snmp_sess.securityPrivKeyLen = USM_PRIV_KU_LEN;
 
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE) )
@@ -1250,14 +1601,58 @@ net-snmp/library/keytools.h:   int    generate_Ku(const oid * hashtype, u_int ha
 	/* Open the session */
 	SOCK_STARTUP; /* MS Windows wrapper, not really needed on Unix! */
 	g_snmp_sess_p = snmp_open(&g_snmp_sess);	/* establish the session */
-	if (g_snmp_sess_p == NULL) {
+	if (g_snmp_sess_p == NULL && v3cache_loaded == FALSE) {
 		nut_snmp_perror(&g_snmp_sess, 0, NULL, "nut_snmp_init: snmp_open");
 		fatalx(EXIT_FAILURE, "Unable to establish communication");
 	}
+
+	if (v3cache_loaded == TRUE
+	 && (g_snmp_sess_p == NULL || su_v3cache_verify() == FALSE)
+	) {
+		/* Start over the hard way, without the cached data */
+		upslogx(LOG_WARNING, "SNMPv3 key cache %s not accepted, "
+			"generating the keys again", v3cache_fn);
+		if (g_snmp_sess_p != NULL) {
+			struct usmUser	*user = usm_get_user(g_snmp_sess_p->securityEngineID,
+				g_snmp_sess_p->securityEngineIDLen, g_snmp_sess_p->securityName);
+
+			if (user != NULL) {
+				usm_remove_user(user);
+				usm_free_user(user);
+			}
+			snmp_close(g_snmp_sess_p);
+			g_snmp_sess_p = NULL;
+		}
+		unlink(v3cache_fn);
+
+		/* snmp_sess_init() starts the template over */
+		su_v3cache_unload();
+		free(g_snmp_sess.peername);
+		free(g_snmp_sess.securityName);
+
+		v3cache_loaded = FALSE;
+		v3cache_enabled = FALSE;
+		nut_snmp_init(type, hostname);
+		v3cache_enabled = TRUE;
+		if (g_snmp_sess.version == SNMP_VERSION_3)
+			su_v3cache_save();
+		return;
+	}
+
+	if (v3cache_enabled == TRUE && v3cache_loaded == FALSE
+	 && g_snmp_sess.version == SNMP_VERSION_3
+	) {
+		su_v3cache_save();
+	}
 }
 
 void nut_snmp_cleanup(void)
 {
+	su_trap_free();
+	su_prefetch_free();
+	su_lookup_free();
+	su_v3cache_unload();
+
 	/* close snmp session. */
 	if (g_snmp_sess_p) {
 		snmp_close(g_snmp_sess_p);
@@ -1266,6 +1661,247 @@ void nut_snmp_cleanup(void)
 	SOCK_CLEANUP; /* wrapper not needed on Unix! */
 }
 
+/* -----------------------------------------------------------
+ * SNMP trap/inform listener: traps are not decoded per MIB, they just
+ * trigger an early update of the status, the alarms and the entries
+ * (or template columns) whose OIDs they carry in their varbinds.
+ * ----------------------------------------------------------- */
+
+/* Are there traps to handle, and not too soon after the last ones? */
+static bool_t su_trap_due(void)
+{
+	if (trap_pending == FALSE)
+		return FALSE;
+
+	return (time(NULL) >= trap_lastupdate + SU_TRAP_MINWAIT) ? TRUE : FALSE;
+}
+
+#ifndef WIN32
+static int su_trap_callback(int operation, struct snmp_session *sp,
+	int reqid, struct snmp_pdu *pdu, void *magic)
+{
+	struct variable_list	*var;
+	char	buf[SU_INFOSIZE];
+	size_t	i;
+
+	NUT_UNUSED_VARIABLE(reqid);
+	NUT_UNUSED_VARIABLE(magic);
+
+	if (operation != NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE || pdu == NULL)
+		return 1;
+
+	if (pdu->command != SNMP_MSG_TRAP
+	 && pdu->command != SNMP_MSG_TRAP2
+	 && pdu->command != SNMP_MSG_INFORM
+	) {
+		return 1;
+	}
+
+	/* No SNMPv3 users are set up for the listener */
+	if (pdu->version == SNMP_VERSION_3) {
+		upsdebugx(2, "%s: ignoring SNMPv3 notification", __func__);
+		return 1;
+	}
+
+	if (trap_community == NULL
+	 || pdu->community == NULL
+	 || pdu->community_len != strlen(trap_community)
+	 || memcmp(pdu->community, trap_community, pdu->community_len)
+	) {
+		upsdebugx(2, "%s: ignoring notification with another community", __func__);
+		return 1;
+	}
+
+	if (pdu->command == SNMP_MSG_INFORM) {
+		struct snmp_pdu	*reply = snmp_clone_pdu(pdu);
+
+		if (reply != NULL) {
+			reply->command = SNMP_MSG_RESPONSE;
+			reply->errstat = 0;
+			reply->errindex = 0;
+			if (!snmp_send(sp, reply)) {
+				upsdebugx(2, "%s: can't acknowledge the inform", __func__);
+				snmp_free_pdu(reply);
+			}
+		}
+	}
+
+	for (var = pdu->variables; var != NULL; var = var->next_variable) {
+		buf[0] = '\0';
+		for (i = 0; i < var->name_length; i++) {
+			if (i == 0)
+				snprintfcat(buf, sizeof(buf), "%lu", (unsigned long)var->name[i]);
+			else
+				snprintfcat(buf, sizeof(buf), ".%lu", (unsigned long)var->name[i]);
+		}
+
+		upsdebugx(3, "%s: notification varbind %s", __func__, buf);
+
+		if (trap_OIDs_count < SU_TRAP_MAXOIDS)
+			trap_OIDs[trap_OIDs_count++] = xstrdup(buf);
+		else
+			trap_all = TRUE;
+	}
+
+	upsdebugx(1, "%s: notification received", __func__);
+	trap_pending = TRUE;
+
+	return 1;
+}
+
+/* end of the wait for traps coalesced after an early update */
+static int su_trap_timeout(void *arg)
+{
+	NUT_UNUSED_VARIABLE(arg);
+
+	trap_timer = -1;
+	return (su_trap_due() == TRUE);
+}
+
+static int su_trap_ready(TYPE_FD fd, void *arg)
+{
+	fd_set	fdset;
+
+	NUT_UNUSED_VARIABLE(arg);
+
+	FD_ZERO(&fdset);
+	FD_SET(fd, &fdset);
+	snmp_read(&fdset);
+
+	/* update right away, unless one was just done: a burst (or a flood)
+	 * of traps then makes a single update, when the timer ends */
+	if (su_trap_due() == TRUE)
+		return 1;
+
+	if (trap_pending == TRUE && trap_timer < 0) {
+		long	wait = (long)(trap_lastupdate + SU_TRAP_MINWAIT - time(NULL));
+
+		trap_timer = dstate_timer_add((wait > 0 ? wait : 1) * 1000, 0, su_trap_timeout, NULL);
+	}
+
+	return 0;
+}
+#endif	/* !WIN32 */
+
+static void su_trap_init(void)
+{
+	const char	*listen_addr = getval(SU_VAR_TRAPLISTEN);
+#ifndef WIN32
+	netsnmp_transport	*transport;
+	struct snmp_session	trap_sess;
+
+	if (listen_addr == NULL)
+		return;
+
+	/* With SNMPv3 there is no community to fall back on, and accepting
+	 * traps from anyone is not an option: ask for one */
+	if (getval(SU_VAR_TRAPCOMMUNITY))
+		trap_community = getval(SU_VAR_TRAPCOMMUNITY);
+	else if (g_snmp_sess.version != SNMP_VERSION_3)
+		trap_community = testvar(SU_VAR_COMMUNITY) ? getval(SU_VAR_COMMUNITY) : "public";
+	else {
+		upslogx(LOG_ERR, "Not listening for SNMP traps: %s must be set with SNMPv3",
+			SU_VAR_TRAPCOMMUNITY);
+		return;
+	}
+
+	transport = netsnmp_tdomain_transport(listen_addr, 1, "udp");
+	if (transport == NULL) {
+		upslogx(LOG_ERR, "Can't listen for SNMP traps on %s", listen_addr);
+		return;
+	}
+
+	snmp_sess_init(&trap_sess);
+	trap_sess.callback = su_trap_callback;
+	trap_sess.callback_magic = NULL;
+	trap_sess.isAuthoritative = SNMP_SESS_UNKNOWNAUTH;
+
+	/* takes over (or closes) the transport */
+	trap_sess_p = snmp_add(&trap_sess, transport, NULL, NULL);
+	if (trap_sess_p == NULL) {
+		upslogx(LOG_ERR, "Can't set up the SNMP trap listener on %s", listen_addr);
+		return;
+	}
+
+	if (dstate_fd_add(transport->sock, su_trap_ready, NULL) < 0) {
+		upslog_with_errno(LOG_ERR, "Can't watch the SNMP trap listener");
+		snmp_close(trap_sess_p);
+		trap_sess_p = NULL;
+		return;
+	}
+
+	trap_sock = transport->sock;
+	upslogx(LOG_INFO, "Listening for SNMP traps on %s", listen_addr);
+#else
+	if (listen_addr != NULL)
+		upslogx(LOG_WARNING, "SNMP trap listener is not supported on this platform");
+#endif	/* !WIN32 */
+}
+
+static void su_trap_free(void)
+{
+	if (trap_sess_p != NULL) {
+#ifndef WIN32
+		if (trap_sock >= 0)
+			dstate_fd_del(trap_sock);
+		if (trap_timer >= 0)
+			dstate_timer_del(trap_timer);
+		trap_timer = -1;
+#endif
+		snmp_close(trap_sess_p);
+		trap_sess_p = NULL;
+		trap_sock = -1;
+	}
+
+	while (trap_OIDs_count > 0)
+		free(trap_OIDs[--trap_OIDs_count]);
+}
+
+/* Is this entry to be re-read after the traps received? */
+static bool_t su_trap_target(const snmp_info_t *su_info_p)
+{
+	const char	*suffix, *entry_OID;
+	size_t	len, i;
+
+	/* The status and alarms are made of all their entries */
+	suffix = strrchr(su_info_p->info_type, '.');
+	if (!strcasecmp(su_info_p->info_type, "ups.status")
+	 || !strcasecmp(su_info_p->info_type, "ups.alarms")
+	 || (suffix != NULL && !strcmp(suffix, ".alarm"))
+	) {
+		return TRUE;
+	}
+
+	if (su_info_p->OID == NULL)
+		return FALSE;
+
+	/* Compare without leading dots; for templates, the table column
+	 * (up to the first index) is enough, on a sub-identifier boundary
+	 * so that column 1 is not taken for columns 10 to 19 */
+	entry_OID = su_info_p->OID + (*su_info_p->OID == '.');
+	len = strcspn(entry_OID, "%");
+
+	for (i = 0; i < trap_OIDs_count; i++) {
+		if (entry_OID[len] == '\0') {
+			if (!strcmp(trap_OIDs[i], entry_OID))
+				return TRUE;
+		}
+		else {
+			size_t	col = len;
+
+			while (col > 0 && entry_OID[col - 1] == '.')
+				col--;
+			if (col > 0 && !strncmp(trap_OIDs[i], entry_OID, col)
+			 && (trap_OIDs[i][col] == '\0' || trap_OIDs[i][col] == '.')
+			) {
+				return TRUE;
+			}
+		}
+	}
+
+	return FALSE;
+}
+
 /* Free a struct snmp_pdu * returned by nut_snmp_walk */
 static void nut_snmp_free(struct snmp_pdu ** array_to_free)
 {
@@ -1283,6 +1919,81 @@ static void nut_snmp_free(struct snmp_pdu ** array_to_free)
 	}
 }
 
+/* Parsed (binary) forms of the textual OIDs the driver requests, so each
+ * one goes through the MIB parser only once and not on every update.
+ * Failures are not cached, to keep reporting the actual parse error. */
+typedef struct su_oid_cache_s {
+	char	*OID;
+	oid	*name;
+	size_t	name_len;
+	struct su_oid_cache_s	*next;
+} su_oid_cache_t;
+
+#define SU_OID_CACHE_BUCKETS	1024
+/* Just parse the OIDs beyond that, should a mapping table go wild */
+#define SU_OID_CACHE_MAX	65536
+
+static su_oid_cache_t	*oid_cache[SU_OID_CACHE_BUCKETS];
+static size_t	oid_cache_count = 0;
+
+/* Drop-in replacement for snmp_parse_oid(): return NULL if <OID> can
+ * not be parsed, or does not fit in <name_len> sub-identifiers */
+static oid *su_parse_oid(const char *OID, oid *name, size_t *name_len)
+{
+	su_oid_cache_t	*entry;
+	size_t	hash = 5381;
+	const char	*p;
+
+	for (p = OID; *p != '\0'; p++)
+		hash = hash * 33 + (unsigned char)*p;
+	hash %= SU_OID_CACHE_BUCKETS;
+
+	for (entry = oid_cache[hash]; entry != NULL; entry = entry->next) {
+		if (strcmp(entry->OID, OID))
+			continue;
+
+		if (entry->name_len > *name_len)
+			return NULL;
+
+		memcpy(name, entry->name, entry->name_len * sizeof(oid));
+		*name_len = entry->name_len;
+		return name;
+	}
+
+	if (!snmp_parse_oid(OID, name, name_len))
+		return NULL;
+
+	if (oid_cache_count < SU_OID_CACHE_MAX) {
+		entry = (su_oid_cache_t *)xcalloc(1, sizeof(su_oid_cache_t));
+		entry->OID = xstrdup(OID);
+		entry->name = (oid *)xcalloc(*name_len, sizeof(oid));
+		memcpy(entry->name, name, *name_len * sizeof(oid));
+		entry->name_len = *name_len;
+		entry->next = oid_cache[hash];
+		oid_cache[hash] = entry;
+		oid_cache_count++;
+	}
+
+	return name;
+}
+
+static void su_oid_cache_free(void)
+{
+	su_oid_cache_t	*entry;
+	size_t	i;
+
+	for (i = 0; i < SU_OID_CACHE_BUCKETS; i++) {
+		while ((entry = oid_cache[i]) != NULL) {
+			oid_cache[i] = entry->next;
+			free(entry->OID);
+			free(entry->name);
+			free(entry);
+		}
+	}
+
+	oid_cache_count = 0;
+}
+
 /* Return a NULL terminated array of snmp_pdu * */
 static struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration, int log_unhandled_loudly)
 {
@@ -1296,12 +2007,13 @@ static struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration, int l
 	int nb_iteration = 0;
 	struct snmp_pdu ** ret_array = NULL;
 	int type = SNMP_MSG_GET;
+	st_tree_timespec_t start;
 
 	upsdebugx(3, "%s(%s)", __func__, OID);
 	upsdebugx(4, "%s: max. iteration = %i", __func__, max_iteration);
 
 	/* create and send request. */
-	if (!snmp_parse_oid(OID, name, &name_len)) {
+	if (!su_parse_oid(OID, name, &name_len)) {
 		upsdebugx(2, "[%s] %s: %s: %s",
 			upsname?upsname:device_name, __func__, OID, snmp_api_errstring(snmp_errno));
 		return NULL;
@@ -1331,7 +2043,11 @@ static struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration, int l
 
 		snmp_add_null_var(pdu, current_name, current_name_len);
 
+		dstate_perf_start(&start);
 		status = snmp_synch_response(g_snmp_sess_p, pdu, &response);
+		dstate_perf_since(status == STAT_SUCCESS ? "snmp.get" :
+			(status == STAT_TIMEOUT ? "snmp.get.timeout" : "snmp.get.error"),
+			&start);
 
 		if (!response) {
 			break;
@@ -1345,89 +2061,617 @@ static struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration, int l
 				return NULL;
 			}
 
-			if (response->errstat == SNMP_ERR_NOSUCHNAME) {
-				upsdebugx(4, "%s: OID does not exist, skipping", __func__);
-				snmp_free_pdu(response);
-				nut_snmp_free(ret_array);
-				return NULL;
-			}
+			if (response->errstat == SNMP_ERR_NOSUCHNAME) {
+				upsdebugx(4, "%s: OID does not exist, skipping", __func__);
+				snmp_free_pdu(response);
+				nut_snmp_free(ret_array);
+				return NULL;
+			}
+
+			upsdebugx(3, "status = %i, response->errstat = %li", status, response->errstat);
+
+			/* Error throttling otherwise */
+			numerr++;
+			upsdebugx(4, "%s: numerr++ (total=%u)", __func__, numerr);
+
+			if ((numerr == SU_ERR_LIMIT) || ((numerr % SU_ERR_RATE) == 0)) {
+				upslogx(LOG_WARNING, "[%s] Warning: excessive poll "
+						"failures, limiting error reporting (OID = %s)",
+						upsname?upsname:device_name, OID);
+			}
+
+			if ((numerr < SU_ERR_LIMIT) || ((numerr % SU_ERR_RATE) == 0)) {
+				if (type == SNMP_MSG_GETNEXT) {
+					upsdebugx(2, "=> No more OID, walk complete");
+				}
+				else {
+					nut_snmp_perror(g_snmp_sess_p, status, response,
+							"%s: %s", __func__, OID);
+				}
+			}
+
+			snmp_free_pdu(response);
+			break;
+		} else {
+			upsdebugx(3, "status = %i, response->errstat = %li", status, response->errstat);
+
+			/* Checked the "type" field of the returned varbind if
+			 * it is a type error exception (only applicable with
+			 * SNMPv2 or SNMPv3 protocol, would not happen with
+			 * SNMPv1). This allows to proceed interpreting large
+			 * responses when one entry in the middle is rejectable.
+			 */
+			if (response->variables->type == SNMP_NOSUCHOBJECT
+			 || response->variables->type == SNMP_NOSUCHINSTANCE
+			 || response->variables->type == SNMP_ENDOFMIBVIEW
+			) {
+				if (log_unhandled_loudly) {
+					upslogx(LOG_WARNING, "[%s] Warning: type error exception (OID = %s)",
+						upsname?upsname:device_name, OID);
+				} else {
+					upsdebugx(2, "[%s] Warning: type error exception (OID = %s)",
+						upsname?upsname:device_name, OID);
+				}
+				snmp_free_pdu(response);
+				break;
+			}
+			else {
+				/* no error */
+				numerr = 0;
+			}
+		}
+
+		nb_iteration++;
+		/* +1 is for the terminating NULL */
+		new_ret_array = (struct snmp_pdu**)realloc(
+			ret_array,
+			sizeof(struct snmp_pdu*) * ((size_t)nb_iteration+1)
+			);
+		if (new_ret_array == NULL) {
+			upsdebugx(1, "%s: Failed to realloc ret_array", __func__);
+			break;
+		}
+		else {
+			ret_array = new_ret_array;
+		}
+		ret_array[nb_iteration-1] = response;
+		ret_array[nb_iteration]=NULL;
+
+		current_name = response->variables->name;
+		current_name_len = response->variables->name_length;
+
+		type = SNMP_MSG_GETNEXT;
+	}
+
+	return ret_array;
+}
+
+/* Prefetch cache: snmp_ups_walk() requests the OIDs it is about to read
+ * with as few multi-varbind GET PDUs as the agent accepts, and
+ * do_nut_snmp_get() takes the answers from here instead of making a round
+ * trip for each of them.  The cache only lives for one device walk, so
+ * the values are never older than the walk itself. */
+typedef struct {
+	char	*OID;
+	size_t	hash;
+	struct snmp_pdu	*pdu;	/* single-varbind response */
+} su_prefetch_t;
+
+static su_prefetch_t	*prefetch_cache = NULL;
+static size_t	prefetch_count = 0;
+static size_t	prefetch_alloc = 0;
+
+/* Open addressing index of the cache by OID: each slot holds the
+ * position of an entry plus one, or 0 if free */
+static size_t	*prefetch_index = NULL;
+static size_t	prefetch_index_size = 0;	/* a power of 2 */
+
+static size_t su_prefetch_hash(const char *OID)
+{
+	size_t	hash = 5381;
+
+	for (; *OID != '\0'; OID++)
+		hash = hash * 33 + (unsigned char)*OID;
+
+	return hash;
+}
+
+static void su_prefetch_index_add(size_t n)
+{
+	size_t	i;
+
+	for (i = prefetch_cache[n].hash & (prefetch_index_size - 1);
+		prefetch_index[i] != 0;
+		i = (i + 1) & (prefetch_index_size - 1)
+	)
+		;
+
+	prefetch_index[i] = n + 1;
+}
+
+static void su_prefetch_clear(void)
+{
+	size_t	i;
+
+	for (i = 0; i < prefetch_count; i++) {
+		free(prefetch_cache[i].OID);
+		snmp_free_pdu(prefetch_cache[i].pdu);
+	}
+
+	if (prefetch_index != NULL)
+		memset(prefetch_index, 0, prefetch_index_size * sizeof(size_t));
+
+	prefetch_count = 0;
+}
+
+static void su_async_free(void);
+
+static void su_prefetch_free(void)
+{
+	su_async_free();
+	su_prefetch_clear();
+	free(prefetch_cache);
+	prefetch_cache = NULL;
+	prefetch_alloc = 0;
+	free(prefetch_index);
+	prefetch_index = NULL;
+	prefetch_index_size = 0;
+}
+
+static void su_prefetch_store(const char *OID, struct snmp_pdu *pdu)
+{
+	size_t	n;
+
+	if (prefetch_count == prefetch_alloc) {
+		prefetch_alloc = prefetch_alloc ? prefetch_alloc * 2 : 64;
+		prefetch_cache = (su_prefetch_t *)xrealloc(prefetch_cache,
+			prefetch_alloc * sizeof(su_prefetch_t));
+
+		/* Keep the index at most half full */
+		free(prefetch_index);
+		prefetch_index_size = prefetch_alloc * 2;
+		prefetch_index = (size_t *)xcalloc(prefetch_index_size, sizeof(size_t));
+		for (n = 0; n < prefetch_count; n++)
+			su_prefetch_index_add(n);
+	}
+
+	prefetch_cache[prefetch_count].OID = xstrdup(OID);
+	prefetch_cache[prefetch_count].hash = su_prefetch_hash(OID);
+	prefetch_cache[prefetch_count].pdu = pdu;
+	su_prefetch_index_add(prefetch_count);
+	prefetch_count++;
+}
+
+/* Return the cache entry for OID, or NULL if there is none */
+static su_prefetch_t *su_prefetch_find(const char *OID)
+{
+	size_t	hash, i;
+
+	if (prefetch_count == 0)
+		return NULL;
+
+	hash = su_prefetch_hash(OID);
+	for (i = hash & (prefetch_index_size - 1);
+		prefetch_index[i] != 0;
+		i = (i + 1) & (prefetch_index_size - 1)
+	) {
+		su_prefetch_t	*entry = &prefetch_cache[prefetch_index[i] - 1];
+
+		if (entry->hash == hash && !strcmp(entry->OID, OID))
+			return entry;
+	}
+
+	return NULL;
+}
+
+/* Return a copy of the prefetched response for OID (to be freed by the
+ * caller), or NULL if there is none */
+static struct snmp_pdu *su_prefetch_lookup(const char *OID)
+{
+	su_prefetch_t	*entry = su_prefetch_find(OID);
+
+	return entry ? snmp_clone_pdu(entry->pdu) : NULL;
+}
+
+/* Multi-varbind GET requests of the prefetch are sent asynchronously,
+ * with up to max_requests of them in flight at once, so that a walk
+ * takes about as long as its slowest request rather than the sum of
+ * them all.  Net-SNMP takes care of the retries and of the deadline
+ * (snmp_timeout x snmp_retries) of each request. */
+typedef struct {
+	int	reqid;		/* 0 if the slot is free */
+	int	status;		/* STAT_* once completed, -1 while in flight */
+	size_t	*idx;		/* indexes of the requested OIDs */
+	size_t	used;
+	struct snmp_pdu	*response;
+	st_tree_timespec_t	start;
+} su_async_req_t;
+
+static su_async_req_t	*async_reqs = NULL;
+static int	async_pending = 0;
+
+static int su_async_callback(int operation, struct snmp_session *sp,
+	int reqid, struct snmp_pdu *pdu, void *magic)
+{
+	int	r;
+
+	NUT_UNUSED_VARIABLE(sp);
+	NUT_UNUSED_VARIABLE(magic);
+
+	/* Answers to requests given up on (reqid reset) are ignored */
+	for (r = 0; async_reqs != NULL && r < max_requests; r++) {
+		su_async_req_t	*req = &async_reqs[r];
+
+		if (req->reqid != reqid || req->status != -1)
+			continue;
+
+		if (operation == NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE) {
+			req->status = STAT_SUCCESS;
+			req->response = snmp_clone_pdu(pdu);
+		}
+		else if (operation == NETSNMP_CALLBACK_OP_TIMED_OUT) {
+			req->status = STAT_TIMEOUT;
+		}
+		else {
+			req->status = STAT_ERROR;
+		}
+
+		async_pending--;
+		break;
+	}
+
+	return 1;
+}
+
+/* Wait until at least one of the requests in flight completes */
+static void su_async_wait(void)
+{
+	int	pending = async_pending;
+
+	while (async_pending == pending && async_pending > 0 && exit_flag == 0) {
+		int	numfds = 0, block = 1, ret;
+		fd_set	fdset;
+		struct timeval	timeout;
+
+		FD_ZERO(&fdset);
+		timeout.tv_sec = 1;
+		timeout.tv_usec = 0;
+		snmp_select_info(&numfds, &fdset, &timeout, &block);
+
+		ret = select(numfds, &fdset, NULL, NULL, &timeout);
+		if (ret > 0) {
+			snmp_read(&fdset);
+		}
+		else if (ret == 0) {
+			/* Retransmit, or time out, the due requests */
+			snmp_timeout();
+		}
+		else if (errno != EINTR) {
+			upsdebug_with_errno(2, "%s: select", __func__);
+			snmp_timeout();
+		}
+	}
+}
+
+/* Forget the requests of all slots */
+static void su_async_clear(void)
+{
+	int	r;
+
+	for (r = 0; async_reqs != NULL && r < max_requests; r++) {
+		if (async_reqs[r].response != NULL)
+			snmp_free_pdu(async_reqs[r].response);
+		async_reqs[r].response = NULL;
+		async_reqs[r].reqid = 0;
+	}
+
+	async_pending = 0;
+}
+
+static void su_async_free(void)
+{
+	int	r;
+
+	/* the session is about to be closed */
+	su_async_clear();
+
+	for (r = 0; async_reqs != NULL && r < max_requests; r++)
+		free(async_reqs[r].idx);
+
+	free(async_reqs);
+	async_reqs = NULL;
+}
+
+/* Request the <count> OIDs in batches of up to max_varbinds, and cache
+ * the answers.  Whatever can not be had this way (unparsable or missing
+ * OIDs, failed batches) is left for the regular requests to fetch, and
+ * to report about. */
+static void su_prefetch_get(char **OIDs, size_t count)
+{
+	oid	name[MAX_OID_LEN];
+	size_t	name_len, i;
+	size_t	*todo, todo_first = 0, todo_count, todo_alloc;
+	bool_t	failed = FALSE;
+	int	r;
+
+	if (max_varbinds < 2 || count < 2)
+		return;
+
+	if (async_reqs == NULL) {
+		/* max_varbinds only ever gets lowered */
+		async_reqs = (su_async_req_t *)xcalloc((size_t)max_requests, sizeof(su_async_req_t));
+		for (r = 0; r < max_requests; r++)
+			async_reqs[r].idx = (size_t *)xcalloc((size_t)max_varbinds, sizeof(size_t));
+	}
+
+	todo_alloc = todo_count = count;
+	todo = (size_t *)xcalloc(todo_alloc, sizeof(size_t));
+	for (i = 0; i < count; i++)
+		todo[i] = i;
+
+	while (exit_flag == 0
+	 && (async_pending > 0 || (todo_first < todo_count && failed == FALSE))
+	) {
+		/* Put all free slots to work */
+		for (r = 0; r < max_requests && todo_first < todo_count && failed == FALSE; r++) {
+			su_async_req_t	*req = &async_reqs[r];
+			struct snmp_pdu	*pdu;
+
+			if (req->reqid != 0)
+				continue;
+
+			pdu = snmp_pdu_create(SNMP_MSG_GET);
+			if (pdu == NULL) {
+				fatalx(EXIT_FAILURE, "Not enough memory");
+			}
+
+			for (req->used = 0;
+				todo_first < todo_count && req->used < (size_t)max_varbinds;
+				todo_first++
+			) {
+				name_len = MAX_OID_LEN;
+				if (!su_parse_oid(OIDs[todo[todo_first]], name, &name_len))
+					continue;
+
+				snmp_add_null_var(pdu, name, name_len);
+				req->idx[req->used++] = todo[todo_first];
+			}
+
+			if (req->used == 0) {
+				snmp_free_pdu(pdu);
+				break;
+			}
+
+			upsdebugx(3, "%s: requesting %" PRIuSIZE " OIDs at once", __func__, req->used);
+
+			req->status = -1;
+			req->response = NULL;
+			dstate_perf_start(&req->start);
+			req->reqid = snmp_async_send(g_snmp_sess_p, pdu, su_async_callback, NULL);
+			if (req->reqid == 0) {
+				upsdebugx(2, "%s: sending failed, "
+					"leaving the rest to single requests", __func__);
+				snmp_free_pdu(pdu);
+				failed = TRUE;
+				break;
+			}
+			async_pending++;
+		}
+
+		if (async_pending > 0)
+			su_async_wait();
+
+		/* Handle the completed requests, and free their slots */
+		for (r = 0; r < max_requests; r++) {
+			su_async_req_t	*req = &async_reqs[r];
+			struct snmp_pdu	*response = req->response;
+			struct variable_list	*var;
+			size_t	dropped = req->used;	/* none */
+			bool_t	retry = FALSE;
+
+			if (req->reqid == 0 || req->status == -1)
+				continue;
+
+			dstate_perf_since(req->status == STAT_SUCCESS ? "snmp.get" :
+				(req->status == STAT_TIMEOUT ? "snmp.get.timeout" : "snmp.get.error"),
+				&req->start);
+
+			if (req->status != STAT_SUCCESS || response == NULL) {
+				/* Probably no use trying the next batches either */
+				upsdebugx(2, "%s: request failed (status %d), "
+					"leaving the rest to single requests", __func__, req->status);
+				failed = TRUE;
+			}
+			else if (response->errstat == SNMP_ERR_TOOBIG && req->used > 1) {
+				if (max_varbinds > (int)(req->used / 2))
+					max_varbinds = (int)(req->used / 2);
+				upsdebugx(1, "%s: agent can not answer %" PRIuSIZE " OIDs at once, "
+					"trying with %d", __func__, req->used, max_varbinds);
+				retry = TRUE;
+			}
+			else if (response->errstat == SNMP_ERR_NOSUCHNAME
+			 && response->errindex > 0 && (size_t)response->errindex <= req->used
+			) {
+				/* SNMPv1 fails the whole request for one missing OID:
+				 * drop that one and retry the others */
+				dropped = (size_t)(response->errindex - 1);
+				upsdebugx(3, "%s: %s does not exist, retrying without it",
+					__func__, OIDs[req->idx[dropped]]);
+				retry = TRUE;
+			}
+			else if (response->errstat != SNMP_ERR_NOERROR) {
+				upsdebugx(2, "%s: request failed (error %ld), "
+					"leaving these OIDs to single requests",
+					__func__, response->errstat);
+			}
+			else {
+				/* Varbinds come back in the order they were requested */
+				for (i = 0, var = response->variables; var != NULL && i < req->used;
+					var = var->next_variable, i++
+				) {
+					struct snmp_pdu	*var_pdu = snmp_split_pdu(response, (int)i, 1);
+
+					if (var_pdu != NULL)
+						su_prefetch_store(OIDs[req->idx[i]], var_pdu);
+				}
+			}
+
+			/* Queue the OIDs of the request to retry again */
+			if (retry == TRUE) {
+				for (i = 0; i < req->used; i++) {
+					if (i == dropped)
+						continue;
+
+					if (todo_count == todo_alloc) {
+						todo_alloc *= 2;
+						todo = (size_t *)xrealloc(todo, todo_alloc * sizeof(size_t));
+					}
+					todo[todo_count++] = req->idx[i];
+				}
+			}
+
+			if (response != NULL)
+				snmp_free_pdu(response);
+			req->response = NULL;
+			req->reqid = 0;
+		}
+	}
+
+	/* Only requests cut short by exit_flag may be left over */
+	su_async_clear();
+	free(todo);
+}
+
+/* Read the rows of the table column holding the <count> instance OIDs
+ * of a template with GETBULK requests of up to max_varbinds repetitions,
+ * and cache the answers for these OIDs.  This is only done if the OIDs
+ * are rows of one column, i.e. only differ in their last sub-identifier
+ * (in ascending order); then the walk starts just before the first one,
+ * and stops after <rows> rows, at the end of the column, or once all
+ * of them were seen.  Return how many of the OIDs got cached. */
+static size_t su_prefetch_bulk(char **OIDs, size_t count, int rows)
+{
+	oid	base[MAX_OID_LEN], name[MAX_OID_LEN], next[MAX_OID_LEN];
+	oid	*rowids;
+	size_t	base_len = MAX_OID_LEN, name_len, next_len, i, want = 0, got = 0;
+	st_tree_timespec_t	start;
+
+	if (max_varbinds < 2 || rows < 2 || count < 2)
+		return 0;
+
+	if (!su_parse_oid(OIDs[0], base, &base_len) || base_len < 2)
+		return 0;
+	base_len--;	/* the column */
+
+	rowids = (oid *)xcalloc(count, sizeof(oid));
+	for (i = 0; i < count; i++) {
+		name_len = MAX_OID_LEN;
+		if (!su_parse_oid(OIDs[i], name, &name_len)
+		 || name_len != base_len + 1
+		 || memcmp(name, base, base_len * sizeof(oid)) != 0
+		 || (i > 0 && name[base_len] <= rowids[i - 1])
+		) {
+			upsdebugx(3, "%s: %s is not a further row of the column of %s, "
+				"not reading the column", __func__, OIDs[i], OIDs[0]);
+			free(rowids);
+			return 0;
+		}
+		rowids[i] = name[base_len];
+	}
+
+	memcpy(next, base, base_len * sizeof(oid));
+	next_len = base_len;
+	if (rowids[0] > 0)
+		next[next_len++] = rowids[0] - 1;
 
-			upsdebugx(3, "status = %i, response->errstat = %li", status, response->errstat);
+	while (want < count && rows > 0 && exit_flag == 0) {
+		struct snmp_pdu	*pdu, *response = NULL;
+		struct variable_list	*var;
+		int	status, n, reps;
+		bool_t	done = FALSE;
 
-			/* Error throttling otherwise */
-			numerr++;
-			upsdebugx(4, "%s: numerr++ (total=%u)", __func__, numerr);
+		pdu = snmp_pdu_create(SNMP_MSG_GETBULK);
+		if (pdu == NULL) {
+			fatalx(EXIT_FAILURE, "Not enough memory");
+		}
+		reps = (rows < max_varbinds) ? rows : max_varbinds;
+		if ((size_t)reps > count - want)
+			reps = (int)(count - want);
+		pdu->non_repeaters = 0;
+		pdu->max_repetitions = reps;
+		snmp_add_null_var(pdu, next, next_len);
 
-			if ((numerr == SU_ERR_LIMIT) || ((numerr % SU_ERR_RATE) == 0)) {
-				upslogx(LOG_WARNING, "[%s] Warning: excessive poll "
-						"failures, limiting error reporting (OID = %s)",
-						upsname?upsname:device_name, OID);
-			}
+		upsdebugx(3, "%s: requesting %ld rows of the column of %s",
+			__func__, pdu->max_repetitions, OIDs[0]);
 
-			if ((numerr < SU_ERR_LIMIT) || ((numerr % SU_ERR_RATE) == 0)) {
-				if (type == SNMP_MSG_GETNEXT) {
-					upsdebugx(2, "=> No more OID, walk complete");
-				}
-				else {
-					nut_snmp_perror(g_snmp_sess_p, status, response,
-							"%s: %s", __func__, OID);
-				}
-			}
+		dstate_perf_start(&start);
+		status = snmp_synch_response(g_snmp_sess_p, pdu, &response);
+		dstate_perf_since(status == STAT_SUCCESS ? "snmp.get" :
+			(status == STAT_TIMEOUT ? "snmp.get.timeout" : "snmp.get.error"),
+			&start);
+
+		if (status != STAT_SUCCESS || response == NULL) {
+			upsdebugx(2, "%s: request failed (status %d)", __func__, status);
+			if (response)
+				snmp_free_pdu(response);
+			break;
+		}
+
+		if (response->errstat == SNMP_ERR_TOOBIG && max_varbinds > 2) {
+			max_varbinds /= 2;
+			upsdebugx(1, "%s: agent can not answer that many rows at once, "
+				"trying with %d", __func__, max_varbinds);
+			snmp_free_pdu(response);
+			continue;
+		}
 
+		if (response->errstat != SNMP_ERR_NOERROR) {
+			upsdebugx(2, "%s: request failed (error %ld)",
+				__func__, response->errstat);
 			snmp_free_pdu(response);
 			break;
-		} else {
-			upsdebugx(3, "status = %i, response->errstat = %li", status, response->errstat);
+		}
 
-			/* Checked the "type" field of the returned varbind if
-			 * it is a type error exception (only applicable with
-			 * SNMPv2 or SNMPv3 protocol, would not happen with
-			 * SNMPv1). This allows to proceed interpreting large
-			 * responses when one entry in the middle is rejectable.
-			 */
-			if (response->variables->type == SNMP_NOSUCHOBJECT
-			 || response->variables->type == SNMP_NOSUCHINSTANCE
-			 || response->variables->type == SNMP_ENDOFMIBVIEW
+		for (n = 0, var = response->variables; var != NULL && rows > 0;
+			var = var->next_variable, n++
+		) {
+			/* Stop at the end of the column (or if it is not one) */
+			if (var->type == SNMP_ENDOFMIBVIEW
+			 || var->name_length != base_len + 1
+			 || memcmp(var->name, base, base_len * sizeof(oid)) != 0
 			) {
-				if (log_unhandled_loudly) {
-					upslogx(LOG_WARNING, "[%s] Warning: type error exception (OID = %s)",
-						upsname?upsname:device_name, OID);
-				} else {
-					upsdebugx(2, "[%s] Warning: type error exception (OID = %s)",
-						upsname?upsname:device_name, OID);
-				}
-				snmp_free_pdu(response);
+				done = TRUE;
 				break;
 			}
-			else {
-				/* no error */
-				numerr = 0;
+
+			/* Only keep the rows asked for */
+			while (want < count && rowids[want] < var->name[base_len])
+				want++;
+			if (want < count && rowids[want] == var->name[base_len]) {
+				struct snmp_pdu	*var_pdu = snmp_split_pdu(response, n, 1);
+
+				if (var_pdu != NULL) {
+					su_prefetch_store(OIDs[want], var_pdu);
+					got++;
+				}
+				want++;
 			}
-		}
 
-		nb_iteration++;
-		/* +1 is for the terminating NULL */
-		new_ret_array = (struct snmp_pdu**)realloc(
-			ret_array,
-			sizeof(struct snmp_pdu*) * ((size_t)nb_iteration+1)
-			);
-		if (new_ret_array == NULL) {
-			upsdebugx(1, "%s: Failed to realloc ret_array", __func__);
-			break;
-		}
-		else {
-			ret_array = new_ret_array;
+			memcpy(next, var->name, var->name_length * sizeof(oid));
+			next_len = var->name_length;
+			rows--;
 		}
-		ret_array[nb_iteration-1] = response;
-		ret_array[nb_iteration]=NULL;
 
-		current_name = response->variables->name;
-		current_name_len = response->variables->name_length;
+		if (n == 0)
+			done = TRUE;
 
-		type = SNMP_MSG_GETNEXT;
+		snmp_free_pdu(response);
+		if (done)
+			break;
 	}
 
-	return ret_array;
+	free(rowids);
+	return got;
 }
 
 static struct snmp_pdu *do_nut_snmp_get(const char *OID, int log_unhandled_loudly)
@@ -1440,6 +2684,28 @@ static struct snmp_pdu *do_nut_snmp_get(const char *OID, int log_unhandled_loudl
 
 	upsdebugx(3, "%s(%s)", __func__, OID);
 
+	if ((ret_pdu = su_prefetch_lookup(OID)) != NULL) {
+		/* Same checks as nut_snmp_walk() does for a single answer */
+		if (ret_pdu->variables == NULL
+		 || ret_pdu->variables->type == SNMP_NOSUCHOBJECT
+		 || ret_pdu->variables->type == SNMP_NOSUCHINSTANCE
+		 || ret_pdu->variables->type == SNMP_ENDOFMIBVIEW
+		) {
+			if (log_unhandled_loudly) {
+				upslogx(LOG_WARNING, "[%s] Warning: type error exception (OID = %s)",
+					upsname?upsname:device_name, OID);
+			} else {
+				upsdebugx(2, "[%s] Warning: type error exception (OID = %s)",
+					upsname?upsname:device_name, OID);
+			}
+			snmp_free_pdu(ret_pdu);
+			return NULL;
+		}
+
+		upsdebugx(4, "%s: using prefetched value", __func__);
+		return ret_pdu;
+	}
+
 	pdu_array = nut_snmp_walk(OID, 1, log_unhandled_loudly);
 
 	if(pdu_array == NULL) {
@@ -1698,10 +2964,11 @@ bool_t nut_snmp_set(const char *OID, char type, const char *value)
 	struct snmp_pdu *pdu, *response = NULL;
 	oid name[MAX_OID_LEN];
 	size_t name_len = MAX_OID_LEN;
+	st_tree_timespec_t start;
 
 	upsdebugx(1, "entering %s(%s, %c, %s)", __func__, OID, type, value);
 
-	if (!snmp_parse_oid(OID, name, &name_len)) {
+	if (!su_parse_oid(OID, name, &name_len)) {
 		upslogx(LOG_ERR, "[%s] %s: %s: %s",
 			upsname?upsname:device_name, __func__, OID, snmp_api_errstring(snmp_errno));
 		return FALSE;
@@ -1718,7 +2985,11 @@ bool_t nut_snmp_set(const char *OID, char type, const char *value)
 		return FALSE;
 	}
 
+	dstate_perf_start(&start);
 	status = snmp_synch_response(g_snmp_sess_p, pdu, &response);
+	dstate_perf_since(status == STAT_SUCCESS ? "snmp.set" :
+		(status == STAT_TIMEOUT ? "snmp.set.timeout" : "snmp.set.error"),
+		&start);
 
 	if ((status == STAT_SUCCESS) && (response->errstat == SNMP_ERR_NOERROR))
 		ret = TRUE;
@@ -2047,10 +3318,90 @@ void su_alarm_set(snmp_info_t *su_info_p, long value)
 	/* TODO: else */
 }
 
+/* Hash index of the entries of snmp_info by (case-insensitive) info_type,
+ * built when a mapping table is first searched, since su_find_info() is
+ * called for each setvar and each instant command.  The mapping tables
+ * are static and never modified, so the index stays valid for as long as
+ * the same table is in use. */
+static snmp_info_t	*info_index_table = NULL;	/* the indexed snmp_info */
+static snmp_info_t	**info_index = NULL;
+static size_t	info_index_size = 0;	/* a power of 2 */
+
+/* Binary forms of the mib2nut[] sysOIDs, parsed once for match_sysoid()
+ * (each only when first compared) */
+typedef struct {
+	int	parsed;	/* whether name was set already */
+	oid	*name;	/* NULL if there is none, or it can not be parsed */
+	size_t	name_len;
+} su_sysoid_t;
+
+static su_sysoid_t	*sysoid_index = NULL;
+
+static size_t su_info_hash(const char *type)
+{
+	size_t	hash = 5381;
+
+	for (; *type != '\0'; type++)
+		hash = hash * 33 + (size_t)tolower((unsigned char)*type);
+
+	return hash;
+}
+
+static void su_info_index_build(void)
+{
+	snmp_info_t	*su_info_p;
+	size_t	count = 0, i;
+
+	free(info_index);
+
+	for (su_info_p = snmp_info; su_info_p->info_type != NULL; su_info_p++)
+		count++;
+
+	for (info_index_size = 16; info_index_size < count * 2; info_index_size *= 2)
+		;
+	info_index = (snmp_info_t **)xcalloc(info_index_size, sizeof(snmp_info_t *));
+
+	for (su_info_p = snmp_info; su_info_p->info_type != NULL; su_info_p++) {
+		for (i = su_info_hash(su_info_p->info_type) & (info_index_size - 1);
+			info_index[i] != NULL;
+			i = (i + 1) & (info_index_size - 1)
+		) {
+			/* Keep the first entry, as the linear search did */
+			if (!strcasecmp(info_index[i]->info_type, su_info_p->info_type))
+				break;
+		}
+
+		if (info_index[i] == NULL)
+			info_index[i] = su_info_p;
+	}
+
+	info_index_table = snmp_info;
+	upsdebugx(3, "%s: indexed %" PRIuSIZE " entries", __func__, count);
+}
+
+static void su_lookup_free(void)
+{
+	int	i;
+
+	su_oid_cache_free();
+
+	free(info_index);
+	info_index = NULL;
+	info_index_table = NULL;
+	info_index_size = 0;
+
+	if (sysoid_index != NULL) {
+		for (i = 0; mib2nut[i] != NULL; i++)
+			free(sysoid_index[i].name);
+		free(sysoid_index);
+		sysoid_index = NULL;
+	}
+}
+
 /* find info element definition in my info array. */
 snmp_info_t *su_find_info(const char *type)
 {
-	snmp_info_t *su_info_p;
+	size_t	i;
 
 	if (snmp_info == NULL) {
 		fatalx(EXIT_FAILURE, "%s: snmp_info is not initialized", __func__);
@@ -2060,11 +3411,18 @@ snmp_info_t *su_find_info(const char *type)
 		upsdebugx(1, "%s: WARNING: snmp_info is empty", __func__);
 	}
 
-	for (su_info_p = &snmp_info[0]; (su_info_p != NULL && su_info_p->info_type != NULL) ; su_info_p++)
-		if (!strcasecmp(su_info_p->info_type, type)) {
+	if (info_index_table != snmp_info)
+		su_info_index_build();
+
+	for (i = su_info_hash(type) & (info_index_size - 1);
+		info_index[i] != NULL;
+		i = (i + 1) & (info_index_size - 1)
+	) {
+		if (!strcasecmp(info_index[i]->info_type, type)) {
 			upsdebugx(3, "%s: \"%s\" found", __func__, type);
-			return su_info_p;
+			return info_index[i];
 		}
+	}
 
 	upsdebugx(3, "%s: unknown info type (%s)", __func__, type);
 	return NULL;
@@ -2120,6 +3478,34 @@ static bool_t match_model_OID(void)
 	return retCode;
 }
 
+/* Binary form of the sysOID of mib2nut[i], parsed on first use */
+static su_sysoid_t *su_sysoid_parse(int i)
+{
+	oid mib2nut_sysOID[MAX_OID_LEN];
+	size_t mib2nut_sysOID_len = MAX_OID_LEN;
+
+	if (sysoid_index[i].parsed)
+		return &sysoid_index[i];
+
+	sysoid_index[i].parsed = 1;
+
+	if (mib2nut[i]->sysOID == NULL)
+		return &sysoid_index[i];
+
+	if (!read_objid(mib2nut[i]->sysOID, mib2nut_sysOID, &mib2nut_sysOID_len))
+	{
+		upsdebugx(2, "%s: can't build OID %s: %s",
+			__func__, mib2nut[i]->sysOID, snmp_api_errstring(snmp_errno));
+		return &sysoid_index[i];
+	}
+
+	sysoid_index[i].name = (oid *)xcalloc(mib2nut_sysOID_len, sizeof(oid));
+	memcpy(sysoid_index[i].name, mib2nut_sysOID, mib2nut_sysOID_len * sizeof(oid));
+	sysoid_index[i].name_len = mib2nut_sysOID_len;
+
+	return &sysoid_index[i];
+}
+
 /* Try to find the MIB using sysOID matching.
  * Return a pointer to a mib2nut definition if found, NULL otherwise */
 static mib2nut_info_t *match_sysoid(void)
@@ -2127,10 +3513,16 @@ static mib2nut_info_t *match_sysoid(void)
 	char sysOID_buf[LARGEBUF];
 	oid device_sysOID[MAX_OID_LEN];
 	size_t device_sysOID_len = MAX_OID_LEN;
-	oid mib2nut_sysOID[MAX_OID_LEN];
-	size_t mib2nut_sysOID_len = MAX_OID_LEN;
 	int i;
 
+	/* Room for the parsed sysOIDs of all the mappings, kept for all the
+	 * attempts; each is only parsed once the loop below gets to it */
+	if (sysoid_index == NULL) {
+		for (i = 0; mib2nut[i] != NULL; i++)
+			;
+		sysoid_index = (su_sysoid_t *)xcalloc((size_t)i + 1, sizeof(su_sysoid_t));
+	}
+
 	/* Retrieve sysOID value of this device */
 	if (nut_snmp_get_oid(SYSOID_OID, sysOID_buf, sizeof(sysOID_buf)) != TRUE)
 	{
@@ -2158,25 +3550,14 @@ static mib2nut_info_t *match_sysoid(void)
 	{
 		upsdebugx(1, "%s: checking MIB %s", __func__, mib2nut[i]->mib_name);
 
-		if (mib2nut[i]->sysOID == NULL)
-			continue;
-
-		/* Clear variables */
-		memset(mib2nut_sysOID, 0, sizeof(mib2nut_sysOID));
-		mib2nut_sysOID_len = MAX_OID_LEN;
-
-		if (!read_objid(mib2nut[i]->sysOID, mib2nut_sysOID, &mib2nut_sysOID_len))
-		{
-			upsdebugx(2, "%s: can't build OID %s: %s",
-				__func__, sysOID_buf, snmp_api_errstring(snmp_errno));
-
-			/* Try to continue anyway! */
+		/* No sysOID, or could not be parsed: try to continue anyway! */
+		if (su_sysoid_parse(i)->name == NULL)
 			continue;
-		}
 
 		/* Now compare these */
 		upsdebugx(1, "%s: comparing %s with %s", __func__, sysOID_buf, mib2nut[i]->sysOID);
-		if (!netsnmp_oid_equals(device_sysOID, device_sysOID_len, mib2nut_sysOID, mib2nut_sysOID_len))
+		if (!netsnmp_oid_equals(device_sysOID, device_sysOID_len,
+			sysoid_index[i].name, sysoid_index[i].name_len))
 		{
 			upsdebugx(2, "%s: sysOID matches MIB '%s'!", __func__, mib2nut[i]->mib_name);
 			/* Counter verify, using {ups,device}.model */
@@ -2217,6 +3598,41 @@ static mib2nut_info_t *match_sysoid(void)
 	return NULL;
 }
 
+/* Try first the MIB which matched the device last time, if known from
+ * the warm-start snapshot (whose file is already specific to the host):
+ * one counter check of it instead of the sysOID and classic matching.
+ * Return a pointer to a mib2nut definition if found, NULL otherwise */
+static mib2nut_info_t *match_mib_snapshot(void)
+{
+	const char	*hint = dstate_snapshot_gethint("snmp-ups.mib");
+	int	i;
+
+	if (!hint)
+		return NULL;
+
+	for (i = 0; mib2nut[i] != NULL; i++) {
+		if (strcmp(mib2nut[i]->mib_name, hint))
+			continue;
+
+		snmp_info = mib2nut[i]->snmp_info;
+		if (snmp_info == NULL)
+			break;
+
+		if (match_model_OID() == TRUE) {
+			upsdebugx(2, "%s: MIB '%s' found last time still matches",
+				__func__, hint);
+			return mib2nut[i];
+		}
+
+		upsdebugx(1, "%s: MIB '%s' found last time does not match anymore",
+			__func__, hint);
+		snmp_info = NULL;
+		break;
+	}
+
+	return NULL;
+}
+
 /* Load the right snmp_info_t structure matching mib parameter */
 bool_t load_mib2nut(const char *mib)
 {
@@ -2233,10 +3649,14 @@ bool_t load_mib2nut(const char *mib)
 		device_path /* the "port" from config section is hostname/IP for networked drivers */
 		);
 
+	/* Unless told which MIB to use, first try the one used last time */
+	if (mibIsAuto)
+		m2n = match_mib_snapshot();
+
 	/* First, try to match against sysOID, if no MIB was provided.
 	 * This should speed up init stage
 	 * (Note: sysOID points the device main MIB entry point) */
-	if (mibIsAuto)
+	if (mibIsAuto && m2n == NULL)
 	{
 		upsdebugx(2, "%s: trying the new match_sysoid() method with %s",
 			__func__, mib);
@@ -2331,6 +3751,9 @@ bool_t load_mib2nut(const char *mib)
 			__func__, mibname,
 			upsname ? upsname : device_name, device_path);
 
+		/* Remember it for the next start (if warm-start snapshots are used) */
+		dstate_snapshot_sethint("snmp-ups.mib", mibname);
+
 		/* FIXME: also "tripplite" on devices that do not identify as such */
 		if (mibIsAuto && strcasecmp(mibname, "ietf"))
 			upsdebugx(0, "Only the IETF standard mapping was found as fallback. "
@@ -2746,6 +4169,115 @@ static int guesstimate_template_count(snmp_info_t *su_info_p)
 /* Process template definition, instantiate and get data or register
  * command
  * type: outlet, outlet.group, device */
+/* Format the OID of instance <cur_template_number> of the template into
+ * <OID>. Return FALSE (leaving <OID> untouched) if there is nothing to
+ * format, i.e. for the whole daisychain ("device.0") */
+static bool_t template_instance_OID(const char *type, const snmp_info_t *su_info_p,
+	int cur_template_number, char *OID, size_t OID_len)
+{
+	/* Special processing for daisychain */
+	if (!strncmp(type, "device", 6)) {
+		if (current_device_number > 0) {
+			snprintf_dynamic(OID, OID_len, su_info_p->OID, "%i", current_device_number + device_template_offset);
+			return TRUE;
+		}
+		/*else
+		 * FIXME: daisychain-whole, what to do?
+		 */
+		return FALSE;
+	}
+
+	/* Special processing for daisychain:
+	 * these outlet | outlet groups also include formatting info,
+	 * so we have to check if the daisychain is enabled, and if
+	 * the formatting info for it are in 1rst or 2nd position */
+	if (daisychain_enabled == TRUE) {
+		if (su_info_p->flags & SU_TYPE_DAISY_1) {
+			snprintf_dynamic(OID, OID_len,
+				su_info_p->OID, "%i%i",
+				current_device_number + device_template_offset,
+				cur_template_number);
+		}
+		else if (su_info_p->flags & SU_TYPE_DAISY_2) {
+			snprintf_dynamic(OID, OID_len,
+				su_info_p->OID, "%i%i",
+				cur_template_number + device_template_offset,
+				current_device_number - device_template_offset);
+		}
+		else {
+			/* Note: no device daisychain templating (SU_TYPE_DAISY_MASTER_ONLY)! */
+			snprintf_dynamic(OID, OID_len,
+				su_info_p->OID, "%i",
+				cur_template_number);
+		}
+	}
+	else {
+		snprintf_dynamic(OID, OID_len,
+				su_info_p->OID, "%i",
+				cur_template_number);
+	}
+
+	return TRUE;
+}
+
+/* Prefetch the values of all the instances of an outlet, outlet group
+ * or ambient template, which process_template() is about to request one
+ * by one.  With SNMPv2c/v3 the table column is read with GETBULK, and
+ * the instance OIDs which this did not get (all of them with SNMPv1, or
+ * if they are not rows of a column) are requested in multi-varbind GETs. */
+static void su_prefetch_template(int mode, const char *type,
+	snmp_info_t *su_info_p, int base_snmp_index, int template_count)
+{
+	char	**OIDs, **missing;
+	int	i, rows;
+	size_t	got = 0, missing_count = 0;
+
+	/* "device" templates resolve to one OID per device, and commands
+	 * are not read at all */
+	if (su_info_p->OID == NULL || !strncmp(type, "device", 6)
+	 || SU_TYPE(su_info_p) == SU_TYPE_CMD || template_count < 2)
+		return;
+
+	if (mode == SU_WALKMODE_UPDATE && !(su_info_p->flags & SU_FLAG_OK))
+		return;
+
+	if (daisychain_enabled == TRUE
+	 && (su_info_p->flags & SU_TYPE_DAISY_MASTER_ONLY)
+	 && current_device_number != 1)
+		return;
+
+	OIDs = (char **)xcalloc((size_t)template_count, sizeof(char *));
+	for (i = 0; i < template_count; i++) {
+		OIDs[i] = (char *)xcalloc(SU_INFOSIZE, sizeof(char));
+		template_instance_OID(type, su_info_p, base_snmp_index + i,
+			OIDs[i], SU_INFOSIZE);
+	}
+
+	/* For SU_TYPE_DAISY_2, the rows of all devices are interleaved
+	 * in the column */
+	rows = template_count;
+	if (daisychain_enabled == TRUE && (su_info_p->flags & SU_TYPE_DAISY_2)
+	 && devices_count > 1)
+		rows = template_count * (int)devices_count;
+
+	if (g_snmp_sess_p != NULL && g_snmp_sess_p->version != SNMP_VERSION_1)
+		got = su_prefetch_bulk(OIDs, (size_t)template_count, rows);
+
+	if (got < (size_t)template_count) {
+		missing = (char **)xcalloc((size_t)template_count, sizeof(char *));
+		for (i = 0; i < template_count; i++) {
+			if (su_prefetch_find(OIDs[i]) == NULL)
+				missing[missing_count++] = OIDs[i];
+		}
+		su_prefetch_get(missing, missing_count);
+		free(missing);
+	}
+
+	for (i = 0; i < template_count; i++)
+		free(OIDs[i]);
+	free(OIDs);
+}
+
 static bool_t process_template(int mode, const char* type, snmp_info_t *su_info_p)
 {
 	/* Default to TRUE, and leave to get_and_process_data() to set
@@ -2792,6 +4324,8 @@ static bool_t process_template(int mode, const char* type, snmp_info_t *su_info_
 
 		base_snmp_index = base_snmp_template_index(su_info_p);
 
+		su_prefetch_template(mode, type, su_info_p, base_snmp_index, template_count);
+
 		for (cur_template_number = base_snmp_index ;
 				cur_template_number < (template_count + base_snmp_index) ;
 				cur_template_number++)
@@ -2905,46 +4439,8 @@ static bool_t process_template(int mode, const char* type, snmp_info_t *su_info_
 			}
 
 			if (cur_info_p.OID != NULL) {
-				/* Special processing for daisychain */
-				if (!strncmp(type, "device", 6)) {
-					if (current_device_number > 0) {
-						snprintf_dynamic((char *)cur_info_p.OID, SU_INFOSIZE, su_info_p->OID, "%i", current_device_number + device_template_offset);
-					}
-					/*else
-					 * FIXME: daisychain-whole, what to do?
-					 */
-				}
-				else {
-					/* Special processing for daisychain:
-					 * these outlet | outlet groups also include formatting info,
-					 * so we have to check if the daisychain is enabled, and if
-					 * the formatting info for it are in 1rst or 2nd position */
-					if (daisychain_enabled == TRUE) {
-						if (su_info_p->flags & SU_TYPE_DAISY_1) {
-							snprintf_dynamic((char *)cur_info_p.OID, SU_INFOSIZE,
-								su_info_p->OID, "%i%i",
-								current_device_number + device_template_offset,
-								cur_template_number);
-						}
-						else if (su_info_p->flags & SU_TYPE_DAISY_2) {
-							snprintf_dynamic((char *)cur_info_p.OID, SU_INFOSIZE,
-								su_info_p->OID, "%i%i",
-								cur_template_number + device_template_offset,
-								current_device_number - device_template_offset);
-						}
-						else {
-							/* Note: no device daisychain templating (SU_TYPE_DAISY_MASTER_ONLY)! */
-							snprintf_dynamic((char *)cur_info_p.OID, SU_INFOSIZE,
-								su_info_p->OID, "%i",
-								cur_template_number);
-						}
-					}
-					else {
-						snprintf_dynamic((char *)cur_info_p.OID, SU_INFOSIZE,
-								su_info_p->OID, "%i",
-								cur_template_number);
-					}
-				}
+				template_instance_OID(type, su_info_p, cur_template_number,
+					(char *)cur_info_p.OID, SU_INFOSIZE);
 
 				/* add instant commands to the info database. */
 				if (SU_TYPE(su_info_p) == SU_TYPE_CMD) {
@@ -3345,6 +4841,82 @@ static int process_phase_data(const char* type, long *nb_phases, snmp_info_t *su
 }
 
 
+/* Prefetch the OIDs of the plain (not outlet, outlet group or ambient
+ * template) entries that snmp_ups_walk() is going to read for the
+ * current device, using the same criteria to skip the others */
+static void su_prefetch_walk(int mode)
+{
+	snmp_info_t	*su_info_p;
+	char	OID[SU_INFOSIZE];
+	char	**OIDs = NULL;
+	size_t	count = 0, alloc = 0, i;
+
+	su_prefetch_clear();
+
+	if (max_varbinds < 2)
+		return;
+
+	/* skipped by the walk for now */
+	if (current_device_number == 0 && daisychain_enabled == TRUE)
+		return;
+
+	for (su_info_p = &snmp_info[0]; su_info_p->info_type != NULL; su_info_p++) {
+		if (su_info_p->OID == NULL
+		 || SU_TYPE(su_info_p) == SU_TYPE_CMD
+		 || (su_info_p->flags & (SU_OUTLET | SU_OUTLET_GROUP | SU_AMBIENT_TEMPLATE | SU_FLAG_ABSENT))
+		) {
+			continue;
+		}
+
+		if (mode == SU_WALKMODE_UPDATE) {
+			if (!(su_info_p->flags & SU_FLAG_OK)
+			 || (su_info_p->flags & SU_FLAG_STATIC)
+			 || ((su_info_p->flags & SU_FLAG_SEMI_STATIC) && semistatic_countdown != 0)
+			 || (walk_targeted == TRUE && su_trap_target(su_info_p) == FALSE)
+			) {
+				continue;
+			}
+		} else if (!strncmp(su_info_p->info_type, "device.count", 12)) {
+			continue;
+		}
+
+		/* entries for another number of phases are not read either;
+		 * the walk would find out the phases the same way first */
+		if (((su_info_p->flags & SU_INPHASES) && process_phase_data("input",
+			&daisychain_info[current_device_number]->input_phases, su_info_p) == 1)
+		 || ((su_info_p->flags & SU_OUTPHASES) && process_phase_data("output",
+			&daisychain_info[current_device_number]->output_phases, su_info_p) == 1)
+		 || ((su_info_p->flags & SU_BYPPHASES) && process_phase_data("input.bypass",
+			&daisychain_info[current_device_number]->bypass_phases, su_info_p) == 1)
+		) {
+			continue;
+		}
+
+		/* daisychain templates get instantiated like in su_ups_get() */
+		if (strchr(su_info_p->OID, '%') != NULL) {
+			if (snprintf_dynamic(OID, sizeof(OID), su_info_p->OID,
+				"%i", current_device_number + device_template_offset) < 0
+			) {
+				continue;
+			}
+		} else {
+			snprintf(OID, sizeof(OID), "%s", su_info_p->OID);
+		}
+
+		if (count == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			OIDs = (char **)xrealloc(OIDs, alloc * sizeof(char *));
+		}
+		OIDs[count++] = xstrdup(OID);
+	}
+
+	su_prefetch_get(OIDs, count);
+
+	for (i = 0; i < count; i++)
+		free(OIDs[i]);
+	free(OIDs);
+}
+
 /* walk ups variables and set elements of the info array. */
 bool_t snmp_ups_walk(int mode)
 {
@@ -3356,7 +4928,7 @@ bool_t snmp_ups_walk(int mode)
 	snmp_info_t *su_info_p;
 	bool_t status = FALSE;
 
-	if (mode == SU_WALKMODE_UPDATE) {
+	if (mode == SU_WALKMODE_UPDATE && walk_targeted == FALSE) {
 		/* Below we skip semi-static elements in update mode:
 		 * only parse when countdown reaches exactly 0 */
 		semistatic_countdown--;
@@ -3403,6 +4975,9 @@ bool_t snmp_ups_walk(int mode)
 			upsdebugx(1, "%s: WARNING: snmp_info is empty", __func__);
 		}
 
+		/* get the data of plain entries in as few requests as possible */
+		su_prefetch_walk(mode);
+
 		/* Loop through all mapping entries for the current_device_number */
 		for (su_info_p = &snmp_info[0]; (su_info_p != NULL && su_info_p->info_type != NULL) ; su_info_p++) {
 
@@ -3438,6 +5013,7 @@ bool_t snmp_ups_walk(int mode)
 			/* Check if we are asked to stop (reactivity++) */
 			if (exit_flag != 0) {
 				upsdebugx(1, "%s: aborting because exit_flag was set", __func__);
+				su_prefetch_clear();
 				return TRUE;
 			}
 
@@ -3485,6 +5061,10 @@ bool_t snmp_ups_walk(int mode)
 				continue;
 			}
 
+			/* only re-read what traps pointed at, between the updates */
+			if (walk_targeted == TRUE && su_trap_target(su_info_p) == FALSE)
+				continue;
+
 			/* Set default value if we cannot fetch it
 			 * and set static flag on this element.
 			 * Not applicable to outlets (need SU_FLAG_STATIC tagging) */
@@ -3597,6 +5177,9 @@ bool_t snmp_ups_walk(int mode)
 		}
 	}
 
+	/* values are only good for this walk */
+	su_prefetch_clear();
+
 #ifdef COUNT_ITERATIONS
 	iterations++;
 #endif
@@ -139,6 +139,10 @@
 #define DEFAULT_NETSNMP_RETRIES   5
 #define DEFAULT_NETSNMP_TIMEOUT   1    /* in seconds */
 #define DEFAULT_SEMISTATICFREQ    10   /* in snmpwalk update cycles */
+#define DEFAULT_MAXVARBINDS       16   /* OIDs per GET request */
+#define DEFAULT_MAXREQUESTS       4    /* GET requests in flight */
+#define SU_TRAP_MAXOIDS           64   /* varbinds remembered between updates */
+#define SU_TRAP_MINWAIT           2    /* in seconds between trap updates */
 
 /* use explicit booleans */
 #ifndef FALSE
@@ -372,6 +376,11 @@ typedef struct {
 #define SU_VAR_SEMISTATICFREQ	"semistaticfreq"
 #define SU_VAR_MIBS			"mibs"
 #define SU_VAR_POLLFREQ		"pollfreq"
+#define SU_VAR_MAXVARBINDS	"snmp_max_varbinds"
+#define SU_VAR_MAXREQUESTS	"snmp_max_requests"
+#define SU_VAR_TRAPLISTEN	"trap_listen"
+#define SU_VAR_TRAPCOMMUNITY	"trap_community"
+#define SU_VAR_KEYCACHE		"snmp_keycache"
 /* SNMP v3 related parameters */
 #define SU_VAR_SECLEVEL		"secLevel"
 #define SU_VAR_SECNAME		"secName"
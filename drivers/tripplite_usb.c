@@ -1708,6 +1708,11 @@ void upsdrv_makevartable(void)
 	/* allow -x vendor=X, vendorid=X, product=X, productid=X, serial=X */
 	nut_usb_addvars();
 
+#if WITH_LIBUSB_1_0
+	/* allow -x usb_record=FILE, usb_replay=FILE */
+	nut_libusb_capture_addvars();
+#endif	/* WITH_LIBUSB_1_0 */
+
 	snprintf(msg, sizeof msg, "Minimum battery voltage, corresponding to 10%% charge (default=%.1f)",
 		MIN_VOLT);
 	addvar(VAR_VALUE, "battery_min", msg);
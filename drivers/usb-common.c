@@ -21,6 +21,11 @@
 #include "common.h"
 #include "usb-common.h"
 
+#ifdef HAVE_LINUX_NETLINK_H
+# include <sys/socket.h>
+# include <linux/netlink.h>
+#endif
+
 int is_usb_device_supported(usb_device_id_t *usb_device_id_list, USBDevice_t *device)
 {
 	int retval = NOT_SUPPORTED;
@@ -523,3 +528,86 @@ int nut_usb_get_string(
 
 	return len;
 }
+
+int nut_usb_uevent_open(void)
+{
+#ifdef HAVE_LINUX_NETLINK_H
+	struct sockaddr_nl	sa;
+	int	fd, err;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		NETLINK_KOBJECT_UEVENT);
+	if (fd < 0) {
+		upsdebug_with_errno(1, "%s: socket(NETLINK_KOBJECT_UEVENT)", __func__);
+		return -1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = 1;	/* the kernel's own (udev re-sends on group 2) */
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		err = errno;
+		upsdebug_with_errno(1, "%s: bind", __func__);
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	return fd;
+#else	/* !HAVE_LINUX_NETLINK_H */
+	errno = ENOSYS;
+	return -1;
+#endif	/* !HAVE_LINUX_NETLINK_H */
+}
+
+int nut_usb_uevent_read(int fd)
+{
+#ifdef HAVE_LINUX_NETLINK_H
+	char	buf[4096];
+	const char	*p;
+	struct sockaddr_nl	sa;
+	socklen_t	salen;
+	ssize_t	len;
+	int	added = 0;
+
+	for (;;) {
+		salen = sizeof(sa);
+		len = recvfrom(fd, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&sa, &salen);
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			return -1;
+		}
+
+		/* only trust messages from the kernel itself */
+		if (salen != sizeof(sa) || sa.nl_pid != 0) {
+			continue;
+		}
+
+		/* "ACTION@DEVPATH", then "KEY=VALUE" strings, all NUL-terminated;
+		 * interfaces of a device are reported too, skip those */
+		buf[len] = '\0';
+		if (strncmp(buf, "add@", 4)) {
+			continue;
+		}
+
+		for (p = buf + strlen(buf) + 1; p < buf + len; p += strlen(p) + 1) {
+			if (!strcmp(p, "DEVTYPE=usb_device")) {
+				upsdebugx(3, "%s: %s", __func__, buf);
+				added = 1;
+				break;
+			}
+		}
+	}
+
+	return added;
+#else	/* !HAVE_LINUX_NETLINK_H */
+	NUT_UNUSED_VARIABLE(fd);
+	errno = ENOSYS;
+	return -1;
+#endif	/* !HAVE_LINUX_NETLINK_H */
+}
@@ -571,4 +571,13 @@ void warn_if_bad_usb_port_filename(const char *fn);
  * langid descriptor is invalid. */
 int nut_usb_get_string(usb_dev_handle *udev, int StringIdx, char *buf, size_t buflen);
 
+/* Kernel notifications about USB devices (Linux netlink uevents), for
+ * the USB layer to learn about device arrivals without help of libusb.
+ * nut_usb_uevent_open() returns a non-blocking socket to watch, or -1
+ * with errno set (ENOSYS where not supported). nut_usb_uevent_read()
+ * drains it and returns 1 if a USB device was added meanwhile, 0 if
+ * not, or -1 with errno on error. */
+int nut_usb_uevent_open(void);
+int nut_usb_uevent_read(int fd);
+
 #endif /* NUT_USB_COMMON_H */
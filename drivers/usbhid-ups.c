@@ -41,6 +41,9 @@
 #include "hidparser.h"
 #include "hidtypes.h"
 #include "common.h"
+
+#include <ctype.h>
+
 #ifdef WIN32
 #include "wincompat.h"
 #endif	/* WIN32 */
@@ -121,6 +124,16 @@ typedef enum {
 	HU_WALKMODE_FULL_UPDATE
 } walkmode_t;
 
+/* Reports needed by one update walk, each read from the device once */
+typedef struct {
+	HIDData_t	*wanted[256];	/* an item of each needed report, by ReportID */
+	int	status[256];	/* outcome of reading each report, see HIDRefreshReports() */
+} hid_walk_plan_t;
+
+/* In "pollonly" mode, reports holding only static data are re-read
+ * once per this many full updates */
+#define HU_STATIC_REPORT_CYCLES	10
+
 /* pointer to the active subdriver object (changed in callback() function) */
 static subdriver_t *subdriver = NULL;
 
@@ -139,6 +152,7 @@ static HIDDeviceMatcher_t *regex_matcher = NULL;
 static int pollfreq = DEFAULT_POLLFREQ;
 static unsigned ups_status = 0;
 static bool_t data_has_changed = FALSE; /* for SEMI_STATIC data polling */
+static time_t static_reports_ts = 0; /* when reports with only STATIC data were last read */
 #ifndef SUN_LIBUSB
 bool_t use_interrupt_pipe = TRUE;
 #else
@@ -251,15 +265,50 @@ static int lbrb_log_delay_without_calibrating = 0;
 static time_t last_lb_start = 0;
 static time_t last_rb_start = 0;
 
+/**
+ * Hash indexes of the hid2nut entries which got mapped to HID data, by
+ * NUT variable name and by HID data pointer, for find_nut_info() and
+ * find_hid_info(). Rebuilt on next use whenever a hiddata is (un)set.
+ */
+static hid_info_t	**hid_info_name_index = NULL;
+static hid_info_t	**hid_info_data_index = NULL;
+static size_t	hid_info_index_size = 0;	/* power of two, 0 if not built */
+static int	hid_info_index_dirty = 1;
+
+/**
+ * Last conversion of a raw HID value to its NUT value, for each hid2nut
+ * entry (same position), so that ups_infoval_set() need not repeat the
+ * lookup or formatting while the value does not change. Only the lookup
+ * tables, and the conversion functions known to depend on nothing but
+ * their argument (see hu_lkp_fun_memoizable()), are remembered.
+ */
+typedef struct {
+	bool_t	valid;
+	double	value;
+	const char	*nutvalue;	/* in lookup table, or buf */
+	char	buf[32];
+} hid_info_memo_t;
+
+static hid_info_memo_t	*hid_info_memo = NULL;
+static hid_info_t	*hid_info_memo_table = NULL;	/* the hid2nut it is for */
+static size_t	hid_info_memo_count = 0;
+
 /* support functions */
 static hid_info_t *find_nut_info(const char *varname);
 static hid_info_t *find_hid_info(const HIDData_t *hiddata);
+static void hid_info_index_build(void);
+static void parsed_rdesc_forget(void);
 static const char *hu_find_infoval(info_lkp_t *hid2info, const double value);
+static const char *hu_find_infoval_memo(hid_info_t *item, const double value);
+static void hid_info_memo_free(void);
 static long hu_find_valinfo(info_lkp_t *hid2info, const char* value);
 static void process_boolean_info(const char *nutvalue);
 static void ups_alarm_set(void);
 static void ups_status_set(void);
 static bool_t hid_ups_walk(walkmode_t mode);
+static bool_t hid_ups_item_due(const hid_info_t *item, walkmode_t mode);
+static bool_t hid_ups_report_blocked(const hid_info_t *item);
+static void hid_ups_walk_plan(walkmode_t mode, hid_walk_plan_t *plan);
 static int reconnect_ups(void);
 static int ups_infoval_set(hid_info_t *item, double value);
 static int callback(hid_dev_handle_t argudev, HIDDevice_t *arghd,
@@ -1365,6 +1414,13 @@ void upsdrv_makevartable(void)
 		"Don't use polling, only use interrupt pipe");
 	addvar(VAR_VALUE, "interruptsize",
 		"Number of bytes to read from interrupt pipe");
+#if WITH_LIBUSB_1_0
+	addvar(VAR_FLAG, "sync_interrupt",
+		"Read interrupt pipe synchronously, rather than keep a transfer pending");
+
+	/* allow -x usb_record=FILE, usb_replay=FILE */
+	nut_libusb_capture_addvars();
+#endif	/* WITH_LIBUSB_1_0 */
 	addvar(VAR_VALUE, HU_VAR_WAITBEFORERECONNECT,
 		"Seconds to wait before trying to reconnect");
 
@@ -1390,9 +1446,14 @@ void upsdrv_updateinfo(void)
 
 	/* check for device availability to set datastale! */
 	if (reconnecting) {
-		/* don't flood reconnection attempts */
+		/* don't flood reconnection attempts, unless the USB layer
+		 * saw a device arrive (it woke us up for that) */
 		int	maylog;
-		if (now < (lastpoll + poll_interval)) {
+		if (now < (lastpoll + poll_interval)
+#if !((defined SHUT_MODE) && SHUT_MODE) && WITH_LIBUSB_1_0
+		 && !(comm_driver == &usb_subdriver && nut_libusb_device_arrived())
+#endif	/* !SHUT_MODE && WITH_LIBUSB_1_0 */
+		) {
 			return;
 		}
 
@@ -1735,6 +1796,12 @@ void upsdrv_initups(void)
 	comm_driver = &usb_subdriver;
 # endif	/* WIN32 */
 
+# if WITH_LIBUSB_1_0
+	if (comm_driver == &usb_subdriver && !testvar("sync_interrupt")) {
+		nut_libusb_set_async_interrupt(1);
+	}
+# endif	/* WITH_LIBUSB_1_0 */
+
 	transport_backend = dstate_getinfo("driver.version.usb");
 # ifdef WIN32
 	if (comm_driver == &winhid_subdriver) {
@@ -1988,6 +2055,8 @@ void upsdrv_cleanup(void)
 
 	comm_driver->close_dev(udev);
 	Free_ReportDesc(pDesc);
+	parsed_rdesc_forget();
+	hid_info_memo_free();
 	free_report_buffer(reportbuf);
 #if !((defined SHUT_MODE) && SHUT_MODE)
 	USBFreeExactMatcher(exact_matcher);
@@ -2072,43 +2141,104 @@ static void process_boolean_info(const char *nutvalue)
  * The public entry point winhid_canonicalize_parsed_report_desc() is
  * declared in libwinhid.h and called from callback() below. */
 
-static int callback(
-	hid_dev_handle_t argudev,
+/* Report descriptor which pDesc was parsed from, and the identity of its
+ * device, so that reconnecting to the same device (e.g. after a USB glitch)
+ * can keep pDesc, the subdriver and the NUT-to-HID mapping, rather than
+ * parse and match all over again */
+static struct {
+	uint16_t	VendorID;
+	uint16_t	ProductID;
+	uint16_t	bcdDevice;
+	size_t	len;
+	unsigned char	*buf;	/* NULL if none remembered */
+} parsed_rdesc = { 0, 0, 0, 0, NULL };
+
+static void parsed_rdesc_forget(void)
+{
+	free(parsed_rdesc.buf);
+	parsed_rdesc.buf = NULL;
+	parsed_rdesc.len = 0;
+}
+
+static void parsed_rdesc_remember(const HIDDevice_t *arghd,
+	const usb_ctrl_charbuf rdbuf, usb_ctrl_charbufsize rdlen)
+{
+	parsed_rdesc_forget();
+
+	if (rdlen <= 0)
+		return;
+
+	parsed_rdesc.buf = (unsigned char *)malloc((size_t)rdlen);
+	if (!parsed_rdesc.buf)
+		return;
+
+	memcpy(parsed_rdesc.buf, rdbuf, (size_t)rdlen);
+	parsed_rdesc.len = (size_t)rdlen;
+	parsed_rdesc.VendorID = arghd->VendorID;
+	parsed_rdesc.ProductID = arghd->ProductID;
+	parsed_rdesc.bcdDevice = arghd->bcdDevice;
+}
+
+static int parsed_rdesc_same(const HIDDevice_t *arghd,
+	const usb_ctrl_charbuf rdbuf, usb_ctrl_charbufsize rdlen)
+{
+	return (parsed_rdesc.buf != NULL
+		&& rdlen > 0 && (size_t)rdlen == parsed_rdesc.len
+		&& arghd->VendorID == parsed_rdesc.VendorID
+		&& arghd->ProductID == parsed_rdesc.ProductID
+		&& arghd->bcdDevice == parsed_rdesc.bcdDevice
+		&& !memcmp(rdbuf, parsed_rdesc.buf, parsed_rdesc.len));
+}
+
+/* Try first the subdriver which handled the device last time, if known
+ * from the warm-start snapshot and the device is the same model: one
+ * claim() of it instead of going through the whole list */
+static subdriver_t *match_function_subdriver_snapshot(void)
+{
+	const char	*hint = dstate_snapshot_gethint("usbhid-ups.subdriver");
+	const char	*vendorid = dstate_snapshot_getinfo("ups.vendorid");
+	const char	*productid = dstate_snapshot_getinfo("ups.productid");
+	char	vid[8], pid[8];
+	int	i;
+
+	if (!hint || !vendorid || !productid || !hd)
+		return NULL;
+
+	snprintf(vid, sizeof(vid), "%04x", hd->VendorID);
+	snprintf(pid, sizeof(pid), "%04x", hd->ProductID);
+	if (strcmp(vid, vendorid) || strcmp(pid, productid))
+		return NULL;
+
+	for (i = 0; subdriver_list[i] != NULL; i++) {
+		if (strcmp(subdriver_list[i]->name, hint))
+			continue;
+
+		if (subdriver_list[i]->claim(hd)) {
+			upsdebugx(2, "%s: using subdriver %s, as found last time",
+				__func__, hint);
+			return subdriver_list[i];
+		}
+
+		upsdebugx(1, "%s: subdriver %s found last time did not claim the device",
+			__func__, hint);
+		break;
+	}
+
+	return NULL;
+}
+
+/* Parse the report descriptor of a newly opened device, and select and
+ * set up the subdriver for it. Returns 1 on success, 0 otherwise. */
+static int parse_report_desc(
 	HIDDevice_t *arghd,
 	usb_ctrl_charbuf rdbuf,
 	usb_ctrl_charbufsize rdlen)
 {
 	int i;
-	const char *mfr = NULL, *model = NULL, *serial = NULL;
-#if !((defined SHUT_MODE) && SHUT_MODE)
-	int ret;
-#endif	/* !SHUT_MODE => USB */
-	upsdebugx(2, "Report Descriptor size = %" PRI_NUT_USB_CTRL_CHARBUFSIZE, rdlen);
-
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_UNSIGNED_ZERO_COMPARE) )
-# pragma GCC diagnostic push
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS
-# pragma GCC diagnostic ignored "-Wtype-limits"
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE
-# pragma GCC diagnostic ignored "-Wtautological-constant-out-of-range-compare"
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_UNSIGNED_ZERO_COMPARE
-# pragma GCC diagnostic ignored "-Wtautological-unsigned-zero-compare"
-#endif
-	if ((uintmax_t)rdlen < (uintmax_t)SIZE_MAX) {
-		upsdebug_hex(3, "Report Descriptor", rdbuf, (size_t)rdlen);
-	}
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_UNSIGNED_ZERO_COMPARE) )
-# pragma GCC diagnostic pop
-#endif
-
-	/* Save the global "hd" for this driver instance */
-	hd = arghd;
-	udev = argudev;
+	subdriver_t	*prev_subdriver;
 
 	/* Parse Report Descriptor */
+	parsed_rdesc_forget();
 	Free_ReportDesc(pDesc);
 	pDesc = Parse_ReportDesc(rdbuf, rdlen);
 	if (!pDesc) {
@@ -2118,7 +2248,8 @@ static int callback(
 
 #if !((defined SHUT_MODE) && SHUT_MODE) && defined WIN32
 	if (comm_driver == &winhid_subdriver) {
-		(void)winhid_canonicalize_parsed_report_desc(pDesc);
+		if (winhid_canonicalize_parsed_report_desc(pDesc))
+			Index_ReportDesc(pDesc);
 	}
 #endif
 
@@ -2128,11 +2259,16 @@ static int callback(
 	if (!reportbuf) {
 		upsdebug_with_errno(1, "Failed to allocate report buffer!");
 		Free_ReportDesc(pDesc);
+		pDesc = NULL;
 		return 0;
 	}
 
 	/* select the subdriver for this device */
+	prev_subdriver = subdriver;
 	subdriver = match_function_subdriver_name(0);
+	if (!subdriver && !getval("subdriver")) {
+		subdriver = match_function_subdriver_snapshot();
+	}
 	if (!subdriver) {
 		for (i=0; subdriver_list[i] != NULL; i++) {
 			if (subdriver_list[i]->claim(hd)) {
@@ -2150,15 +2286,86 @@ static int callback(
 
 	upslogx(LOG_INFO, "Using subdriver: %s", subdriver->name);
 
+	/* Remember it for the next start (if warm-start snapshots are used) */
+	dstate_snapshot_sethint("usbhid-ups.subdriver", subdriver->name);
+
 	if (subdriver->fix_report_desc(arghd, pDesc)) {
 		upsdebugx(2, "Report Descriptor Fixed");
 	}
+	/* fix-ups may have changed item limits */
+	Prepare_ReportDesc(pDesc);
 	upsdebugx(1, "%s: calling HIDDumpTree(); in case of problems with device data "
 		"please note that a wrong subdriver could have been chosen above; "
 		"consider testing others with an explicit driver option",
 		__func__);
 	HIDDumpTree(udev, arghd, subdriver->utab);
 
+	/* Mapping entries kept from an earlier connection (see the INIT
+	 * walk) must point into the new descriptor, if still there */
+	if (subdriver == prev_subdriver) {
+		hid_info_t	*item;
+
+		for (item = subdriver->hid2nut; item->info_type != NULL; item++) {
+			if (item->hiddata != NULL)
+				item->hiddata = HIDGetItemData(item->hidpath, subdriver->utab);
+		}
+	}
+	hid_info_index_dirty = 1;
+	/* string IDs are for the new device */
+	hid_info_memo_free();
+
+	parsed_rdesc_remember(arghd, rdbuf, rdlen);
+
+	return 1;
+}
+
+static int callback(
+	hid_dev_handle_t argudev,
+	HIDDevice_t *arghd,
+	usb_ctrl_charbuf rdbuf,
+	usb_ctrl_charbufsize rdlen)
+{
+	const char *mfr = NULL, *model = NULL, *serial = NULL;
+#if !((defined SHUT_MODE) && SHUT_MODE)
+	int ret;
+#endif	/* !SHUT_MODE => USB */
+	upsdebugx(2, "Report Descriptor size = %" PRI_NUT_USB_CTRL_CHARBUFSIZE, rdlen);
+
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_UNSIGNED_ZERO_COMPARE) )
+# pragma GCC diagnostic push
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS
+# pragma GCC diagnostic ignored "-Wtype-limits"
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE
+# pragma GCC diagnostic ignored "-Wtautological-constant-out-of-range-compare"
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_UNSIGNED_ZERO_COMPARE
+# pragma GCC diagnostic ignored "-Wtautological-unsigned-zero-compare"
+#endif
+	if ((uintmax_t)rdlen < (uintmax_t)SIZE_MAX) {
+		upsdebug_hex(3, "Report Descriptor", rdbuf, (size_t)rdlen);
+	}
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_UNSIGNED_ZERO_COMPARE) )
+# pragma GCC diagnostic pop
+#endif
+
+	/* Save the global "hd" for this driver instance */
+	hd = arghd;
+	udev = argudev;
+
+	if (pDesc && subdriver && reportbuf && parsed_rdesc_same(arghd, rdbuf, rdlen)) {
+		/* Reconnected to the same device: the parsed descriptor, the
+		 * subdriver and the NUT-to-HID mapping all remain valid */
+		upsdebugx(2, "Report Descriptor unchanged, keeping parsed data and subdriver %s",
+			subdriver->name);
+
+		/* but do not use reports buffered from the previous connection */
+		memset(reportbuf->ts, 0, sizeof(reportbuf->ts));
+	} else if (!parse_report_desc(arghd, rdbuf, rdlen)) {
+		return 0;
+	}
+
 #if !((defined SHUT_MODE) && SHUT_MODE)
 	/* create a new matcher for later matching */
 	USBFreeExactMatcher(exact_matcher);
@@ -2228,6 +2435,109 @@ int fix_report_desc(HIDDevice_t *arg_pDev, HIDDesc_t *arg_pDesc) {
 	return 0;
 }
 
+/* Does an update walk in "mode" poll this item? */
+static bool_t hid_ups_item_due(const hid_info_t *item, walkmode_t mode)
+{
+	if (mode == HU_WALKMODE_QUICK_UPDATE) {
+		/* Quick update only deals with status and alarms! */
+		return (item->hidflags & HU_FLAG_QUICK_POLL) ? TRUE : FALSE;
+	}
+
+	if (mode != HU_WALKMODE_FULL_UPDATE) {
+		return FALSE;
+	}
+
+	/* These don't need polling after initinfo() */
+	if (item->hidflags & (HU_FLAG_ABSENT | HU_TYPE_CMD))
+		return FALSE;
+
+	/* These don't need polling after initinfo() normally
+	 * However in "pollonly" mode we use these to detect "Data stale"
+	 * condition (e.g. cable disconnected) by failing the reads:
+	 */
+	if ((item->hidflags & HU_FLAG_STATIC) && use_interrupt_pipe)
+		return FALSE;
+
+	/* These need to be polled after user changes (setvar / instcmd)
+	 * or to detect "Data stale" in "pollonly" mode
+	 */
+	if (   (item->hidflags & HU_FLAG_SEMI_STATIC)
+		&& (data_has_changed == FALSE)
+		&& use_interrupt_pipe
+	)
+		return FALSE;
+
+	return TRUE;
+}
+
+/* Is the report of this item known to upset the device firmware? */
+static bool_t hid_ups_report_blocked(const hid_info_t *item)
+{
+#if !((defined SHUT_MODE) && SHUT_MODE)
+	/* skip report 0x54 for Tripplite SU3000LCD2UHV due to firmware bug */
+	if ((curDevice.VendorID == 0x09ae) && (curDevice.ProductID == 0x1330)) {
+		if (item->hiddata && (item->hiddata->ReportID == 0x54)) {
+			return TRUE;
+		}
+	}
+#else
+	NUT_UNUSED_VARIABLE(item);
+#endif	/* !SHUT_MODE => USB */
+
+	return FALSE;
+}
+
+/* Collect the reports holding the items due in this update "mode" and
+ * read each of them from the device once, so the walk then decodes all
+ * items from the report buffer (rather than the mapping table order and
+ * report ages deciding how many GET_REPORT requests one cycle costs) */
+static void hid_ups_walk_plan(walkmode_t mode, hid_walk_plan_t *plan)
+{
+	HIDData_t	*rare[256];
+	hid_info_t	*item;
+	bool_t	have_regular = FALSE, have_rare = FALSE;
+	time_t	now = time(NULL);
+	int	id;
+
+	memset(plan->wanted, 0, sizeof(plan->wanted));
+	memset(rare, 0, sizeof(rare));
+
+	for (item = subdriver->hid2nut; item->info_type != NULL; item++) {
+		if (item->hiddata == NULL
+		 || !hid_ups_item_due(item, mode)
+		 || hid_ups_report_blocked(item)
+		) {
+			continue;
+		}
+
+		id = item->hiddata->ReportID;
+		if (item->hidflags & HU_FLAG_STATIC) {
+			rare[id] = item->hiddata;
+			have_rare = TRUE;
+		} else {
+			plan->wanted[id] = item->hiddata;
+			have_regular = TRUE;
+		}
+	}
+
+	/* Reports with only static items (polled in "pollonly" mode just to
+	 * notice a stale device) are re-read every HU_STATIC_REPORT_CYCLES
+	 * full updates, or always if nothing else would be read */
+	if (have_rare
+	 && (!have_regular || now - static_reports_ts >= (time_t)pollfreq * HU_STATIC_REPORT_CYCLES)
+	) {
+		for (id = 0; id < 256; id++) {
+			if (plan->wanted[id] == NULL) {
+				plan->wanted[id] = rare[id];
+			}
+		}
+		static_reports_ts = now;
+	}
+
+	id = HIDRefreshReports(udev, plan->wanted, poll_interval, plan->status);
+	upsdebugx(3, "%s: %d report(s) ready for this cycle", __func__, id);
+}
+
 /* walk ups variables and set elements of the info array. */
 static bool_t hid_ups_walk(walkmode_t mode)
 {
@@ -2236,16 +2546,18 @@ static bool_t hid_ups_walk(walkmode_t mode)
 	int		retcode;
 	int		items_polled = 0;    /* Poll attempts on mapped HID objects */
 	int		items_succeeded = 0; /* Track successful polls to detect total failure */
-
-#if !((defined SHUT_MODE) && SHUT_MODE)
-	/* extract the VendorId for further testing */
-	int vendorID = curDevice.VendorID;
-	int productID = curDevice.ProductID;
-#endif	/* !SHUT_MODE => USB */
+	hid_walk_plan_t	plan, *pplan = NULL;
 
 	/* 3 modes: HU_WALKMODE_INIT, HU_WALKMODE_QUICK_UPDATE
 	 * and HU_WALKMODE_FULL_UPDATE */
 
+	/* Updates fetch each needed report once, then decode all items
+	 * from the buffer; initialization keeps probing item by item */
+	if (mode != HU_WALKMODE_INIT) {
+		hid_ups_walk_plan(mode, &plan);
+		pplan = &plan;
+	}
+
 	/* Device data walk ----------------------------- */
 	for (item = subdriver->hid2nut; item->info_type != NULL; item++) {
 
@@ -2269,6 +2581,7 @@ static bool_t hid_ups_walk(walkmode_t mode)
 
 			/* Create the NUT-to-HID mapping */
 			item->hiddata = HIDGetItemData(item->hidpath, subdriver->utab);
+			hid_info_index_dirty = 1;
 			if (item->hiddata == NULL)
 				continue;
 
@@ -2331,34 +2644,12 @@ static bool_t hid_ups_walk(walkmode_t mode)
 
 			/* ...but this one does, so don't use it! */
 			item->hiddata = NULL;
+			hid_info_index_dirty = 1;
 			continue;
 
 		case HU_WALKMODE_QUICK_UPDATE:
-			/* Quick update only deals with status and alarms! */
-			if (!(item->hidflags & HU_FLAG_QUICK_POLL))
-				continue;
-
-			break;
-
 		case HU_WALKMODE_FULL_UPDATE:
-			/* These don't need polling after initinfo() */
-			if (item->hidflags & (HU_FLAG_ABSENT | HU_TYPE_CMD))
-				continue;
-
-			/* These don't need polling after initinfo() normally
-			 * However in "pollonly" mode we use these to detect "Data stale"
-			 * condition (e.g. cable disconnected) by failing the reads:
-			 */
-			if ((item->hidflags & HU_FLAG_STATIC) && use_interrupt_pipe)
-				continue;
-
-			/* These need to be polled after user changes (setvar / instcmd)
-			 * or to detect "Data stale" in "pollonly" mode
-			 */
-			if (   (item->hidflags & HU_FLAG_SEMI_STATIC)
-				&& (data_has_changed == FALSE)
-				&& use_interrupt_pipe
-			)
+			if (!hid_ups_item_due(item, mode))
 				continue;
 
 			break;
@@ -2392,21 +2683,23 @@ static bool_t hid_ups_walk(walkmode_t mode)
 # pragma GCC diagnostic pop
 #endif
 
-#if !((defined SHUT_MODE) && SHUT_MODE)
-		/* skip report 0x54 for Tripplite SU3000LCD2UHV due to firmware bug */
-		if ((vendorID == 0x09ae) && (productID == 0x1330)) {
-			if (item->hiddata && (item->hiddata->ReportID == 0x54)) {
-				continue;
-			}
+		if (hid_ups_report_blocked(item)) {
+			continue;
 		}
-#endif	/* !SHUT_MODE => USB */
 
 		if (item->hiddata == NULL) {
 			continue;
 		}
 		items_polled++;
 
-		retcode = HIDGetDataValue(udev, item->hiddata, &value, poll_interval);
+		if (pplan != NULL) {
+			/* The report was read (or failed) once for this cycle */
+			retcode = pplan->status[item->hiddata->ReportID];
+			if (retcode == 1)
+				retcode = HIDGetBufferedDataValue(item->hiddata, &value);
+		} else {
+			retcode = HIDGetDataValue(udev, item->hiddata, &value, poll_interval);
+		}
 
 		switch (retcode)
 		{
@@ -3019,6 +3312,88 @@ static void ups_status_set(void)
 	}
 }
 
+static size_t hid_info_name_hash(const char *name)
+{
+	size_t	hash = 5381;
+
+	for (; *name; name++)
+		hash = hash * 33 + (size_t)tolower((unsigned char)*name);
+
+	return hash;
+}
+
+static size_t hid_info_data_hash(const HIDData_t *hiddata)
+{
+	return ((size_t)hiddata / sizeof(*hiddata)) * 2654435761U;
+}
+
+/* (Re)build the indexes for find_nut_info() and find_hid_info(), keeping
+ * the first matching entry for each key, as the scans of hid2nut would */
+static void hid_info_index_build(void)
+{
+	hid_info_t	*item;
+	size_t	count = 0, size = 64, mask, k;
+
+	free(hid_info_name_index);
+	free(hid_info_data_index);
+	hid_info_name_index = NULL;
+	hid_info_data_index = NULL;
+	hid_info_index_size = 0;
+	hid_info_index_dirty = 0;
+
+	for (item = subdriver->hid2nut; item->info_type != NULL; item++) {
+		if (item->hiddata != NULL)
+			count++;
+	}
+
+	while (size < 2 * count)
+		size <<= 1;
+
+	hid_info_name_index = (hid_info_t **)calloc(size, sizeof(*hid_info_name_index));
+	hid_info_data_index = (hid_info_t **)calloc(size, sizeof(*hid_info_data_index));
+	if (!hid_info_name_index || !hid_info_data_index) {
+		/* lookups will just scan hid2nut */
+		free(hid_info_name_index);
+		free(hid_info_data_index);
+		hid_info_name_index = NULL;
+		hid_info_data_index = NULL;
+		return;
+	}
+
+	hid_info_index_size = size;
+	mask = size - 1;
+
+	for (item = subdriver->hid2nut; item->info_type != NULL; item++) {
+		if (item->hiddata == NULL)
+			continue;
+
+		for (k = hid_info_name_hash(item->info_type) & mask;
+			hid_info_name_index[k] != NULL; k = (k + 1) & mask
+		) {
+			if (!strcasecmp(hid_info_name_index[k]->info_type, item->info_type))
+				break;
+		}
+		if (hid_info_name_index[k] == NULL)
+			hid_info_name_index[k] = item;
+
+		/* Skip server side vars */
+		if (item->hidflags & HU_FLAG_ABSENT)
+			continue;
+
+		for (k = hid_info_data_hash(item->hiddata) & mask;
+			hid_info_data_index[k] != NULL; k = (k + 1) & mask
+		) {
+			if (hid_info_data_index[k]->hiddata == item->hiddata)
+				break;
+		}
+		if (hid_info_data_index[k] == NULL)
+			hid_info_data_index[k] = item;
+	}
+
+	upsdebugx(3, "%s: indexed %" PRIuSIZE " mapped entries in %" PRIuSIZE " slots",
+		__func__, count, size);
+}
+
 /* find info element definition in info array
  * by NUT varname, or NULL if not found.
  */
@@ -3038,13 +3413,29 @@ static hid_info_t *find_nut_info(const char *varname)
 		return NULL;
 	}
 
-	for (hidups_item = subdriver->hid2nut; hidups_item->info_type != NULL ; hidups_item++) {
-		if (strcasecmp(hidups_item->info_type, varname))
-			continue;
+	if (hid_info_index_dirty)
+		hid_info_index_build();
 
-		if (hidups_item->hiddata != NULL) {
-			errno = 0;
-			return hidups_item;
+	if (hid_info_index_size) {
+		size_t	k, mask = hid_info_index_size - 1;
+
+		for (k = hid_info_name_hash(varname) & mask;
+			(hidups_item = hid_info_name_index[k]) != NULL; k = (k + 1) & mask
+		) {
+			if (!strcasecmp(hidups_item->info_type, varname)) {
+				errno = 0;
+				return hidups_item;
+			}
+		}
+	} else {
+		for (hidups_item = subdriver->hid2nut; hidups_item->info_type != NULL ; hidups_item++) {
+			if (strcasecmp(hidups_item->info_type, varname))
+				continue;
+
+			if (hidups_item->hiddata != NULL) {
+				errno = 0;
+				return hidups_item;
+			}
 		}
 	}
 
@@ -3066,6 +3457,25 @@ static hid_info_t *find_hid_info(const HIDData_t *hiddata)
 		return NULL;
 	}
 
+	if (hid_info_index_dirty)
+		hid_info_index_build();
+
+	if (hid_info_index_size) {
+		size_t	k, mask = hid_info_index_size - 1;
+
+		for (k = hid_info_data_hash(hiddata) & mask;
+			(hidups_item = hid_info_data_index[k]) != NULL; k = (k + 1) & mask
+		) {
+			if (hidups_item->hiddata == hiddata) {
+				errno = 0;
+				return hidups_item;
+			}
+		}
+
+		errno = EINVAL;
+		return NULL;
+	}
+
 	for (hidups_item = subdriver->hid2nut; hidups_item->info_type != NULL ; hidups_item++) {
 		/* Skip server side vars */
 		if (hidups_item->hidflags & HU_FLAG_ABSENT)
@@ -3154,6 +3564,77 @@ static const char *hu_find_infoval(info_lkp_t *hid2info, const double value)
 	return NULL;
 }
 
+/* Conversion functions whose result only depends on the value (or on the
+ * device, for string IDs, once they were read) and which have no side
+ * effects, so that their results may be reused for the same value */
+static bool_t hu_lkp_fun_memoizable(const char *(*fun)(double hid_value))
+{
+	return (fun == date_conversion_fun
+		|| fun == hex_conversion_fun
+		|| fun == stringid_conversion_fun
+		|| fun == divide_by_10_conversion_fun
+		|| fun == divide_by_100_conversion_fun
+		|| fun == kelvin_celsius_conversion_fun);
+}
+
+static void hid_info_memo_free(void)
+{
+	free(hid_info_memo);
+	hid_info_memo = NULL;
+	hid_info_memo_table = NULL;
+	hid_info_memo_count = 0;
+}
+
+/* hu_find_infoval() for this item, reusing its last result if the
+ * value did not change */
+static const char *hu_find_infoval_memo(hid_info_t *item, const double value)
+{
+	hid_info_memo_t	*memo = NULL;
+	const char	*nutvalue;
+	size_t	len;
+
+	if (hid_info_memo_table != subdriver->hid2nut) {
+		hid_info_t	*p;
+
+		hid_info_memo_free();
+		for (p = subdriver->hid2nut; p->info_type != NULL; p++)
+			hid_info_memo_count++;
+		hid_info_memo = (hid_info_memo_t *)calloc(hid_info_memo_count, sizeof(*hid_info_memo));
+		hid_info_memo_table = subdriver->hid2nut;
+	}
+
+	if (hid_info_memo && item >= hid_info_memo_table
+	 && (size_t)(item - hid_info_memo_table) < hid_info_memo_count
+	) {
+		memo = &hid_info_memo[item - hid_info_memo_table];
+		if (memo->valid && d_equal(memo->value, value)) {
+			errno = 0;
+			return memo->nutvalue;
+		}
+		memo->valid = FALSE;
+	}
+
+	nutvalue = hu_find_infoval(item->hid2info, value);
+	if (!memo || !nutvalue)
+		return nutvalue;
+
+	memo->value = value;
+	if (item->hid2info->fun == NULL) {
+		memo->nutvalue = nutvalue;
+		memo->valid = TRUE;
+	} else if (hu_lkp_fun_memoizable(item->hid2info->fun)
+	 && (len = strlen(nutvalue)) < sizeof(memo->buf)
+	 /* an empty string ID is what a failed read gives, try it again */
+	 && (len > 0 || item->hid2info->fun != stringid_conversion_fun)
+	) {
+		memcpy(memo->buf, nutvalue, len + 1);
+		memo->nutvalue = memo->buf;
+		memo->valid = TRUE;
+	}
+
+	return nutvalue;
+}
+
 /* return -1 on failure, 0 for a status update and 1 in all other cases */
 static int ups_infoval_set(hid_info_t *item, double value)
 {
@@ -3162,7 +3643,7 @@ static int ups_infoval_set(hid_info_t *item, double value)
 
 	/* need lookup'ed translation? */
 	if (item->hid2info != NULL) {
-		if ((nutvalue = hu_find_infoval(item->hid2info, value)) == NULL) {
+		if ((nutvalue = hu_find_infoval_memo(item, value)) == NULL) {
 			upsdebugx(5, "%s: Lookup [%g] failed for [%s]", __func__, value, item->info_type);
 			return -1;
 		}
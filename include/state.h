@@ -33,6 +33,7 @@ extern "C" {
 #define ST_SOCK_BUF_LEN 512
 
 #include "timehead.h"
+#include "nut_stdint.h"
 
 #if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
 typedef struct timespec	st_tree_timespec_t;
@@ -61,6 +62,13 @@ typedef struct st_tree_s {
 	 */
 	st_tree_timespec_t	lastset;
 
+	/* Generation number of the last actual change of this entry, as
+	 * maintained by the tree owner (e.g. driver-side dstate code for
+	 * incremental resync); 0 if not tracked. Unlike lastset, this is
+	 * not bumped by re-writing an unchanged value.
+	 */
+	uint64_t	gen;
+
 	struct enum_s		*enum_list;
 	struct range_s		*range_list;
 
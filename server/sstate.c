@@ -39,6 +39,8 @@
 #include <sys/un.h>
 #endif	/* !WIN32 */
 
+static void sendline_dumpall(upstype_t *ups);
+
 static int parse_args(upstype_t *ups, size_t numargs, char **arg)
 {
 	if (numargs < 1)
@@ -46,12 +48,32 @@ static int parse_args(upstype_t *ups, size_t numargs, char **arg)
 
 	if (!strcasecmp(arg[0], "PONG")) {
 		upsdebugx(3, "%s: Got PONG from UPS [%s]", __func__, ups->name);
+
+		/* The driver handles our commands in order, so an answer
+		 * to a later PING before the DUMPDONE means it ignored the
+		 * DUMPSINCE (older driver program): start over with DUMPALL */
+		if (ups->resync && !ups->dumpdone) {
+			upslogx(LOG_NOTICE, "Driver for UPS [%s] did not resume the data dump, requesting a full one", ups->name);
+			sendline_dumpall(ups);
+		}
+		return 1;
+	}
+
+	/* DUMPRESET: the driver can not resume from the generation we
+	 * asked, drop what we have and take the full dump that follows */
+	if (!strcasecmp(arg[0], "DUMPRESET")) {
+		upsdebugx(3, "%s: UPS [%s]: data dump restarts from scratch", __func__, ups->name);
+		ups->resync = 0;
+		sstate_infofree(ups);
+		sstate_cmdfree(ups);
+		state_setinfo(&ups->inforoot, "ups.status", "WAIT");
 		return 1;
 	}
 
 	if (!strcasecmp(arg[0], "DUMPDONE")) {
 		upsdebugx(3, "%s: UPS [%s]: dump is done", __func__, ups->name);
 		ups->dumpdone = 1;
+		ups->resync = 0;
 		return 1;
 	}
 
@@ -122,6 +144,17 @@ static int parse_args(upstype_t *ups, size_t numargs, char **arg)
 		return 1;
 	}
 
+	/* GENERATION <id> <gen> */
+	if (!strcasecmp(arg[0], "GENERATION")) {
+		upsdebugx(3, "%s: UPS [%s]: resync point is %s %s",
+			__func__, ups->name, arg[1], arg[2]);
+		free(ups->gen_id);
+		free(ups->gen);
+		ups->gen_id = xstrdup(arg[1]);
+		ups->gen = xstrdup(arg[2]);
+		return 1;
+	}
+
 	/* TRACKING <id> <status> */
 	if (!strcasecmp(arg[0], "TRACKING")) {
 		tracking_set(arg[1], arg[2]);
@@ -190,14 +223,37 @@ static void sendping(upstype_t *ups)
 	time(&ups->last_ping);
 }
 
+/* forget any partial data and ask for a complete dump (on the connected socket) */
+static void sendline_dumpall(upstype_t *ups)
+{
+	ups->resync = 0;
+	sstate_infofree(ups);
+	sstate_cmdfree(ups);
+	state_setinfo(&ups->inforoot, "ups.status", "WAIT");
+
+	sstate_sendline(ups, "DUMPALL\n");
+}
+
 /* interface */
 
 TYPE_FD sstate_connect(upstype_t *ups)
 {
 	TYPE_FD	fd;
+	char	dumpcmd[SMALLBUF];
+
+	/* If we kept the data from a previous connection (see
+	 * sstate_disconnect()), only ask for what changed since */
+	if (ups->gen_id && ups->gen && ups->inforoot) {
+		snprintf(dumpcmd, sizeof(dumpcmd), "DUMPSINCE %s %s\n",
+			ups->gen_id, ups->gen);
+		ups->resync = 1;
+	} else {
+		snprintf(dumpcmd, sizeof(dumpcmd), "DUMPALL\n");
+		ups->resync = 0;
+	}
+
 #ifndef WIN32
-	const char	*dumpcmd = "DUMPALL\n";
-	size_t	dumpcmdlen = strlen(dumpcmd);
+	size_t	dumpcmdlen;
 	ssize_t	ret;
 	struct sockaddr_un	sa;
 
@@ -269,6 +325,7 @@ TYPE_FD sstate_connect(upstype_t *ups)
 	}
 
 	/* get a dump started so we have a fresh set of data */
+	dumpcmdlen = strlen(dumpcmd);
 	ret = write(fd, dumpcmd, dumpcmdlen);
 
 	if ((ret < 1) || (ret != (ssize_t)dumpcmdlen))  {
@@ -279,7 +336,6 @@ TYPE_FD sstate_connect(upstype_t *ups)
 
 #else	/* WIN32 */
 	char pipename[NUT_PATH_MAX];
-	const char	*dumpcmd = "DUMPALL\n";
 	BOOL  result = FALSE;
 	DWORD bytesWritten;
 
@@ -350,9 +406,18 @@ void sstate_disconnect(upstype_t *ups)
 		return;
 	}
 
-	sstate_infofree(ups);
-	sstate_cmdfree(ups);
+	/* Keep a completely received data set which the driver told us how
+	 * to resume (GENERATION), so reconnection can just get the changes.
+	 * Clients do not see it meanwhile, per ups_available() checks. */
+	if (ups->dumpdone && !ups->resync && ups->gen_id && ups->gen) {
+		upsdebugx(2, "%s: keeping data of UPS [%s] to resync from generation %s %s",
+			__func__, ups->name, ups->gen_id, ups->gen);
+	} else {
+		sstate_infofree(ups);
+		sstate_cmdfree(ups);
+	}
 
+	ups->resync = 0;
 	pconf_finish(&ups->sock_ctx);
 
 #ifndef WIN32
@@ -411,6 +476,10 @@ void sstate_readline(upstype_t *ups)
 			if (parse_args(ups, ups->sock_ctx.numargs, ups->sock_ctx.arglist)) {
 				time(&ups->last_heard);
 			}
+
+			/* handling the line could have failed a write back */
+			if (INVALID_FD(ups->sock_fd))
+				return;
 			continue;
 
 		case 0:
@@ -514,6 +583,12 @@ void sstate_infofree(upstype_t *ups)
 	state_infofree(ups->inforoot);
 
 	ups->inforoot = NULL;
+
+	/* resync point refers to the data we just dropped */
+	free(ups->gen_id);
+	ups->gen_id = NULL;
+	free(ups->gen);
+	ups->gen = NULL;
 }
 
 void sstate_cmdfree(upstype_t *ups)
@@ -51,6 +51,13 @@ typedef struct upstype_s {
 	struct st_tree_s	*inforoot;
 	struct cmdlist_s	*cmdlist;
 
+	/* Resync point (GENERATION <id> <gen>) reported by the driver with
+	 * the last completed dump, to reconnect with DUMPSINCE instead of
+	 * DUMPALL; resync is set while such a DUMPSINCE is in progress */
+	char	*gen_id;
+	char	*gen;
+	int	resync;
+
 	int	numlogins;
 	int	fsd;		/* forced shutdown in effect? */
 
@@ -27,6 +27,11 @@
 #include "attribute.h"
 #include "nut_stdint.h"
 
+#ifndef WIN32
+# include <sys/socket.h>
+# include <sys/un.h>
+#endif	/* !WIN32 */
+
 /* driver version */
 #define DRIVER_NAME	"Mock driver for unit tests"
 #define DRIVER_VERSION	"0.02"
@@ -73,6 +78,84 @@ static int report_0_means_pass(int i) {
 	return i;
 }
 
+#ifndef WIN32
+static int events_fired = 0;
+
+static int test_timer_handler(void *arg) {
+	NUT_UNUSED_VARIABLE(arg);
+	events_fired++;
+	return 1;	/* end the wait */
+}
+
+static int test_fd_handler(TYPE_FD fd, void *arg) {
+	char	c;
+
+	NUT_UNUSED_VARIABLE(arg);
+	if (read(fd, &c, 1) == 1)
+		events_fired++;
+	return 1;	/* end the wait */
+}
+
+static int test_fd_write_handler(TYPE_FD fd, void *arg) {
+	NUT_UNUSED_VARIABLE(fd);
+	NUT_UNUSED_VARIABLE(arg);
+	events_fired++;
+	return 1;	/* end the wait */
+}
+
+/* A client of the driver socket, like upsd */
+static int	sock_client = -1;
+static char	sock_reply[65536];
+
+/* Send a request to the driver socket, and collect the reply (up to its
+ * DUMPDONE) while dstate_poll_fds() serves it */
+static const char *sock_request(const char *req) {
+	char	drain[LARGEBUF];
+	size_t	len = 0;
+	ssize_t	ret;
+	int	tries;
+	struct timeval	timeout;
+
+	/* forget the broadcasts of earlier changes */
+	while (read(sock_client, drain, sizeof(drain)) > 0);
+
+	sock_reply[0] = '\0';
+	if (write(sock_client, req, strlen(req)) != (ssize_t)strlen(req))
+		return sock_reply;
+
+	for (tries = 0; tries < 50 && !strstr(sock_reply, "DUMPDONE\n"); tries++) {
+		gettimeofday(&timeout, NULL);
+		timeout.tv_usec += 100000;
+		if (timeout.tv_usec >= 1000000) {
+			timeout.tv_sec++;
+			timeout.tv_usec -= 1000000;
+		}
+		dstate_poll_fds(timeout, ERROR_FD);
+
+		while (len < sizeof(sock_reply) - 1
+		&& (ret = read(sock_client, sock_reply + len, sizeof(sock_reply) - 1 - len)) > 0
+		) {
+			len += (size_t)ret;
+			sock_reply[len] = '\0';
+		}
+	}
+
+	return sock_reply;
+}
+
+/* How many times <what> is seen in <reply> */
+static int count_in(const char *reply, const char *what) {
+	int	n = 0;
+
+	while ((reply = strstr(reply, what)) != NULL) {
+		n++;
+		reply += strlen(what);
+	}
+
+	return n;
+}
+#endif	/* !WIN32 */
+
 int main(int argc, char **argv) {
 	const char	*valueStr = NULL;
 	char	*s;
@@ -396,12 +479,267 @@ int main(int argc, char **argv) {
 	report_0_means_pass(strcmp(valueStr, "OB LB FSD"));
 	printf(" test for ups.status with FSD token set and now committed: '%s'; got OB LB FSD?\n", NUT_STRARG(valueStr));
 
-	/* Clear testing state before finishing. */
+	/* Clear testing state before the next from-scratch test. */
 	alarm_init();
 	alarm_commit();
 	status_init();
 	status_commit();
 
+	/* Test cases #21+#22+#23+#24 (from scratch, warm-start snapshot)
+	 * Data saved before the state is dropped is loaded aside, merged
+	 * into what the live tree lacks, and merged values which were not
+	 * set again are removed by validation.
+	 */
+	{
+		const char	*snapfn = "driver_methods_utest.snapshot";
+		int	ret;
+
+		dstate_free();
+		dstate_setinfo("ups.model", "Snapshot device");
+		dstate_addenum("ups.model", "Some \"quoted\" model");
+		dstate_setinfo("ups.serial", "12345");
+		dstate_setinfo("ups.mfr", "Old vendor");
+		dstate_setinfo("driver.state", "quiet");
+		dstate_snapshot_save(snapfn, "mock 1 snap");
+		dstate_free();
+
+		/* #21 */
+		ret = dstate_snapshot_load(snapfn, "mock 2 snap");
+		report_0_means_pass(ret != -1);
+		printf(" test for state snapshot load with another identity: %d; got -1?\n", ret);
+
+		ret = dstate_snapshot_load(snapfn, "mock 1 snap");
+		unlink(snapfn);
+
+		dstate_setinfo("ups.mfr", "New vendor");
+		ret = dstate_snapshot_merge();
+
+		/* #22 */
+		valueStr = dstate_getinfo("ups.model");
+		report_0_means_pass(ret != 2 || strcmp(NUT_STRARG(valueStr), "Snapshot device")
+			|| !dstate_tree_find("ups.model")->enum_list
+			|| strcmp(dstate_tree_find("ups.model")->enum_list->val, "Some \\\"quoted\\\" model"));
+		printf(" test for ups.model (and its enum) merged from state snapshot (%d merged): '%s'; got Snapshot device?\n", ret, NUT_STRARG(valueStr));
+
+		/* #23 */
+		valueStr = dstate_getinfo("ups.mfr");
+		report_0_means_pass(strcmp(NUT_STRARG(valueStr), "New vendor"));
+		printf(" test for live ups.mfr not overridden by state snapshot: '%s'; got New vendor?\n", NUT_STRARG(valueStr));
+
+		dstate_setinfo("ups.serial", "12345");
+		ret = dstate_snapshot_validate();
+
+		/* #24 */
+		valueStr = dstate_getinfo("ups.model");
+		report_0_means_pass(ret != 1 || valueStr != NULL || !dstate_getinfo("ups.serial"));
+		printf(" test for unconfirmed ups.model removed by state snapshot validation (%d removed): '%s'; got NULL?\n", ret, NUT_STRARG(valueStr));
+	}
+
+	/* Test cases #25-#27 (from scratch, performance counters)
+	 * Recorded values are summarized into driver.perf.* data, and each
+	 * of many counters keeps its own values.
+	 */
+	{
+		dstate_free();
+		dstate_perf_record("utest.op", "us", 10);
+		dstate_perf_record("utest.op", "us", 30);
+		dstate_perf_record("utest.op", "us", 2);
+		dstate_perf_publish();
+
+		/* #25 */
+		valueStr = dstate_getinfo("driver.perf.utest.op.count");
+		report_0_means_pass(strcmp(NUT_STRARG(valueStr), "3"));
+		printf(" test for driver.perf.utest.op.count: '%s'; got 3?\n", NUT_STRARG(valueStr));
+
+		/* #26 */
+		valueStr = dstate_getinfo("driver.perf.utest.op.avg");
+		report_0_means_pass(strcmp(NUT_STRARG(valueStr), "14")
+			|| strcmp(NUT_STRARG(dstate_getinfo("driver.perf.utest.op.max")), "30"));
+		printf(" test for driver.perf.utest.op.avg (and max): '%s'; got 14?\n", NUT_STRARG(valueStr));
+
+		for (i = 0; i < 100; i++) {
+			char	perfname[SMALLBUF];
+
+			snprintf(perfname, sizeof(perfname), "utest.many%d", i);
+			dstate_perf_record(perfname, "", (double)i);
+			dstate_perf_record(perfname, "", (double)i);
+		}
+		dstate_perf_publish();
+
+		/* #27 */
+		valueStr = dstate_getinfo("driver.perf.utest.many99.count");
+		report_0_means_pass(strcmp(NUT_STRARG(valueStr), "2")
+			|| strcmp(NUT_STRARG(dstate_getinfo("driver.perf.utest.many42.max")), "42"));
+		printf(" test for driver.perf.utest.many99.count (and many42.max): '%s'; got 2?\n", NUT_STRARG(valueStr));
+	}
+
+#ifndef WIN32
+	/* Test cases #28-#30 (from scratch, driver event sources)
+	 * A due timer and a readable or writable descriptor end the wait in
+	 * dstate_poll_fds() long before its own timeout.
+	 */
+	{
+		struct timeval	timeout;
+		int	fds[2], ret;
+		long	timer;
+
+		events_fired = 0;
+		timer = dstate_timer_add(10, 0, test_timer_handler, NULL);
+		gettimeofday(&timeout, NULL);
+		timeout.tv_sec += 5;
+		ret = dstate_poll_fds(timeout, ERROR_FD);
+
+		/* #28 */
+		report_0_means_pass(timer < 0 || ret != 1 || events_fired != 1
+			|| dstate_timer_del(timer) != -1);
+		printf(" test for one-shot timer served by dstate_poll_fds(): fired %d time(s); got 1?\n", events_fired);
+
+		events_fired = 0;
+		if (pipe(fds) == 0) {
+			ret = dstate_fd_add(fds[0], test_fd_handler, NULL);
+			if (write(fds[1], "x", 1) == 1) {
+				gettimeofday(&timeout, NULL);
+				timeout.tv_sec += 5;
+				ret |= (dstate_poll_fds(timeout, ERROR_FD) != 1);
+			}
+			ret |= dstate_fd_del(fds[0]);
+			close(fds[0]);
+			close(fds[1]);
+		} else {
+			ret = -1;
+		}
+
+		/* #29 */
+		report_0_means_pass(ret != 0 || events_fired != 1);
+		printf(" test for descriptor served by dstate_poll_fds(): fired %d time(s); got 1?\n", events_fired);
+
+		/* an empty pipe can be written to at once */
+		events_fired = 0;
+		if (pipe(fds) == 0) {
+			ret = dstate_fd_add_events(fds[1], DSTATE_FD_WRITE, test_fd_write_handler, NULL);
+			gettimeofday(&timeout, NULL);
+			timeout.tv_sec += 5;
+			ret |= (dstate_poll_fds(timeout, ERROR_FD) != 1);
+			ret |= dstate_fd_del(fds[1]);
+			close(fds[0]);
+			close(fds[1]);
+		} else {
+			ret = -1;
+		}
+
+		/* #30 */
+		report_0_means_pass(ret != 0 || events_fired != 1);
+		printf(" test for writable descriptor served by dstate_poll_fds(): fired %d time(s); got 1?\n", events_fired);
+	}
+
+	/* Test cases #31-#35 (from scratch, incremental resync over the socket)
+	 * A DUMPSINCE from the GENERATION of an earlier dump only gets what
+	 * was changed or deleted since.  One from another life time of the
+	 * tree, from a generation not reached yet, or from before the oldest
+	 * of the DSTATE_DELLOG_MAX (256) remembered deletions gets DUMPRESET
+	 * and then all the data.
+	 */
+	{
+		char	*sockname, gen_id[SMALLBUF], gen[SMALLBUF], req[LARGEBUF];
+		const char	*reply;
+		struct sockaddr_un	sa;
+
+		dstate_free();
+		setenv("NUT_STATEPATH", ".", 1);
+		sockname = dstate_init("driver_methods_utest", "resync");
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sun_family = AF_UNIX;
+		snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", sockname);
+		sock_client = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (sock_client < 0
+		|| connect(sock_client, (struct sockaddr *)&sa, sizeof(sa)) < 0
+		|| fcntl(sock_client, F_SETFL, fcntl(sock_client, F_GETFL, 0) | O_NONBLOCK) < 0
+		) {
+			report_fail();
+			printf(" test for incremental resync: could not connect to %s\n", sockname);
+		} else {
+			dstate_setinfo("ups.model", "Resync device");
+			dstate_setinfo("ups.serial", "12345");
+			dstate_setinfo("ups.mfr", "Old vendor");
+
+			reply = sock_request("DUMPALL\n");
+			gen_id[0] = gen[0] = '\0';
+			if ((reply = strstr(reply, "GENERATION ")) != NULL)
+				sscanf(reply, "GENERATION %255s %255s", gen_id, gen);
+
+			dstate_setinfo("ups.serial", "67890");
+			dstate_delinfo("ups.mfr");
+			snprintf(req, sizeof(req), "DUMPSINCE %s %s\n", gen_id, gen);
+			reply = sock_request(req);
+
+			/* #31 */
+			report_0_means_pass(!strstr(reply, "DELINFO ups.mfr\n")
+				|| !strstr(reply, "SETINFO ups.serial \"67890\"\n")
+				|| strstr(reply, "ups.model") || strstr(reply, "DUMPRESET")
+				|| !strstr(reply, "GENERATION ") || !strstr(reply, "DUMPDONE\n"));
+			printf(" test for DUMPSINCE %s %s replaying a deletion and a change only: %d line(s); got 5?\n",
+				gen_id, gen, count_in(reply, "\n"));
+
+			snprintf(req, sizeof(req), "DUMPSINCE another.%s %s\n", gen_id, gen);
+			reply = sock_request(req);
+
+			/* #32 */
+			report_0_means_pass(strncmp(reply, "DUMPRESET\n", 10)
+				|| !strstr(reply, "SETINFO ups.model \"Resync device\"\n")
+				|| !strstr(reply, "DUMPDONE\n"));
+			printf(" test for DUMPSINCE from another tree life time: '%.9s' and %d line(s); got DUMPRESET and 6?\n",
+				reply, count_in(reply, "\n"));
+
+			snprintf(req, sizeof(req), "DUMPSINCE %s 1%s\n", gen_id, gen);
+			reply = sock_request(req);
+
+			/* #33 */
+			report_0_means_pass(strncmp(reply, "DUMPRESET\n", 10)
+				|| !strstr(reply, "SETINFO ups.model \"Resync device\"\n"));
+			printf(" test for DUMPSINCE from a generation not reached yet: '%.9s'; got DUMPRESET?\n", reply);
+
+			for (i = 0; i <= 256; i++) {
+				snprintf(req, sizeof(req), "utest.del%d", i);
+				dstate_setinfo(req, "x");
+			}
+
+			reply = sock_request("DUMPALL\n");
+			if ((reply = strstr(reply, "GENERATION ")) != NULL)
+				sscanf(reply, "GENERATION %255s %255s", gen_id, gen);
+
+			for (i = 0; i < 256; i++) {
+				snprintf(req, sizeof(req), "utest.del%d", i);
+				dstate_delinfo(req);
+			}
+			snprintf(req, sizeof(req), "DUMPSINCE %s %s\n", gen_id, gen);
+			reply = sock_request(req);
+
+			/* #34 */
+			report_0_means_pass(count_in(reply, "DELINFO utest.del") != 256
+				|| strstr(reply, "DUMPRESET") || !strstr(reply, "DUMPDONE\n"));
+			printf(" test for DUMPSINCE replaying 256 deletions: %d replayed; got 256?\n",
+				count_in(reply, "DELINFO utest.del"));
+
+			dstate_delinfo("utest.del256");
+			reply = sock_request(req);
+
+			/* #35 */
+			report_0_means_pass(strncmp(reply, "DUMPRESET\n", 10)
+				|| count_in(reply, "DELINFO ") != 0
+				|| !strstr(reply, "SETINFO ups.model \"Resync device\"\n")
+				|| !strstr(reply, "DUMPDONE\n"));
+			printf(" test for DUMPSINCE after the 257th deletion: '%.9s' and %d deletion(s) replayed; got DUMPRESET and 0?\n",
+				reply, count_in(reply, "DELINFO "));
+		}
+
+		if (sock_client >= 0)
+			close(sock_client);
+		dstate_free();
+		free(sockname);
+	}
+#endif	/* !WIN32 */
+
 	/* Finish */
 	printf("test_rules completed. Total cases %d, passed %d, failed %d\n",
 		cases_passed+cases_failed, cases_passed, cases_failed);
@@ -101,7 +101,10 @@ static int RunBuiltInTests(char *argv[]) {
 		{.buf = "16 0c 00 00 00", .Offset = 7, .Size = 1, .LogMin = 0, .LogMax = 1, .expectedValue =  0},
 		{.buf = "16 0c 00 00 00", .Offset = 8, .Size = 1, .LogMin = 0, .LogMax = 1, .expectedValue =  0},
 		{.buf = "16 0c 00 00 00", .Offset = 9, .Size = 1, .LogMin = 0, .LogMax = 1, .expectedValue =  0},
-		{.buf = "16 0c 00 00 00", .Offset = 10, .Size = 1, .LogMin = 0, .LogMax = 1, .expectedValue =  0}
+		{.buf = "16 0c 00 00 00", .Offset = 10, .Size = 1, .LogMin = 0, .LogMax = 1, .expectedValue =  0},
+		{.buf = "00 f8 ff 01", .Offset = 3, .Size = 16, .LogMin = 0, .LogMax = 65535, .expectedValue = 16383},
+		{.buf = "00 f0 ff", .Offset = 4, .Size = 8, .LogMin = -128, .LogMax = 127, .expectedValue = -1},
+		{.buf = "00 30 f8 ff 0f", .Offset = 4, .Size = 24, .LogMin = -8388608, .LogMax = 8388607, .expectedValue = -125}
 	};
 
 	/* See comments below about rdlen calculation emulation for tests */
@@ -0,0 +1,229 @@
+/*  libusb1_async_utest.c - NUT libusb-1.0 asynchronous interrupt reads test tool
+ *
+ *  Copyright (C) 2026 by NUT Community
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+
+/* The libusb calls which the interrupt transfer goes through are mocked,
+ * to end the transfer (or not) when the tests want it; the rest of the
+ * libusb1.c code is used as is */
+#define libusb_submit_transfer		mock_libusb_submit_transfer
+#define libusb_cancel_transfer		mock_libusb_cancel_transfer
+#define libusb_handle_events_timeout	mock_libusb_handle_events_timeout
+#define libusb_free_transfer		mock_libusb_free_transfer
+#define libusb_close			mock_libusb_close
+
+#include "libusb1.c"
+
+/* driver version */
+#define DRIVER_NAME	"Mock USB driver for unit tests"
+#define DRIVER_VERSION	"0.01"
+
+/* driver description structure */
+upsdrv_info_t upsdrv_info = {
+	DRIVER_NAME,
+	DRIVER_VERSION,
+	"NUT Community",
+	DRV_EXPERIMENTAL,
+	{ NULL }
+};
+
+static int cases_passed = 0;
+static int cases_failed = 0;
+
+static char * pass_fail[2] = {"pass", "fail"};
+
+void upsdrv_cleanup(void) {}
+void upsdrv_shutdown(void) {}
+void upsdrv_initups(void) {}
+void upsdrv_initinfo(void) {}
+void upsdrv_makevartable(void) {}
+void upsdrv_tweak_prognames(void) {}
+void upsdrv_updateinfo(void) {}
+void upsdrv_help(void) {}
+
+static void report_pass(void) {
+	printf("%s", pass_fail[0]);
+	cases_passed++;
+}
+
+static void report_fail(void) {
+	printf("%s", pass_fail[1]);
+	cases_failed++;
+}
+
+static int report_0_means_pass(int i) {
+	if (i == 0) {
+		report_pass();
+	} else {
+		report_fail();
+	}
+	return i;
+}
+
+/* the transfers are static, "freeing" them is only counted */
+static struct libusb_transfer	mock_xfer[2];
+static int	mock_device;	/* its address is the device handle */
+static int	mock_inflight[2];
+
+/* handle_events calls after which the transfer ends, or -1 for never */
+static int	mock_end_after = -1;
+static enum libusb_transfer_status	mock_end_status = LIBUSB_TRANSFER_CANCELLED;
+
+static int	mock_events, mock_submitted, mock_freed, mock_closed;
+
+static void mock_transfer_end(int i, enum libusb_transfer_status status)
+{
+	mock_inflight[i] = 0;
+	mock_xfer[i].status = status;
+	mock_xfer[i].callback(&mock_xfer[i]);
+}
+
+int LIBUSB_CALL mock_libusb_submit_transfer(struct libusb_transfer *transfer)
+{
+	mock_inflight[transfer == &mock_xfer[1]] = 1;
+	mock_submitted++;
+	return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL mock_libusb_cancel_transfer(struct libusb_transfer *transfer)
+{
+	return mock_inflight[transfer == &mock_xfer[1]] ? LIBUSB_SUCCESS : LIBUSB_ERROR_NOT_FOUND;
+}
+
+int LIBUSB_CALL mock_libusb_handle_events_timeout(libusb_context *ctx, struct timeval *tv)
+{
+	NUT_UNUSED_VARIABLE(ctx);
+	NUT_UNUSED_VARIABLE(tv);
+
+	mock_events++;
+	if (mock_end_after >= 0 && mock_events > mock_end_after && mock_inflight[0]) {
+		mock_transfer_end(0, mock_end_status);
+	}
+	return LIBUSB_SUCCESS;
+}
+
+void LIBUSB_CALL mock_libusb_free_transfer(struct libusb_transfer *transfer)
+{
+	NUT_UNUSED_VARIABLE(transfer);
+	mock_freed++;
+}
+
+void LIBUSB_CALL mock_libusb_close(libusb_device_handle *dev_handle)
+{
+	NUT_UNUSED_VARIABLE(dev_handle);
+	mock_closed++;
+}
+
+/* a transfer (#i) is in flight on the mock device, as after
+ * nut_libusb_async_submit(); it ends after that many event loops */
+static libusb_device_handle *mock_start(int i, int end_after, enum libusb_transfer_status status)
+{
+	libusb_device_handle	*udev = (libusb_device_handle *)(void *)&mock_device;
+
+	memset(&mock_xfer[i], 0, sizeof(mock_xfer[i]));
+	mock_xfer[i].dev_handle = udev;
+	mock_xfer[i].buffer = nut_usb_async_buf;
+	mock_xfer[i].callback = nut_libusb_async_complete;
+	mock_inflight[i] = 1;
+
+	nut_usb_async_xfer = &mock_xfer[i];
+	nut_usb_async_udev = udev;
+	nut_usb_async_inflight = true;
+
+	mock_end_after = end_after;
+	mock_end_status = status;
+	mock_events = mock_submitted = mock_freed = mock_closed = 0;
+
+	return udev;
+}
+
+int main(int argc, char **argv) {
+	char	*s;
+	libusb_device_handle	*udev;
+
+	NUT_UNUSED_VARIABLE(argc);
+	NUT_UNUSED_VARIABLE(argv);
+
+	s = getenv("NUT_DEBUG_LEVEL");
+	if (s) {
+		int	l;
+		if (str_to_int(s, &l, 10) && l > 0) {
+			nut_debug_level = l;
+			upsdebugx(1, "Defaulting debug verbosity to NUT_DEBUG_LEVEL=%d "
+				"since none was requested by command-line options", l);
+		}
+	}
+
+	/* Test cases #1-#5 (closing with an interrupt transfer in flight)
+	 * The device handle is only closed, and the transfer freed, after
+	 * the completion callback of the transfer ran; a transfer which
+	 * does not end is left behind with its handle, and released by its
+	 * callback should it run later.
+	 */
+
+	/* #1 */
+	udev = mock_start(0, 0, LIBUSB_TRANSFER_CANCELLED);
+	nut_libusb_close(udev);
+	report_0_means_pass(mock_freed != 1 || mock_closed != 1 || nut_usb_async_xfer != NULL);
+	printf(" test for close with the transfer cancelled at once: freed %d, closed %d; got 1 and 1?\n",
+		mock_freed, mock_closed);
+
+	/* #2 */
+	udev = mock_start(0, 20, LIBUSB_TRANSFER_CANCELLED);
+	nut_libusb_close(udev);
+	report_0_means_pass(mock_freed != 1 || mock_closed != 1 || mock_events != 21);
+	printf(" test for close with the transfer cancelled after %d event loops: freed %d, closed %d; got 1 and 1?\n",
+		mock_events, mock_freed, mock_closed);
+
+	/* #3 */
+	udev = mock_start(0, 0, LIBUSB_TRANSFER_COMPLETED);
+	nut_libusb_close(udev);
+	report_0_means_pass(mock_submitted != 0 || mock_freed != 1 || mock_closed != 1
+		|| nut_usb_async_count != 0);
+	printf(" test for close with a report completed instead: resubmitted %d, freed %d, closed %d; got 0, 1 and 1?\n",
+		mock_submitted, mock_freed, mock_closed);
+
+	/* #4 */
+	udev = mock_start(0, -1, LIBUSB_TRANSFER_CANCELLED);
+	nut_libusb_close(udev);
+	report_0_means_pass(mock_freed != 0 || mock_closed != 0 || nut_usb_async_xfer != NULL
+		|| mock_events != NUT_LIBUSB_ASYNC_STOP_WAIT);
+	printf(" test for close with the transfer never ending (%d event loops): freed %d, closed %d; got 0 and 0?\n",
+		mock_events, mock_freed, mock_closed);
+
+	/* #5: the transfer left behind ends while another one is in flight */
+	mock_start(1, -1, LIBUSB_TRANSFER_CANCELLED);
+	mock_transfer_end(0, LIBUSB_TRANSFER_COMPLETED);
+	report_0_means_pass(mock_freed != 1 || mock_submitted != 0 || !nut_usb_async_inflight
+		|| nut_usb_async_count != 0 || nut_usb_async_xfer != &mock_xfer[1]);
+	printf(" test for the transfer left behind ending later: freed %d, resubmitted %d; got 1 and 0?\n",
+		mock_freed, mock_submitted);
+
+	/* Finish */
+	printf("test_rules completed. Total cases %d, passed %d, failed %d\n",
+		cases_passed+cases_failed, cases_passed, cases_failed);
+
+	/* Return 0 (exit-code OK, boolean false) if no tests failed and some ran */
+	if ( (cases_failed == 0) && (cases_passed > 0) )
+		return 0;
+
+	return 1;
+}
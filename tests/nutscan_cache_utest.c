@@ -0,0 +1,326 @@
+/*  nutscan_cache_utest.c - NUT scanner results cache test tool
+ *
+ *  Copyright (C) 2026 by NUT Community
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "common.h"	/* Must be first include to pull "config.h" */
+#include "nut_stdint.h"
+#include "nutscan-cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_FILE	"nutscan_cache_utest.cache"
+
+static int cases_passed = 0;
+static int cases_failed = 0;
+
+static char * pass_fail[2] = {"pass", "fail"};
+
+static void report_pass(void) {
+	printf("%s", pass_fail[0]);
+	cases_passed++;
+}
+
+static void report_fail(void) {
+	printf("%s", pass_fail[1]);
+	cases_failed++;
+}
+
+static int report_0_means_pass(int i) {
+	if (i == 0) {
+		report_pass();
+	} else {
+		report_fail();
+	}
+	return i;
+}
+
+static void write_file(const char *text)
+{
+	FILE	*f = fopen(CACHE_FILE, "w");
+
+	if (f == NULL) {
+		printf("fail: could not write %s\n", CACHE_FILE);
+		exit(1);
+	}
+	fputs(text, f);
+	fclose(f);
+}
+
+/* load "text" as a cache file; returns what nutscan_cache_load() did */
+static int load_text(nutscan_cache_t *cache, const char *text)
+{
+	nutscan_cache_init(cache);
+	write_file(text);
+	return nutscan_cache_load(cache, CACHE_FILE);
+}
+
+static nutscan_device_t *new_device(nutscan_device_type_t type,
+	const char *driver, const char *port)
+{
+	nutscan_device_t	*dev = nutscan_new_device();
+
+	dev->type = type;
+	dev->driver = driver ? strdup(driver) : NULL;
+	dev->port = port ? strdup(port) : NULL;
+	return dev;
+}
+
+static int same_str(const char *s1, const char *s2)
+{
+	if (s1 == NULL || s2 == NULL)
+		return (s1 == s2);
+	return !strcmp(s1, s2);
+}
+
+/* the planned ranges, as "start-end,start-end," */
+static const char *plan_string(const nutscan_ip_range_list_t *plan)
+{
+	static char	buf[LARGEBUF];
+	nutscan_ip_range_t	*p;
+
+	buf[0] = '\0';
+	for (p = plan->ip_ranges; p != NULL; p = p->next)
+		snprintfcat(buf, sizeof(buf), "%s-%s,", p->start_ip, p->end_ip);
+
+	return buf;
+}
+
+int main(int argc, char **argv) {
+	char	*s;
+	nutscan_cache_t	cache;
+	int	ret;
+
+	NUT_UNUSED_VARIABLE(argc);
+	NUT_UNUSED_VARIABLE(argv);
+
+	s = getenv("NUT_DEBUG_LEVEL");
+	if (s && atoi(s) > 0) {
+		nut_debug_level = atoi(s);
+		upsdebugx(1, "Defaulting debug verbosity to NUT_DEBUG_LEVEL=%d "
+			"since none was requested by command-line options", nut_debug_level);
+	}
+
+	/* Test cases #1-#5 (save and load round-trip)
+	 * Devices with their options (escaped characters and NULL values
+	 * included) and the scanned ranges come back as they were saved;
+	 * devices found gone are not saved.
+	 */
+	{
+		nutscan_device_t	*found;
+		nutscan_cache_entry_t	*e;
+		nutscan_ip_range_list_t	req, plan;
+		nutscan_options_t	*opt;
+		time_t	saved;
+
+		/* a device which the scan below does not find again */
+		load_text(&cache, "DEVICE\tSNMP\t1000\tsnmp-ups\t192.0.2.9\t\\N\n");
+		saved = cache.now;
+
+		nutscan_init_ip_ranges(&req);
+		nutscan_add_ip_range(&req, strdup("192.0.2.1"), strdup("192.0.2.254"));
+		nutscan_init_ip_ranges(&plan);
+		nutscan_cache_plan(&cache, TYPE_SNMP, &req, 3600, &plan);
+		nutscan_free_ip_ranges(&plan);
+
+		found = new_device(TYPE_SNMP, "snmp-ups", "192.0.2.1");
+		nutscan_add_commented_option_to_device(found, "desc", "Rack\t2\\A\nrow 3", NULL);
+		nutscan_add_commented_option_to_device(found, "community", "public", "# ");
+		nutscan_add_commented_option_to_device(found, "mibs", NULL, NULL);
+		nutscan_cache_update(&cache, TYPE_SNMP, found, &req);
+		nutscan_free_device(found);
+
+		ret = nutscan_cache_save(&cache, CACHE_FILE);
+		nutscan_cache_free(&cache);
+
+		nutscan_cache_init(&cache);
+		ret = (ret == 0) ? nutscan_cache_load(&cache, CACHE_FILE) : -2;
+
+		/* #1 */
+		report_0_means_pass(ret != 1 || cache.entries == NULL || cache.entries->next != NULL);
+		printf(" test for the devices saved and loaded again: loaded %d; got 1?\n", ret);
+
+		e = cache.entries;
+
+		/* #2 */
+		report_0_means_pass(e == NULL || e->dev->type != TYPE_SNMP
+			|| !same_str(e->dev->driver, "snmp-ups")
+			|| !same_str(e->dev->port, "192.0.2.1")
+			|| e->dev->alt_driver_names != NULL
+			|| e->state != NUTSCAN_CACHE_KNOWN || e->last_seen != saved);
+		printf(" test for the device fields coming back: driver %s, port %s; got snmp-ups and 192.0.2.1?\n",
+			e ? NUT_STRARG(e->dev->driver) : "(none)", e ? NUT_STRARG(e->dev->port) : "(none)");
+
+		/* #3 */
+		opt = e ? e->dev->opt : NULL;
+		report_0_means_pass(opt == NULL
+			|| !same_str(opt->option, "desc")
+			|| !same_str(opt->value, "Rack\t2\\A\nrow 3")
+			|| opt->comment_tag != NULL
+			|| opt->next == NULL
+			|| !same_str(opt->next->value, "public")
+			|| !same_str(opt->next->comment_tag, "# ")
+			|| opt->next->next == NULL
+			|| opt->next->next->value != NULL
+			|| opt->next->next->next != NULL);
+		printf(" test for the options with tabs, newlines, backslashes and NULL values coming back\n");
+
+		/* #4 */
+		report_0_means_pass(cache.ranges == NULL || cache.ranges->next != NULL
+			|| cache.ranges->type != TYPE_SNMP
+			|| !same_str(cache.ranges->start_ip, "192.0.2.1")
+			|| !same_str(cache.ranges->end_ip, "192.0.2.254")
+			|| cache.ranges->scanned_at != saved);
+		printf(" test for the scanned range coming back with its time stamp\n");
+
+		/* #5 */
+		nutscan_cache_free(&cache);
+		ret = load_text(&cache, "# nut-scanner results cache, format 1\n\n");
+		report_0_means_pass(ret != 0 || cache.entries != NULL || cache.ranges != NULL);
+		printf(" test for an empty cache file: loaded %d; got 0?\n", ret);
+		nutscan_cache_free(&cache);
+
+		nutscan_free_ip_ranges(&req);
+	}
+
+	/* Test cases #6-#11 (malformed cache files)
+	 * Any line which can not be parsed makes the whole file ignored:
+	 * the load fails (-1) and leaves the cache empty.
+	 */
+	{
+		static const char *bad[] = {
+			"DEVICE\tnosuchbus\t1000\tsnmp-ups\t192.0.2.1\t\\N\n",
+			"DEVICE\tSNMP\tyesterday\tsnmp-ups\t192.0.2.1\t\\N\n",
+			"DEVICE\tSNMP\t1000\tsnmp-ups\t192.0.2.1\n",
+			"OPTION\tcommunity\tpublic\t\\N\n",
+			"RANGE\tSNMP\t-5\t192.0.2.1\t192.0.2.254\n",
+			"DEVICE\tSNMP\t1000\tsnmp-ups\t192.0.2.1\t\\N\nGARBAGE\n",
+			NULL
+		};
+		size_t	i;
+
+		for (i = 0; bad[i] != NULL; i++) {
+			/* #6-#11 */
+			ret = load_text(&cache, bad[i]);
+			report_0_means_pass(ret != -1 || cache.entries != NULL || cache.ranges != NULL);
+			printf(" test for malformed cache file #%" PRIuSIZE ": loaded %d; got -1?\n", i + 1, ret);
+			nutscan_cache_free(&cache);
+		}
+	}
+
+	/* Test cases #12-#17 (range expiry and time stamps)
+	 * A range scanned completely within max_age only has its known
+	 * hosts probed again; an older (or unknown) one is fully
+	 * scanned, and only stamped once that scan is done.
+	 */
+	{
+		nutscan_ip_range_list_t	req, plan;
+		time_t	now;
+		char	text[LARGEBUF];
+
+		nutscan_init_ip_ranges(&req);
+		nutscan_add_ip_range(&req, strdup("192.0.2.1"), strdup("192.0.2.254"));
+
+		nutscan_cache_init(&cache);
+		now = cache.now;
+		nutscan_cache_free(&cache);
+
+#define CACHE_TEXT(age) \
+		snprintf(text, sizeof(text), \
+			"RANGE\tSNMP\t%lld\t192.0.2.1\t192.0.2.254\n" \
+			"DEVICE\tSNMP\t1000\tsnmp-ups\t192.0.2.7\t\\N\n" \
+			"DEVICE\tSNMP\t1000\tsnmp-ups\t198.51.100.1\t\\N\n", \
+			(long long)(now - (age)))
+
+		/* #12 */
+		CACHE_TEXT(600);
+		load_text(&cache, text);
+		nutscan_init_ip_ranges(&plan);
+		nutscan_cache_plan(&cache, TYPE_SNMP, &req, 3600, &plan);
+		report_0_means_pass(strcmp(plan_string(&plan), "192.0.2.7-192.0.2.7,"));
+		printf(" test for a range scanned 10 minutes ago: plan %s; got 192.0.2.7-192.0.2.7,?\n",
+			plan_string(&plan));
+		nutscan_free_ip_ranges(&plan);
+		nutscan_cache_free(&cache);
+
+		/* #13 */
+		CACHE_TEXT(7200);
+		load_text(&cache, text);
+		nutscan_init_ip_ranges(&plan);
+		nutscan_cache_plan(&cache, TYPE_SNMP, &req, 3600, &plan);
+		report_0_means_pass(strcmp(plan_string(&plan), "192.0.2.1-192.0.2.254,"));
+		printf(" test for a range scanned 2 hours ago: plan %s; got the whole range?\n",
+			plan_string(&plan));
+		nutscan_free_ip_ranges(&plan);
+
+		/* #14: the planned scan did not complete (yet) */
+		report_0_means_pass(cache.ranges == NULL || cache.ranges->scanned_at != now - 7200);
+		printf(" test for the range not stamped at plan time: %lld sec old; got 7200?\n",
+			cache.ranges ? (long long)(now - cache.ranges->scanned_at) : -1LL);
+
+		/* #15 */
+		nutscan_cache_update(&cache, TYPE_SNMP, NULL, &req);
+		report_0_means_pass(cache.ranges == NULL || cache.ranges->scanned_at != cache.now);
+		printf(" test for the range stamped after the scan: %lld sec old; got 0?\n",
+			cache.ranges ? (long long)(cache.now - cache.ranges->scanned_at) : -1LL);
+		nutscan_cache_free(&cache);
+
+		/* #16 */
+		CACHE_TEXT(600);
+		load_text(&cache, text);
+		nutscan_init_ip_ranges(&plan);
+		nutscan_cache_plan(&cache, TYPE_SNMP, &req, 0, &plan);
+		report_0_means_pass(strcmp(plan_string(&plan), "192.0.2.1-192.0.2.254,"));
+		printf(" test for reuse disabled (max age 0): plan %s; got the whole range?\n",
+			plan_string(&plan));
+		nutscan_free_ip_ranges(&plan);
+		nutscan_cache_free(&cache);
+
+		/* #17: a new range which was planned, but never scanned,
+		 * is not saved */
+		nutscan_cache_init(&cache);
+		nutscan_init_ip_ranges(&plan);
+		nutscan_cache_plan(&cache, TYPE_SNMP, &req, 3600, &plan);
+		nutscan_free_ip_ranges(&plan);
+		nutscan_cache_save(&cache, CACHE_FILE);
+		nutscan_cache_free(&cache);
+		nutscan_cache_init(&cache);
+		ret = nutscan_cache_load(&cache, CACHE_FILE);
+		report_0_means_pass(ret != 0 || cache.ranges != NULL);
+		printf(" test for a planned range whose scan did not complete: %s saved; got none?\n",
+			cache.ranges ? "one" : "none");
+		nutscan_cache_free(&cache);
+
+		nutscan_free_ip_ranges(&req);
+	}
+
+	unlink(CACHE_FILE);
+
+	/* Finish */
+	printf("test_rules completed. Total cases %d, passed %d, failed %d\n",
+		cases_passed+cases_failed, cases_passed, cases_failed);
+
+	/* Return 0 (exit-code OK, boolean false) if no tests failed and some ran */
+	if ( (cases_failed == 0) && (cases_passed > 0) )
+		return 0;
+
+	return 1;
+}
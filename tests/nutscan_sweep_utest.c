@@ -0,0 +1,224 @@
+/*  nutscan_sweep_utest.c - NUT scanner liveness sweep test tool
+ *
+ *  Copyright (C) 2026 by NUT Community
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "common.h"	/* Must be first include to pull "config.h" */
+#include "nut_stdint.h"
+#include "nutscan-sweep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined HAVE_SYS_RESOURCE_H) && !(defined WIN32)
+# define SWEEP_UTEST_POSSIBLE 1
+# include <unistd.h>
+# include <sys/resource.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+#endif
+
+static int cases_passed = 0;
+static int cases_failed = 0;
+
+static char * pass_fail[2] = {"pass", "fail"};
+
+static void report_pass(void) {
+	printf("%s", pass_fail[0]);
+	cases_passed++;
+}
+
+static void report_fail(void) {
+	printf("%s", pass_fail[1]);
+	cases_failed++;
+}
+
+static int report_0_means_pass(int i) {
+	if (i == 0) {
+		report_pass();
+	} else {
+		report_fail();
+	}
+	return i;
+}
+
+#ifdef SWEEP_UTEST_POSSIBLE
+/* limit the process to "fds" open files, so the sweeps share "fds"
+ * less NUTSCAN_SWEEP_RESERVE_FD; returns 0 on success */
+static int set_fd_limit(rlim_t fds)
+{
+	struct rlimit	limit;
+
+	if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+		return -1;
+
+	if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < fds)
+		return -1;
+
+	limit.rlim_cur = fds;
+	return setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+/* a TCP listener on 127.0.0.1 (only), its port is returned in "port" */
+static int listen_loopback(uint16_t *port)
+{
+	struct sockaddr_in	sa;
+	socklen_t	len = sizeof(sa);
+	int	fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (fd < 0)
+		return -1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = 0;
+
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0
+	 || listen(fd, 64) < 0
+	 || getsockname(fd, (struct sockaddr *)&sa, &len) < 0
+	) {
+		close(fd);
+		return -1;
+	}
+
+	*port = ntohs(sa.sin_port);
+	return fd;
+}
+#endif	/* SWEEP_UTEST_POSSIBLE */
+
+int main(int argc, char **argv) {
+	char	*s;
+
+	NUT_UNUSED_VARIABLE(argc);
+	NUT_UNUSED_VARIABLE(argv);
+
+	s = getenv("NUT_DEBUG_LEVEL");
+	if (s && atoi(s) > 0) {
+		nut_debug_level = atoi(s);
+		upsdebugx(1, "Defaulting debug verbosity to NUT_DEBUG_LEVEL=%d "
+			"since none was requested by command-line options", nut_debug_level);
+	}
+
+#ifdef SWEEP_UTEST_POSSIBLE
+	if (set_fd_limit(NUTSCAN_SWEEP_RESERVE_FD + 128) != 0) {
+		printf("SKIP: could not lower the open files limit for the tests\n");
+		return 0;
+	}
+
+	/* Test cases #1-#5 (file descriptor budget)
+	 * The sweeps running at the same time share the open files limit
+	 * (less the reserve); each gets at most what it asks for, and
+	 * what is left then, which may be nothing.
+	 */
+	{
+		size_t	a, b;
+
+		/* #1 */
+		a = nutscan_sweep_budget_take(NUTSCAN_SWEEP_MAX_INFLIGHT);
+		report_0_means_pass(a != 128);
+		printf(" test for a sweep asking for more than the budget: granted %" PRIuSIZE "; got 128?\n", a);
+
+		/* #2 */
+		b = nutscan_sweep_budget_take(10);
+		report_0_means_pass(b != 0);
+		printf(" test for another sweep with the budget used up: granted %" PRIuSIZE "; got 0?\n", b);
+
+		/* #3 */
+		nutscan_sweep_budget_release(100);
+		b = nutscan_sweep_budget_take(NUTSCAN_SWEEP_MAX_INFLIGHT);
+		report_0_means_pass(b != 100);
+		printf(" test for another sweep after 100 were handed back: granted %" PRIuSIZE "; got 100?\n", b);
+		nutscan_sweep_budget_release(a - 100);
+		nutscan_sweep_budget_release(b);
+
+		/* #4 */
+		a = nutscan_sweep_budget_take(50);
+		b = nutscan_sweep_budget_take(50);
+		report_0_means_pass(a != 50 || b != 50);
+		printf(" test for two small sweeps: granted %" PRIuSIZE " and %" PRIuSIZE "; got 50 and 50?\n", a, b);
+		nutscan_sweep_budget_release(a);
+		nutscan_sweep_budget_release(b);
+
+		/* #5 */
+		set_fd_limit(NUTSCAN_SWEEP_RESERVE_FD);
+		a = nutscan_sweep_budget_take(NUTSCAN_SWEEP_MAX_INFLIGHT);
+		report_0_means_pass(a != 0);
+		printf(" test for an open files limit within the reserve: granted %" PRIuSIZE "; got 0?\n", a);
+		nutscan_sweep_budget_release(a);
+		set_fd_limit(NUTSCAN_SWEEP_RESERVE_FD + 128);
+	}
+
+	/* Test cases #6-#8 (TCP sweeps of 127.0.0.1-127.0.0.40)
+	 * Only 127.0.0.1 listens; the window of probes in flight is what
+	 * the budget grants, and the sweep falls back (-1) if it is none.
+	 */
+	{
+		nutscan_ip_range_list_t	irl, alive;
+		uint16_t	port = 0;
+		size_t	held;
+		int	lfd = listen_loopback(&port), ret;
+
+		nutscan_init_ip_ranges(&irl);
+		nutscan_add_ip_range(&irl, strdup("127.0.0.1"), strdup("127.0.0.40"));
+
+		/* #6: 8 probes in flight at most, for 40 addresses */
+		held = nutscan_sweep_budget_take(120);
+		nutscan_init_ip_ranges(&alive);
+		ret = nutscan_sweep_ip_ranges(&irl, NUTSCAN_SWEEP_TCP, port,
+			NULL, 0, 500000, 1, &alive);
+		report_0_means_pass(lfd < 0 || ret != 1 || alive.ip_ranges_count != 1
+			|| strcmp(alive.ip_ranges->start_ip, "127.0.0.1"));
+		printf(" test for a sweep with a window of 8: %d responded; got 1?\n", ret);
+		nutscan_free_ip_ranges(&alive);
+
+		/* #7 */
+		nutscan_sweep_budget_release(held);
+		held = nutscan_sweep_budget_take(NUTSCAN_SWEEP_MAX_INFLIGHT);
+		report_0_means_pass(held != 128);
+		printf(" test for the sweep handing its budget back: %" PRIuSIZE " free; got 128?\n", held);
+
+		/* #8 */
+		nutscan_init_ip_ranges(&alive);
+		ret = nutscan_sweep_ip_ranges(&irl, NUTSCAN_SWEEP_TCP, port,
+			NULL, 0, 500000, 1, &alive);
+		report_0_means_pass(ret != -1 || alive.ip_ranges_count != 0);
+		printf(" test for a sweep with no budget left: returned %d; got -1?\n", ret);
+		nutscan_free_ip_ranges(&alive);
+		nutscan_sweep_budget_release(held);
+
+		nutscan_free_ip_ranges(&irl);
+		if (lfd >= 0)
+			close(lfd);
+	}
+#endif	/* SWEEP_UTEST_POSSIBLE */
+
+	/* Finish */
+	printf("test_rules completed. Total cases %d, passed %d, failed %d\n",
+		cases_passed+cases_failed, cases_passed, cases_failed);
+
+	/* Return 0 (exit-code OK, boolean false) if no tests failed (or none
+	 * could run on this platform) */
+	if (cases_failed == 0)
+		return 0;
+
+	return 1;
+}
@@ -0,0 +1,222 @@
+/*  serial_utest.c - NUT serial port helpers test tool
+ *
+ *  Copyright (C) 2026 by NUT Community
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "main.h"
+#include "dstate.h"
+#include "serial.h"
+#include "attribute.h"
+#include "nut_stdint.h"
+
+/* driver version */
+#define DRIVER_NAME	"Mock serial driver for unit tests"
+#define DRIVER_VERSION	"0.01"
+
+/* driver description structure */
+upsdrv_info_t upsdrv_info = {
+	DRIVER_NAME,
+	DRIVER_VERSION,
+	"NUT Community",
+	DRV_EXPERIMENTAL,
+	{ NULL }
+};
+
+static int cases_passed = 0;
+static int cases_failed = 0;
+
+static char * pass_fail[2] = {"pass", "fail"};
+
+void upsdrv_cleanup(void) {}
+void upsdrv_shutdown(void) {}
+void upsdrv_initups(void) {}
+void upsdrv_initinfo(void) {}
+void upsdrv_makevartable(void) {}
+void upsdrv_tweak_prognames(void) {}
+void upsdrv_updateinfo(void) {}
+void upsdrv_help(void) {}
+
+static void report_pass(void) {
+	printf("%s", pass_fail[0]);
+	cases_passed++;
+}
+
+static void report_fail(void) {
+	printf("%s", pass_fail[1]);
+	cases_failed++;
+}
+
+static int report_0_means_pass(int i) {
+	if (i == 0) {
+		report_pass();
+	} else {
+		report_fail();
+	}
+	return i;
+}
+
+#ifndef WIN32
+/* The "device" is a pair of pipes: commands are written into one, and
+ * replies (put there by the test) are read from the other; the serial
+ * helpers keep their latency statistics per command, not per port */
+static int	cmd_pipe[2], reply_pipe[2];
+
+/* send a command; if reply_delay >= 0, the reply is there after that
+ * many msec; then read with the given timeout, and return how long
+ * the read took (msec) */
+static long exchange(const char *cmd, long reply_delay, time_t d_sec, useconds_t d_usec, ssize_t *ret)
+{
+	char	buf[SMALLBUF], drain[SMALLBUF];
+	struct timeval	start, now;
+
+	ser_send(cmd_pipe[1], "%s", cmd);
+	if (read(cmd_pipe[0], drain, sizeof(drain)) < 1) {
+		/* the command should be in there */
+	}
+
+	if (reply_delay >= 0) {
+		usleep((useconds_t)reply_delay * 1000);
+		if (write(reply_pipe[1], "(OK\r", 4) != 4) {
+			/* the read will time out then */
+		}
+	}
+
+	gettimeofday(&start, NULL);
+	*ret = ser_get_buf(reply_pipe[0], buf, sizeof(buf), d_sec, d_usec);
+	gettimeofday(&now, NULL);
+
+	return (now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000;
+}
+
+/* let the helpers see a few quick (or slower) replies to a command */
+static void learn(const char *cmd, long reply_delay)
+{
+	ssize_t	ret;
+	int	i;
+
+	for (i = 0; i < 4; i++)
+		exchange(cmd, reply_delay, 1, 0, &ret);
+}
+#endif	/* !WIN32 */
+
+int main(int argc, char **argv) {
+	char	*s;
+
+	NUT_UNUSED_VARIABLE(argc);
+	NUT_UNUSED_VARIABLE(argv);
+
+	s = getenv("NUT_DEBUG_LEVEL");
+	if (s) {
+		int	l;
+		if (str_to_int(s, &l, 10) && l > 0) {
+			nut_debug_level = l;
+			upsdebugx(1, "Defaulting debug verbosity to NUT_DEBUG_LEVEL=%d "
+				"since none was requested by command-line options", l);
+		}
+	}
+
+#ifndef WIN32
+	if (pipe(cmd_pipe) || pipe(reply_pipe)) {
+		printf("fail: could not make the pipes for the tests\n");
+		return 1;
+	}
+
+	/* Test cases #1-#8 (adaptive read timeouts, 20 msec floor)
+	 * Waits for replies are cut to what a command is known to take,
+	 * but not below the floor nor above what the caller asked for, and
+	 * not again before a reply which took longer is seen.
+	 */
+	{
+		ssize_t	ret;
+		long	took;
+
+		serial_adaptive_timeout = 20;
+
+		/* #1 */
+		took = exchange("X\r", -1, 0, 200000, &ret);
+		report_0_means_pass(ret != 0 || took < 150);
+		printf(" test for no reply to an unknown command: waited %ld msec; got 200?\n", took);
+
+		learn("Q1\r", 0);
+
+		/* #2 */
+		took = exchange("Q1\r", -1, 2, 0, &ret);
+		report_0_means_pass(ret != 0 || took < 10 || took > 500);
+		printf(" test for no reply to a quick command: waited %ld msec; got the 20 msec floor?\n", took);
+
+		/* #3 */
+		took = exchange("Q1\r", -1, 0, 200000, &ret);
+		report_0_means_pass(ret != 0 || took < 150);
+		printf(" test for no reply again after a wait was cut short: waited %ld msec; got 200?\n", took);
+
+		/* #4 */
+		exchange("Q1\r", 0, 1, 0, &ret);
+		took = exchange("Q1\r", -1, 2, 0, &ret);
+		report_0_means_pass(ret != 0 || took > 500);
+		printf(" test for no reply after the command got a reply again: waited %ld msec; got 20?\n", took);
+
+		/* #5: another command with the same length is not mistaken
+		 * for the one learned */
+		took = exchange("Q2\r", -1, 0, 200000, &ret);
+		report_0_means_pass(ret != 0 || took < 150);
+		printf(" test for no reply to another (unknown) command: waited %ld msec; got 200?\n", took);
+
+		/* about 100 msec each: average 100 and deviation 50, 37, 28,
+		 * 21 msec make the wait about 180 msec */
+		learn("I\r", 100);
+
+		/* #6 */
+		took = exchange("I\r", -1, 2, 0, &ret);
+		report_0_means_pass(ret != 0 || took < 120 || took > 1000);
+		printf(" test for no reply to a slow command: waited %ld msec; got about 180?\n", took);
+
+		/* #7 */
+		exchange("I\r", 100, 1, 0, &ret);
+		took = exchange("I\r", -1, 0, 60000, &ret);
+		report_0_means_pass(ret != 0 || took > 110);
+		printf(" test for the caller's timeout being shorter than the learned wait: waited %ld msec; got 60?\n", took);
+
+		/* #8 */
+		serial_adaptive_timeout = 0;
+		took = exchange("Q1\r", -1, 0, 200000, &ret);
+		report_0_means_pass(ret != 0 || took < 150);
+		printf(" test for no reply to a quick command with adaptive timeouts off: waited %ld msec; got 200?\n", took);
+	}
+
+	ser_close(reply_pipe[0], "reply pipe");
+	close(reply_pipe[1]);
+	close(cmd_pipe[0]);
+	close(cmd_pipe[1]);
+#endif	/* !WIN32 */
+
+	/* Finish */
+	printf("test_rules completed. Total cases %d, passed %d, failed %d\n",
+		cases_passed+cases_failed, cases_passed, cases_failed);
+
+	dstate_free();
+	upsdrv_cleanup();
+
+	/* Return 0 (exit-code OK, boolean false) if no tests failed (or none
+	 * could run on this platform) */
+	if (cases_failed == 0)
+		return 0;
+
+	return 1;
+}
@@ -0,0 +1,108 @@
+#!/bin/sh
+
+# Copyright (C) 2026 by NUT Community
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+#
+#! \file    usb-replay-bench.sh
+#  \brief   Benchmark a USB driver against a capture of its device
+#  \details Runs a USB driver (built with libusb-1.0) on the transactions
+#           recorded with its "usb_record" option, replayed via the
+#           "usb_replay" option, so no device is needed; reports the
+#           initialization time, the time and processor time of an
+#           update cycle and the USB transfers done per cycle, from
+#           the driver.perf.* data of the driver (see "perfvars").
+#
+#           Usage: usb-replay-bench.sh [-n CYCLES] DRIVER CAPTURE [-x ...]
+#           e.g.:  usb-replay-bench.sh -n 200 ../drivers/usbhid-ups eaton.cap
+#
+#           Or from the build area: make -C tests usb-replay-bench \
+#               BENCH_DRIVER=../drivers/usbhid-ups BENCH_CAPTURE=eaton.cap
+
+CYCLES=100
+if [ x"$1" = x"-n" ] ; then
+	CYCLES="$2"
+	shift 2
+fi
+
+if [ $# -lt 2 ] || ! [ "$CYCLES" -ge 1 ] 2>/dev/null ; then
+	echo "Usage: $0 [-n CYCLES] DRIVER CAPTURE [driver options...]" >&2
+	exit 2
+fi
+
+DRIVER="$1"
+CAPTURE="$2"
+shift 2
+
+if [ ! -x "$DRIVER" ] ; then
+	echo "FATAL: driver '$DRIVER' is not executable" >&2
+	exit 2
+fi
+if [ ! -r "$CAPTURE" ] ; then
+	echo "FATAL: capture '$CAPTURE' is not readable" >&2
+	exit 2
+fi
+
+TMPDIR="${TMPDIR:-/tmp}"
+BENCH_STATEPATH="`mktemp -d "$TMPDIR/nut-usb-replay-bench.XXXXXX"`" || exit
+trap 'rm -rf "$BENCH_STATEPATH"' 0 1 2 3 15
+
+# Run the driver in data dump mode for a number of update cycles,
+# and keep its driver.perf.* data
+run_driver() {
+	N="$1"
+	shift
+	NUT_STATEPATH="$BENCH_STATEPATH" NUT_ALTPIDPATH="$BENCH_STATEPATH" \
+	"$DRIVER" -s replaybench -x port=auto \
+		-x usb_replay="$CAPTURE" -x perfvars -d "$N" "$@" \
+		2>"$BENCH_STATEPATH/stderr.$N" \
+	| grep '^driver\.perf\.' > "$BENCH_STATEPATH/perf.$N"
+}
+
+# Get a value (e.g. "usb.get_report.count") from run results, or 0
+perf() {
+	sed -n "s/^driver\\.perf\\.$2: //p" "$BENCH_STATEPATH/perf.$1" | head -1 | grep . || echo 0
+}
+
+# The first update cycle also covers the initialization (and whatever
+# updates the driver does in it); the difference with a run of further
+# cycles is the cost of the cycles alone
+CYCLES_ALL="`expr $CYCLES + 1`"
+for N in 1 "$CYCLES_ALL" ; do
+	run_driver "$N" "$@"
+	if [ ! -s "$BENCH_STATEPATH/perf.$N" ] ; then
+		echo "FATAL: driver run for $N cycle(s) failed:" >&2
+		cat "$BENCH_STATEPATH/stderr.$N" >&2
+		exit 1
+	fi
+done
+
+echo "Driver:                $DRIVER"
+echo "Capture:               $CAPTURE"
+echo "Update cycles:         $CYCLES"
+echo "initups time (usec):   `perf 1 initups.avg`"
+echo "initinfo time (usec):  `perf 1 initinfo.avg`"
+echo "Cycle time (usec):     avg `perf $CYCLES_ALL updateinfo.avg`, max `perf $CYCLES_ALL updateinfo.max`"
+echo "Cycle CPU (usec):      avg `perf $CYCLES_ALL updateinfo.cpu.avg`, max `perf $CYCLES_ALL updateinfo.cpu.max`"
+
+for XFER in get_report set_report interrupt ; do
+	TOTAL=0
+	for RESULT in "" .timeout .error ; do
+		A="`perf 1 usb.$XFER$RESULT.count`"
+		B="`perf $CYCLES_ALL usb.$XFER$RESULT.count`"
+		TOTAL="`expr $TOTAL + $B - $A`"
+	done
+	echo "USB $XFER per cycle: `echo "$TOTAL $CYCLES" | awk '{printf "%.2f", $1 / $2}'`"
+done
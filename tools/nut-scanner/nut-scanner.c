@@ -89,10 +89,11 @@
 #endif   /* HAVE_PTHREAD */
 
 #include "nut-scan.h"
+#include "nutscan-cache.h"
 
 #define ERR_BAD_OPTION	(-1)
 
-static const char optstring[] = "?ht:T:s:e:E:c:l:u:W:X:w:x:p:b:B:d:L:CUSMOAm:QnNPqIVaDJ";
+static const char optstring[] = "?ht:T:s:e:E:c:l:u:W:X:w:x:p:b:B:d:L:CUSMOAm:QnNPqIVaDJk:K:Y";
 
 #ifdef HAVE_GETOPT_LONG
 static const struct option longopts[] = {
@@ -126,6 +127,9 @@ static const struct option longopts[] = {
 	{ "disp_nut_conf_with_sanity_check", no_argument, NULL, 'Q' },
 	{ "disp_nut_conf", no_argument, NULL, 'N' },
 	{ "disp_parsable", no_argument, NULL, 'P' },
+	{ "disp_diff", no_argument, NULL, 'Y' },
+	{ "cache", required_argument, NULL, 'k' },
+	{ "cache_max_age", required_argument, NULL, 'K' },
 	{ "quiet", no_argument, NULL, 'q' },
 	{ "help", no_argument, NULL, 'h' },
 	{ "version", no_argument, NULL, 'V' },
@@ -147,6 +151,45 @@ static int cli_link_detail_level = -1;
 /* Track requested IP ranges (from CLI or auto-discovery) */
 static nutscan_ip_range_list_t ip_ranges_list;
 
+/* Optional cache of earlier results, for incremental rescans */
+static char * cache_file = NULL;
+static time_t cache_max_age = NUTSCAN_CACHE_DEFAULT_MAX_AGE;
+static nutscan_cache_t scan_cache;
+
+/* With the cache, IP-based buses probe just a subset of the requested
+ * ranges: new or expired ranges and the hosts known in the others */
+static nutscan_ip_range_list_t ip_ranges_planned[TYPE_END];
+static int ip_ranges_use_plan[TYPE_END];
+
+static nutscan_ip_range_list_t * scan_ranges(nutscan_device_type_t type)
+{
+	return (ip_ranges_use_plan[type] ? &ip_ranges_planned[type] : &ip_ranges_list);
+}
+
+static void plan_scan_ranges(nutscan_device_type_t type)
+{
+	nutscan_init_ip_ranges(&ip_ranges_planned[type]);
+	nutscan_cache_plan(&scan_cache, type, &ip_ranges_list,
+		cache_max_age, &ip_ranges_planned[type]);
+	ip_ranges_use_plan[type] = 1;
+}
+
+/* Only IP-based buses know which part of the cache they covered */
+static void update_scan_cache(nutscan_device_type_t type, int ran, int ip_based)
+{
+	if (!ran) {
+		return;
+	}
+
+	nutscan_cache_update(&scan_cache, type, dev[type],
+		ip_based ? &ip_ranges_list : NULL);
+}
+
+static void display_nothing(nutscan_device_t * device)
+{
+	NUT_UNUSED_VARIABLE(device);
+}
+
 #ifdef HAVE_PTHREAD
 static pthread_t thread[TYPE_END];
 #endif  /* HAVE_PTHREAD */
@@ -210,9 +253,9 @@ static void * run_snmp(void * arg)
 	nutscan_snmp_t * sec = (nutscan_snmp_t *)arg;
 
 	upsdebugx(2, "Entering %s for %" PRIuSIZE " IP address range(s)",
-		__func__, ip_ranges_list.ip_ranges_count);
+		__func__, scan_ranges(TYPE_SNMP)->ip_ranges_count);
 
-	dev[TYPE_SNMP] = nutscan_scan_ip_range_snmp(&ip_ranges_list, timeout, sec);
+	dev[TYPE_SNMP] = nutscan_scan_ip_range_snmp(scan_ranges(TYPE_SNMP), timeout, sec);
 
 	upsdebugx(2, "Finished %s loop", __func__);
 	return NULL;
@@ -223,9 +266,9 @@ static void * run_xml(void * arg)
 	nutscan_xml_t * sec = (nutscan_xml_t *)arg;
 
 	upsdebugx(2, "Entering %s for %" PRIuSIZE " IP address range(s)",
-		__func__, ip_ranges_list.ip_ranges_count);
+		__func__, scan_ranges(TYPE_XML)->ip_ranges_count);
 
-	dev[TYPE_XML] = nutscan_scan_ip_range_xml_http(&ip_ranges_list, timeout, sec);
+	dev[TYPE_XML] = nutscan_scan_ip_range_xml_http(scan_ranges(TYPE_XML), timeout, sec);
 
 	upsdebugx(2, "Finished %s loop", __func__);
 	return NULL;
@@ -236,9 +279,9 @@ static void * run_nut_old(void *arg)
 	NUT_UNUSED_VARIABLE(arg);
 
 	upsdebugx(2, "Entering %s for %" PRIuSIZE " IP address range(s)",
-		__func__, ip_ranges_list.ip_ranges_count);
+		__func__, scan_ranges(TYPE_NUT)->ip_ranges_count);
 
-	dev[TYPE_NUT] = nutscan_scan_ip_range_nut(&ip_ranges_list, port, timeout);
+	dev[TYPE_NUT] = nutscan_scan_ip_range_nut(scan_ranges(TYPE_NUT), port, timeout);
 
 	upsdebugx(2, "Finished %s loop", __func__);
 	return NULL;
@@ -265,9 +308,9 @@ static void * run_ipmi(void * arg)
 	nutscan_ipmi_t * sec = (nutscan_ipmi_t *)arg;
 	
 	upsdebugx(2, "Entering %s for %" PRIuSIZE " IP address range(s)",
-		__func__, ip_ranges_list.ip_ranges_count);
+		__func__, scan_ranges(TYPE_IPMI)->ip_ranges_count);
 
-	dev[TYPE_IPMI] = nutscan_scan_ip_range_ipmi(&ip_ranges_list, sec);
+	dev[TYPE_IPMI] = nutscan_scan_ip_range_ipmi(scan_ranges(TYPE_IPMI), sec);
 
 	upsdebugx(2, "Finished %s loop", __func__);
 	return NULL;
@@ -1162,6 +1205,14 @@ static void show_usage(const char *arg_progname)
 	printf("  -Q, --disp_nut_conf_with_sanity_check: Display result in the ups.conf format with sanity-check warnings as comments (default)\n");
 	printf("  -N, --disp_nut_conf: Display result in the ups.conf format\n");
 	printf("  -P, --disp_parsable: Display result in a parsable format\n");
+	printf("  -Y, --disp_diff: Display only devices new (+), changed (~) or gone (-) since the\n"
+		"                  previous run, in the parsable format (requires '-k')\n");
+	printf("\nResults cache options:\n");
+	printf("  -k, --cache <file>: Keep scan results in this file, and only re-check the hosts\n"
+		"                  known in recently scanned IP ranges instead of whole ranges\n");
+	printf("  -K, --cache_max_age <seconds>: Scan cached IP ranges fully again when older than\n"
+		"                  this (default %d, 0 to always scan them fully)\n",
+		NUTSCAN_CACHE_DEFAULT_MAX_AGE);
 	printf("\nMiscellaneous options:\n");
 	printf("  -h, --help: display this help text\n");
 	printf("  -V, --version: Display NUT version\n");
@@ -1191,6 +1242,7 @@ int main(int argc, char *argv[])
 	int allow_ipmi = 0;
 	int allow_upower = 0;
 	int allow_eaton_serial = 0; /* MUST be requested explicitly! */
+	int disp_diff = 0;
 	int quiet = 0; /* The debugging level for certain upsdebugx() progress messages; 0 = print always, quiet==1 is to require at least one -D */
 	void (*display_func)(nutscan_device_t * device);
 	int ret_code = EXIT_SUCCESS;
@@ -1596,6 +1648,27 @@ int main(int argc, char *argv[])
 			case 'P':
 				display_func = nutscan_display_parsable;
 				break;
+			case 'Y':
+				disp_diff = 1;
+				break;
+			case 'k':
+				cache_file = strdup(optarg);
+				break;
+			case 'K':
+				{ /* scoping */
+					long	l;
+					char	*s = NULL;
+
+					errno = 0;
+					l = strtol(optarg, &s, 10);
+					if (errno || (s && *s != '\0') || l < 0) {
+						fatalx(EXIT_FAILURE,
+							"Invalid cache max age, should be a number of seconds: %s",
+							optarg);
+					}
+					cache_max_age = (time_t)l;
+				}
+				break;
 			case 'q':
 				quiet = 1;
 				break;
@@ -1753,6 +1826,30 @@ display_help:
 		/* BEWARE: allow_all does not include allow_eaton_serial! */
 	}
 
+	if (disp_diff && !cache_file) {
+		fatalx(EXIT_FAILURE, "Showing differences (-Y) requires a results cache (-k)");
+	}
+
+	if (cache_file) {
+		nutscan_cache_init(&scan_cache);
+		if (nutscan_cache_load(&scan_cache, cache_file) < 0) {
+			upsdebugx(0, "WARNING: Ignoring unusable results cache %s, all ranges will be scanned",
+				cache_file);
+		}
+
+		/* Only for buses which will run, so their ranges count as scanned */
+		if (ip_ranges_list.ip_ranges_count) {
+			if (allow_snmp && nutscan_avail_snmp)
+				plan_scan_ranges(TYPE_SNMP);
+			if (allow_xml && nutscan_avail_xml_http)
+				plan_scan_ranges(TYPE_XML);
+			if (allow_oldnut && nutscan_avail_nut)
+				plan_scan_ranges(TYPE_NUT);
+			if (allow_ipmi && nutscan_avail_ipmi)
+				plan_scan_ranges(TYPE_IPMI);
+		}
+	}
+
 /* TODO/discuss : Should the #else...#endif code below for lack of pthreads
  *  during build also serve as a fallback for pthread failure at runtime?
  *  Also consider a setproctag() variant for threads, where it would be most
@@ -1782,6 +1879,10 @@ display_help:
 			upsdebugx(quiet, "No IP range(s) requested, skipping SNMP");
 			nutscan_avail_snmp = 0;
 		}
+		else if (!scan_ranges(TYPE_SNMP)->ip_ranges_count) {
+			upsdebugx(quiet, "No new or known hosts in cached IP range(s), skipping SNMP");
+			nutscan_avail_snmp = 0;
+		}
 		else {
 			upsdebugx(quiet, "Scanning SNMP bus.");
 #ifdef HAVE_PTHREAD
@@ -1801,6 +1902,13 @@ display_help:
 		upsdebugx(1, "SNMP SCAN: not requested or supported, SKIPPED");
 	}
 
+	if (allow_xml && nutscan_avail_xml_http
+	&&  ip_ranges_use_plan[TYPE_XML] && !scan_ranges(TYPE_XML)->ip_ranges_count
+	) {
+		/* Do not fall back to a broadcast */
+		upsdebugx(quiet, "No new or known hosts in cached IP range(s), skipping XML/HTTP");
+		nutscan_avail_xml_http = 0;
+	}
 	if (allow_xml && nutscan_avail_xml_http) {
 		/* NOTE: No check for ip_ranges_count,
 		 * NetXML default scan is broadcast
@@ -1830,6 +1938,10 @@ display_help:
 			upsdebugx(quiet, "No IP range(s) requested, skipping NUT bus (old libupsclient connect method)");
 			nutscan_avail_nut = 0;
 		}
+		else if (!scan_ranges(TYPE_NUT)->ip_ranges_count) {
+			upsdebugx(quiet, "No new or known hosts in cached IP range(s), skipping NUT bus (old libupsclient connect method)");
+			nutscan_avail_nut = 0;
+		}
 		else {
 			upsdebugx(quiet, "Scanning NUT bus (old libupsclient connect method).");
 #ifdef HAVE_PTHREAD
@@ -1885,6 +1997,13 @@ display_help:
 		upsdebugx(1, "NUT bus (avahi) SCAN: not requested or supported, SKIPPED");
 	}
 
+	if (allow_ipmi && nutscan_avail_ipmi
+	&&  ip_ranges_use_plan[TYPE_IPMI] && !scan_ranges(TYPE_IPMI)->ip_ranges_count
+	) {
+		/* Do not fall back to the local device */
+		upsdebugx(quiet, "No new or known hosts in cached IP range(s), skipping IPMI");
+		nutscan_avail_ipmi = 0;
+	}
 	if (allow_ipmi && nutscan_avail_ipmi) {
 		/* NOTE: No check for ip_ranges_count,
 		 * IPMI default scan is local device
@@ -1985,6 +2104,24 @@ display_help:
 
 	nutscan_upslog_setproctag("post-processing", NULL);
 
+	if (cache_file) {
+		upsdebugx(1, "SCANS DONE: compare results with the cache");
+		update_scan_cache(TYPE_USB, allow_usb && nutscan_avail_usb, 0);
+		update_scan_cache(TYPE_SNMP, allow_snmp && nutscan_avail_snmp, 1);
+		update_scan_cache(TYPE_XML, allow_xml && nutscan_avail_xml_http, 1);
+		update_scan_cache(TYPE_NUT, allow_oldnut && nutscan_avail_nut, 1);
+		update_scan_cache(TYPE_NUT_SIMULATION, allow_nut_simulation && nutscan_avail_nut_simulation, 0);
+		update_scan_cache(TYPE_AVAHI, allow_avahi && nutscan_avail_avahi, 0);
+		update_scan_cache(TYPE_IPMI, allow_ipmi && nutscan_avail_ipmi, 1);
+		update_scan_cache(TYPE_UPOWER, allow_upower && nutscan_avail_upower, 0);
+		update_scan_cache(TYPE_EATON_SERIAL, allow_eaton_serial, 0);
+
+		if (disp_diff) {
+			nutscan_cache_display_diff(&scan_cache);
+			display_func = display_nothing;
+		}
+	}
+
 	upsdebugx(1, "SCANS DONE: display results");
 
 	upsdebugx(1, "SCANS DONE: display results: USB");
@@ -2032,6 +2169,11 @@ display_help:
 	upsdebugx(1, "SCANS DONE: free resources: SERIAL");
 	nutscan_free_device(dev[TYPE_EATON_SERIAL]);
 
+	if (cache_file) {
+		nutscan_cache_save(&scan_cache, cache_file);
+		nutscan_cache_free(&scan_cache);
+	}
+
 	nutscan_upslog_setproctag("cleanup", NULL);
 #ifdef HAVE_PTHREAD
 # ifdef HAVE_SEMAPHORE_UNNAMED
@@ -2047,6 +2189,14 @@ display_help:
 
 	upsdebugx(1, "SCANS DONE: free common scanner resources");
 	nutscan_free_ip_ranges(&ip_ranges_list);
+	{	/* scoping */
+		int	t;
+		for (t = 0; t < TYPE_END; t++) {
+			if (ip_ranges_use_plan[t])
+				nutscan_free_ip_ranges(&ip_ranges_planned[t]);
+		}
+	}
+	free(cache_file);
 	nutscan_free();
 
 	/* Not a sub-process (do not let common::proctag_cleanup() mis-report us as such) */
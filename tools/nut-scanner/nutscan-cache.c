@@ -0,0 +1,762 @@
+/*
+ *  Copyright (C) 2026 by NUT Community
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*! \file nutscan-cache.c
+    \brief persistent cache of earlier scan results, for incremental rescans
+
+    Periodic inventory runs of nut-scanner over the same networks mostly
+    find the same devices again. With a cache file, the results of a run
+    are kept along with the IP ranges which were scanned completely; the
+    next run only probes the hosts already known in recently scanned
+    ranges (and fully scans new or expired ones), and can report just the
+    devices which appeared, changed or disappeared since the last run.
+
+    The file is line-based text, with tab-separated fields where tabs,
+    newlines and backslashes are escaped and "\N" stands for NULL:
+        RANGE   <type> <scanned_at> <start_ip> <end_ip>
+        DEVICE  <type> <last_seen> <driver> <port> <alt_driver_names>
+        OPTION  <name> <value> <comment_tag>    (for the preceding DEVICE)
+*/
+
+#include "config.h" /* must be first */
+
+#include "nut_stdint.h"
+#include "common.h"
+#include "nutscan-cache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#ifndef WIN32
+# include <sys/socket.h>
+# include <netdb.h>
+# include <netinet/in.h>
+#else	/* WIN32 */
+# include <ws2tcpip.h>
+# include <wspiapi.h>
+# include "wincompat.h"
+#endif	/* WIN32 */
+
+#define CACHE_FILE_HEADER	"# nut-scanner results cache, format 1"
+#define CACHE_MAX_FIELDS	6
+
+/* Options which tell apart several devices behind the same "port" value
+ * (e.g. "auto" for all USB devices), so are part of the device key */
+static const char *cache_identity_options[] = {
+	"vendorid", "productid", "serial", "bus", "busport", NULL
+};
+
+static int cache_strcmp(const char *s1, const char *s2)
+{
+	if (s1 == NULL || s2 == NULL) {
+		return (s1 != s2);
+	}
+	return strcmp(s1, s2);
+}
+
+static char *cache_strdup(const char *s)
+{
+	return (s ? xstrdup(s) : NULL);
+}
+
+static const char *cache_option_value(const nutscan_device_t *dev, const char *name)
+{
+	nutscan_options_t	*opt;
+
+	for (opt = dev->opt; opt != NULL; opt = opt->next) {
+		if (opt->option && !strcmp(opt->option, name)) {
+			return opt->value;
+		}
+	}
+
+	return NULL;
+}
+
+static nutscan_device_t *cache_copy_device(const nutscan_device_t *src)
+{
+	nutscan_device_t	*dev = nutscan_new_device();
+	nutscan_options_t	*opt;
+
+	if (dev == NULL) {
+		fatal_with_errno(EXIT_FAILURE, "%s: nutscan_new_device", __func__);
+	}
+
+	dev->type = src->type;
+	dev->driver = cache_strdup(src->driver);
+	dev->alt_driver_names = cache_strdup(src->alt_driver_names);
+	dev->port = cache_strdup(src->port);
+
+	for (opt = src->opt; opt != NULL; opt = opt->next) {
+		nutscan_add_commented_option_to_device(dev,
+			opt->option, opt->value, opt->comment_tag);
+	}
+
+	return dev;
+}
+
+static void cache_free_device(nutscan_device_t *dev)
+{
+	/* nutscan_free_device() does not own this field */
+	free(dev->alt_driver_names);
+	dev->alt_driver_names = NULL;
+	nutscan_free_device(dev);
+}
+
+/* Same device, as far as we can tell from the scan results? */
+static int cache_same_key(const nutscan_device_t *d1, const nutscan_device_t *d2)
+{
+	size_t	i;
+
+	if (d1->type != d2->type || cache_strcmp(d1->port, d2->port)) {
+		return 0;
+	}
+
+	for (i = 0; cache_identity_options[i] != NULL; i++) {
+		if (cache_strcmp(cache_option_value(d1, cache_identity_options[i]),
+		                 cache_option_value(d2, cache_identity_options[i]))
+		) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Same details reported (beside the key)? Scanners produce the options
+ * in a stable order, so a sequential comparison suffices */
+static int cache_same_details(const nutscan_device_t *d1, const nutscan_device_t *d2)
+{
+	nutscan_options_t	*o1, *o2;
+
+	if (cache_strcmp(d1->driver, d2->driver)
+	 || cache_strcmp(d1->alt_driver_names, d2->alt_driver_names)
+	) {
+		return 0;
+	}
+
+	for (o1 = d1->opt, o2 = d2->opt;
+	     o1 != NULL && o2 != NULL;
+	     o1 = o1->next, o2 = o2->next
+	) {
+		if (cache_strcmp(o1->option, o2->option)
+		 || cache_strcmp(o1->value, o2->value)
+		 || cache_strcmp(o1->comment_tag, o2->comment_tag)
+		) {
+			return 0;
+		}
+	}
+
+	return (o1 == NULL && o2 == NULL);
+}
+
+/* Extract the host address part of a device "port" as reported by
+ * the IP-based scanners, e.g. "192.0.2.1" (SNMP), "http://192.0.2.1"
+ * (XML), "ups@[2001:db8::1]:3493" (NUT), "id0x20@192.0.2.1" (IPMI).
+ * Returns 0 if there seems to be no host part. */
+static int cache_port_host(const char *port, char *buf, size_t bufsize)
+{
+	const char	*p, *s;
+	size_t	len;
+
+	if (port == NULL) {
+		return 0;
+	}
+
+	if ((p = strstr(port, "://")) != NULL) {
+		port = p + 3;
+	}
+	if ((p = strrchr(port, '@')) != NULL) {
+		port = p + 1;
+	}
+
+	if (*port == '[') {
+		port++;
+		if ((p = strchr(port, ']')) == NULL) {
+			return 0;
+		}
+		len = (size_t)(p - port);
+	} else {
+		len = strcspn(port, "/");
+		/* Only one colon means "host:port", more mean an IPv6 address */
+		if ((p = strchr(port, ':')) != NULL
+		 && (size_t)(p - port) < len
+		 && ((s = strchr(p + 1, ':')) == NULL || (size_t)(s - port) >= len)
+		) {
+			len = (size_t)(p - port);
+		}
+	}
+
+	if (len == 0 || len >= bufsize) {
+		return 0;
+	}
+
+	memcpy(buf, port, len);
+	buf[len] = '\0';
+	return 1;
+}
+
+/* Numeric address as bytes comparable with memcmp() (network order);
+ * returns the address family, or 0 if "host" is not an IP address */
+static int cache_addr(const char *host, unsigned char *bytes)
+{
+	struct addrinfo	hints, *res = NULL;
+	int	family = 0;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_flags = AI_NUMERICHOST;
+
+	if (host == NULL || getaddrinfo(host, NULL, &hints, &res) != 0) {
+		return 0;
+	}
+
+	if (res->ai_family == AF_INET) {
+		struct sockaddr_in	s_in4;
+		memcpy(&s_in4, res->ai_addr, sizeof(s_in4));
+		memcpy(bytes, &s_in4.sin_addr, 4);
+		family = AF_INET;
+	} else if (res->ai_family == AF_INET6) {
+		struct sockaddr_in6	s_in6;
+		memcpy(&s_in6, res->ai_addr, sizeof(s_in6));
+		memcpy(bytes, &s_in6.sin6_addr, 16);
+		family = AF_INET6;
+	}
+
+	freeaddrinfo(res);
+	return family;
+}
+
+static int cache_host_in_range(const char *host, const char *start_ip, const char *end_ip)
+{
+	unsigned char	h[16], lo[16], hi[16];
+	int	family;
+	size_t	len;
+
+	if (!(family = cache_addr(host, h))
+	 || cache_addr(start_ip, lo) != family
+	 || cache_addr(end_ip ? end_ip : start_ip, hi) != family
+	) {
+		return 0;
+	}
+
+	len = (family == AF_INET ? 4 : 16);
+	return (memcmp(h, lo, len) >= 0 && memcmp(h, hi, len) <= 0);
+}
+
+static int cache_host_in_ranges(const char *host, const nutscan_ip_range_list_t *irl)
+{
+	nutscan_ip_range_t	*r;
+
+	for (r = irl->ip_ranges; r != NULL; r = r->next) {
+		if (cache_host_in_range(host, r->start_ip, r->end_ip)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static nutscan_cache_range_t *cache_find_range(const nutscan_cache_t *cache,
+	nutscan_device_type_t type, const char *start_ip, const char *end_ip)
+{
+	nutscan_cache_range_t	*r;
+
+	for (r = cache->ranges; r != NULL; r = r->next) {
+		if (r->type == type
+		 && !cache_strcmp(r->start_ip, start_ip)
+		 && !cache_strcmp(r->end_ip, end_ip)
+		) {
+			return r;
+		}
+	}
+
+	return NULL;
+}
+
+static void cache_append_entry(nutscan_cache_t *cache, nutscan_cache_entry_t *e)
+{
+	nutscan_cache_entry_t	**tail = &cache->entries;
+
+	while (*tail != NULL) {
+		tail = &(*tail)->next;
+	}
+	*tail = e;
+}
+
+void nutscan_cache_init(nutscan_cache_t *cache)
+{
+	memset(cache, 0, sizeof(*cache));
+	cache->now = time(NULL);
+}
+
+void nutscan_cache_free(nutscan_cache_t *cache)
+{
+	nutscan_cache_entry_t	*e;
+	nutscan_cache_range_t	*r;
+
+	if (cache == NULL) {
+		return;
+	}
+
+	while ((e = cache->entries) != NULL) {
+		cache->entries = e->next;
+		cache_free_device(e->dev);
+		free(e);
+	}
+
+	while ((r = cache->ranges) != NULL) {
+		cache->ranges = r->next;
+		free(r->start_ip);
+		free(r->end_ip);
+		free(r);
+	}
+}
+
+/* File format helpers */
+
+static void cache_write_field(FILE *f, const char *s)
+{
+	fputc('\t', f);
+
+	if (s == NULL) {
+		fputs("\\N", f);
+		return;
+	}
+
+	for (; *s; s++) {
+		switch (*s) {
+			case '\\':	fputs("\\\\", f); break;
+			case '\t':	fputs("\\t", f); break;
+			case '\n':	fputs("\\n", f); break;
+			case '\r':	fputs("\\r", f); break;
+			default:	fputc(*s, f);
+		}
+	}
+}
+
+/* Split "line" (modified in place) into unescaped fields;
+ * returns the field count, NULL fields stand for "\N" */
+static size_t cache_split_fields(char *line, char **fields, size_t maxfields)
+{
+	size_t	n = 0;
+	char	*src = line, *dst;
+
+	while (n < maxfields) {
+		fields[n] = dst = src;
+
+		if (src[0] == '\\' && src[1] == 'N' && (src[2] == '\t' || src[2] == '\0')) {
+			fields[n] = NULL;
+			src += 2;
+		} else {
+			while (*src && *src != '\t') {
+				if (*src == '\\' && src[1]) {
+					src++;
+					switch (*src) {
+						case 't':	*dst++ = '\t'; break;
+						case 'n':	*dst++ = '\n'; break;
+						case 'r':	*dst++ = '\r'; break;
+						default:	*dst++ = *src;
+					}
+					src++;
+				} else {
+					*dst++ = *src++;
+				}
+			}
+		}
+
+		n++;
+		if (*src != '\t') {
+			if (fields[n - 1]) {
+				*dst = '\0';
+			}
+			break;
+		}
+		src++;
+		if (fields[n - 1]) {
+			*dst = '\0';
+		}
+	}
+
+	return n;
+}
+
+static nutscan_device_type_t cache_type_from_string(const char *s)
+{
+	int	t;
+
+	for (t = TYPE_NONE + 1; t < TYPE_END; t++) {
+		if (s && !strcmp(nutscan_device_type_strings[t], s)) {
+			return (nutscan_device_type_t)t;
+		}
+	}
+
+	return TYPE_NONE;
+}
+
+static int cache_time_from_string(const char *s, time_t *t)
+{
+	long long	l;
+	char	*end = NULL;
+
+	if (s == NULL) {
+		return 0;
+	}
+
+	errno = 0;
+	l = strtoll(s, &end, 10);
+	if (errno || end == s || *end != '\0' || l < 0) {
+		return 0;
+	}
+
+	*t = (time_t)l;
+	return 1;
+}
+
+int nutscan_cache_load(nutscan_cache_t *cache, const char *filename)
+{
+	FILE	*f;
+	char	line[LARGEBUF * 4];
+	char	*fields[CACHE_MAX_FIELDS];
+	size_t	nf, lineno = 0;
+	int	count = 0;
+	nutscan_cache_entry_t	*e = NULL;
+
+	if ((f = fopen(filename, "r")) == NULL) {
+		if (errno == ENOENT) {
+			upsdebugx(1, "%s: no cache file %s yet, starting afresh",
+				__func__, filename);
+			return 0;
+		}
+		upsdebug_with_errno(0, "Could not read scan results cache %s", filename);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		size_t	len = strlen(line);
+		nutscan_device_type_t	type;
+		time_t	t;
+
+		lineno++;
+		if (len > 0 && line[len - 1] == '\n') {
+			line[--len] = '\0';
+		} else if (!feof(f)) {
+			upsdebugx(0, "%s: line %" PRIuSIZE " is too long", filename, lineno);
+			goto fail;
+		}
+		if (len > 0 && line[len - 1] == '\r') {
+			line[--len] = '\0';
+		}
+
+		if (line[0] == '#' || line[0] == '\0') {
+			continue;
+		}
+
+		nf = cache_split_fields(line, fields, CACHE_MAX_FIELDS);
+
+		if (fields[0] && !strcmp(fields[0], "RANGE") && nf == 5) {
+			nutscan_cache_range_t	*r;
+
+			if ((type = cache_type_from_string(fields[1])) == TYPE_NONE
+			 || !cache_time_from_string(fields[2], &t)
+			 || fields[3] == NULL
+			) {
+				goto bad_line;
+			}
+
+			r = (nutscan_cache_range_t *)xcalloc(1, sizeof(*r));
+			r->type = type;
+			r->scanned_at = t;
+			r->start_ip = xstrdup(fields[3]);
+			r->end_ip = cache_strdup(fields[4]);
+			r->next = cache->ranges;
+			cache->ranges = r;
+		} else if (fields[0] && !strcmp(fields[0], "DEVICE") && nf == 6) {
+			if ((type = cache_type_from_string(fields[1])) == TYPE_NONE
+			 || !cache_time_from_string(fields[2], &t)
+			) {
+				goto bad_line;
+			}
+
+			e = (nutscan_cache_entry_t *)xcalloc(1, sizeof(*e));
+			if ((e->dev = nutscan_new_device()) == NULL) {
+				fatal_with_errno(EXIT_FAILURE, "%s: nutscan_new_device", __func__);
+			}
+			e->dev->type = type;
+			e->dev->driver = cache_strdup(fields[3]);
+			e->dev->port = cache_strdup(fields[4]);
+			e->dev->alt_driver_names = cache_strdup(fields[5]);
+			e->last_seen = t;
+			e->state = NUTSCAN_CACHE_KNOWN;
+			cache_append_entry(cache, e);
+			count++;
+		} else if (fields[0] && !strcmp(fields[0], "OPTION") && nf == 4 && e != NULL) {
+			nutscan_add_commented_option_to_device(e->dev,
+				fields[1], fields[2], fields[3]);
+		} else {
+			goto bad_line;
+		}
+		continue;
+
+bad_line:
+		upsdebugx(0, "%s: can not parse line %" PRIuSIZE ", ignoring the cache",
+			filename, lineno);
+		goto fail;
+	}
+
+	fclose(f);
+	upsdebugx(1, "%s: loaded %d device(s) from %s", __func__, count, filename);
+	return count;
+
+fail:
+	fclose(f);
+	nutscan_cache_free(cache);
+	return -1;
+}
+
+int nutscan_cache_save(const nutscan_cache_t *cache, const char *filename)
+{
+	FILE	*f;
+	char	tmpname[NUT_PATH_MAX + 1];
+	nutscan_cache_range_t	*r;
+	nutscan_cache_entry_t	*e;
+	nutscan_options_t	*opt;
+
+	if (snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename) >= (int)sizeof(tmpname)) {
+		upsdebugx(0, "%s: file name too long: %s", __func__, filename);
+		return -1;
+	}
+
+	if ((f = fopen(tmpname, "w")) == NULL) {
+		upsdebug_with_errno(0, "Could not write scan results cache %s", tmpname);
+		return -1;
+	}
+
+	fprintf(f, "%s\n", CACHE_FILE_HEADER);
+
+	for (r = cache->ranges; r != NULL; r = r->next) {
+		/* planned, but that scan did not complete */
+		if (r->scanned_at == 0) {
+			continue;
+		}
+
+		fputs("RANGE", f);
+		cache_write_field(f, nutscan_device_type_strings[r->type]);
+		fprintf(f, "\t%lld", (long long)r->scanned_at);
+		cache_write_field(f, r->start_ip);
+		cache_write_field(f, r->end_ip);
+		fputc('\n', f);
+	}
+
+	for (e = cache->entries; e != NULL; e = e->next) {
+		if (e->state == NUTSCAN_CACHE_GONE) {
+			continue;
+		}
+
+		fputs("DEVICE", f);
+		cache_write_field(f, nutscan_device_type_strings[e->dev->type]);
+		fprintf(f, "\t%lld", (long long)e->last_seen);
+		cache_write_field(f, e->dev->driver);
+		cache_write_field(f, e->dev->port);
+		cache_write_field(f, e->dev->alt_driver_names);
+		fputc('\n', f);
+
+		for (opt = e->dev->opt; opt != NULL; opt = opt->next) {
+			fputs("OPTION", f);
+			cache_write_field(f, opt->option);
+			cache_write_field(f, opt->value);
+			cache_write_field(f, opt->comment_tag);
+			fputc('\n', f);
+		}
+	}
+
+	if (ferror(f) | fclose(f)) {
+		upsdebug_with_errno(0, "Could not write scan results cache %s", tmpname);
+		unlink(tmpname);
+		return -1;
+	}
+
+#ifdef WIN32
+	/* rename() does not replace existing files there */
+	unlink(filename);
+#endif
+	if (rename(tmpname, filename) != 0) {
+		upsdebug_with_errno(0, "Could not rename %s to %s", tmpname, filename);
+		unlink(tmpname);
+		return -1;
+	}
+
+	upsdebugx(1, "%s: saved scan results cache to %s", __func__, filename);
+	return 0;
+}
+
+size_t nutscan_cache_plan(nutscan_cache_t *cache, nutscan_device_type_t type,
+	const nutscan_ip_range_list_t *requested, time_t max_age,
+	nutscan_ip_range_list_t *plan)
+{
+	nutscan_ip_range_t	*req;
+	nutscan_cache_range_t	*r;
+	nutscan_cache_entry_t	*e;
+	nutscan_ip_range_t	*p;
+	char	host[SMALLBUF];
+	size_t	reused = 0;
+
+	for (req = requested->ip_ranges; req != NULL; req = req->next) {
+		r = cache_find_range(cache, type, req->start_ip, req->end_ip);
+
+		if (r != NULL && max_age > 0
+		 && r->scanned_at <= cache->now
+		 && cache->now - r->scanned_at <= max_age
+		) {
+			/* Recently scanned completely: re-verify what is known there */
+			upsdebugx(2, "%s: %s range [%s .. %s] was scanned %lld sec ago, "
+				"only re-checking its known hosts",
+				__func__, nutscan_device_type_strings[type],
+				req->start_ip, NUT_STRARG(req->end_ip),
+				(long long)(cache->now - r->scanned_at));
+			reused++;
+
+			for (e = cache->entries; e != NULL; e = e->next) {
+				if (e->dev->type != type
+				 || !cache_port_host(e->dev->port, host, sizeof(host))
+				 || !cache_host_in_range(host, req->start_ip, req->end_ip)
+				) {
+					continue;
+				}
+
+				/* Several devices (e.g. NUT "ups@host" names) per host */
+				for (p = plan->ip_ranges; p != NULL; p = p->next) {
+					if (!strcmp(p->start_ip, host)) {
+						break;
+					}
+				}
+				if (p == NULL) {
+					nutscan_add_ip_range(plan, xstrdup(host), NULL);
+				}
+			}
+			continue;
+		}
+
+		nutscan_add_ip_range(plan, xstrdup(req->start_ip),
+			(req->end_ip && req->end_ip != req->start_ip) ? xstrdup(req->end_ip) : NULL);
+
+		if (r == NULL) {
+			r = (nutscan_cache_range_t *)xcalloc(1, sizeof(*r));
+			r->type = type;
+			r->start_ip = xstrdup(req->start_ip);
+			r->end_ip = cache_strdup(req->end_ip);
+			r->next = cache->ranges;
+			cache->ranges = r;
+		}
+		/* only stamped by nutscan_cache_update(), after the scan */
+		r->planned = 1;
+	}
+
+	upsdebugx(1, "%s: %s scan reuses %" PRIuSIZE " of %" PRIuSIZE
+		" requested range(s), will probe %" PRIuSIZE " range(s)",
+		__func__, nutscan_device_type_strings[type], reused,
+		requested->ip_ranges_count, plan->ip_ranges_count);
+
+	return plan->ip_ranges_count;
+}
+
+void nutscan_cache_update(nutscan_cache_t *cache, nutscan_device_type_t type,
+	nutscan_device_t *found, const nutscan_ip_range_list_t *requested)
+{
+	nutscan_device_t	*d;
+	nutscan_cache_entry_t	*e;
+	nutscan_cache_range_t	*r;
+	char	host[SMALLBUF];
+
+	for (r = cache->ranges; r != NULL; r = r->next) {
+		if (r->type == type && r->planned) {
+			r->scanned_at = cache->now;
+			r->planned = 0;
+		}
+	}
+
+	for (d = nutscan_rewind_device(found); d != NULL; d = d->next) {
+		/* Only match entries not claimed yet in this run, so several
+		 * alike devices map to as many entries */
+		for (e = cache->entries; e != NULL; e = e->next) {
+			if (e->state == NUTSCAN_CACHE_KNOWN && cache_same_key(e->dev, d)) {
+				break;
+			}
+		}
+
+		if (e == NULL) {
+			e = (nutscan_cache_entry_t *)xcalloc(1, sizeof(*e));
+			e->dev = cache_copy_device(d);
+			e->state = NUTSCAN_CACHE_NEW;
+			cache_append_entry(cache, e);
+		} else if (cache_same_details(e->dev, d)) {
+			e->state = NUTSCAN_CACHE_SEEN;
+		} else {
+			cache_free_device(e->dev);
+			e->dev = cache_copy_device(d);
+			e->state = NUTSCAN_CACHE_CHANGED;
+		}
+		e->last_seen = cache->now;
+	}
+
+	for (e = cache->entries; e != NULL; e = e->next) {
+		if (e->state != NUTSCAN_CACHE_KNOWN || e->dev->type != type) {
+			continue;
+		}
+
+		/* Was it within reach of this scan? */
+		if (requested != NULL && requested->ip_ranges_count > 0
+		&& (!cache_port_host(e->dev->port, host, sizeof(host))
+		    || !cache_host_in_ranges(host, requested))
+		) {
+			continue;
+		}
+
+		e->state = NUTSCAN_CACHE_GONE;
+	}
+}
+
+size_t nutscan_cache_display_diff(const nutscan_cache_t *cache)
+{
+	nutscan_cache_entry_t	*e;
+	size_t	count = 0;
+
+	for (e = cache->entries; e != NULL; e = e->next) {
+		switch (e->state) {
+			case NUTSCAN_CACHE_NEW:
+				printf("+");
+				break;
+			case NUTSCAN_CACHE_CHANGED:
+				printf("~");
+				break;
+			case NUTSCAN_CACHE_GONE:
+				printf("-");
+				break;
+			case NUTSCAN_CACHE_KNOWN:
+			case NUTSCAN_CACHE_SEEN:
+			default:
+				continue;
+		}
+
+		/* The stored device is standalone, so just that one is shown */
+		nutscan_display_parsable(e->dev);
+		count++;
+	}
+
+	return count;
+}
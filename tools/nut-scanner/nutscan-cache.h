@@ -0,0 +1,118 @@
+/*
+ *  Copyright (C) 2026 by NUT Community
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*! \file nutscan-cache.h
+    \brief persistent cache of earlier scan results, for incremental rescans
+*/
+
+#ifndef SCAN_CACHE
+#define SCAN_CACHE
+
+#include <time.h>
+
+#include "nut-scan.h"	/* nutscan_device_t, nutscan_ip_range_list_t */
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* How fresh a fully scanned IP range must be (in seconds) so that only
+ * the hosts already known in it are probed again, by default */
+#define NUTSCAN_CACHE_DEFAULT_MAX_AGE	3600
+
+typedef enum nutscan_cache_state {
+	NUTSCAN_CACHE_KNOWN = 0,	/* loaded from the file, not (yet) seen in this run */
+	NUTSCAN_CACHE_SEEN,	/* found again, same as before */
+	NUTSCAN_CACHE_NEW,	/* found in this run, was not known */
+	NUTSCAN_CACHE_CHANGED,	/* found again, but driver or options differ */
+	NUTSCAN_CACHE_GONE	/* was known, its bus and address were probed, not found */
+} nutscan_cache_state_t;
+
+/* An IP address range which was fully scanned for some bus type */
+typedef struct nutscan_cache_range_s {
+	nutscan_device_type_t	type;
+	time_t	scanned_at;	/* 0 if not (yet) scanned completely */
+	int	planned;	/* to be scanned completely in this run */
+	char	*start_ip;
+	char	*end_ip;
+	struct nutscan_cache_range_s	*next;
+} nutscan_cache_range_t;
+
+/* A device seen by some earlier (or this) run; "dev" is a standalone
+ * copy owned by the cache (its prev/next are NULL) */
+typedef struct nutscan_cache_entry_s {
+	nutscan_device_t	*dev;
+	time_t	last_seen;
+	nutscan_cache_state_t	state;
+	struct nutscan_cache_entry_s	*next;
+} nutscan_cache_entry_t;
+
+typedef struct nutscan_cache_s {
+	nutscan_cache_entry_t	*entries;
+	nutscan_cache_range_t	*ranges;
+	time_t	now;	/* timestamp of this run */
+} nutscan_cache_t;
+
+/* Initialize an empty cache, stamped with current time */
+void nutscan_cache_init(nutscan_cache_t *cache);
+
+/* Free everything the cache holds (not the object itself) */
+void nutscan_cache_free(nutscan_cache_t *cache);
+
+/* Read the cache file; a missing file is not an error (first run).
+ * Returns the number of loaded devices, or -1 if the file could not
+ * be read or parsed (the cache is then left empty). */
+int nutscan_cache_load(nutscan_cache_t *cache, const char *filename);
+
+/* Write the cache (without devices found GONE) to "filename", via a
+ * temporary file renamed over it. Returns 0 on success, -1 on error. */
+int nutscan_cache_save(const nutscan_cache_t *cache, const char *filename);
+
+/* Decide what an IP-based scan of bus "type" must really probe for the
+ * "requested" ranges: any range which was scanned completely no longer
+ * than "max_age" seconds ago (0 disables reuse) is replaced by just the
+ * hosts known in it, other ranges are copied into "plan" as they are,
+ * to be recorded as scanned by nutscan_cache_update() once the scan is
+ * done. Returns the count of ranges in "plan". */
+size_t nutscan_cache_plan(nutscan_cache_t *cache, nutscan_device_type_t type,
+	const nutscan_ip_range_list_t *requested, time_t max_age,
+	nutscan_ip_range_list_t *plan);
+
+/* Merge the devices "found" by a completed scan of bus "type" into
+ * the cache, classifying each as seen, new or changed. Known devices
+ * of that type which were not found become GONE, if they were within
+ * the "requested" IP ranges (or always, if NULL or empty was requested,
+ * e.g. for local buses). The ranges planned to be scanned completely
+ * are stamped with the time of this run. */
+void nutscan_cache_update(nutscan_cache_t *cache, nutscan_device_type_t type,
+	nutscan_device_t *found, const nutscan_ip_range_list_t *requested);
+
+/* Print devices which are new ("+"), changed ("~") or gone ("-") since
+ * the previous run, in the nutscan_display_parsable() format.
+ * Returns the number of printed lines. */
+size_t nutscan_cache_display_diff(const nutscan_cache_t *cache);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* SCAN_CACHE */
@@ -0,0 +1,472 @@
+/*
+ *  Copyright (C) 2026 by NUT Community
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*! \file nutscan-sweep.c
+    \brief single-threaded asynchronous liveness sweep of IP address ranges
+
+    Sweeping a large network with one blocking probe per scanning thread
+    costs a thread per in-flight address and a full timeout for every
+    silent one. Instead, the scanners can first call this sweep, which
+    keeps thousands of non-blocking probes in flight from one thread with
+    a poll() loop, each probe with its own deadline; the detailed (and
+    protocol-specific) per-host scans then only run for the responders.
+*/
+
+#include "config.h" /* must be first */
+
+#include "nut_stdint.h"
+#include "common.h"
+#include "nutscan-sweep.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+
+#if (defined HAVE_POLL_H) && !(defined WIN32)
+# define NUTSCAN_SWEEP_POSSIBLE 1
+# include <poll.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/socket.h>
+# include <netdb.h>
+#endif
+
+#if (defined HAVE_SYS_RESOURCE_H) && !(defined WIN32)
+# include <sys/resource.h>	/* for getrlimit() and struct rlimit */
+#endif
+
+/* File descriptors handed out to the sweeps running right now (e.g. the
+ * SNMP and NUT scans, in parallel threads), so that together they stay
+ * within the process limit */
+static size_t	sweep_fds_taken = 0;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t	sweep_fds_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+int nutscan_sweep_worthwhile(const nutscan_ip_range_list_t *irl)
+{
+	if (irl == NULL || irl->ip_ranges == NULL
+	 || irl->ip_ranges->start_ip == NULL
+	) {
+		return 0;
+	}
+
+	if (irl->ip_ranges_count == 1
+	&& (irl->ip_ranges->start_ip == irl->ip_ranges->end_ip
+	    || !strcmp(irl->ip_ranges->start_ip, irl->ip_ranges->end_ip)
+	)) {
+		return 0;
+	}
+
+	return 1;
+}
+
+/* How many descriptors all sweeps together may use */
+static size_t sweep_fd_budget(void)
+{
+#if (defined HAVE_SYS_RESOURCE_H) && !(defined WIN32)
+	struct rlimit	limit;
+
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0
+	 && limit.rlim_cur != RLIM_INFINITY
+	) {
+		if (limit.rlim_cur <= NUTSCAN_SWEEP_RESERVE_FD)
+			return 0;
+		if ((uintmax_t)(limit.rlim_cur - NUTSCAN_SWEEP_RESERVE_FD) < (uintmax_t)SIZE_MAX)
+			return (size_t)(limit.rlim_cur - NUTSCAN_SWEEP_RESERVE_FD);
+	}
+#endif
+
+	return SIZE_MAX;
+}
+
+size_t nutscan_sweep_budget_take(size_t want)
+{
+	size_t	budget = sweep_fd_budget(), granted = 0;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&sweep_fds_mutex);
+#endif
+	if (budget > sweep_fds_taken) {
+		granted = budget - sweep_fds_taken;
+		if (granted > want)
+			granted = want;
+		sweep_fds_taken += granted;
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&sweep_fds_mutex);
+#endif
+
+	upsdebugx(3, "%s: granted %" PRIuSIZE " of %" PRIuSIZE
+		" file descriptors asked for", __func__, granted, want);
+
+	return granted;
+}
+
+void nutscan_sweep_budget_release(size_t count)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&sweep_fds_mutex);
+#endif
+	sweep_fds_taken -= (count < sweep_fds_taken) ? count : sweep_fds_taken;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&sweep_fds_mutex);
+#endif
+}
+
+void nutscan_sweep_add_alive(nutscan_ip_range_list_t *alive, char *ip)
+{
+	size_t	len = strlen(ip);
+
+	/* The range iterators hand out IPv6 addresses in square brackets
+	 * (for "host:port" notations), but do not take them back that way */
+	if (len > 2 && ip[0] == '[' && ip[len - 1] == ']') {
+		memmove(ip, ip + 1, len - 2);
+		ip[len - 2] = '\0';
+	}
+
+	nutscan_add_ip_range(alive, ip, NULL);
+}
+
+#ifdef NUTSCAN_SWEEP_POSSIBLE
+
+typedef struct sweep_probe_s {
+	char	*ip;	/* owned address string; NULL if the slot is free */
+	int	fd;
+	int	attempts;	/* connection attempts or datagrams sent so far */
+	struct timeval	deadline;
+} sweep_probe_t;
+
+static void sweep_set_deadline(sweep_probe_t *p, useconds_t usec_timeout)
+{
+	gettimeofday(&p->deadline, NULL);
+	p->deadline.tv_sec += usec_timeout / 1000000;
+	p->deadline.tv_usec += usec_timeout % 1000000;
+	if (p->deadline.tv_usec >= 1000000) {
+		p->deadline.tv_sec++;
+		p->deadline.tv_usec -= 1000000;
+	}
+}
+
+/* Milliseconds until the deadline (rounded up), or 0 if it has passed */
+static int sweep_msec_left(const struct timeval *deadline, const struct timeval *now)
+{
+	double	left = difftimeval(*deadline, *now);
+
+	if (left <= 0)
+		return 0;
+	if (left > 3600)
+		return 3600 * 1000;
+
+	return (int)(left * 1000) + 1;
+}
+
+/* Send (or re-send) the UDP payload, and (re)start the deadline of this
+ * attempt; returns 0 on success */
+static int sweep_send(sweep_probe_t *p, nutscan_sweep_proto_t proto,
+	const char *payload, size_t payload_len, useconds_t usec_timeout)
+{
+	if (proto == NUTSCAN_SWEEP_UDP) {
+		if (send(p->fd, payload, payload_len, 0) < 0
+		 && errno != EAGAIN && errno != EWOULDBLOCK
+		) {
+			upsdebug_with_errno(5, "%s: send() to %s failed", __func__, p->ip);
+			return -1;
+		}
+	}
+
+	p->attempts++;
+	sweep_set_deadline(p, usec_timeout);
+	return 0;
+}
+
+/* Start a probe: returns 1 if in flight, -1 if it can not be reached,
+ * 0 if the host should be handed to the per-host scan right away: it is
+ * known to be alive (immediate TCP connect), or we could not probe it
+ * ourselves (e.g. a host name rather than a numeric address, or running
+ * out of sockets) and so should not drop it either */
+static int sweep_start(sweep_probe_t *p, nutscan_sweep_proto_t proto,
+	uint16_t port, const char *payload, size_t payload_len,
+	useconds_t usec_timeout)
+{
+	struct addrinfo	hints, *res = NULL;
+	char	port_str[8], host[SMALLBUF];
+	size_t	len = strlen(p->ip);
+	int	flags, ret;
+
+	if (len > 2 && len < sizeof(host) && p->ip[0] == '[' && p->ip[len - 1] == ']') {
+		memcpy(host, p->ip + 1, len - 2);
+		host[len - 2] = '\0';
+	} else {
+		snprintf(host, sizeof(host), "%s", p->ip);
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = (proto == NUTSCAN_SWEEP_TCP) ? SOCK_STREAM : SOCK_DGRAM;
+	hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+	snprintf(port_str, sizeof(port_str), "%" PRIu16, port);
+
+	if ((ret = getaddrinfo(host, port_str, &hints, &res)) != 0 || res == NULL) {
+		upsdebugx(5, "%s: getaddrinfo(%s): %s", __func__, p->ip, gai_strerror(ret));
+		if (res)
+			freeaddrinfo(res);
+		return 0;
+	}
+
+	p->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (p->fd < 0) {
+		upsdebug_with_errno(5, "%s: socket() for %s failed", __func__, p->ip);
+		freeaddrinfo(res);
+		return 0;
+	}
+
+	flags = fcntl(p->fd, F_GETFL);
+	if (flags < 0 || fcntl(p->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		upsdebug_with_errno(5, "%s: fcntl() for %s failed", __func__, p->ip);
+		freeaddrinfo(res);
+		return 0;
+	}
+
+	/* For UDP this only sets the peer, so replies (or the ICMP "port
+	 * unreachable" surfacing as ECONNREFUSED) land on this socket */
+	ret = connect(p->fd, res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+
+	if (ret < 0 && errno != EINPROGRESS) {
+		upsdebug_with_errno(5, "%s: connect() to %s failed", __func__, p->ip);
+		return -1;
+	}
+
+	if (ret == 0 && proto == NUTSCAN_SWEEP_TCP) {
+		return 0;
+	}
+
+	p->attempts = 0;
+	if (sweep_send(p, proto, payload, payload_len, usec_timeout) != 0)
+		return -1;
+
+	return 1;
+}
+
+/* Release the slot, handing the address over to "alive" if it responded */
+static void sweep_finish(sweep_probe_t *p, int responded,
+	nutscan_ip_range_list_t *alive, int *count)
+{
+	if (p->fd >= 0) {
+		close(p->fd);
+		p->fd = -1;
+	}
+
+	if (responded) {
+		upsdebugx(3, "%s: %s responded", __func__, p->ip);
+		nutscan_sweep_add_alive(alive, p->ip);
+		(*count)++;
+	} else {
+		free(p->ip);
+	}
+
+	p->ip = NULL;
+}
+
+int nutscan_sweep_ip_ranges(const nutscan_ip_range_list_t *irl,
+	nutscan_sweep_proto_t proto, uint16_t port,
+	const char *payload, size_t payload_len,
+	useconds_t usec_timeout, int attempts,
+	nutscan_ip_range_list_t *alive)
+{
+	nutscan_ip_range_list_iter_t	ip;
+	char	*ip_str;
+	sweep_probe_t	*probes;
+	struct pollfd	*pfds;
+	size_t	*pidx;
+	size_t	window, i, nfds, active = 0;
+	int	count = 0, ret;
+	struct timeval	now;
+
+	if (irl == NULL || alive == NULL
+	 || (proto == NUTSCAN_SWEEP_UDP && (payload == NULL || payload_len == 0))
+	) {
+		return -1;
+	}
+
+	window = nutscan_sweep_budget_take(NUTSCAN_SWEEP_MAX_INFLIGHT);
+	if (window == 0) {
+		upsdebugx(1, "%s: no file descriptors left for a sweep", __func__);
+		return -1;
+	}
+
+	if (attempts < 1 || proto == NUTSCAN_SWEEP_TCP)
+		attempts = 1;
+
+	upsdebugx(2, "%s: sweeping %s port %" PRIu16
+		" with up to %" PRIuSIZE " probes in flight"
+		" and a timeout of %" PRIuMAX " usec",
+		__func__, proto == NUTSCAN_SWEEP_TCP ? "TCP" : "UDP",
+		port, window, (uintmax_t)usec_timeout);
+
+	probes = (sweep_probe_t *)xcalloc(window, sizeof(sweep_probe_t));
+	pfds = (struct pollfd *)xcalloc(window, sizeof(struct pollfd));
+	pidx = (size_t *)xcalloc(window, sizeof(size_t));
+
+	for (i = 0; i < window; i++)
+		probes[i].fd = -1;
+
+	ip_str = nutscan_ip_ranges_iter_init(&ip, irl);
+
+	while (ip_str != NULL || active > 0) {
+		int	msec = -1;
+
+		/* Fill all free slots with new probes */
+		for (i = 0; i < window && ip_str != NULL; i++) {
+			if (probes[i].ip != NULL)
+				continue;
+
+			probes[i].ip = ip_str;
+			ip_str = nutscan_ip_ranges_iter_inc(&ip);
+
+			ret = sweep_start(&probes[i], proto, port,
+				payload, payload_len, usec_timeout);
+			if (ret > 0) {
+				active++;
+			} else {
+				sweep_finish(&probes[i], (ret == 0), alive, &count);
+			}
+		}
+
+		if (active == 0)
+			continue;
+
+		/* Wait for any socket, at most until the nearest deadline */
+		gettimeofday(&now, NULL);
+		nfds = 0;
+		for (i = 0; i < window; i++) {
+			int	left;
+
+			if (probes[i].ip == NULL)
+				continue;
+
+			pfds[nfds].fd = probes[i].fd;
+			pfds[nfds].events = (proto == NUTSCAN_SWEEP_TCP) ? POLLOUT : POLLIN;
+			pfds[nfds].revents = 0;
+			pidx[nfds] = i;
+			nfds++;
+
+			left = sweep_msec_left(&probes[i].deadline, &now);
+			if (msec < 0 || left < msec)
+				msec = left;
+		}
+
+		ret = poll(pfds, (nfds_t)nfds, msec);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			upsdebug_with_errno(1, "%s: poll() failed", __func__);
+			break;
+		}
+
+		gettimeofday(&now, NULL);
+		for (i = 0; i < nfds; i++) {
+			sweep_probe_t	*p = &probes[pidx[i]];
+
+			if (pfds[i].revents) {
+				int	responded = 0;
+
+				if (proto == NUTSCAN_SWEEP_TCP) {
+					int	err = 0;
+					socklen_t	len = sizeof(err);
+
+					if (getsockopt(p->fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0
+					 && err == 0
+					) {
+						responded = 1;
+					}
+				} else {
+					char	buf[16];
+
+					if (recv(p->fd, buf, sizeof(buf), 0) >= 0) {
+						responded = 1;
+					} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+						/* Spurious wake-up, keep waiting */
+						continue;
+					}
+				}
+
+				sweep_finish(p, responded, alive, &count);
+				active--;
+				continue;
+			}
+
+			if (sweep_msec_left(&p->deadline, &now) > 0)
+				continue;
+
+			if (p->attempts < attempts
+			 && sweep_send(p, proto, payload, payload_len, usec_timeout) == 0
+			) {
+				continue;
+			}
+
+			sweep_finish(p, 0, alive, &count);
+			active--;
+		}
+	}
+
+	/* Only after a poll() failure: hand whatever was not answered yet
+	 * over to the per-host scan, rather than lose these addresses */
+	for (i = 0; i < window; i++) {
+		if (probes[i].ip != NULL)
+			sweep_finish(&probes[i], 1, alive, &count);
+	}
+	while (ip_str != NULL) {
+		nutscan_sweep_add_alive(alive, ip_str);
+		count++;
+		ip_str = nutscan_ip_ranges_iter_inc(&ip);
+	}
+
+	free(pidx);
+	free(pfds);
+	free(probes);
+	nutscan_sweep_budget_release(window);
+
+	upsdebugx(2, "%s: %d host(s) responded", __func__, count);
+
+	return count;
+}
+
+#else	/* !NUTSCAN_SWEEP_POSSIBLE */
+
+int nutscan_sweep_ip_ranges(const nutscan_ip_range_list_t *irl,
+	nutscan_sweep_proto_t proto, uint16_t port,
+	const char *payload, size_t payload_len,
+	useconds_t usec_timeout, int attempts,
+	nutscan_ip_range_list_t *alive)
+{
+	NUT_UNUSED_VARIABLE(irl);
+	NUT_UNUSED_VARIABLE(proto);
+	NUT_UNUSED_VARIABLE(port);
+	NUT_UNUSED_VARIABLE(payload);
+	NUT_UNUSED_VARIABLE(payload_len);
+	NUT_UNUSED_VARIABLE(usec_timeout);
+	NUT_UNUSED_VARIABLE(attempts);
+	NUT_UNUSED_VARIABLE(alive);
+
+	return -1;
+}
+
+#endif	/* !NUTSCAN_SWEEP_POSSIBLE */
@@ -0,0 +1,85 @@
+/*
+ *  Copyright (C) 2026 by NUT Community
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*! \file nutscan-sweep.h
+    \brief single-threaded asynchronous liveness sweep of IP address ranges
+*/
+
+#ifndef SCAN_SWEEP
+#define SCAN_SWEEP
+
+#include "nut-scan.h"	/* useconds_t, nutscan_ip_range_list_t */
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* Upper bound of probes kept in flight at once by one sweep; the actual
+ * window is also limited by the file descriptors left in the budget
+ * which all the sweeps running at the same time share */
+#define NUTSCAN_SWEEP_MAX_INFLIGHT	4096
+
+/* File descriptors left for the rest of the process (libraries, logs,
+ * and the per-host scans) out of its limit */
+#define NUTSCAN_SWEEP_RESERVE_FD	64
+
+typedef enum nutscan_sweep_proto {
+	NUTSCAN_SWEEP_TCP,	/* host answers a TCP connect() to port */
+	NUTSCAN_SWEEP_UDP	/* host sends any datagram back to payload */
+} nutscan_sweep_proto_t;
+
+/* Probe every address of "irl" with non-blocking sockets, keeping many
+ * probes in flight from the calling thread, each with its own deadline
+ * of "usec_timeout". UDP probes are re-sent up to "attempts" times.
+ * Addresses which responded are appended to "alive" (one single-address
+ * range each, in no particular order); the caller frees that list.
+ * Returns the number of responding hosts, or -1 if the sweep can not
+ * be done on this platform (the caller should then probe every address
+ * the old way).
+ */
+int nutscan_sweep_ip_ranges(const nutscan_ip_range_list_t *irl,
+	nutscan_sweep_proto_t proto, uint16_t port,
+	const char *payload, size_t payload_len,
+	useconds_t usec_timeout, int attempts,
+	nutscan_ip_range_list_t *alive);
+
+/* Reserve up to "want" file descriptors (in-flight probes) for a sweep
+ * out of the budget shared by all sweeps in this process (the process
+ * limit, less NUTSCAN_SWEEP_RESERVE_FD). Returns how many were granted,
+ * maybe 0; those must be handed back with nutscan_sweep_budget_release()
+ * when the sweep is done. */
+size_t nutscan_sweep_budget_take(size_t want);
+void nutscan_sweep_budget_release(size_t count);
+
+/* Append a responding address, as handed out by the range iterators,
+ * to "alive" (which takes over the string) */
+void nutscan_sweep_add_alive(nutscan_ip_range_list_t *alive, char *ip);
+
+/* Returns TRUE-ish if "irl" covers more than one address, so a sweep
+ * ahead of the per-host scans is worth its extra round-trip */
+int nutscan_sweep_worthwhile(const nutscan_ip_range_list_t *irl);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* SCAN_SWEEP */
@@ -51,6 +51,7 @@
 #include "bcmxcp_ser.h"
 #include "bcmxcp.h"
 #include "nutscan-serial.h"
+#include "state.h"	/* st_tree_timespec_t for dstate_perf_*() stubs */
 
 /* SHUT header */
 #define SHUT_SYNC 0x16
@@ -89,6 +90,23 @@ char  *device_path;
 TYPE_FD   upsfd;
 int   exit_flag = 0;
 int   do_lock_port;
+int   serial_adaptive_timeout = 0;
+
+/* No performance counters to keep here (serial.c records its I/O timing) */
+void dstate_perf_start(st_tree_timespec_t *start) { NUT_UNUSED_VARIABLE(start); }
+void dstate_perf_since(const char *name, const st_tree_timespec_t *start) {
+	NUT_UNUSED_VARIABLE(name);
+	NUT_UNUSED_VARIABLE(start);
+}
+void dstate_perf_record(const char *name, const char *unit, double value) {
+	NUT_UNUSED_VARIABLE(name);
+	NUT_UNUSED_VARIABLE(unit);
+	NUT_UNUSED_VARIABLE(value);
+}
+double dstate_perf_elapsed(const st_tree_timespec_t *start) {
+	NUT_UNUSED_VARIABLE(start);
+	return 0;
+}
 
 /* Functions extracted from drivers/bcmxcp.c, to avoid pulling too many things
  * lightweight function to calculate the 8-bit
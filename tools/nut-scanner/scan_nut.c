@@ -29,6 +29,7 @@
 #include "common.h"
 #include "upsclient.h"
 #include "nut-scan.h"
+#include "nutscan-sweep.h"
 #include "nut_stdint.h"
 
 /* externally visible to nutscan-init */
@@ -597,6 +598,7 @@ nutscan_device_t * nutscan_scan_ip_range_nut_authconf(nutscan_ip_range_list_t *
 	char * ip_str = NULL;
 	char * ip_dest = NULL;
 	char buf[SMALLBUF];
+	nutscan_ip_range_list_t alive;
 #ifndef WIN32
 	struct sigaction oldact;
 	int change_action_handler = 0;
@@ -788,6 +790,26 @@ nutscan_device_t * nutscan_scan_ip_range_nut_authconf(nutscan_ip_range_list_t *
 	}
 #endif	/* !WIN32 */
 
+	/* Find the hosts which accept connections on the NUT port first,
+	 * so the blocking per-host queries below only run for those */
+	nutscan_init_ip_ranges(&alive);
+	if (nutscan_sweep_worthwhile(irl)) {
+		unsigned short	port = NUT_PORT;
+
+		if (sec && sec->port_string && *(sec->port_string)
+		 && !str_to_ushort_strict(sec->port_string, &port, 10)
+		) {
+			port = 0;
+		}
+
+		if (port > 0
+		 && nutscan_sweep_ip_ranges(irl, NUTSCAN_SWEEP_TCP, (uint16_t)port,
+			NULL, 0, usec_timeout, 1, &alive) >= 0
+		) {
+			irl = &alive;
+		}
+	}
+
 	ip_str = nutscan_ip_ranges_iter_init(&ip, irl);
 
 	if (nut_upscli_find_authconf_item != NULL) {
@@ -1116,5 +1138,7 @@ nutscan_device_t * nutscan_scan_ip_range_nut_authconf(nutscan_ip_range_list_t *
 	}
 #endif	/* !WIN32 */
 
+	nutscan_free_ip_ranges(&alive);
+
 	return nutscan_rewind_device(dev_ret);
 }
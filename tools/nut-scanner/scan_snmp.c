@@ -28,6 +28,7 @@
 
 #include "common.h"
 #include "nut-scan.h"
+#include "nutscan-sweep.h"
 #include "nut_stdint.h"
 
 /* externally visible to nutscan-init */
@@ -143,6 +144,13 @@ static int (*nut_snmp_sess_synch_response) (void *sessp, netsnmp_pdu *pdu,
 static int (*nut_snmp_oid_compare) (const oid *in_name1, size_t len1,
 			const oid *in_name2, size_t len2);
 static void (*nut_snmp_free_pdu) (netsnmp_pdu *pdu);
+static int (*nut_snmp_sess_async_send) (void *sessp, netsnmp_pdu *pdu,
+	netsnmp_callback callback, void *cb_data);
+static int (*nut_snmp_sess_select_info) (void *sessp, int *numfds,
+	fd_set *fdset, struct timeval *timeout, int *block);
+static int (*nut_snmp_sess_read) (void *sessp, fd_set *fdset);
+static void (*nut_snmp_sess_timeout) (void *sessp);
+static netsnmp_transport * (*nut_snmp_sess_transport) (void *sessp);
 
 /* NOTE: Net-SNMP headers just are weird like that, in the same release:
 net-snmp/types.h:              size_t securityAuthProtoLen;
@@ -241,6 +249,16 @@ int nutscan_load_snmp_library(const char *libname_path)
 		snmp_oid_compare;
 	*(void **) (&nut_snmp_free_pdu) =
 		snmp_free_pdu;
+	*(void **) (&nut_snmp_sess_async_send) =
+		snmp_sess_async_send;
+	*(void **) (&nut_snmp_sess_select_info) =
+		snmp_sess_select_info;
+	*(void **) (&nut_snmp_sess_read) =
+		snmp_sess_read;
+	*(void **) (&nut_snmp_sess_timeout) =
+		snmp_sess_timeout;
+	*(void **) (&nut_snmp_sess_transport) =
+		snmp_sess_transport;
 	*(void **) (&nut_generate_Ku) =
 		generate_Ku;
 	*(void **) (&nut_snmp_out_toggle_options) =
@@ -393,6 +411,36 @@ int nutscan_load_snmp_library(const char *libname_path)
 		goto err;
 	}
 
+	*(void **) (&nut_snmp_sess_async_send) = lt_dlsym(dl_handle,
+		symbol = "snmp_sess_async_send");
+	if ((dl_error = lt_dlerror()) != NULL) {
+		goto err;
+	}
+
+	*(void **) (&nut_snmp_sess_select_info) = lt_dlsym(dl_handle,
+		symbol = "snmp_sess_select_info");
+	if ((dl_error = lt_dlerror()) != NULL) {
+		goto err;
+	}
+
+	*(void **) (&nut_snmp_sess_read) = lt_dlsym(dl_handle,
+		symbol = "snmp_sess_read");
+	if ((dl_error = lt_dlerror()) != NULL) {
+		goto err;
+	}
+
+	*(void **) (&nut_snmp_sess_timeout) = lt_dlsym(dl_handle,
+		symbol = "snmp_sess_timeout");
+	if ((dl_error = lt_dlerror()) != NULL) {
+		goto err;
+	}
+
+	*(void **) (&nut_snmp_sess_transport) = lt_dlsym(dl_handle,
+		symbol = "snmp_sess_transport");
+	if ((dl_error = lt_dlerror()) != NULL) {
+		goto err;
+	}
+
 	*(void **) (&nut_generate_Ku) = lt_dlsym(dl_handle,
 		symbol = "generate_Ku");
 	if ((dl_error = lt_dlerror()) != NULL) {
@@ -1092,6 +1140,242 @@ try_SysOID_free:
 	return NULL;
 }
 
+/* Asynchronous sysOID sweep: one net-snmp single-session per probed host,
+ * all driven from this thread with select(); so the window is bounded by
+ * FD_SETSIZE rather than by NUTSCAN_SWEEP_MAX_INFLIGHT, and sessions which
+ * got a descriptor beyond FD_SETSIZE anyway (other scans hold the lower
+ * ones) are not swept but left for the per-host scan */
+#define SNMP_SWEEP_MAX_INFLIGHT	(FD_SETSIZE > 128 ? FD_SETSIZE - 64 : FD_SETSIZE / 2)
+
+typedef struct snmp_sweep_probe_s {
+	void	*handle;	/* net-snmp session, NULL if the slot is free */
+	char	*ip;	/* owned address string */
+	int	done;	/* 0 = pending, 1 = answered (or not probed), -1 = timed out */
+} snmp_sweep_probe_t;
+
+static int snmp_sweep_callback(int operation, netsnmp_session *session,
+	int reqid, netsnmp_pdu *pdu, void *magic)
+{
+	snmp_sweep_probe_t	*p = (snmp_sweep_probe_t *)magic;
+
+	NUT_UNUSED_VARIABLE(session);
+	NUT_UNUSED_VARIABLE(reqid);
+	NUT_UNUSED_VARIABLE(pdu);
+
+#ifdef NETSNMP_CALLBACK_OP_RESEND
+	if (operation == NETSNMP_CALLBACK_OP_RESEND)
+		return 1;
+#endif
+
+	/* Like with the synchronous GET in try_SysOID_thready(), any
+	 * answer (even an error status) means there is an agent here */
+	p->done = (operation == NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE) ? 1 : -1;
+
+	return 1;
+}
+
+/* Start the sysOID GET for p->ip; returns 1 if in flight, 0 if it could
+ * not be sent (so the host should go to the per-host scan, unprobed) */
+static int snmp_sweep_start(snmp_sweep_probe_t *p, nutscan_snmp_t *sec,
+	oid *name, size_t name_len)
+{
+	struct snmp_session	snmp_sess;
+	struct snmp_pdu	*pdu;
+	netsnmp_transport	*transport;
+	nutscan_snmp_t	tmp_sec;
+
+	memcpy(&tmp_sec, sec, sizeof(nutscan_snmp_t));
+	tmp_sec.peername = p->ip;
+
+	if (!init_session(&snmp_sess, &tmp_sec)) {
+		return 0;
+	}
+
+	snmp_sess.retries = 0;
+	snmp_sess.timeout = (long)g_usec_timeout;
+
+	p->done = 0;
+	p->handle = wrap_nut_snmp_sess_open(&snmp_sess);
+	if (p->handle == NULL) {
+		upsdebugx(2, "Failed to open SNMP session for %s", p->ip);
+		return 0;
+	}
+
+	/* select() can not watch descriptors beyond FD_SETSIZE */
+	transport = (*nut_snmp_sess_transport)(p->handle);
+	if (transport == NULL || transport->sock < 0 || transport->sock >= FD_SETSIZE) {
+		upsdebugx(2, "%s: no usable descriptor for the SNMP session with %s",
+			__func__, p->ip);
+		return 0;
+	}
+
+	pdu = (*nut_snmp_pdu_create)(SNMP_MSG_GET);
+	if (pdu == NULL) {
+		upsdebugx(0, "%s: Memory allocation error", __func__);
+		return 0;
+	}
+
+	(*nut_snmp_add_null_var)(pdu, name, name_len);
+
+	if (!(*nut_snmp_sess_async_send)(p->handle, pdu, snmp_sweep_callback, p)) {
+		upsdebugx(2, "%s: SNMP errors for %s: %s", __func__, p->ip,
+			(*nut_snmp_api_errstring)((*nut_snmp_errno)));
+		(*nut_snmp_free_pdu)(pdu);
+		return 0;
+	}
+
+	return 1;
+}
+
+static void snmp_sweep_finish(snmp_sweep_probe_t *p,
+	nutscan_ip_range_list_t *alive, int *count)
+{
+	if (p->handle) {
+		(*nut_snmp_sess_close)(p->handle);
+		p->handle = NULL;
+	}
+
+	if (p->done > 0) {
+		upsdebugx(3, "%s: %s responded", __func__, p->ip);
+		nutscan_sweep_add_alive(alive, p->ip);
+		(*count)++;
+	} else {
+		free(p->ip);
+	}
+
+	p->ip = NULL;
+	p->done = 0;
+}
+
+/* Send the sysOID GET to every address in "irl" with asynchronous
+ * net-snmp sessions, keeping many in flight from this one thread (each
+ * with its own timeout, tracked by the library), and collect the hosts
+ * which answered into "alive". The detailed per-host probing is then
+ * only done for those. Returns the number of responders, or -1 if the
+ * sweep is not applicable (SNMPv3: opening a session already involves
+ * a blocking engine ID discovery, so nothing would be gained).
+ */
+static int scan_snmp_sweep(nutscan_ip_range_list_t *irl, nutscan_snmp_t *sec,
+	nutscan_ip_range_list_t *alive)
+{
+	nutscan_ip_range_list_iter_t	ip;
+	char	*ip_str;
+	snmp_sweep_probe_t	*probes;
+	size_t	window, i, active = 0;
+	oid	name[MAX_OID_LEN];
+	size_t	name_len = MAX_OID_LEN;
+	int	count = 0;
+
+	if (sec->community == NULL && sec->secLevel != NULL) {
+		return -1;
+	}
+
+	if (!(*nut_snmp_parse_oid)(SysOID, name, &name_len)) {
+		return -1;
+	}
+
+	window = nutscan_sweep_budget_take(
+		(SNMP_SWEEP_MAX_INFLIGHT < NUTSCAN_SWEEP_MAX_INFLIGHT)
+		? SNMP_SWEEP_MAX_INFLIGHT : NUTSCAN_SWEEP_MAX_INFLIGHT);
+	if (window == 0) {
+		upsdebugx(1, "%s: no file descriptors left for a sweep", __func__);
+		return -1;
+	}
+
+	upsdebugx(2, "%s: sweeping for SNMP agents with up to %" PRIuSIZE
+		" requests in flight", __func__, window);
+
+	probes = (snmp_sweep_probe_t *)xcalloc(window, sizeof(snmp_sweep_probe_t));
+
+	ip_str = nutscan_ip_ranges_iter_init(&ip, irl);
+
+	while (ip_str != NULL || active > 0) {
+		fd_set	fdset;
+		struct timeval	timeout, *tvp = NULL;
+		int	numfds = 0, ret;
+
+		for (i = 0; i < window && ip_str != NULL; i++) {
+			if (probes[i].ip != NULL)
+				continue;
+
+			probes[i].ip = ip_str;
+			ip_str = nutscan_ip_ranges_iter_inc(&ip);
+
+			if (snmp_sweep_start(&probes[i], sec, name, name_len)) {
+				active++;
+			} else {
+				probes[i].done = 1;
+				snmp_sweep_finish(&probes[i], alive, &count);
+			}
+		}
+
+		if (active == 0)
+			continue;
+
+		/* Wait for any session, at most until the nearest timeout */
+		FD_ZERO(&fdset);
+		for (i = 0; i < window; i++) {
+			struct timeval	tv;
+			int	block = 1;
+
+			if (probes[i].handle == NULL)
+				continue;
+
+			tv.tv_sec = 0;
+			tv.tv_usec = 0;
+			(*nut_snmp_sess_select_info)(probes[i].handle,
+				&numfds, &fdset, &tv, &block);
+			if (!block && (tvp == NULL || timercmp(&tv, tvp, <))) {
+				timeout = tv;
+				tvp = &timeout;
+			}
+		}
+
+		ret = select(numfds, &fdset, NULL, NULL, tvp);
+		if (ret < 0 && errno != EINTR) {
+			upsdebug_with_errno(1, "%s: select() failed", __func__);
+			break;
+		}
+
+		/* Reading dispatches to snmp_sweep_callback(); expired
+		 * requests get it called with a TIMED_OUT operation */
+		for (i = 0; i < window; i++) {
+			if (probes[i].handle == NULL)
+				continue;
+
+			if (ret > 0)
+				(*nut_snmp_sess_read)(probes[i].handle, &fdset);
+			if (!probes[i].done)
+				(*nut_snmp_sess_timeout)(probes[i].handle);
+
+			if (probes[i].done) {
+				snmp_sweep_finish(&probes[i], alive, &count);
+				active--;
+			}
+		}
+	}
+
+	/* Only after a select() failure: leave the rest to the per-host scan */
+	for (i = 0; i < window; i++) {
+		if (probes[i].ip != NULL) {
+			probes[i].done = 1;
+			snmp_sweep_finish(&probes[i], alive, &count);
+		}
+	}
+	while (ip_str != NULL) {
+		nutscan_sweep_add_alive(alive, ip_str);
+		count++;
+		ip_str = nutscan_ip_ranges_iter_inc(&ip);
+	}
+
+	free(probes);
+	nutscan_sweep_budget_release(window);
+
+	upsdebugx(2, "%s: %d SNMP agent(s) responded", __func__, count);
+
+	return count;
+}
+
 static void init_snmp_once(void)
 {
 	/* Initialize the SNMP library */
@@ -1130,6 +1414,7 @@ nutscan_device_t * nutscan_scan_ip_range_snmp(
 	nutscan_snmp_t * tmp_sec;
 	nutscan_ip_range_list_iter_t ip;
 	char * ip_str = NULL;
+	nutscan_ip_range_list_t alive;
 
 #ifdef HAVE_PTHREAD
 # if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
@@ -1226,6 +1511,15 @@ nutscan_device_t * nutscan_scan_ip_range_snmp(
 	/* Initialize the SNMP library */
 	init_snmp_once();
 
+	/* Find the hosts with an SNMP agent first, so the (blocking and
+	 * thread-hungry) per-host probing below only runs for those */
+	nutscan_init_ip_ranges(&alive);
+	if (nutscan_sweep_worthwhile(irl)
+	 && scan_snmp_sweep(irl, sec, &alive) >= 0
+	) {
+		irl = &alive;
+	}
+
 	ip_str = nutscan_ip_ranges_iter_init(&ip, irl);
 
 	while (ip_str != NULL) {
@@ -1489,6 +1783,8 @@ nutscan_device_t * nutscan_scan_ip_range_snmp(
 # endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
 #endif /* HAVE_PTHREAD */
 
+	nutscan_free_ip_ranges(&alive);
+
 	result = nutscan_rewind_device(dev_ret);
 	dev_ret = NULL;
 	return result;
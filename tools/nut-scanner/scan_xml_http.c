@@ -28,6 +28,7 @@
 
 #include "common.h"
 #include "nut-scan.h"
+#include "nutscan-sweep.h"
 #include "nut_stdint.h"
 
 /* externally visible to nutscan-init */
@@ -59,6 +60,10 @@ int nutscan_unload_neon_library(void);
 #include <ne_xml.h>
 #include <ltdl.h>
 
+/* UDP datagram which Eaton network cards answer with their XML details */
+#define XML_SCAN_REQUEST	"<SCAN_REQUEST/>"
+#define XML_SCAN_PORT_UDP	4679
+
 /* dynamic link library stuff */
 static lt_dlhandle dl_handle = NULL;
 static const char *dl_error = NULL;
@@ -229,11 +234,11 @@ static int startelm_cb(void *userdata, int parent, const char *nspace, const cha
 static void * nutscan_scan_xml_http_thready(void * arg)
 {
 	nutscan_xml_t * sec = (nutscan_xml_t *)arg;
-	char *scanMsg = "<SCAN_REQUEST/>";
+	char *scanMsg = XML_SCAN_REQUEST;
 	/* Note: at this time the HTTP/XML scan is
 	 * in fact not implemented - just the UDP part */
 /*	uint16_t port_http = 80; */
-	uint16_t port_udp = 4679;
+	uint16_t port_udp = XML_SCAN_PORT_UDP;
 	/* A NULL "ip" causes a broadcast scan; otherwise
 	 * the single ip address is queried directly */
 	char *ip = NULL;
@@ -518,6 +523,7 @@ nutscan_device_t * nutscan_scan_ip_range_xml_http(nutscan_ip_range_list_t * irl,
 		/* Iterate the one or a range of IPs to scan */
 		nutscan_ip_range_list_iter_t ip;
 		char * ip_str = NULL;
+		nutscan_ip_range_list_t alive;
 
 #ifdef HAVE_PTHREAD
 # if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
@@ -595,6 +601,31 @@ nutscan_device_t * nutscan_scan_ip_range_xml_http(nutscan_ip_range_list_t * irl,
 
 #endif /* HAVE_PTHREAD */
 
+		/* Send the scan request to all addresses at once, so the per-host
+		 * threads below (which re-query and parse the reply) only run
+		 * for the cards which did answer */
+		nutscan_init_ip_ranges(&alive);
+		if (nutscan_sweep_worthwhile(irl)) {
+			uint16_t	port_udp = XML_SCAN_PORT_UDP;
+			useconds_t	sweep_timeout = usec_timeout;
+
+			if (sec != NULL) {
+				if (sec->port_udp > 0 && sec->port_udp <= 65534)
+					port_udp = sec->port_udp;
+				if (sec->usec_timeout > 0)
+					sweep_timeout = sec->usec_timeout;
+			}
+			if (sweep_timeout <= 0)
+				sweep_timeout = 5000000; /* Driver default : 5sec */
+
+			if (nutscan_sweep_ip_ranges(irl, NUTSCAN_SWEEP_UDP, port_udp,
+				XML_SCAN_REQUEST, strlen(XML_SCAN_REQUEST),
+				sweep_timeout, MAX_RETRIES, &alive) >= 0
+			) {
+				irl = &alive;
+			}
+		}
+
 		ip_str = nutscan_ip_ranges_iter_init(&ip, irl);
 
 		while (ip_str != NULL) {
@@ -861,6 +892,8 @@ nutscan_device_t * nutscan_scan_ip_range_xml_http(nutscan_ip_range_list_t * irl,
 # endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
 #endif /* HAVE_PTHREAD */
 
+		nutscan_free_ip_ranges(&alive);
+
 		result = nutscan_rewind_device(dev_ret);
 		dev_ret = NULL;
 		return result;